@@ -0,0 +1,594 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_block_cache.c
+ *
+ * This file contains function definitions for caching decompressed column
+ * blocks in shared memory, so that hot blocks aren't decompressed again by
+ * every query that reads them.
+ *
+ * Blocks are stored in fixed size chunks that are linked together. Each cached
+ * block occupies a slot, and a hash table maps block keys to slots. When the
+ * cache is full, slots are evicted with the clock-sweep algorithm: each hit
+ * raises a slot's usage count, and the clock hand decrements usage counts
+ * until it finds a slot that wasn't used since its last pass. The cache is
+ * only available when cstore_fdw is loaded through shared_preload_libraries.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "cstore_block_cache.h"
+
+#include <sys/stat.h>
+#include "miscadmin.h"
+#if PG_VERSION_NUM >= 90600
+#include "port/atomics.h"
+#endif
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+
+/* size of the data chunks in the cache */
+#define BLOCK_CACHE_CHUNK_SIZE 8192
+#define INVALID_CACHE_INDEX PG_UINT32_MAX
+
+/* upper bound for usage counts, a block survives this many passes without hits */
+#define BLOCK_CACHE_MAX_USAGE_COUNT 5
+
+/* name used for the cache's shared memory segment and lock */
+#define BLOCK_CACHE_NAME "cstore_fdw block cache"
+#define BLOCK_CACHE_HASH_NAME "cstore_fdw block cache hash"
+
+
+#if PG_VERSION_NUM >= 90600
+
+/* BlockCacheHashEntry maps a block key to the slot holding the block. */
+typedef struct BlockCacheHashEntry
+{
+	BlockCacheKey key;	/* hash key, must be first */
+	uint32 slotIndex;
+
+} BlockCacheHashEntry;
+
+
+/* BlockCacheSlot describes a cached block, or an unused slot. */
+typedef struct BlockCacheSlot
+{
+	BlockCacheKey key;
+	bool used;
+	pg_atomic_uint32 usageCount;
+	uint32 firstChunkIndex;
+	uint32 valueLength;
+
+} BlockCacheSlot;
+
+
+/*
+ * BlockCacheControl is the shared state of the cache. It is followed in shared
+ * memory by the slot array, the chunk link array, and the chunk data. Counters
+ * are atomic so that lookups can update them while holding the lock shared.
+ */
+typedef struct BlockCacheControl
+{
+	LWLock *lock;
+
+	uint32 slotCount;
+	uint32 clockHand;
+	uint32 chunkCount;
+	uint32 freeChunkCount;
+	uint32 freeChunkIndex;
+	uint64 cachedBlockCount;
+	uint64 cachedByteCount;
+
+	pg_atomic_uint64 hitCount;
+	pg_atomic_uint64 missCount;
+	pg_atomic_uint64 evictionCount;
+
+} BlockCacheControl;
+
+
+/* pointers into shared memory, set when the cache is attached */
+static BlockCacheControl *CacheControl = NULL;
+static HTAB *CacheHash = NULL;
+static BlockCacheSlot *SlotArray = NULL;
+static uint32 *ChunkLinkArray = NULL;
+static char *ChunkDataArray = NULL;
+
+/* saved hook value in case of unload */
+static shmem_startup_hook_type PreviousShmemStartupHook = NULL;
+
+/* local functions forward declarations */
+static uint32 BlockCacheChunkCount(void);
+static Size BlockCacheControlSize(uint32 chunkCount);
+static void BlockCacheShmemStartup(void);
+static uint32 ClockSweepSlot(uint32 requiredChunkCount);
+static void EvictBlockCacheSlot(BlockCacheSlot *slot);
+#endif
+
+
+/* Configuration parameters for the block cache */
+int BlockCacheSize = DEFAULT_BLOCK_CACHE_SIZE;
+
+
+/*
+ * InitializeBlockCache reserves shared memory for the block cache. It is called
+ * from _PG_init, and does nothing unless the extension is being loaded through
+ * shared_preload_libraries and the cache size is set. As with the metadata
+ * cache, PostgreSQL 9.6 or later is required.
+ */
+void
+InitializeBlockCache(void)
+{
+#if PG_VERSION_NUM >= 90600
+	uint32 chunkCount = 0;
+	Size cacheSize = 0;
+
+	if (!process_shared_preload_libraries_in_progress || BlockCacheSize == 0)
+	{
+		return;
+	}
+
+	chunkCount = BlockCacheChunkCount();
+	cacheSize = add_size(BlockCacheControlSize(chunkCount),
+						 hash_estimate_size(chunkCount, sizeof(BlockCacheHashEntry)));
+
+	RequestAddinShmemSpace(cacheSize);
+	RequestNamedLWLockTranche(BLOCK_CACHE_NAME, 1);
+
+	PreviousShmemStartupHook = shmem_startup_hook;
+	shmem_startup_hook = BlockCacheShmemStartup;
+#endif
+}
+
+
+/* BlockCacheEnabled returns true if this backend is attached to the block cache. */
+bool
+BlockCacheEnabled(void)
+{
+#if PG_VERSION_NUM >= 90600
+	return CacheControl != NULL;
+#else
+	return false;
+#endif
+}
+
+
+/*
+ * BlockCacheLookup finds the given block in the cache, and copies it into the
+ * given buffer, replacing the buffer's contents. The function returns false if
+ * the block isn't cached. Lookups hold the cache lock shared, so that backends
+ * reading different blocks don't block each other.
+ */
+bool
+BlockCacheLookup(BlockCacheKey *cacheKey, StringInfo value)
+{
+	bool found = false;
+
+#if PG_VERSION_NUM >= 90600
+	BlockCacheHashEntry *hashEntry = NULL;
+
+	if (CacheControl == NULL)
+	{
+		return false;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_SHARED);
+
+	hashEntry = (BlockCacheHashEntry *) hash_search(CacheHash, cacheKey, HASH_FIND,
+													NULL);
+	if (hashEntry != NULL)
+	{
+		BlockCacheSlot *slot = &SlotArray[hashEntry->slotIndex];
+		uint32 chunkIndex = slot->firstChunkIndex;
+		uint32 copiedLength = 0;
+
+		if (pg_atomic_read_u32(&slot->usageCount) < BLOCK_CACHE_MAX_USAGE_COUNT)
+		{
+			pg_atomic_fetch_add_u32(&slot->usageCount, 1);
+		}
+
+		resetStringInfo(value);
+		enlargeStringInfo(value, slot->valueLength);
+
+		while (copiedLength < slot->valueLength)
+		{
+			uint32 copyLength = Min(slot->valueLength - copiedLength,
+									BLOCK_CACHE_CHUNK_SIZE);
+			char *chunkData = ChunkDataArray +
+							  ((Size) chunkIndex) * BLOCK_CACHE_CHUNK_SIZE;
+
+			memcpy(value->data + copiedLength, chunkData, copyLength);
+
+			copiedLength += copyLength;
+			chunkIndex = ChunkLinkArray[chunkIndex];
+		}
+
+		value->len = slot->valueLength;
+		value->data[value->len] = '\0';
+		found = true;
+
+		pg_atomic_fetch_add_u64(&CacheControl->hitCount, 1);
+	}
+	else
+	{
+		pg_atomic_fetch_add_u64(&CacheControl->missCount, 1);
+	}
+
+	LWLockRelease(CacheControl->lock);
+#endif
+
+	return found;
+}
+
+
+/*
+ * BlockCacheInsert stores a copy of the given decompressed block in the cache,
+ * evicting other blocks if needed. Blocks larger than a quarter of the cache
+ * aren't stored, since they would flush out too many other blocks.
+ */
+void
+BlockCacheInsert(BlockCacheKey *cacheKey, StringInfo value)
+{
+#if PG_VERSION_NUM >= 90600
+	BlockCacheHashEntry *hashEntry = NULL;
+	BlockCacheSlot *slot = NULL;
+	uint32 requiredChunkCount = 0;
+	uint32 slotIndex = INVALID_CACHE_INDEX;
+	uint32 copiedLength = 0;
+	uint32 previousChunkIndex = INVALID_CACHE_INDEX;
+	bool found = false;
+
+	if (CacheControl == NULL)
+	{
+		return;
+	}
+
+	requiredChunkCount = (value->len + BLOCK_CACHE_CHUNK_SIZE - 1) /
+						 BLOCK_CACHE_CHUNK_SIZE;
+	if (requiredChunkCount > CacheControl->chunkCount / 4)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_EXCLUSIVE);
+
+	/* another backend may have cached the same block in the meantime */
+	hash_search(CacheHash, cacheKey, HASH_FIND, &found);
+	if (found)
+	{
+		LWLockRelease(CacheControl->lock);
+		return;
+	}
+
+	slotIndex = ClockSweepSlot(requiredChunkCount);
+
+	hashEntry = (BlockCacheHashEntry *) hash_search(CacheHash, cacheKey,
+													HASH_ENTER_NULL, &found);
+	if (hashEntry == NULL)
+	{
+		LWLockRelease(CacheControl->lock);
+		return;
+	}
+
+	hashEntry->slotIndex = slotIndex;
+
+	slot = &SlotArray[slotIndex];
+	slot->key = *cacheKey;
+	slot->used = true;
+	slot->firstChunkIndex = INVALID_CACHE_INDEX;
+	slot->valueLength = value->len;
+	pg_atomic_write_u32(&slot->usageCount, 1);
+
+	/* take chunks from the free list, and copy the block into them */
+	while (copiedLength < (uint32) value->len)
+	{
+		uint32 chunkIndex = CacheControl->freeChunkIndex;
+		uint32 copyLength = Min(value->len - copiedLength, BLOCK_CACHE_CHUNK_SIZE);
+		char *chunkData = ChunkDataArray + ((Size) chunkIndex) * BLOCK_CACHE_CHUNK_SIZE;
+
+		CacheControl->freeChunkIndex = ChunkLinkArray[chunkIndex];
+		CacheControl->freeChunkCount--;
+
+		memcpy(chunkData, value->data + copiedLength, copyLength);
+		ChunkLinkArray[chunkIndex] = INVALID_CACHE_INDEX;
+
+		if (previousChunkIndex == INVALID_CACHE_INDEX)
+		{
+			slot->firstChunkIndex = chunkIndex;
+		}
+		else
+		{
+			ChunkLinkArray[previousChunkIndex] = chunkIndex;
+		}
+
+		previousChunkIndex = chunkIndex;
+		copiedLength += copyLength;
+	}
+
+	CacheControl->cachedBlockCount++;
+	CacheControl->cachedByteCount += value->len;
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+/*
+ * BlockCacheInvalidateFile removes all cached blocks of the given data file.
+ * It should be called before a cstore file is deleted, since a file created
+ * later may reuse the same inode number.
+ */
+void
+BlockCacheInvalidateFile(const char *filename)
+{
+#if PG_VERSION_NUM >= 90600
+	struct stat fileStat;
+	uint32 slotIndex = 0;
+
+	if (CacheControl == NULL || stat(filename, &fileStat) != 0)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_EXCLUSIVE);
+
+	for (slotIndex = 0; slotIndex < CacheControl->slotCount; slotIndex++)
+	{
+		BlockCacheSlot *slot = &SlotArray[slotIndex];
+
+		if (slot->used && slot->key.fileDevice == (uint64) fileStat.st_dev &&
+			slot->key.fileInode == (uint64) fileStat.st_ino)
+		{
+			EvictBlockCacheSlot(slot);
+		}
+	}
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+/* BlockCacheReset removes all blocks from the cache. */
+void
+BlockCacheReset(void)
+{
+#if PG_VERSION_NUM >= 90600
+	uint32 slotIndex = 0;
+
+	if (CacheControl == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_EXCLUSIVE);
+
+	for (slotIndex = 0; slotIndex < CacheControl->slotCount; slotIndex++)
+	{
+		BlockCacheSlot *slot = &SlotArray[slotIndex];
+
+		if (slot->used)
+		{
+			EvictBlockCacheSlot(slot);
+		}
+	}
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+/*
+ * BlockCacheGetStats fills in the cache's usage counters. If the cache is
+ * disabled, all counters are zero.
+ */
+void
+BlockCacheGetStats(BlockCacheStats *cacheStats)
+{
+	memset(cacheStats, 0, sizeof(BlockCacheStats));
+
+#if PG_VERSION_NUM >= 90600
+	if (CacheControl == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_SHARED);
+
+	cacheStats->hitCount = pg_atomic_read_u64(&CacheControl->hitCount);
+	cacheStats->missCount = pg_atomic_read_u64(&CacheControl->missCount);
+	cacheStats->evictionCount = pg_atomic_read_u64(&CacheControl->evictionCount);
+	cacheStats->cachedBlockCount = CacheControl->cachedBlockCount;
+	cacheStats->cachedByteCount = CacheControl->cachedByteCount;
+	cacheStats->capacityByteCount = ((uint64) CacheControl->chunkCount) *
+									BLOCK_CACHE_CHUNK_SIZE;
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+#if PG_VERSION_NUM >= 90600
+
+/* BlockCacheChunkCount returns the number of chunks that fit the cache size. */
+static uint32
+BlockCacheChunkCount(void)
+{
+	uint64 cacheSizeBytes = ((uint64) BlockCacheSize) * 1024;
+	uint64 chunkSize = BLOCK_CACHE_CHUNK_SIZE + sizeof(uint32) + sizeof(BlockCacheSlot);
+	uint64 chunkCount = cacheSizeBytes / chunkSize;
+
+	return (uint32) Max(chunkCount, 1);
+}
+
+
+/*
+ * BlockCacheControlSize returns the shared memory size of the cache's slots
+ * and chunks. Every block takes at least one chunk, so we need as many slots
+ * as there are chunks.
+ */
+static Size
+BlockCacheControlSize(uint32 chunkCount)
+{
+	Size controlSize = MAXALIGN(sizeof(BlockCacheControl));
+	controlSize = add_size(controlSize,
+						   MAXALIGN(mul_size(chunkCount, sizeof(BlockCacheSlot))));
+	controlSize = add_size(controlSize, MAXALIGN(mul_size(chunkCount, sizeof(uint32))));
+	controlSize = add_size(controlSize, mul_size(chunkCount, BLOCK_CACHE_CHUNK_SIZE));
+
+	return controlSize;
+}
+
+
+/*
+ * BlockCacheShmemStartup creates or attaches to the cache's shared memory. The
+ * first backend to get here initializes the slots and the chunk free list.
+ */
+static void
+BlockCacheShmemStartup(void)
+{
+	uint32 chunkCount = BlockCacheChunkCount();
+	HASHCTL hashInfo;
+	bool found = false;
+
+	if (PreviousShmemStartupHook != NULL)
+	{
+		PreviousShmemStartupHook();
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	CacheControl = ShmemInitStruct(BLOCK_CACHE_NAME, BlockCacheControlSize(chunkCount),
+								   &found);
+	SlotArray = (BlockCacheSlot *) (((char *) CacheControl) +
+									MAXALIGN(sizeof(BlockCacheControl)));
+	ChunkLinkArray = (uint32 *) (((char *) SlotArray) +
+								 MAXALIGN(((Size) chunkCount) * sizeof(BlockCacheSlot)));
+	ChunkDataArray = ((char *) ChunkLinkArray) +
+					 MAXALIGN(((Size) chunkCount) * sizeof(uint32));
+
+	if (!found)
+	{
+		uint32 chunkIndex = 0;
+
+		CacheControl->lock = &(GetNamedLWLockTranche(BLOCK_CACHE_NAME))->lock;
+		CacheControl->slotCount = chunkCount;
+		CacheControl->clockHand = 0;
+		CacheControl->chunkCount = chunkCount;
+		CacheControl->freeChunkCount = chunkCount;
+		CacheControl->freeChunkIndex = 0;
+		CacheControl->cachedBlockCount = 0;
+		CacheControl->cachedByteCount = 0;
+		pg_atomic_init_u64(&CacheControl->hitCount, 0);
+		pg_atomic_init_u64(&CacheControl->missCount, 0);
+		pg_atomic_init_u64(&CacheControl->evictionCount, 0);
+
+		for (chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++)
+		{
+			BlockCacheSlot *slot = &SlotArray[chunkIndex];
+
+			memset(&slot->key, 0, sizeof(BlockCacheKey));
+			slot->used = false;
+			slot->firstChunkIndex = INVALID_CACHE_INDEX;
+			slot->valueLength = 0;
+			pg_atomic_init_u32(&slot->usageCount, 0);
+
+			ChunkLinkArray[chunkIndex] = chunkIndex + 1;
+		}
+		ChunkLinkArray[chunkCount - 1] = INVALID_CACHE_INDEX;
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(BlockCacheKey);
+	hashInfo.entrysize = sizeof(BlockCacheHashEntry);
+
+	CacheHash = ShmemInitHash(BLOCK_CACHE_HASH_NAME, chunkCount, chunkCount,
+							  &hashInfo, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+
+/*
+ * ClockSweepSlot advances the clock hand until there is an unused slot and
+ * enough free chunks for a new block, and returns the unused slot's index.
+ * Slots whose usage count is zero are evicted on the way, and the usage counts
+ * of the others are decremented. Since a block never takes more than a quarter
+ * of the chunks, the sweep always terminates. The caller must hold the cache
+ * lock exclusively.
+ */
+static uint32
+ClockSweepSlot(uint32 requiredChunkCount)
+{
+	uint32 freeSlotIndex = INVALID_CACHE_INDEX;
+
+	while (freeSlotIndex == INVALID_CACHE_INDEX ||
+		   CacheControl->freeChunkCount < requiredChunkCount)
+	{
+		uint32 slotIndex = CacheControl->clockHand;
+		BlockCacheSlot *slot = &SlotArray[slotIndex];
+
+		CacheControl->clockHand = (slotIndex + 1) % CacheControl->slotCount;
+
+		if (slot->used)
+		{
+			if (pg_atomic_read_u32(&slot->usageCount) > 0)
+			{
+				pg_atomic_fetch_sub_u32(&slot->usageCount, 1);
+				continue;
+			}
+
+			EvictBlockCacheSlot(slot);
+			pg_atomic_fetch_add_u64(&CacheControl->evictionCount, 1);
+		}
+
+		if (freeSlotIndex == INVALID_CACHE_INDEX)
+		{
+			freeSlotIndex = slotIndex;
+		}
+	}
+
+	return freeSlotIndex;
+}
+
+
+/*
+ * EvictBlockCacheSlot removes the block in the given slot from the cache, and
+ * returns its chunks to the free list. The caller must hold the cache lock
+ * exclusively.
+ */
+static void
+EvictBlockCacheSlot(BlockCacheSlot *slot)
+{
+	uint32 chunkIndex = slot->firstChunkIndex;
+
+	while (chunkIndex != INVALID_CACHE_INDEX)
+	{
+		uint32 nextChunkIndex = ChunkLinkArray[chunkIndex];
+
+		ChunkLinkArray[chunkIndex] = CacheControl->freeChunkIndex;
+		CacheControl->freeChunkIndex = chunkIndex;
+		CacheControl->freeChunkCount++;
+
+		chunkIndex = nextChunkIndex;
+	}
+
+	hash_search(CacheHash, &slot->key, HASH_REMOVE, NULL);
+
+	CacheControl->cachedBlockCount--;
+	CacheControl->cachedByteCount -= slot->valueLength;
+
+	slot->used = false;
+	slot->firstChunkIndex = INVALID_CACHE_INDEX;
+	slot->valueLength = 0;
+	pg_atomic_write_u32(&slot->usageCount, 0);
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_block_cache.h
+ *
+ * Type and function declarations for the shared memory cache of decompressed
+ * column blocks.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSTORE_BLOCK_CACHE_H
+#define CSTORE_BLOCK_CACHE_H
+
+#include "lib/stringinfo.h"
+
+
+/* Default and limits for the cache size configuration parameter, in kB */
+#define DEFAULT_BLOCK_CACHE_SIZE 0
+#define BLOCK_CACHE_SIZE_MAXIMUM (INT_MAX / 2)
+
+
+/*
+ * BlockCacheKey identifies a decompressed column block. Column blocks are
+ * never modified once they are written, so a block is identified by its data
+ * file and by its position within that file.
+ */
+typedef struct BlockCacheKey
+{
+	uint64 fileDevice;
+	uint64 fileInode;
+	uint64 blockOffset;
+	uint64 blockLength;
+
+} BlockCacheKey;
+
+
+/* BlockCacheStats contains usage counters of the block cache. */
+typedef struct BlockCacheStats
+{
+	uint64 hitCount;
+	uint64 missCount;
+	uint64 evictionCount;
+	uint64 cachedBlockCount;
+	uint64 cachedByteCount;
+	uint64 capacityByteCount;
+
+} BlockCacheStats;
+
+
+/* Configuration parameters */
+extern int BlockCacheSize;
+
+/* Function declarations for the block cache */
+extern void InitializeBlockCache(void);
+extern bool BlockCacheEnabled(void);
+extern bool BlockCacheLookup(BlockCacheKey *cacheKey, StringInfo value);
+extern void BlockCacheInsert(BlockCacheKey *cacheKey, StringInfo value);
+extern void BlockCacheInvalidateFile(const char *filename);
+extern void BlockCacheReset(void);
+extern void BlockCacheGetStats(BlockCacheStats *cacheStats);
+
+
+#endif   /* CSTORE_BLOCK_CACHE_H */
@@ -0,0 +1,130 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_bloom_filter.c
+ *
+ * This file contains the functions that build and probe the bloom filters
+ * kept in block skip nodes of columns with the bloom_filter option.
+ *
+ * A bloom filter is a bit array whose length in bits is a power of two. Each
+ * value sets BLOOM_FILTER_HASH_COUNT bits, picked by double hashing the 32-bit
+ * hash that the column type's default hash function computes for the value.
+ * Since values that are equal under a hash operator family hash the same, the
+ * reader can probe a filter with the hash of a constant of another type in the
+ * family.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "cstore_fdw.h"
+
+
+/* local functions forward declarations */
+static uint32 BloomFilterBitCount(uint32 valueCount);
+static inline uint32 BloomFilterSecondHash(uint32 hashValue);
+
+
+/*
+ * BuildBloomFilter builds a bloom filter of the given value hashes, and sets
+ * bloomFilterLength to its length in bytes. The filter is sized for the number
+ * of hashes, so that blocks with fewer values get smaller filters. A filter of
+ * no hashes has no bits set, and rejects all probes.
+ */
+char *
+BuildBloomFilter(uint32 *hashArray, uint32 hashCount, uint32 *bloomFilterLength)
+{
+	uint32 bitCount = BloomFilterBitCount(hashCount);
+	uint32 bitMask = bitCount - 1;
+	uint8 *bloomFilter = palloc0(bitCount / 8);
+	uint32 hashIndex = 0;
+
+	for (hashIndex = 0; hashIndex < hashCount; hashIndex++)
+	{
+		uint32 bitIndex = hashArray[hashIndex];
+		uint32 bitStep = BloomFilterSecondHash(bitIndex);
+		uint32 hashFunctionIndex = 0;
+
+		for (hashFunctionIndex = 0; hashFunctionIndex < BLOOM_FILTER_HASH_COUNT;
+			 hashFunctionIndex++)
+		{
+			uint32 maskedBitIndex = bitIndex & bitMask;
+			bloomFilter[maskedBitIndex / 8] |= (uint8) (1 << (maskedBitIndex % 8));
+
+			bitIndex += bitStep;
+		}
+	}
+
+	(*bloomFilterLength) = bitCount / 8;
+	return (char *) bloomFilter;
+}
+
+
+/*
+ * BloomFilterMayContain returns false if the value with the given hash is
+ * certainly not in the bloom filter, and true if it might be.
+ */
+bool
+BloomFilterMayContain(const char *bloomFilter, uint32 bloomFilterLength,
+					  uint32 hashValue)
+{
+	const uint8 *bloomFilterBytes = (const uint8 *) bloomFilter;
+	uint32 bitMask = bloomFilterLength * 8 - 1;
+	uint32 bitIndex = hashValue;
+	uint32 bitStep = BloomFilterSecondHash(hashValue);
+	uint32 hashFunctionIndex = 0;
+
+	for (hashFunctionIndex = 0; hashFunctionIndex < BLOOM_FILTER_HASH_COUNT;
+		 hashFunctionIndex++)
+	{
+		uint32 maskedBitIndex = bitIndex & bitMask;
+		if ((bloomFilterBytes[maskedBitIndex / 8] & (1 << (maskedBitIndex % 8))) == 0)
+		{
+			return false;
+		}
+
+		bitIndex += bitStep;
+	}
+
+	return true;
+}
+
+
+/*
+ * BloomFilterBitCount returns the number of bits for a bloom filter of the
+ * given number of values: BLOOM_FILTER_BITS_PER_VALUE bits per value, rounded
+ * up to a power of two so that bit indexes can be masked.
+ */
+static uint32
+BloomFilterBitCount(uint32 valueCount)
+{
+	uint64 minimumBitCount = (uint64) valueCount * BLOOM_FILTER_BITS_PER_VALUE;
+	uint32 bitCount = BLOOM_FILTER_MINIMUM_BIT_COUNT;
+
+	while (bitCount < minimumBitCount && bitCount < BLOOM_FILTER_MAXIMUM_BIT_COUNT)
+	{
+		bitCount *= 2;
+	}
+
+	return bitCount;
+}
+
+
+/*
+ * BloomFilterSecondHash derives the step between the bits a value sets from
+ * its hash, using the finalizer of MurmurHash3 to mix the hash's bits. The
+ * step is odd, so that it is coprime with the filter's bit count.
+ */
+static inline uint32
+BloomFilterSecondHash(uint32 hashValue)
+{
+	hashValue ^= hashValue >> 16;
+	hashValue *= 0x85ebca6b;
+	hashValue ^= hashValue >> 13;
+	hashValue *= 0xc2b2ae35;
+	hashValue ^= hashValue >> 16;
+
+	return hashValue | 1;
+}
@@ -20,8 +20,101 @@
 #include "utils/pg_lzcompress.h"
 #endif
 
+#include "lz4.h"
+#include "lz4hc.h"
 #include "snappy-c.h"
+#include "zdict.h"
 #include "zlib.h"
+#include "zstd.h"
+
+
+/* levels used when the table doesn't specify a compression level */
+#define LZ4_DEFAULT_COMPRESSION_LEVEL 1
+#define ZSTD_DEFAULT_COMPRESSION_LEVEL 3
+
+/*
+ * Limits for training zstd dictionaries. We need a handful of blocks to find
+ * content they have in common, and keep dictionaries small relative to the
+ * data they are trained on, since each stripe stores its own.
+ */
+#define ZSTD_DICTIONARY_MINIMUM_SAMPLE_COUNT 8
+#define ZSTD_DICTIONARY_MINIMUM_SIZE 1024
+#define ZSTD_DICTIONARY_MAXIMUM_SIZE (64 * 1024)
+
+/*
+ * Read cost the balanced auto compression objective charges per compressed
+ * byte, in nanoseconds. This corresponds to reading at about 1GB/s.
+ */
+#define AUTO_COMPRESSION_READ_NANOSECONDS_PER_BYTE 1.0
+
+/*
+ * A single decompression of a small buffer takes microseconds, so timings vary
+ * from run to run. Auto compression averages several runs, and treats costs
+ * within this fraction of each other as equal, preferring the smaller output.
+ */
+#define AUTO_COMPRESSION_DECODE_RUN_COUNT 3
+#define AUTO_COMPRESSION_COST_TOLERANCE 0.1
+
+/* compression types that auto compression considers for a column */
+static const CompressionType AutoCompressionTypeArray[] =
+{
+	COMPRESSION_PG_LZ,
+	COMPRESSION_SNAPPY,
+	COMPRESSION_DEFLATE,
+	COMPRESSION_LZ4,
+	COMPRESSION_ZSTD
+};
+
+/* configuration parameter for the objective that auto compression uses */
+int AutoCompressionObjective = COMPRESSION_OBJECTIVE_BALANCED;
+
+
+/*
+ * CompressionState keeps the compression contexts of a data load, so that each
+ * block reuses them instead of setting up its own. zlib and zstd allocate
+ * theirs with malloc(), so we release them through a memory context callback.
+ * lz4 states are allocated in memoryContext.
+ */
+struct CompressionState
+{
+	MemoryContext memoryContext;
+	z_stream deflateStream;
+	bool deflateStreamValid;
+	int deflateLevel;
+	ZSTD_CCtx *zstdContext;
+	void *lz4State;
+	void *lz4HighCompressionState;
+	bool contextFailed;
+#if PG_VERSION_NUM >= 90500
+	MemoryContextCallback resetCallback;
+#endif
+};
+
+
+/*
+ * DecompressionState keeps the zlib and zstd decompression contexts of a scan.
+ * Both libraries allocate these with malloc(), so we release them through a
+ * memory context callback when the scan's memory goes away, even on errors.
+ */
+struct DecompressionState
+{
+	z_stream inflateStream;
+	bool inflateStreamValid;
+	ZSTD_DCtx *zstdContext;
+#if PG_VERSION_NUM >= 90500
+	MemoryContextCallback resetCallback;
+#endif
+};
+
+
+static z_stream * DeflateStream(CompressionState *compressionState,
+								int compressionLevel);
+static double DecompressionNanoseconds(StringInfo compressedBuffer,
+									   CompressionType compressionType);
+#if PG_VERSION_NUM >= 90500
+static void ReleaseCompressionStateCallback(void *arg);
+static void ReleaseDecompressionStateCallback(void *arg);
+#endif
 
 
 #if PG_VERSION_NUM >= 90500
@@ -59,141 +152,546 @@ typedef struct CStoreCompressHeader
  * CompressBuffer compresses the given buffer with the given compression type
  * outputBuffer enlarged to contain compressed data. The function returns true
  * if compression is done, returns false if compression is not done.
- * outputBuffer is valid only if the function returns true.
+ * outputBuffer is valid only if the function returns true. compressionLevel is
+ * used by deflate, lz4 and zstd, where zero selects the codec's default level,
+ * and zstd also uses the given compression dictionary if it isn't NULL.
+ * Compression contexts are taken from compressionState, or are set up for this
+ * call only if it is NULL.
  */
 bool
 CompressBuffer(StringInfo inputBuffer, StringInfo outputBuffer,
-			   CompressionType compressionType)
+			   CompressionType compressionType, int compressionLevel,
+			   StringInfo compressionDictionary, CompressionState *compressionState)
 {
-	uint64 maximumLength = 0;
+	uint64 maximumLength = CompressedLengthBound(compressionType, inputBuffer->len);
+	uint32 compressedLength = 0;
 	bool compressionResult = false;
-//#if PG_VERSION_NUM >= 90500
-	int32 compressedByteCount = 0;
-//#endif
+	CompressionState temporaryCompressionState;
+
+	if (maximumLength == 0)
+	{
+		return false;
+	}
+
+	/* without the caller's state, we set up compression contexts just for this call */
+	if (compressionState == NULL)
+	{
+		memset(&temporaryCompressionState, 0, sizeof(CompressionState));
+		temporaryCompressionState.memoryContext = CurrentMemoryContext;
+		compressionState = &temporaryCompressionState;
+	}
+
+	PrepareCompressionState(compressionState, compressionType, compressionLevel);
+
+	resetStringInfo(outputBuffer);
+	enlargeStringInfo(outputBuffer, maximumLength);
+
+	compressionResult = CompressData(inputBuffer->data, inputBuffer->len,
+									 outputBuffer->data, maximumLength,
+									 compressionType, compressionLevel,
+									 compressionDictionary, compressionState,
+									 &compressedLength);
+	if (compressionResult)
+	{
+		outputBuffer->len = compressedLength;
+	}
+	else if (CompressionContextFailed(compressionState))
+	{
+		ereport(WARNING, (errmsg("could not set up compression context, storing "
+								 "block uncompressed")));
+	}
+
+	if (compressionState == &temporaryCompressionState)
+	{
+		ReleaseCompressionState(compressionState);
+	}
+
+	return compressionResult;
+}
+
+
+/*
+ * CompressedLengthBound returns the largest length that compressing the given
+ * number of bytes with the given compression type can produce, including the
+ * compression header. The function returns zero for types that don't compress.
+ */
+uint64
+CompressedLengthBound(CompressionType compressionType, uint32 inputLength)
+{
+	uint64 maximumLength = 0;
 
 	if (compressionType == COMPRESSION_PG_LZ)
 	{
-		maximumLength = PGLZ_MAX_OUTPUT(inputBuffer->len) + CSTORE_COMPRESS_HDRSZ;
-	        resetStringInfo(outputBuffer);
-	        enlargeStringInfo(outputBuffer, maximumLength);
+		maximumLength = PGLZ_MAX_OUTPUT(inputLength);
+	}
+	else if (compressionType == COMPRESSION_SNAPPY)
+	{
+		maximumLength = snappy_max_compressed_length(inputLength);
+	}
+	else if (compressionType == COMPRESSION_DEFLATE)
+	{
+		/* deflateBound() needs a stream, so we use the bound for default settings */
+		maximumLength = compressBound(inputLength);
+	}
+	else if (compressionType == COMPRESSION_LZ4)
+	{
+		maximumLength = LZ4_compressBound(inputLength);
+	}
+	else if (compressionType == COMPRESSION_ZSTD)
+	{
+		maximumLength = ZSTD_compressBound(inputLength);
+	}
+	else
+	{
+		return 0;
+	}
 
+	return maximumLength + CSTORE_COMPRESS_HDRSZ;
+}
+
+
+/*
+ * CompressData compresses inputLength bytes from inputData into outputData,
+ * which must have room for CompressedLengthBound() bytes, and sets
+ * compressedLength to the length of the compressed data, including its header.
+ * The function returns false if the data can't be compressed.
+ *
+ * Except for pglz, which keeps its state in static variables, this function is
+ * safe to call from compression worker threads. It therefore never allocates
+ * Postgres memory or reports errors, and the caller prepares compressionState
+ * with PrepareCompressionState() beforehand. If zlib or zstd can't set up their
+ * context, the function marks the state, so that the caller can report it.
+ */
+bool
+CompressData(const char *inputData, uint32 inputLength, char *outputData,
+			 uint64 outputCapacity, CompressionType compressionType,
+			 int compressionLevel, StringInfo compressionDictionary,
+			 CompressionState *compressionState, uint32 *compressedLength)
+{
+	uint64 compressedCapacity = outputCapacity - CSTORE_COMPRESS_HDRSZ;
+	char *compressedData = (char *) CSTORE_COMPRESS_RAWDATA(outputData);
+	uint64 compressedByteCount = 0;
+	bool compressionResult = false;
+
+	if (compressionType == COMPRESSION_PG_LZ)
+	{
 #if PG_VERSION_NUM >= 90500
-		compressedByteCount = pglz_compress((const char *) inputBuffer->data,
-										inputBuffer->len,
-										CSTORE_COMPRESS_RAWDATA(outputBuffer->data),
-										PGLZ_strategy_always);
-		if (compressedByteCount >= 0)
-		{
-			CSTORE_COMPRESS_SET_RAWSIZE(outputBuffer->data, inputBuffer->len);
-			SET_VARSIZE_COMPRESSED(outputBuffer->data,
-								   compressedByteCount + CSTORE_COMPRESS_HDRSZ);
+		int32 pglzByteCount = pglz_compress(inputData, inputLength, compressedData,
+											PGLZ_strategy_always);
+		if (pglzByteCount >= 0)
+		{
+			compressedByteCount = pglzByteCount;
 			compressionResult = true;
 		}
 #else
-
-		compressionResult = pglz_compress(inputBuffer->data, inputBuffer->len,
-										  CSTORE_COMPRESS_RAWDATA(outputBuffer->data),
+		compressionResult = pglz_compress(inputData, inputLength,
+										  (PGLZ_Header *) compressedData,
 										  PGLZ_strategy_always);
 #endif
-	} else if (compressionType == COMPRESSION_SNAPPY)
+	}
+	else if (compressionType == COMPRESSION_SNAPPY)
 	{
-		maximumLength = snappy_max_compressed_length(inputBuffer->len);
-	        resetStringInfo(outputBuffer);
-	        enlargeStringInfo(outputBuffer, maximumLength);
+		size_t snappyByteCount = compressedCapacity;
 
-		if (snappy_compress(inputBuffer->data, inputBuffer->len, (char *)CSTORE_COMPRESS_RAWDATA(outputBuffer->data), (size_t *)&compressedByteCount) == SNAPPY_OK)
+		if (snappy_compress(inputData, inputLength, compressedData,
+							&snappyByteCount) == SNAPPY_OK)
 		{
-
-                	if (compressedByteCount >= 0)
-	                {
-	                        CSTORE_COMPRESS_SET_RAWSIZE(outputBuffer->data, inputBuffer->len);
-	                        SET_VARSIZE_COMPRESSED(outputBuffer->data,
-                                                                   compressedByteCount + CSTORE_COMPRESS_HDRSZ);
-	                        compressionResult = true;
-	                }
-		} else
+			compressedByteCount = snappyByteCount;
+			compressionResult = true;
+		}
+	}
+	else if (compressionType == COMPRESSION_DEFLATE)
+	{
+		z_stream *deflateStream = DeflateStream(compressionState, compressionLevel);
+		if (deflateStream != NULL)
 		{
-			compressionResult = false;
+			/* set the streaming context */
+			deflateStream->avail_in = inputLength;
+			deflateStream->next_in = (Bytef *) inputData;
+			deflateStream->avail_out = compressedCapacity;
+			deflateStream->next_out = (Bytef *) compressedData;
+
+			/* do a single pass deflate compression */
+			if (deflate(deflateStream, Z_FINISH) == Z_STREAM_END)
+			{
+				compressedByteCount = deflateStream->total_out;
+				compressionResult = true;
+			}
 		}
+		else
+		{
+			compressionState->contextFailed = true;
+		}
+	}
+	else if (compressionType == COMPRESSION_LZ4)
+	{
+		int lz4ByteCount = 0;
 
+		if (compressionLevel == DEFAULT_COMPRESSION_LEVEL)
+		{
+			compressionLevel = LZ4_DEFAULT_COMPRESSION_LEVEL;
+		}
 
+		/* levels above one use the slower high compression mode */
+		if (compressionLevel > 1)
+		{
+			lz4ByteCount = LZ4_compress_HC_extStateHC(compressionState->lz4HighCompressionState,
+													  inputData, compressedData,
+													  inputLength, compressedCapacity,
+													  compressionLevel);
+		}
+		else
+		{
+			lz4ByteCount = LZ4_compress_fast_extState(compressionState->lz4State,
+													  inputData, compressedData,
+													  inputLength, compressedCapacity, 1);
+		}
 
-	} else if (compressionType == COMPRESSION_DEFLATE)
+		if (lz4ByteCount > 0 && lz4ByteCount < (int) inputLength)
+		{
+			compressedByteCount = lz4ByteCount;
+			compressionResult = true;
+		}
+	}
+	else if (compressionType == COMPRESSION_ZSTD)
 	{
-		z_stream strm;
-
-		/* allocate deflate state */
-		strm.zalloc = Z_NULL;
-		strm.zfree = Z_NULL;
-		strm.opaque = Z_NULL;
+		size_t compressResult = 0;
 
-		if (deflateInit(&strm, Z_DEFAULT_COMPRESSION) != Z_OK)
+		if (compressionLevel == DEFAULT_COMPRESSION_LEVEL)
 		{
-                        ereport(ERROR, (errmsg("deflate cannot compress the buffer"),
-                                                        errdetail("unable to initialize deflate state")));
+			compressionLevel = ZSTD_DEFAULT_COMPRESSION_LEVEL;
 		}
-	
-		/* get upper bound for compressed data and allocate buffer */	
-		maximumLength = deflateBound(&strm, inputBuffer->len);
-	        resetStringInfo(outputBuffer);
-	        enlargeStringInfo(outputBuffer, maximumLength);
-
-		/* set the streaming context */
-		strm.avail_in = inputBuffer->len;
-		strm.next_in = (Bytef *)inputBuffer->data;
-		strm.avail_out = maximumLength;
-		strm.next_out = (Bytef *)CSTORE_COMPRESS_RAWDATA(outputBuffer->data);
 
-		/* do a single pass deflate compression */
-		if (deflate(&strm, Z_FINISH) == Z_STREAM_END) 
+		if (compressionState->zstdContext == NULL)
 		{
-			if (maximumLength - strm.avail_out >= 0)
-                        {
-                                CSTORE_COMPRESS_SET_RAWSIZE(outputBuffer->data, inputBuffer->len);
-                                SET_VARSIZE_COMPRESSED(outputBuffer->data,
-                                                                   maximumLength - strm.avail_out + CSTORE_COMPRESS_HDRSZ);
-                                compressionResult = true;
-                        }
+			compressionState->zstdContext = ZSTD_createCCtx();
+			if (compressionState->zstdContext == NULL)
+			{
+				compressionState->contextFailed = true;
+				return false;
+			}
+		}
 
-		} else
+		if (compressionDictionary != NULL)
+		{
+			compressResult = ZSTD_compress_usingDict(compressionState->zstdContext,
+													 compressedData, compressedCapacity,
+													 inputData, inputLength,
+													 compressionDictionary->data,
+													 compressionDictionary->len,
+													 compressionLevel);
+		}
+		else
 		{
-                        compressionResult = false;
-                }
+			compressResult = ZSTD_compressCCtx(compressionState->zstdContext,
+											   compressedData, compressedCapacity,
+											   inputData, inputLength, compressionLevel);
+		}
 
-		/* closes the deflate stream */
-		(void)deflateEnd(&strm);
+		if (!ZSTD_isError(compressResult) && compressResult < (size_t) inputLength)
+		{
+			compressedByteCount = compressResult;
+			compressionResult = true;
+		}
 	}
 
 	if (compressionResult)
 	{
-		outputBuffer->len = VARSIZE(outputBuffer->data);
+#if PG_VERSION_NUM >= 90500
+		CSTORE_COMPRESS_SET_RAWSIZE(outputData, inputLength);
+		SET_VARSIZE_COMPRESSED(outputData, compressedByteCount + CSTORE_COMPRESS_HDRSZ);
+#else
+		/* pglz sets up its own header, which we reuse for the other codecs */
+		if (compressionType != COMPRESSION_PG_LZ)
+		{
+			CSTORE_COMPRESS_SET_RAWSIZE(outputData, inputLength);
+			SET_VARSIZE_COMPRESSED(outputData,
+								   compressedByteCount + CSTORE_COMPRESS_HDRSZ);
+		}
+#endif
+
+		*compressedLength = VARSIZE(outputData);
 	}
 
 	return compressionResult;
 }
 
 
+/*
+ * CreateCompressionState creates compression state in the current memory
+ * context. Like decompression state, compression contexts are created the
+ * first time they are needed, and are released when the memory context is
+ * reset or deleted.
+ */
+CompressionState *
+CreateCompressionState(void)
+{
+	CompressionState *compressionState = palloc0(sizeof(CompressionState));
+	compressionState->memoryContext = CurrentMemoryContext;
+
+#if PG_VERSION_NUM >= 90500
+	compressionState->resetCallback.func = ReleaseCompressionStateCallback;
+	compressionState->resetCallback.arg = (void *) compressionState;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext,
+									   &compressionState->resetCallback);
+#endif
+
+	return compressionState;
+}
+
+
+/*
+ * PrepareCompressionState allocates the memory that CompressData() needs to
+ * compress with the given compression type and level, since CompressData()
+ * can't allocate memory itself. zlib and zstd allocate their own contexts.
+ */
+void
+PrepareCompressionState(CompressionState *compressionState,
+						CompressionType compressionType, int compressionLevel)
+{
+	if (compressionType != COMPRESSION_LZ4)
+	{
+		return;
+	}
+
+	if (compressionLevel > 1 && compressionState->lz4HighCompressionState == NULL)
+	{
+		compressionState->lz4HighCompressionState =
+			MemoryContextAlloc(compressionState->memoryContext, LZ4_sizeofStateHC());
+	}
+	else if (compressionLevel <= 1 && compressionState->lz4State == NULL)
+	{
+		compressionState->lz4State =
+			MemoryContextAlloc(compressionState->memoryContext, LZ4_sizeofState());
+	}
+}
+
+
+/*
+ * CompressionContextFailed returns whether CompressData() failed to set up a
+ * compression context since the last call, and clears the mark. Like
+ * CompressData(), it is safe to call from compression worker threads.
+ */
+bool
+CompressionContextFailed(CompressionState *compressionState)
+{
+	bool contextFailed = compressionState->contextFailed;
+	compressionState->contextFailed = false;
+
+	return contextFailed;
+}
+
+
+/*
+ * ReleaseCompressionState frees the compression contexts of the given state.
+ * The state stays usable, and creates new contexts if it is used again.
+ */
+void
+ReleaseCompressionState(CompressionState *compressionState)
+{
+	if (compressionState->deflateStreamValid)
+	{
+		(void) deflateEnd(&compressionState->deflateStream);
+		compressionState->deflateStreamValid = false;
+	}
+
+	if (compressionState->zstdContext != NULL)
+	{
+		ZSTD_freeCCtx(compressionState->zstdContext);
+		compressionState->zstdContext = NULL;
+	}
+
+	if (compressionState->lz4State != NULL)
+	{
+		pfree(compressionState->lz4State);
+		compressionState->lz4State = NULL;
+	}
+
+	if (compressionState->lz4HighCompressionState != NULL)
+	{
+		pfree(compressionState->lz4HighCompressionState);
+		compressionState->lz4HighCompressionState = NULL;
+	}
+}
+
+
+#if PG_VERSION_NUM >= 90500
+
+/* ReleaseCompressionStateCallback releases compression state on reset. */
+static void
+ReleaseCompressionStateCallback(void *arg)
+{
+	ReleaseCompressionState((CompressionState *) arg);
+}
+
+#endif
+
+
+/*
+ * DeflateStream returns the state's deflate stream, ready to compress a new
+ * buffer at the given level. The stream is set up on first use, and is only
+ * reset for later buffers, which is much cheaper than setting up a new one.
+ * The function returns NULL if zlib fails to set up the stream.
+ */
+static z_stream *
+DeflateStream(CompressionState *compressionState, int compressionLevel)
+{
+	z_stream *deflateStream = &compressionState->deflateStream;
+
+	if (compressionLevel == DEFAULT_COMPRESSION_LEVEL)
+	{
+		compressionLevel = Z_DEFAULT_COMPRESSION;
+	}
+
+	if (!compressionState->deflateStreamValid)
+	{
+		deflateStream->zalloc = Z_NULL;
+		deflateStream->zfree = Z_NULL;
+		deflateStream->opaque = Z_NULL;
+
+		if (deflateInit(deflateStream, compressionLevel) != Z_OK)
+		{
+			return NULL;
+		}
+
+		compressionState->deflateStreamValid = true;
+		compressionState->deflateLevel = compressionLevel;
+	}
+	else
+	{
+		if (deflateReset(deflateStream) != Z_OK)
+		{
+			return NULL;
+		}
+
+		/* columns may use different levels, which we switch between on reset */
+		if (compressionLevel != compressionState->deflateLevel)
+		{
+			if (deflateParams(deflateStream, compressionLevel,
+							  Z_DEFAULT_STRATEGY) != Z_OK)
+			{
+				return NULL;
+			}
+
+			compressionState->deflateLevel = compressionLevel;
+		}
+	}
+
+	return deflateStream;
+}
+
+
+/*
+ * CreateDecompressionState creates decompression state in the current memory
+ * context. Decompression contexts are created the first time they are needed,
+ * and are released when the memory context is reset or deleted.
+ */
+DecompressionState *
+CreateDecompressionState(void)
+{
+	DecompressionState *decompressionState = palloc0(sizeof(DecompressionState));
+
+#if PG_VERSION_NUM >= 90500
+	decompressionState->resetCallback.func = ReleaseDecompressionStateCallback;
+	decompressionState->resetCallback.arg = (void *) decompressionState;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext,
+									   &decompressionState->resetCallback);
+#endif
+
+	return decompressionState;
+}
+
+
+/*
+ * ReleaseDecompressionState frees the decompression contexts that zlib and zstd
+ * allocated outside of Postgres memory contexts. The state stays usable, and
+ * creates new contexts if it is used again.
+ */
+void
+ReleaseDecompressionState(DecompressionState *decompressionState)
+{
+	if (decompressionState->inflateStreamValid)
+	{
+		(void) inflateEnd(&decompressionState->inflateStream);
+		decompressionState->inflateStreamValid = false;
+	}
+
+	if (decompressionState->zstdContext != NULL)
+	{
+		ZSTD_freeDCtx(decompressionState->zstdContext);
+		decompressionState->zstdContext = NULL;
+	}
+}
+
+
+#if PG_VERSION_NUM >= 90500
+
+/* ReleaseDecompressionStateCallback releases decompression state on reset. */
+static void
+ReleaseDecompressionStateCallback(void *arg)
+{
+	ReleaseDecompressionState((DecompressionState *) arg);
+}
+
+#endif
+
+
 /*
  * DecompressBuffer decompresses the given buffer with the given compression
  * type. This function returns the buffer as-is when no compression is applied.
+ * Buffers compressed with a dictionary need the same dictionary to decompress.
  */
 StringInfo
-DecompressBuffer(StringInfo buffer, CompressionType compressionType)
+DecompressBuffer(StringInfo buffer, CompressionType compressionType,
+				 StringInfo compressionDictionary)
 {
 	StringInfo decompressedBuffer = NULL;
+	DecompressionState decompressionState;
+
+	if (compressionType == COMPRESSION_NONE)
+	{
+		/* in case of no compression, return buffer */
+		return buffer;
+	}
+
+	memset(&decompressionState, 0, sizeof(DecompressionState));
+
+	decompressedBuffer = makeStringInfo();
+	DecompressBufferInto(buffer, compressionType, compressionDictionary,
+						 &decompressionState, decompressedBuffer);
+
+	ReleaseDecompressionState(&decompressionState);
+
+	return decompressedBuffer;
+}
+
+
+/*
+ * DecompressBufferInto decompresses the given compressed buffer into outputBuffer,
+ * replacing its contents. Scans pass the same output buffer and decompression
+ * state for every block of a column, so that both the buffer and the zlib and
+ * zstd contexts are reused instead of being set up for each block.
+ */
+void
+DecompressBufferInto(StringInfo buffer, CompressionType compressionType,
+					 StringInfo compressionDictionary,
+					 DecompressionState *decompressionState, StringInfo outputBuffer)
+{
 	int32 decompressedByteCount = -1;
 	char *decompressedData = NULL;
-        uint32 decompressedDataSize = CSTORE_COMPRESS_RAWSIZE(buffer->data);
+	uint32 decompressedDataSize = CSTORE_COMPRESS_RAWSIZE(buffer->data);
 	uint32 compressedDataSize = VARSIZE(buffer->data) - CSTORE_COMPRESS_HDRSZ;
 
-	Assert(compressionType == COMPRESSION_NONE || compressionType == COMPRESSION_PG_LZ ||
-		compressionType == COMPRESSION_SNAPPY || compressionType == COMPRESSION_DEFLATE);
+	Assert(compressionType == COMPRESSION_PG_LZ || compressionType == COMPRESSION_SNAPPY ||
+		   compressionType == COMPRESSION_DEFLATE || compressionType == COMPRESSION_LZ4 ||
+		   compressionType == COMPRESSION_ZSTD);
 
-	if (compressionType == COMPRESSION_NONE)
-	{
-		/* in case of no compression, return buffer */
-		decompressedBuffer = buffer;
-	} else if (compressionType == COMPRESSION_PG_LZ)
+	/* decompressed data overwrites the whole buffer, so it doesn't need zeroing */
+	resetStringInfo(outputBuffer);
+	enlargeStringInfo(outputBuffer, decompressedDataSize);
+	decompressedData = outputBuffer->data;
+
+	if (compressionType == COMPRESSION_PG_LZ)
 	{
 		if (compressedDataSize + CSTORE_COMPRESS_HDRSZ != buffer->len)
 		{
@@ -202,8 +700,6 @@ DecompressBuffer(StringInfo buffer, CompressionType compressionType)
 									  compressedDataSize, buffer->len)));
 		}
 
-		decompressedData = palloc0(decompressedDataSize);
-
 #if PG_VERSION_NUM >= 90500
 
 #if PG_VERSION_NUM >= 120000
@@ -224,69 +720,279 @@ DecompressBuffer(StringInfo buffer, CompressionType compressionType)
 #else
 		pglz_decompress((PGLZ_Header *) buffer->data, decompressedData);
 #endif
-
-		decompressedBuffer = palloc0(sizeof(StringInfoData));
-		decompressedBuffer->data = decompressedData;
-		decompressedBuffer->len = decompressedDataSize;
-		decompressedBuffer->maxlen = decompressedDataSize;
-	} else if (compressionType == COMPRESSION_SNAPPY) 
+	}
+	else if (compressionType == COMPRESSION_SNAPPY)
 	{
-		decompressedData = palloc0(decompressedDataSize);
+		size_t snappyByteCount = decompressedDataSize;
 
-		if (snappy_uncompress(CSTORE_COMPRESS_RAWDATA(buffer->data), compressedDataSize, decompressedData, (size_t *)&decompressedByteCount) != SNAPPY_OK)
+		if (snappy_uncompress(CSTORE_COMPRESS_RAWDATA(buffer->data), compressedDataSize,
+							  decompressedData, &snappyByteCount) != SNAPPY_OK)
 		{
 			ereport(ERROR, (errmsg("snappy cannot decompress the buffer"),
 							errdetail("compressed data is corrupted")));
 		}
-		if (decompressedByteCount < 0)
+	}
+	else if (compressionType == COMPRESSION_DEFLATE)
+	{
+		z_stream *inflateStream = &decompressionState->inflateStream;
+
+		/* the inflate state is set up once, and reset between blocks */
+		if (!decompressionState->inflateStreamValid)
 		{
-			ereport(ERROR, (errmsg("snappy cannot decompress the buffer"),
-							errdetail("count less than zero")));
+			inflateStream->zalloc = Z_NULL;
+			inflateStream->zfree = Z_NULL;
+			inflateStream->opaque = Z_NULL;
+
+			if (inflateInit(inflateStream) != Z_OK)
+			{
+				ereport(ERROR, (errmsg("inflate cannot decompress the buffer"),
+								errdetail("unable to initialize inflate state")));
+			}
+
+			decompressionState->inflateStreamValid = true;
+		}
+		else if (inflateReset(inflateStream) != Z_OK)
+		{
+			ereport(ERROR, (errmsg("inflate cannot decompress the buffer"),
+							errdetail("unable to reset inflate state")));
 		}
 
-		decompressedBuffer = palloc0(sizeof(StringInfoData));
-		decompressedBuffer->data = decompressedData;
-		decompressedBuffer->len = decompressedDataSize;
-		decompressedBuffer->maxlen = decompressedDataSize;
+		/* set the streaming context */
+		inflateStream->avail_in = compressedDataSize;
+		inflateStream->next_in = (Bytef *) CSTORE_COMPRESS_RAWDATA(buffer->data);
+		inflateStream->avail_out = decompressedDataSize;
+		inflateStream->next_out = (Bytef *) decompressedData;
 
-	} else if (compressionType == COMPRESSION_DEFLATE) 
+		/* do a single pass inflate decompression */
+		if (inflate(inflateStream, Z_FINISH) != Z_STREAM_END)
+		{
+			ereport(ERROR, (errmsg("inflate cannot decompress the buffer"),
+							errdetail("data is corrupted")));
+		}
+	}
+	else if (compressionType == COMPRESSION_LZ4)
+	{
+		decompressedByteCount = LZ4_decompress_safe((char *) CSTORE_COMPRESS_RAWDATA(buffer->data),
+													decompressedData, compressedDataSize,
+													decompressedDataSize);
+		if (decompressedByteCount != (int32) decompressedDataSize)
+		{
+			ereport(ERROR, (errmsg("lz4 cannot decompress the buffer"),
+							errdetail("compressed data is corrupted")));
+		}
+	}
+	else if (compressionType == COMPRESSION_ZSTD)
 	{
-		z_stream strm;
+		size_t decompressResult = 0;
 
-		/* allocate deflate state */
-		strm.zalloc = Z_NULL;
-		strm.zfree = Z_NULL;
-		strm.opaque = Z_NULL;
+		if (decompressionState->zstdContext == NULL)
+		{
+			decompressionState->zstdContext = ZSTD_createDCtx();
+			if (decompressionState->zstdContext == NULL)
+			{
+				ereport(ERROR, (errmsg("zstd cannot decompress the buffer"),
+								errdetail("unable to create decompression context")));
+			}
+		}
 
-		if (inflateInit(&strm) != Z_OK)
+		if (compressionDictionary != NULL)
 		{
-                        ereport(ERROR, (errmsg("inflate cannot decompress the buffer"),
-                                                        errdetail("unable to initialize inflate state")));
+			decompressResult = ZSTD_decompress_usingDict(decompressionState->zstdContext,
+														 decompressedData,
+														 decompressedDataSize,
+														 (char *) CSTORE_COMPRESS_RAWDATA(buffer->data),
+														 compressedDataSize,
+														 compressionDictionary->data,
+														 compressionDictionary->len);
+		}
+		else
+		{
+			decompressResult = ZSTD_decompressDCtx(decompressionState->zstdContext,
+												   decompressedData, decompressedDataSize,
+												   (char *) CSTORE_COMPRESS_RAWDATA(buffer->data),
+												   compressedDataSize);
 		}
-	
-                decompressedData = palloc0(decompressedDataSize);
 
-		/* set the streaming context */
-		strm.avail_in = compressedDataSize;
-		strm.next_in = (Bytef *)CSTORE_COMPRESS_RAWDATA(buffer->data);
-		strm.avail_out = decompressedDataSize;
-		strm.next_out = (Bytef *)decompressedData;
+		if (ZSTD_isError(decompressResult) || decompressResult != decompressedDataSize)
+		{
+			ereport(ERROR, (errmsg("zstd cannot decompress the buffer"),
+							errdetail("compressed data is corrupted")));
+		}
+	}
 
-		/* do a single pass inflate decompression */
-		if (inflate(&strm, Z_FINISH) != Z_STREAM_END) 
+	outputBuffer->len = decompressedDataSize;
+	outputBuffer->data[outputBuffer->len] = '\0';
+}
+
+
+/*
+ * ChooseCompressionType compresses the given buffer with each compression type
+ * that auto compression considers, times decompressing the result, and returns
+ * the compression type that does best by the given objective. Compression types
+ * that don't make the buffer smaller are skipped, and if none does, the function
+ * returns COMPRESSION_NONE. The size objective doesn't time decompression, so
+ * its choice only depends on the data. The function uses outputBuffer as scratch space, so
+ * callers need to compress the buffer again with the returned type.
+ */
+CompressionType
+ChooseCompressionType(StringInfo inputBuffer, StringInfo outputBuffer,
+					  CompressionObjective objective, CompressionState *compressionState)
+{
+	CompressionType bestCompressionType = COMPRESSION_NONE;
+	double bestCost = 0.0;
+	int bestLength = inputBuffer->len;
+	bool haveBestCost = false;
+	double costTolerance = AUTO_COMPRESSION_COST_TOLERANCE;
+	uint32 compressionTypeCount = lengthof(AutoCompressionTypeArray);
+	uint32 compressionTypeIndex = 0;
+
+	/*
+	 * Without compression, reading a block only costs reading its bytes. Not
+	 * compressing always decodes fastest, so that objective only compares the
+	 * compression types that make the buffer smaller.
+	 */
+	if (objective == COMPRESSION_OBJECTIVE_SIZE)
+	{
+		bestCost = inputBuffer->len;
+		haveBestCost = true;
+		costTolerance = 0.0;
+	}
+	else if (objective == COMPRESSION_OBJECTIVE_BALANCED)
+	{
+		bestCost = inputBuffer->len * AUTO_COMPRESSION_READ_NANOSECONDS_PER_BYTE;
+		haveBestCost = true;
+	}
+
+	for (compressionTypeIndex = 0; compressionTypeIndex < compressionTypeCount;
+		 compressionTypeIndex++)
+	{
+		CompressionType compressionType = AutoCompressionTypeArray[compressionTypeIndex];
+		double cost = 0.0;
+		bool compressed = CompressBuffer(inputBuffer, outputBuffer, compressionType,
+										 DEFAULT_COMPRESSION_LEVEL, NULL,
+										 compressionState);
+		if (!compressed || outputBuffer->len >= inputBuffer->len)
 		{
-                        ereport(ERROR, (errmsg("inflate cannot decompress the buffer"),
-                                                        errdetail("data is corrupted")));
+			continue;
 		}
 
-		decompressedBuffer = palloc0(sizeof(StringInfoData));
-		decompressedBuffer->data = decompressedData;
-		decompressedBuffer->len = decompressedDataSize;
-		decompressedBuffer->maxlen = decompressedDataSize;
+		if (objective == COMPRESSION_OBJECTIVE_SIZE)
+		{
+			cost = outputBuffer->len;
+		}
+		else if (objective == COMPRESSION_OBJECTIVE_DECODE_SPEED)
+		{
+			cost = DecompressionNanoseconds(outputBuffer, compressionType);
+		}
+		else
+		{
+			cost = outputBuffer->len * AUTO_COMPRESSION_READ_NANOSECONDS_PER_BYTE +
+				   DecompressionNanoseconds(outputBuffer, compressionType);
+		}
 
-		/* closes the inflate stream */
-		(void)inflateEnd(&strm);
-	} 
+		/* near-equal costs are likely timing noise, so the smaller output wins */
+		if (!haveBestCost || cost < bestCost * (1.0 - costTolerance) ||
+			(cost <= bestCost * (1.0 + costTolerance) && outputBuffer->len < bestLength))
+		{
+			bestCompressionType = compressionType;
+			bestCost = cost;
+			bestLength = outputBuffer->len;
+			haveBestCost = true;
+		}
+	}
 
-	return decompressedBuffer;
+	return bestCompressionType;
+}
+
+
+/*
+ * DecompressionNanoseconds decompresses the given buffer a few times, and
+ * returns the average time a decompression took in nanoseconds.
+ */
+static double
+DecompressionNanoseconds(StringInfo compressedBuffer, CompressionType compressionType)
+{
+	instr_time startTime;
+	instr_time decompressionTime;
+	uint32 runIndex = 0;
+
+	INSTR_TIME_SET_CURRENT(startTime);
+
+	for (runIndex = 0; runIndex < AUTO_COMPRESSION_DECODE_RUN_COUNT; runIndex++)
+	{
+		StringInfo decompressedBuffer = DecompressBuffer(compressedBuffer,
+														 compressionType, NULL);
+
+		pfree(decompressedBuffer->data);
+		pfree(decompressedBuffer);
+	}
+
+	INSTR_TIME_SET_CURRENT(decompressionTime);
+	INSTR_TIME_SUBTRACT(decompressionTime, startTime);
+
+	return INSTR_TIME_GET_DOUBLE(decompressionTime) * 1.0e9 /
+		   AUTO_COMPRESSION_DECODE_RUN_COUNT;
+}
+
+
+/*
+ * TrainCompressionDictionary trains a compression dictionary on the given
+ * sample buffers, and returns it. The function returns NULL if the compression
+ * type doesn't use dictionaries, or if the samples are too few or too small to
+ * train one. Only zstd currently uses dictionaries.
+ */
+StringInfo
+TrainCompressionDictionary(StringInfo *sampleBufferArray, uint32 sampleCount,
+						   CompressionType compressionType)
+{
+	StringInfo compressionDictionary = NULL;
+	StringInfo sampleBuffer = NULL;
+	size_t *sampleSizeArray = NULL;
+	size_t dictionaryCapacity = 0;
+	size_t dictionarySize = 0;
+	uint32 sampleIndex = 0;
+
+	if (compressionType != COMPRESSION_ZSTD ||
+		sampleCount < ZSTD_DICTIONARY_MINIMUM_SAMPLE_COUNT)
+	{
+		return NULL;
+	}
+
+	/* the zstd trainer expects its samples one after another in a single buffer */
+	sampleBuffer = makeStringInfo();
+	sampleSizeArray = palloc0(sampleCount * sizeof(size_t));
+	for (sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++)
+	{
+		StringInfo sample = sampleBufferArray[sampleIndex];
+
+		appendBinaryStringInfo(sampleBuffer, sample->data, sample->len);
+		sampleSizeArray[sampleIndex] = sample->len;
+	}
+
+	dictionaryCapacity = Min(sampleBuffer->len / 8, ZSTD_DICTIONARY_MAXIMUM_SIZE);
+	if (dictionaryCapacity >= ZSTD_DICTIONARY_MINIMUM_SIZE)
+	{
+		compressionDictionary = makeStringInfo();
+		enlargeStringInfo(compressionDictionary, dictionaryCapacity);
+
+		dictionarySize = ZDICT_trainFromBuffer(compressionDictionary->data,
+											   dictionaryCapacity, sampleBuffer->data,
+											   sampleSizeArray, sampleCount);
+		if (ZDICT_isError(dictionarySize))
+		{
+			pfree(compressionDictionary->data);
+			pfree(compressionDictionary);
+			compressionDictionary = NULL;
+		}
+		else
+		{
+			compressionDictionary->len = dictionarySize;
+		}
+	}
+
+	pfree(sampleSizeArray);
+	pfree(sampleBuffer->data);
+	pfree(sampleBuffer);
+
+	return compressionDictionary;
 }
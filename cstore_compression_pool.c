@@ -0,0 +1,414 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_compression_pool.c
+ *
+ * This file contains function definitions for compressing column blocks in
+ * worker threads, so that the backend keeps parsing and serializing rows while
+ * earlier blocks are being compressed.
+ *
+ * Worker threads only ever call into the compression libraries through
+ * CompressData(). They don't allocate Postgres memory, report errors or handle
+ * signals; the backend allocates each job's output buffer up front, and blocks
+ * that fail to compress are simply stored uncompressed. Blocks that didn't
+ * compress because a worker couldn't set up its compression context are counted,
+ * and the backend reports them once it waits for the jobs. pglz keeps its state in
+ * static variables, so pglz blocks are always compressed by the backend.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "cstore_compression_pool.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+
+/* CompressionWorker is the state of a single worker thread. */
+typedef struct CompressionWorker
+{
+	CompressionPool *compressionPool;
+	CompressionState *compressionState;
+	pthread_t thread;
+
+} CompressionWorker;
+
+
+/*
+ * CompressionPool keeps a queue of compression jobs, and the worker threads
+ * that take jobs from it. The queue and the job counters are protected by the
+ * pool's mutex.
+ */
+struct CompressionPool
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t jobAvailable;
+	pthread_cond_t jobsFinished;
+	CompressionJob *jobQueueHead;
+	CompressionJob *jobQueueTail;
+	uint32 pendingJobCount;
+	uint32 contextFailureCount;
+	bool shutdown;
+
+	CompressionWorker *workerArray;
+	int workerCount;
+
+	/*
+	 * Jobs live in the memory context they were submitted in, so the pool
+	 * waits for them before that context is reset. The pool itself stops its
+	 * threads before its own memory context goes away, even on errors.
+	 */
+	MemoryContextCallback jobContextCallback;
+	bool watchingJobContext;
+	MemoryContextCallback poolContextCallback;
+	bool threadsRunning;
+};
+
+
+/* configuration parameter for the number of compression threads per data load */
+int CompressionWorkerCount = DEFAULT_COMPRESSION_WORKER_COUNT;
+
+
+/* local functions forward declarations */
+static void * CompressionWorkerMain(void *arg);
+static void WaitForPendingJobs(CompressionPool *compressionPool);
+#if PG_VERSION_NUM >= 90500
+static void WaitForCompressionJobsCallback(void *arg);
+static void DestroyCompressionPoolCallback(void *arg);
+#endif
+
+
+/*
+ * CompressionPoolSupported returns whether blocks of the given compression type
+ * can be compressed by worker threads.
+ */
+bool
+CompressionPoolSupported(CompressionType compressionType)
+{
+	return compressionType == COMPRESSION_SNAPPY ||
+		   compressionType == COMPRESSION_DEFLATE ||
+		   compressionType == COMPRESSION_LZ4 ||
+		   compressionType == COMPRESSION_ZSTD;
+}
+
+
+/*
+ * CreateCompressionPool starts the given number of compression worker threads
+ * in a pool that lives in the current memory context. The function returns NULL
+ * if no threads could be started, in which case callers compress blocks in the
+ * backend as usual.
+ */
+CompressionPool *
+CreateCompressionPool(int workerCount)
+{
+	CompressionPool *compressionPool = NULL;
+#if PG_VERSION_NUM >= 90500
+	sigset_t blockedSignals;
+	sigset_t previousSignals;
+	int workerIndex = 0;
+
+	compressionPool = palloc0(sizeof(CompressionPool));
+	pthread_mutex_init(&compressionPool->mutex, NULL);
+	pthread_cond_init(&compressionPool->jobAvailable, NULL);
+	pthread_cond_init(&compressionPool->jobsFinished, NULL);
+	compressionPool->workerArray = palloc0(workerCount * sizeof(CompressionWorker));
+
+	/*
+	 * Worker threads can't allocate memory, so we allocate their lz4 states here.
+	 * zlib and zstd allocate their contexts themselves.
+	 */
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		CompressionWorker *worker = &compressionPool->workerArray[workerIndex];
+		worker->compressionPool = compressionPool;
+		worker->compressionState = CreateCompressionState();
+
+		PrepareCompressionState(worker->compressionState, COMPRESSION_LZ4,
+								DEFAULT_COMPRESSION_LEVEL);
+		PrepareCompressionState(worker->compressionState, COMPRESSION_LZ4,
+								LZ4_COMPRESSION_LEVEL_MAXIMUM);
+	}
+
+	/* threads inherit our signal mask, and signals must only reach the backend */
+	sigfillset(&blockedSignals);
+	pthread_sigmask(SIG_SETMASK, &blockedSignals, &previousSignals);
+
+	for (workerIndex = 0; workerIndex < workerCount; workerIndex++)
+	{
+		CompressionWorker *worker = &compressionPool->workerArray[workerIndex];
+		int createResult = pthread_create(&worker->thread, NULL,
+										  CompressionWorkerMain, worker);
+		if (createResult != 0)
+		{
+			break;
+		}
+
+		compressionPool->workerCount++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &previousSignals, NULL);
+
+	if (compressionPool->workerCount == 0)
+	{
+		ereport(DEBUG1, (errmsg("could not start compression worker threads")));
+		return NULL;
+	}
+
+	/*
+	 * Callbacks run in the reverse order of their registration, so this one
+	 * stops the threads before the compression states above are released.
+	 */
+	compressionPool->threadsRunning = true;
+	compressionPool->poolContextCallback.func = DestroyCompressionPoolCallback;
+	compressionPool->poolContextCallback.arg = (void *) compressionPool;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext,
+									   &compressionPool->poolContextCallback);
+#else
+
+	/* we can't stop worker threads on errors without memory context callbacks */
+	(void) workerCount;
+#endif
+
+	return compressionPool;
+}
+
+
+/*
+ * SubmitCompressionJob queues the given buffer for compression by a worker
+ * thread, and returns the job. The job and its output buffer are allocated in
+ * the current memory context, and the input buffer must not change until
+ * WaitForCompressionJobs() returns.
+ */
+CompressionJob *
+SubmitCompressionJob(CompressionPool *compressionPool, StringInfo inputBuffer,
+					 CompressionType compressionType, int compressionLevel,
+					 StringInfo compressionDictionary)
+{
+	CompressionJob *compressionJob = palloc0(sizeof(CompressionJob));
+	uint64 maximumLength = CompressedLengthBound(compressionType, inputBuffer->len);
+
+	Assert(CompressionPoolSupported(compressionType));
+
+	compressionJob->inputBuffer = inputBuffer;
+	compressionJob->compressionType = compressionType;
+	compressionJob->compressionLevel = compressionLevel;
+	compressionJob->compressionDictionary = compressionDictionary;
+	compressionJob->outputBuffer = makeStringInfo();
+	enlargeStringInfo(compressionJob->outputBuffer, maximumLength);
+
+#if PG_VERSION_NUM >= 90500
+	if (!compressionPool->watchingJobContext)
+	{
+		compressionPool->jobContextCallback.func = WaitForCompressionJobsCallback;
+		compressionPool->jobContextCallback.arg = (void *) compressionPool;
+		MemoryContextRegisterResetCallback(CurrentMemoryContext,
+										   &compressionPool->jobContextCallback);
+		compressionPool->watchingJobContext = true;
+	}
+#endif
+
+	pthread_mutex_lock(&compressionPool->mutex);
+
+	if (compressionPool->jobQueueTail == NULL)
+	{
+		compressionPool->jobQueueHead = compressionJob;
+	}
+	else
+	{
+		compressionPool->jobQueueTail->nextJob = compressionJob;
+	}
+	compressionPool->jobQueueTail = compressionJob;
+	compressionPool->pendingJobCount++;
+
+	pthread_cond_signal(&compressionPool->jobAvailable);
+	pthread_mutex_unlock(&compressionPool->mutex);
+
+	return compressionJob;
+}
+
+
+/*
+ * WaitForCompressionJobs waits until all submitted jobs are finished, and warns
+ * if some of their blocks are stored uncompressed because worker threads
+ * couldn't set up a compression context.
+ */
+void
+WaitForCompressionJobs(CompressionPool *compressionPool)
+{
+	uint32 contextFailureCount = 0;
+
+	WaitForPendingJobs(compressionPool);
+
+	pthread_mutex_lock(&compressionPool->mutex);
+	contextFailureCount = compressionPool->contextFailureCount;
+	compressionPool->contextFailureCount = 0;
+	pthread_mutex_unlock(&compressionPool->mutex);
+
+	if (contextFailureCount > 0)
+	{
+		ereport(WARNING, (errmsg("could not set up compression context, storing "
+								 "%u blocks uncompressed", contextFailureCount)));
+	}
+}
+
+
+/*
+ * WaitForPendingJobs waits until all submitted jobs are finished. Unlike
+ * WaitForCompressionJobs(), it doesn't report anything, so it is safe to call
+ * while memory is being released after an error.
+ */
+static void
+WaitForPendingJobs(CompressionPool *compressionPool)
+{
+	pthread_mutex_lock(&compressionPool->mutex);
+
+	while (compressionPool->pendingJobCount > 0)
+	{
+		pthread_cond_wait(&compressionPool->jobsFinished, &compressionPool->mutex);
+	}
+
+	pthread_mutex_unlock(&compressionPool->mutex);
+}
+
+
+/*
+ * DestroyCompressionPool stops the pool's worker threads once they finish the
+ * jobs that are already queued. The pool can't be used afterwards.
+ */
+void
+DestroyCompressionPool(CompressionPool *compressionPool)
+{
+	int workerIndex = 0;
+
+	if (!compressionPool->threadsRunning)
+	{
+		return;
+	}
+
+	pthread_mutex_lock(&compressionPool->mutex);
+	compressionPool->shutdown = true;
+	pthread_cond_broadcast(&compressionPool->jobAvailable);
+	pthread_mutex_unlock(&compressionPool->mutex);
+
+	for (workerIndex = 0; workerIndex < compressionPool->workerCount; workerIndex++)
+	{
+		CompressionWorker *worker = &compressionPool->workerArray[workerIndex];
+
+		pthread_join(worker->thread, NULL);
+		ReleaseCompressionState(worker->compressionState);
+	}
+
+	compressionPool->threadsRunning = false;
+}
+
+
+/*
+ * CompressionWorkerMain is the main loop of worker threads. Each thread takes
+ * jobs from the queue and compresses them until the pool shuts down.
+ */
+static void *
+CompressionWorkerMain(void *arg)
+{
+	CompressionWorker *worker = (CompressionWorker *) arg;
+	CompressionPool *compressionPool = worker->compressionPool;
+
+	for (;;)
+	{
+		CompressionJob *compressionJob = NULL;
+		StringInfo inputBuffer = NULL;
+		StringInfo outputBuffer = NULL;
+		uint32 compressedLength = 0;
+		bool contextFailed = false;
+
+		pthread_mutex_lock(&compressionPool->mutex);
+
+		while (compressionPool->jobQueueHead == NULL && !compressionPool->shutdown)
+		{
+			pthread_cond_wait(&compressionPool->jobAvailable, &compressionPool->mutex);
+		}
+
+		if (compressionPool->jobQueueHead == NULL)
+		{
+			pthread_mutex_unlock(&compressionPool->mutex);
+			break;
+		}
+
+		compressionJob = compressionPool->jobQueueHead;
+		compressionPool->jobQueueHead = compressionJob->nextJob;
+		if (compressionPool->jobQueueHead == NULL)
+		{
+			compressionPool->jobQueueTail = NULL;
+		}
+
+		pthread_mutex_unlock(&compressionPool->mutex);
+
+		inputBuffer = compressionJob->inputBuffer;
+		outputBuffer = compressionJob->outputBuffer;
+		compressionJob->compressed = CompressData(inputBuffer->data, inputBuffer->len,
+												  outputBuffer->data,
+												  outputBuffer->maxlen - 1,
+												  compressionJob->compressionType,
+												  compressionJob->compressionLevel,
+												  compressionJob->compressionDictionary,
+												  worker->compressionState,
+												  &compressedLength);
+		if (compressionJob->compressed)
+		{
+			outputBuffer->len = compressedLength;
+			outputBuffer->data[outputBuffer->len] = '\0';
+		}
+		else
+		{
+			contextFailed = CompressionContextFailed(worker->compressionState);
+		}
+
+		pthread_mutex_lock(&compressionPool->mutex);
+
+		if (contextFailed)
+		{
+			compressionPool->contextFailureCount++;
+		}
+
+		compressionPool->pendingJobCount--;
+		if (compressionPool->pendingJobCount == 0)
+		{
+			pthread_cond_broadcast(&compressionPool->jobsFinished);
+		}
+
+		pthread_mutex_unlock(&compressionPool->mutex);
+	}
+
+	return NULL;
+}
+
+
+#if PG_VERSION_NUM >= 90500
+
+/*
+ * WaitForCompressionJobsCallback waits for running jobs before the memory they
+ * write into is reset, for example when a data load errors out.
+ */
+static void
+WaitForCompressionJobsCallback(void *arg)
+{
+	CompressionPool *compressionPool = (CompressionPool *) arg;
+
+	WaitForPendingJobs(compressionPool);
+	compressionPool->watchingJobContext = false;
+}
+
+
+/* DestroyCompressionPoolCallback stops worker threads when the pool goes away. */
+static void
+DestroyCompressionPoolCallback(void *arg)
+{
+	DestroyCompressionPool((CompressionPool *) arg);
+}
+
+#endif
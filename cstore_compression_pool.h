@@ -0,0 +1,64 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_compression_pool.h
+ *
+ * Type and function declarations for compressing column blocks in worker
+ * threads while data is being loaded.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSTORE_COMPRESSION_POOL_H
+#define CSTORE_COMPRESSION_POOL_H
+
+#include "cstore_fdw.h"
+
+
+/* Default and limit for the worker count configuration parameter */
+#define DEFAULT_COMPRESSION_WORKER_COUNT 0
+#define COMPRESSION_WORKER_COUNT_MAXIMUM 64
+
+
+/*
+ * CompressionJob describes a buffer to be compressed by a worker thread. The
+ * backend allocates the output buffer before submitting the job, since worker
+ * threads can't allocate Postgres memory. The result fields are only valid
+ * once WaitForCompressionJobs() returns.
+ */
+typedef struct CompressionJob
+{
+	/* set by the backend */
+	StringInfo inputBuffer;
+	CompressionType compressionType;
+	int compressionLevel;
+	StringInfo compressionDictionary;
+	StringInfo outputBuffer;
+
+	/* set by the worker thread */
+	bool compressed;
+
+	struct CompressionJob *nextJob;
+
+} CompressionJob;
+
+
+/* Configuration parameters */
+extern int CompressionWorkerCount;
+
+/* Function declarations for the compression pool */
+extern bool CompressionPoolSupported(CompressionType compressionType);
+extern CompressionPool * CreateCompressionPool(int workerCount);
+extern CompressionJob * SubmitCompressionJob(CompressionPool *compressionPool,
+											 StringInfo inputBuffer,
+											 CompressionType compressionType,
+											 int compressionLevel,
+											 StringInfo compressionDictionary);
+extern void WaitForCompressionJobs(CompressionPool *compressionPool);
+extern void DestroyCompressionPool(CompressionPool *compressionPool);
+
+
+#endif   /* CSTORE_COMPRESSION_POOL_H */
@@ -0,0 +1,1109 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_encoding.c
+ *
+ * This file contains the functions that encode serialized column values
+ * before they are compressed, and decode them back into datums.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "cstore_fdw.h"
+
+#include "access/tupmacs.h"
+
+
+/*
+ * A dictionary encoded value buffer starts with a header holding the number of
+ * dictionary entries and the length of the entry section. The distinct values
+ * follow, serialized and aligned like plain values, and then one code for each
+ * value in the block. Codes take one byte if the dictionary has at most 256
+ * entries, and two little-endian bytes otherwise. The header's size keeps the
+ * entries aligned relative to the start of the buffer.
+ */
+typedef struct DictionaryHeader
+{
+	uint32 entryCount;
+	uint32 entrySectionLength;
+
+} DictionaryHeader;
+
+#define DICTIONARY_HEADER_SIZE 8
+#define DICTIONARY_MINIMUM_VALUE_COUNT 16
+#define DICTIONARY_MAXIMUM_ENTRY_COUNT 65536
+#define DICTIONARY_SMALL_ENTRY_COUNT 256
+
+
+/*
+ * A run-length encoded value buffer starts with a header holding the number of
+ * runs and the offset of the value section. The header is followed by the
+ * length of each run, and the value section holds the value of each run,
+ * serialized and aligned like plain values. Runs only count existing values,
+ * since nulls are recorded in the exists stream.
+ */
+typedef struct RunLengthHeader
+{
+	uint32 runCount;
+	uint32 valueSectionOffset;
+
+} RunLengthHeader;
+
+#define RUN_LENGTH_HEADER_SIZE 8
+
+
+/*
+ * A bit-packed value buffer starts with a header, followed by 64-bit words that
+ * hold the packed offsets of the values from their reference. Frame of
+ * reference encoding packs each value's offset from the block's minimum value.
+ * Delta encoding stores the first value as the reference, and packs each later
+ * value's difference from its predecessor, minus the smallest such difference.
+ * Offsets are computed modulo 2^64, so any by-value datum round trips, and the
+ * header's size keeps the words maximally aligned.
+ */
+typedef struct BitPackedHeader
+{
+	int64 referenceValue;
+	int64 deltaReference;
+	uint32 bitWidth;
+	uint32 packedValueCount;
+
+} BitPackedHeader;
+
+#define BIT_PACKED_HEADER_SIZE 24
+#define BIT_PACKED_WORD_BITS 64
+
+
+/*
+ * BitPackingPlan describes how a block's integer values would be bit-packed,
+ * and is filled in when measuring the encoded length of the block.
+ */
+typedef struct BitPackingPlan
+{
+	EncodingType encodingType;
+	int64 referenceValue;
+	int64 deltaReference;
+	uint32 bitWidth;
+	uint32 packedValueCount;
+
+} BitPackingPlan;
+
+
+/*
+ * SerializedValue points to a serialized value in a plain value buffer. The
+ * encoders compare these by their bytes.
+ */
+typedef struct SerializedValue
+{
+	char *data;
+	uint32 length;
+	uint32 valueIndex;
+
+} SerializedValue;
+
+
+/* local functions forward declarations */
+static SerializedValue * ParseValueBuffer(StringInfo inputBuffer, uint32 valueCount,
+										  int datumTypeLength, char datumTypeAlign);
+static bool DictionaryEncodeBuffer(SerializedValue *valueArray, uint32 valueCount,
+								   char datumTypeAlign, uint64 maximumLength,
+								   StringInfo outputBuffer);
+static uint64 RunLengthEncodedLength(SerializedValue *valueArray, uint32 valueCount,
+									 char datumTypeAlign, uint32 *runCount);
+static void RunLengthEncodeBuffer(SerializedValue *valueArray, uint32 valueCount,
+								  char datumTypeAlign, uint32 runCount,
+								  StringInfo outputBuffer);
+static int CompareSerializedValues(const void *leftElement, const void *rightElement);
+static bool SerializedValuesEqual(SerializedValue *leftValue,
+								  SerializedValue *rightValue);
+static void AppendAlignedValue(StringInfo outputBuffer, SerializedValue *value,
+							   char datumTypeAlign);
+static bool BitPackingSupported(bool datumTypeByValue, int datumTypeLength);
+static int64 * IntegerValueArray(SerializedValue *valueArray, uint32 valueCount,
+								 int datumTypeLength);
+static uint64 BitPackedEncodedLength(int64 *integerArray, uint32 valueCount,
+									 BitPackingPlan *bitPackingPlan);
+static void BitPackEncodeBuffer(int64 *integerArray, uint32 valueCount,
+								BitPackingPlan *bitPackingPlan, StringInfo outputBuffer);
+static uint32 BitWidth(uint64 value);
+static uint64 BitPackedLength(uint32 packedValueCount, uint32 bitWidth);
+static void UnpackBits(const uint64 *wordArray, uint32 bitWidth, uint32 valueCount,
+					   uint64 *outputArray);
+static Datum IntegerGetDatum(int64 value, int datumTypeLength);
+static void DictionaryDecodeDatumArray(StringInfo datumBuffer, bool *existsArray,
+									   uint32 datumCount, bool datumTypeByValue,
+									   int datumTypeLength, char datumTypeAlign,
+									   Datum *datumArray);
+static void RunLengthDecodeDatumArray(StringInfo datumBuffer, bool *existsArray,
+									  uint32 datumCount, bool datumTypeByValue,
+									  int datumTypeLength, char datumTypeAlign,
+									  Datum *datumArray);
+static void BitPackedDecodeDatumArray(StringInfo datumBuffer, EncodingType encodingType,
+									  bool *existsArray, uint32 datumCount,
+									  int datumTypeLength, Datum *datumArray);
+
+
+/*
+ * EncodeValueBuffer picks an encoding for the given buffer of serialized values,
+ * and encodes the values into outputBuffer. The function returns the encoding
+ * it used, and outputBuffer is only valid if that isn't ENCODING_NONE. We pick
+ * the encoding that makes the buffer smallest, if any makes it smaller at all,
+ * among the encodings that the column's encoding option allows.
+ */
+EncodingType
+EncodeValueBuffer(StringInfo inputBuffer, StringInfo outputBuffer, uint32 valueCount,
+				  bool datumTypeByValue, int datumTypeLength, char datumTypeAlign,
+				  EncodingOption encodingOption)
+{
+	EncodingType encodingType = ENCODING_NONE;
+	SerializedValue *valueArray = NULL;
+	uint64 runLengthEncodedLength = 0;
+	uint64 maximumLength = inputBuffer->len;
+	uint32 runCount = 0;
+	bool autoEncoding = (encodingOption == ENCODING_OPTION_AUTO);
+	bool tryRunLength = autoEncoding || encodingOption == ENCODING_OPTION_RUN_LENGTH;
+	bool tryDictionary = false;
+	bool tryBitPacking = false;
+
+	if (valueCount == 0 || encodingOption == ENCODING_OPTION_NONE)
+	{
+		return ENCODING_NONE;
+	}
+
+	/*
+	 * Dictionaries pay off for variable length values that repeat, so we only
+	 * try them for other types if the column asks for them.
+	 */
+	if (encodingOption == ENCODING_OPTION_DICTIONARY)
+	{
+		tryDictionary = true;
+	}
+	else if (autoEncoding && datumTypeLength < 0)
+	{
+		tryDictionary = true;
+	}
+
+	/* integer-like values often differ only in their low bits */
+	if (autoEncoding || encodingOption == ENCODING_OPTION_BIT_PACKED)
+	{
+		tryBitPacking = BitPackingSupported(datumTypeByValue, datumTypeLength);
+	}
+
+	valueArray = ParseValueBuffer(inputBuffer, valueCount, datumTypeLength,
+								  datumTypeAlign);
+
+	/* runs of equal values are cheap to find, so we measure them first */
+	if (tryRunLength)
+	{
+		runLengthEncodedLength = RunLengthEncodedLength(valueArray, valueCount,
+														datumTypeAlign, &runCount);
+		maximumLength = Min(runLengthEncodedLength, maximumLength);
+	}
+
+	if (tryDictionary && valueCount >= DICTIONARY_MINIMUM_VALUE_COUNT)
+	{
+		bool encoded = DictionaryEncodeBuffer(valueArray, valueCount, datumTypeAlign,
+											  maximumLength, outputBuffer);
+		if (encoded)
+		{
+			encodingType = ENCODING_DICTIONARY;
+		}
+	}
+	else if (tryBitPacking)
+	{
+		BitPackingPlan bitPackingPlan;
+		int64 *integerArray = IntegerValueArray(valueArray, valueCount,
+												datumTypeLength);
+		uint64 bitPackedLength = BitPackedEncodedLength(integerArray, valueCount,
+														&bitPackingPlan);
+		if (bitPackedLength < maximumLength)
+		{
+			BitPackEncodeBuffer(integerArray, valueCount, &bitPackingPlan,
+								outputBuffer);
+			encodingType = bitPackingPlan.encodingType;
+		}
+
+		pfree(integerArray);
+	}
+
+	if (encodingType == ENCODING_NONE && tryRunLength &&
+		runLengthEncodedLength < (uint64) inputBuffer->len)
+	{
+		RunLengthEncodeBuffer(valueArray, valueCount, datumTypeAlign, runCount,
+							  outputBuffer);
+		encodingType = ENCODING_RUN_LENGTH;
+	}
+
+	pfree(valueArray);
+
+	return encodingType;
+}
+
+
+/*
+ * DecodeDatumArray decodes the given encoded value buffer into datumArray,
+ * setting the entries of rows whose values exist. Datums of by-reference types
+ * point into datumBuffer, so it needs to live as long as the datums.
+ */
+void
+DecodeDatumArray(StringInfo datumBuffer, EncodingType encodingType, bool *existsArray,
+				 uint32 datumCount, bool datumTypeByValue, int datumTypeLength,
+				 char datumTypeAlign, Datum *datumArray)
+{
+	if (encodingType == ENCODING_DICTIONARY)
+	{
+		DictionaryDecodeDatumArray(datumBuffer, existsArray, datumCount,
+								   datumTypeByValue, datumTypeLength, datumTypeAlign,
+								   datumArray);
+	}
+	else if (encodingType == ENCODING_RUN_LENGTH)
+	{
+		RunLengthDecodeDatumArray(datumBuffer, existsArray, datumCount,
+								  datumTypeByValue, datumTypeLength, datumTypeAlign,
+								  datumArray);
+	}
+	else if (encodingType == ENCODING_FRAME_OF_REFERENCE ||
+			 encodingType == ENCODING_DELTA)
+	{
+		if (!BitPackingSupported(datumTypeByValue, datumTypeLength))
+		{
+			ereport(ERROR, (errmsg("bit-packed values of unsupported type")));
+		}
+
+		BitPackedDecodeDatumArray(datumBuffer, encodingType, existsArray, datumCount,
+								  datumTypeLength, datumArray);
+	}
+	else
+	{
+		ereport(ERROR, (errmsg("unknown value encoding type %d", (int) encodingType)));
+	}
+}
+
+
+/*
+ * ParseValueBuffer finds the given number of serialized values in a plain value
+ * buffer, like DeserializeDatumArray() does, and returns an array pointing to
+ * each of them.
+ */
+static SerializedValue *
+ParseValueBuffer(StringInfo inputBuffer, uint32 valueCount, int datumTypeLength,
+				 char datumTypeAlign)
+{
+	SerializedValue *valueArray = palloc(valueCount * sizeof(SerializedValue));
+	uint32 valueIndex = 0;
+	uint32 currentOffset = 0;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		char *currentDataPointer = inputBuffer->data + currentOffset;
+		uint32 nextOffset = att_addlength_pointer(currentOffset, datumTypeLength,
+												  currentDataPointer);
+
+		valueArray[valueIndex].data = currentDataPointer;
+		valueArray[valueIndex].length = nextOffset - currentOffset;
+		valueArray[valueIndex].valueIndex = valueIndex;
+
+		currentOffset = att_align_nominal(nextOffset, datumTypeAlign);
+		Assert(currentOffset <= inputBuffer->len);
+	}
+
+	return valueArray;
+}
+
+
+/*
+ * DictionaryEncodeBuffer builds a dictionary of the distinct values in the given
+ * value array, and writes the dictionary encoded buffer into outputBuffer. The
+ * function returns false without encoding if the values have too many distinct
+ * values for the encoded buffer to be shorter than maximumLength.
+ */
+static bool
+DictionaryEncodeBuffer(SerializedValue *valueArray, uint32 valueCount,
+					   char datumTypeAlign, uint64 maximumLength,
+					   StringInfo outputBuffer)
+{
+	SerializedValue **sortedValueArray = palloc(valueCount * sizeof(SerializedValue *));
+	uint16 *codeArray = palloc(valueCount * sizeof(uint16));
+	DictionaryHeader dictionaryHeader;
+	uint32 valueIndex = 0;
+	uint32 entryCount = 0;
+	uint32 codeWidth = 0;
+	uint64 entrySectionLength = 0;
+	uint64 encodedLength = 0;
+	bool encoded = false;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		sortedValueArray[valueIndex] = &valueArray[valueIndex];
+	}
+
+	pg_qsort(sortedValueArray, valueCount, sizeof(SerializedValue *),
+			 CompareSerializedValues);
+
+	/* assign codes in sorted order, and find the size of the entry section */
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		SerializedValue *value = sortedValueArray[valueIndex];
+
+		if (valueIndex == 0 ||
+			!SerializedValuesEqual(sortedValueArray[valueIndex - 1], value))
+		{
+			if (entryCount == DICTIONARY_MAXIMUM_ENTRY_COUNT)
+			{
+				break;
+			}
+
+			entrySectionLength = att_align_nominal(DICTIONARY_HEADER_SIZE +
+												   entrySectionLength,
+												   datumTypeAlign) -
+								 DICTIONARY_HEADER_SIZE;
+			entrySectionLength += value->length;
+			entryCount++;
+		}
+
+		codeArray[value->valueIndex] = (uint16) (entryCount - 1);
+	}
+
+	codeWidth = (entryCount <= DICTIONARY_SMALL_ENTRY_COUNT) ? 1 : 2;
+	entrySectionLength = att_align_nominal(DICTIONARY_HEADER_SIZE + entrySectionLength,
+										   datumTypeAlign) - DICTIONARY_HEADER_SIZE;
+	encodedLength = DICTIONARY_HEADER_SIZE + entrySectionLength +
+					((uint64) valueCount * codeWidth);
+
+	if (valueIndex == valueCount && encodedLength < maximumLength)
+	{
+		uint32 entryIndex = 0;
+
+		resetStringInfo(outputBuffer);
+		enlargeStringInfo(outputBuffer, encodedLength);
+
+		dictionaryHeader.entryCount = entryCount;
+		dictionaryHeader.entrySectionLength = (uint32) entrySectionLength;
+		appendBinaryStringInfo(outputBuffer, (char *) &dictionaryHeader,
+							   DICTIONARY_HEADER_SIZE);
+
+		/* write the first value of each code as its dictionary entry */
+		for (valueIndex = 0; valueIndex < valueCount && entryIndex < entryCount;
+			 valueIndex++)
+		{
+			SerializedValue *value = sortedValueArray[valueIndex];
+
+			if (codeArray[value->valueIndex] != entryIndex)
+			{
+				continue;
+			}
+
+			AppendAlignedValue(outputBuffer, value, datumTypeAlign);
+			entryIndex++;
+		}
+
+		while (outputBuffer->len < DICTIONARY_HEADER_SIZE + entrySectionLength)
+		{
+			appendStringInfoCharMacro(outputBuffer, '\0');
+		}
+
+		for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+		{
+			uint16 code = codeArray[valueIndex];
+
+			appendStringInfoCharMacro(outputBuffer, (char) (code & 0xFF));
+			if (codeWidth == 2)
+			{
+				appendStringInfoCharMacro(outputBuffer, (char) (code >> 8));
+			}
+		}
+
+		Assert(outputBuffer->len == encodedLength);
+		encoded = true;
+	}
+
+	pfree(codeArray);
+	pfree(sortedValueArray);
+
+	return encoded;
+}
+
+
+/*
+ * RunLengthEncodedLength counts the runs of equal consecutive values in the
+ * given value array, and returns the length of their run-length encoding.
+ */
+static uint64
+RunLengthEncodedLength(SerializedValue *valueArray, uint32 valueCount,
+					   char datumTypeAlign, uint32 *runCount)
+{
+	uint64 valueSectionLength = 0;
+	uint64 valueSectionOffset = 0;
+	uint32 valueIndex = 0;
+
+	(*runCount) = 0;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (valueIndex > 0 &&
+			SerializedValuesEqual(&valueArray[valueIndex - 1], &valueArray[valueIndex]))
+		{
+			continue;
+		}
+
+		valueSectionLength = att_align_nominal(valueSectionLength, datumTypeAlign);
+		valueSectionLength += valueArray[valueIndex].length;
+		(*runCount)++;
+	}
+
+	valueSectionOffset = RUN_LENGTH_HEADER_SIZE + ((uint64) (*runCount) * sizeof(uint32));
+	valueSectionOffset = att_align_nominal(valueSectionOffset, 'd');
+	valueSectionLength = att_align_nominal(valueSectionLength, datumTypeAlign);
+
+	return valueSectionOffset + valueSectionLength;
+}
+
+
+/*
+ * RunLengthEncodeBuffer writes the run-length encoding of the given value array
+ * into outputBuffer. The value section starts at a maximally aligned offset, so
+ * values are aligned relative to the start of the buffer.
+ */
+static void
+RunLengthEncodeBuffer(SerializedValue *valueArray, uint32 valueCount,
+					  char datumTypeAlign, uint32 runCount, StringInfo outputBuffer)
+{
+	RunLengthHeader runLengthHeader;
+	uint32 valueSectionOffset = 0;
+	uint32 valueIndex = 0;
+	uint32 runLength = 0;
+
+	valueSectionOffset = RUN_LENGTH_HEADER_SIZE + (runCount * sizeof(uint32));
+	valueSectionOffset = att_align_nominal(valueSectionOffset, 'd');
+
+	resetStringInfo(outputBuffer);
+
+	runLengthHeader.runCount = runCount;
+	runLengthHeader.valueSectionOffset = valueSectionOffset;
+	appendBinaryStringInfo(outputBuffer, (char *) &runLengthHeader,
+						   RUN_LENGTH_HEADER_SIZE);
+
+	/* write the length of each run */
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		runLength++;
+
+		if (valueIndex + 1 == valueCount ||
+			!SerializedValuesEqual(&valueArray[valueIndex], &valueArray[valueIndex + 1]))
+		{
+			appendBinaryStringInfo(outputBuffer, (char *) &runLength, sizeof(uint32));
+			runLength = 0;
+		}
+	}
+
+	while (outputBuffer->len < valueSectionOffset)
+	{
+		appendStringInfoCharMacro(outputBuffer, '\0');
+	}
+
+	/* then write the value of each run */
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		if (valueIndex > 0 &&
+			SerializedValuesEqual(&valueArray[valueIndex - 1], &valueArray[valueIndex]))
+		{
+			continue;
+		}
+
+		AppendAlignedValue(outputBuffer, &valueArray[valueIndex], datumTypeAlign);
+	}
+
+	while (outputBuffer->len < att_align_nominal(outputBuffer->len, datumTypeAlign))
+	{
+		appendStringInfoCharMacro(outputBuffer, '\0');
+	}
+}
+
+
+/* CompareSerializedValues orders serialized values by length, then by bytes. */
+static int
+CompareSerializedValues(const void *leftElement, const void *rightElement)
+{
+	const SerializedValue *leftValue = *((const SerializedValue **) leftElement);
+	const SerializedValue *rightValue = *((const SerializedValue **) rightElement);
+
+	if (leftValue->length != rightValue->length)
+	{
+		return (leftValue->length < rightValue->length) ? -1 : 1;
+	}
+
+	return memcmp(leftValue->data, rightValue->data, leftValue->length);
+}
+
+
+/* SerializedValuesEqual returns true if the given values have the same bytes. */
+static bool
+SerializedValuesEqual(SerializedValue *leftValue, SerializedValue *rightValue)
+{
+	return leftValue->length == rightValue->length &&
+		   memcmp(leftValue->data, rightValue->data, leftValue->length) == 0;
+}
+
+
+/*
+ * AppendAlignedValue pads outputBuffer to the given alignment, and appends the
+ * serialized value.
+ */
+static void
+AppendAlignedValue(StringInfo outputBuffer, SerializedValue *value, char datumTypeAlign)
+{
+	uint32 alignedLength = att_align_nominal(outputBuffer->len, datumTypeAlign);
+
+	while (outputBuffer->len < alignedLength)
+	{
+		appendStringInfoCharMacro(outputBuffer, '\0');
+	}
+
+	appendBinaryStringInfo(outputBuffer, value->data, value->length);
+}
+
+
+/*
+ * BitPackingSupported returns true if values of the given type are fixed width
+ * integers that fit in a datum, such as integers, dates, times and timestamps.
+ */
+static bool
+BitPackingSupported(bool datumTypeByValue, int datumTypeLength)
+{
+	if (!datumTypeByValue)
+	{
+		return false;
+	}
+
+	return datumTypeLength == sizeof(int16) || datumTypeLength == sizeof(int32) ||
+		   datumTypeLength == sizeof(int64);
+}
+
+
+/*
+ * IntegerValueArray reads the given serialized by-value datums as sign extended
+ * integers.
+ */
+static int64 *
+IntegerValueArray(SerializedValue *valueArray, uint32 valueCount, int datumTypeLength)
+{
+	int64 *integerArray = palloc(valueCount * sizeof(int64));
+	uint32 valueIndex = 0;
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		Datum value = fetch_att(valueArray[valueIndex].data, true, datumTypeLength);
+
+		if (datumTypeLength == sizeof(int16))
+		{
+			integerArray[valueIndex] = DatumGetInt16(value);
+		}
+		else if (datumTypeLength == sizeof(int32))
+		{
+			integerArray[valueIndex] = DatumGetInt32(value);
+		}
+		else
+		{
+			integerArray[valueIndex] = DatumGetInt64(value);
+		}
+	}
+
+	return integerArray;
+}
+
+
+/*
+ * BitPackedEncodedLength measures both the frame of reference and the delta
+ * encodings of the given integers, fills in the plan for the shorter one, and
+ * returns its length. Sorted columns such as surrogate keys and load timestamps
+ * have small, steady deltas, while other columns usually pack better around
+ * their minimum.
+ */
+static uint64
+BitPackedEncodedLength(int64 *integerArray, uint32 valueCount,
+					   BitPackingPlan *bitPackingPlan)
+{
+	int64 minimumValue = integerArray[0];
+	int64 minimumDelta = 0;
+	uint64 maximumOffset = 0;
+	uint64 maximumDeltaOffset = 0;
+	uint32 valueIndex = 0;
+	uint32 frameBitWidth = 0;
+	uint32 deltaBitWidth = 0;
+	uint64 frameLength = 0;
+	uint64 deltaLength = 0;
+
+	for (valueIndex = 1; valueIndex < valueCount; valueIndex++)
+	{
+		int64 delta = (int64) ((uint64) integerArray[valueIndex] -
+							   (uint64) integerArray[valueIndex - 1]);
+
+		minimumValue = Min(minimumValue, integerArray[valueIndex]);
+		if (valueIndex == 1 || delta < minimumDelta)
+		{
+			minimumDelta = delta;
+		}
+	}
+
+	for (valueIndex = 0; valueIndex < valueCount; valueIndex++)
+	{
+		uint64 offset = (uint64) integerArray[valueIndex] - (uint64) minimumValue;
+		maximumOffset = Max(maximumOffset, offset);
+
+		if (valueIndex > 0)
+		{
+			uint64 delta = (uint64) integerArray[valueIndex] -
+						   (uint64) integerArray[valueIndex - 1];
+			uint64 deltaOffset = delta - (uint64) minimumDelta;
+			maximumDeltaOffset = Max(maximumDeltaOffset, deltaOffset);
+		}
+	}
+
+	frameBitWidth = BitWidth(maximumOffset);
+	deltaBitWidth = BitWidth(maximumDeltaOffset);
+	frameLength = BIT_PACKED_HEADER_SIZE + BitPackedLength(valueCount, frameBitWidth);
+	deltaLength = BIT_PACKED_HEADER_SIZE + BitPackedLength(valueCount - 1,
+														   deltaBitWidth);
+
+	if (deltaLength < frameLength)
+	{
+		bitPackingPlan->encodingType = ENCODING_DELTA;
+		bitPackingPlan->referenceValue = integerArray[0];
+		bitPackingPlan->deltaReference = minimumDelta;
+		bitPackingPlan->bitWidth = deltaBitWidth;
+		bitPackingPlan->packedValueCount = valueCount - 1;
+
+		return deltaLength;
+	}
+	else
+	{
+		bitPackingPlan->encodingType = ENCODING_FRAME_OF_REFERENCE;
+		bitPackingPlan->referenceValue = minimumValue;
+		bitPackingPlan->deltaReference = 0;
+		bitPackingPlan->bitWidth = frameBitWidth;
+		bitPackingPlan->packedValueCount = valueCount;
+
+		return frameLength;
+	}
+}
+
+
+/*
+ * BitPackEncodeBuffer writes the given integers into outputBuffer following the
+ * bit packing plan. Each offset is packed into the low bits first, and offsets
+ * may span two words.
+ */
+static void
+BitPackEncodeBuffer(int64 *integerArray, uint32 valueCount,
+					BitPackingPlan *bitPackingPlan, StringInfo outputBuffer)
+{
+	BitPackedHeader bitPackedHeader;
+	uint32 bitWidth = bitPackingPlan->bitWidth;
+	uint32 packedValueCount = bitPackingPlan->packedValueCount;
+	uint64 packedLength = BitPackedLength(packedValueCount, bitWidth);
+	uint64 *wordArray = NULL;
+	uint64 bitOffset = 0;
+	uint32 valueIndex = 0;
+
+	resetStringInfo(outputBuffer);
+	enlargeStringInfo(outputBuffer, BIT_PACKED_HEADER_SIZE + packedLength);
+
+	bitPackedHeader.referenceValue = bitPackingPlan->referenceValue;
+	bitPackedHeader.deltaReference = bitPackingPlan->deltaReference;
+	bitPackedHeader.bitWidth = bitWidth;
+	bitPackedHeader.packedValueCount = packedValueCount;
+	appendBinaryStringInfo(outputBuffer, (char *) &bitPackedHeader,
+						   BIT_PACKED_HEADER_SIZE);
+
+	wordArray = palloc0(packedLength + sizeof(uint64));
+
+	for (valueIndex = 0; valueIndex < packedValueCount && bitWidth > 0; valueIndex++)
+	{
+		uint64 offset = 0;
+		uint32 wordIndex = (uint32) (bitOffset / BIT_PACKED_WORD_BITS);
+		uint32 bitShift = (uint32) (bitOffset % BIT_PACKED_WORD_BITS);
+
+		if (bitPackingPlan->encodingType == ENCODING_DELTA)
+		{
+			uint64 delta = (uint64) integerArray[valueIndex + 1] -
+						   (uint64) integerArray[valueIndex];
+			offset = delta - (uint64) bitPackingPlan->deltaReference;
+		}
+		else
+		{
+			offset = (uint64) integerArray[valueIndex] -
+					 (uint64) bitPackingPlan->referenceValue;
+		}
+
+		wordArray[wordIndex] |= offset << bitShift;
+		if (bitShift + bitWidth > BIT_PACKED_WORD_BITS)
+		{
+			wordArray[wordIndex + 1] |= offset >> (BIT_PACKED_WORD_BITS - bitShift);
+		}
+
+		bitOffset += bitWidth;
+	}
+
+	appendBinaryStringInfo(outputBuffer, (char *) wordArray, packedLength);
+	pfree(wordArray);
+}
+
+
+/* BitWidth returns the number of bits needed to represent the given value. */
+static uint32
+BitWidth(uint64 value)
+{
+	uint32 bitWidth = 0;
+
+	while (value != 0)
+	{
+		bitWidth++;
+		value >>= 1;
+	}
+
+	return bitWidth;
+}
+
+
+/* BitPackedLength returns the length of the words that hold the packed values. */
+static uint64
+BitPackedLength(uint32 packedValueCount, uint32 bitWidth)
+{
+	uint64 bitCount = (uint64) packedValueCount * bitWidth;
+	uint64 wordCount = (bitCount + BIT_PACKED_WORD_BITS - 1) / BIT_PACKED_WORD_BITS;
+
+	return wordCount * sizeof(uint64);
+}
+
+
+/*
+ * UnpackBits unpacks the given number of bitWidth wide offsets from wordArray.
+ * If the bit width divides the word size no offset spans two words, and we use
+ * a branch free loop over each word that compilers can unroll and vectorize.
+ */
+static void
+UnpackBits(const uint64 *wordArray, uint32 bitWidth, uint32 valueCount,
+		   uint64 *outputArray)
+{
+	uint64 mask = 0;
+	uint64 bitOffset = 0;
+	uint32 valueIndex = 0;
+
+	if (bitWidth == 0)
+	{
+		memset(outputArray, 0, valueCount * sizeof(uint64));
+		return;
+	}
+
+	mask = (bitWidth == BIT_PACKED_WORD_BITS) ? ~UINT64CONST(0) :
+		   (UINT64CONST(1) << bitWidth) - 1;
+
+	if (BIT_PACKED_WORD_BITS % bitWidth == 0)
+	{
+		uint32 valuesPerWord = BIT_PACKED_WORD_BITS / bitWidth;
+		uint32 fullWordCount = valueCount / valuesPerWord;
+		uint32 wordIndex = 0;
+
+		for (wordIndex = 0; wordIndex < fullWordCount; wordIndex++)
+		{
+			uint64 word = wordArray[wordIndex];
+			uint64 *output = outputArray + (wordIndex * valuesPerWord);
+			uint32 slotIndex = 0;
+
+			for (slotIndex = 0; slotIndex < valuesPerWord; slotIndex++)
+			{
+				output[slotIndex] = (word >> (slotIndex * bitWidth)) & mask;
+			}
+		}
+
+		valueIndex = fullWordCount * valuesPerWord;
+		bitOffset = (uint64) valueIndex * bitWidth;
+	}
+
+	for (; valueIndex < valueCount; valueIndex++)
+	{
+		uint32 wordIndex = (uint32) (bitOffset / BIT_PACKED_WORD_BITS);
+		uint32 bitShift = (uint32) (bitOffset % BIT_PACKED_WORD_BITS);
+		uint64 offset = wordArray[wordIndex] >> bitShift;
+
+		if (bitShift + bitWidth > BIT_PACKED_WORD_BITS)
+		{
+			offset |= wordArray[wordIndex + 1] << (BIT_PACKED_WORD_BITS - bitShift);
+		}
+
+		outputArray[valueIndex] = offset & mask;
+		bitOffset += bitWidth;
+	}
+}
+
+
+/* IntegerGetDatum converts the given integer back to a datum of the given width. */
+static Datum
+IntegerGetDatum(int64 value, int datumTypeLength)
+{
+	if (datumTypeLength == sizeof(int16))
+	{
+		return Int16GetDatum((int16) value);
+	}
+	else if (datumTypeLength == sizeof(int32))
+	{
+		return Int32GetDatum((int32) value);
+	}
+	else
+	{
+		return Int64GetDatum(value);
+	}
+}
+
+
+/*
+ * DictionaryDecodeDatumArray reads the dictionary entries in the given buffer
+ * once, and then sets the datum of each existing value to the entry of its
+ * code. Rows with the same value therefore share a single datum.
+ */
+static void
+DictionaryDecodeDatumArray(StringInfo datumBuffer, bool *existsArray,
+						   uint32 datumCount, bool datumTypeByValue,
+						   int datumTypeLength, char datumTypeAlign,
+						   Datum *datumArray)
+{
+	DictionaryHeader dictionaryHeader;
+	Datum *entryArray = NULL;
+	uint32 entryIndex = 0;
+	uint32 datumIndex = 0;
+	uint32 currentOffset = DICTIONARY_HEADER_SIZE;
+	uint64 entrySectionEnd = 0;
+	uint32 codeWidth = 0;
+	unsigned char *codePointer = NULL;
+	unsigned char *codeEnd = NULL;
+
+	if (datumBuffer->len < DICTIONARY_HEADER_SIZE)
+	{
+		ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+	}
+
+	memcpy(&dictionaryHeader, datumBuffer->data, DICTIONARY_HEADER_SIZE);
+	entrySectionEnd = (uint64) DICTIONARY_HEADER_SIZE +
+					  dictionaryHeader.entrySectionLength;
+	if (entrySectionEnd > (uint64) datumBuffer->len ||
+		dictionaryHeader.entryCount > DICTIONARY_MAXIMUM_ENTRY_COUNT)
+	{
+		ereport(ERROR, (errmsg("invalid dictionary in datum buffer")));
+	}
+
+	entryArray = palloc(dictionaryHeader.entryCount * sizeof(Datum));
+	for (entryIndex = 0; entryIndex < dictionaryHeader.entryCount; entryIndex++)
+	{
+		char *currentDataPointer = datumBuffer->data + currentOffset;
+
+		entryArray[entryIndex] = fetch_att(currentDataPointer, datumTypeByValue,
+										   datumTypeLength);
+		currentOffset = att_addlength_datum(currentOffset, datumTypeLength,
+											currentDataPointer);
+		currentOffset = att_align_nominal(currentOffset, datumTypeAlign);
+
+		if (currentOffset > entrySectionEnd)
+		{
+			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+		}
+	}
+
+	codeWidth = (dictionaryHeader.entryCount <= DICTIONARY_SMALL_ENTRY_COUNT) ? 1 : 2;
+	codePointer = (unsigned char *) datumBuffer->data + entrySectionEnd;
+	codeEnd = (unsigned char *) datumBuffer->data + datumBuffer->len;
+
+	for (datumIndex = 0; datumIndex < datumCount; datumIndex++)
+	{
+		uint32 code = 0;
+
+		if (!existsArray[datumIndex])
+		{
+			continue;
+		}
+
+		if (codePointer + codeWidth > codeEnd)
+		{
+			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+		}
+
+		code = codePointer[0];
+		if (codeWidth == 2)
+		{
+			code |= ((uint32) codePointer[1]) << 8;
+		}
+		codePointer += codeWidth;
+
+		if (code >= dictionaryHeader.entryCount)
+		{
+			ereport(ERROR, (errmsg("invalid dictionary code in datum buffer")));
+		}
+
+		datumArray[datumIndex] = entryArray[code];
+	}
+
+	pfree(entryArray);
+}
+
+
+/*
+ * RunLengthDecodeDatumArray expands each run in the given buffer into the
+ * entries of the run's existing values. All rows of a run share the same datum,
+ * which lets predicate evaluation reuse a run's result.
+ */
+static void
+RunLengthDecodeDatumArray(StringInfo datumBuffer, bool *existsArray,
+						  uint32 datumCount, bool datumTypeByValue,
+						  int datumTypeLength, char datumTypeAlign,
+						  Datum *datumArray)
+{
+	RunLengthHeader runLengthHeader;
+	uint32 runIndex = 0;
+	uint32 datumIndex = 0;
+	uint32 currentOffset = 0;
+	uint64 runLengthSectionEnd = 0;
+
+	if (datumBuffer->len < RUN_LENGTH_HEADER_SIZE)
+	{
+		ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+	}
+
+	memcpy(&runLengthHeader, datumBuffer->data, RUN_LENGTH_HEADER_SIZE);
+	runLengthSectionEnd = RUN_LENGTH_HEADER_SIZE +
+						  ((uint64) runLengthHeader.runCount * sizeof(uint32));
+	if (runLengthSectionEnd > runLengthHeader.valueSectionOffset ||
+		runLengthHeader.valueSectionOffset > (uint32) datumBuffer->len)
+	{
+		ereport(ERROR, (errmsg("invalid run lengths in datum buffer")));
+	}
+
+	currentOffset = runLengthHeader.valueSectionOffset;
+
+	for (runIndex = 0; runIndex < runLengthHeader.runCount; runIndex++)
+	{
+		char *currentDataPointer = datumBuffer->data + currentOffset;
+		Datum runValue = 0;
+		uint32 runLength = 0;
+
+		memcpy(&runLength, datumBuffer->data + RUN_LENGTH_HEADER_SIZE +
+			   (runIndex * sizeof(uint32)), sizeof(uint32));
+
+		if (currentOffset >= (uint32) datumBuffer->len)
+		{
+			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+		}
+
+		runValue = fetch_att(currentDataPointer, datumTypeByValue, datumTypeLength);
+		currentOffset = att_addlength_datum(currentOffset, datumTypeLength,
+											currentDataPointer);
+		currentOffset = att_align_nominal(currentOffset, datumTypeAlign);
+
+		if (currentOffset > (uint32) datumBuffer->len)
+		{
+			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+		}
+
+		while (runLength > 0)
+		{
+			if (datumIndex >= datumCount)
+			{
+				ereport(ERROR, (errmsg("run lengths exceed the block's row count")));
+			}
+
+			if (existsArray[datumIndex])
+			{
+				datumArray[datumIndex] = runValue;
+				runLength--;
+			}
+
+			datumIndex++;
+		}
+	}
+}
+
+
+/*
+ * BitPackedDecodeDatumArray unpacks the offsets in the given frame of reference
+ * or delta encoded buffer, and sets the datum of each existing value to its
+ * reference plus its offset.
+ */
+static void
+BitPackedDecodeDatumArray(StringInfo datumBuffer, EncodingType encodingType,
+						  bool *existsArray, uint32 datumCount, int datumTypeLength,
+						  Datum *datumArray)
+{
+	BitPackedHeader bitPackedHeader;
+	uint64 *offsetArray = NULL;
+	uint32 existingValueCount = 0;
+	uint32 expectedPackedCount = 0;
+	uint32 datumIndex = 0;
+	uint32 offsetIndex = 0;
+	uint64 currentValue = 0;
+
+	if (datumBuffer->len < BIT_PACKED_HEADER_SIZE)
+	{
+		ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+	}
+
+	memcpy(&bitPackedHeader, datumBuffer->data, BIT_PACKED_HEADER_SIZE);
+
+	for (datumIndex = 0; datumIndex < datumCount; datumIndex++)
+	{
+		existingValueCount += existsArray[datumIndex];
+	}
+
+	expectedPackedCount = existingValueCount;
+	if (encodingType == ENCODING_DELTA && existingValueCount > 0)
+	{
+		expectedPackedCount = existingValueCount - 1;
+	}
+
+	if (bitPackedHeader.packedValueCount != expectedPackedCount ||
+		bitPackedHeader.bitWidth > BIT_PACKED_WORD_BITS)
+	{
+		ereport(ERROR, (errmsg("invalid bit-packed data in datum buffer")));
+	}
+
+	if (BIT_PACKED_HEADER_SIZE + BitPackedLength(bitPackedHeader.packedValueCount,
+												 bitPackedHeader.bitWidth) >
+		(uint64) datumBuffer->len)
+	{
+		ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+	}
+
+	offsetArray = palloc((bitPackedHeader.packedValueCount + 1) * sizeof(uint64));
+	UnpackBits((uint64 *) (datumBuffer->data + BIT_PACKED_HEADER_SIZE),
+			   bitPackedHeader.bitWidth, bitPackedHeader.packedValueCount,
+			   offsetArray);
+
+	/* integers wrap around like they did when computing the offsets */
+	currentValue = (uint64) bitPackedHeader.referenceValue;
+	for (datumIndex = 0; datumIndex < datumCount; datumIndex++)
+	{
+		if (!existsArray[datumIndex])
+		{
+			continue;
+		}
+
+		if (encodingType == ENCODING_DELTA)
+		{
+			if (offsetIndex > 0)
+			{
+				currentValue += (uint64) bitPackedHeader.deltaReference +
+								offsetArray[offsetIndex - 1];
+			}
+		}
+		else
+		{
+			currentValue = (uint64) bitPackedHeader.referenceValue +
+						   offsetArray[offsetIndex];
+		}
+
+		datumArray[datumIndex] = IntegerGetDatum((int64) currentValue, datumTypeLength);
+		offsetIndex++;
+	}
+
+	pfree(offsetArray);
+}
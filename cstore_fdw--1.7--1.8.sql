@@ -0,0 +1,8 @@
+/* cstore_fdw/cstore_fdw--1.7--1.8.sql */
+
+CREATE FUNCTION cstore_block_cache_stats(OUT hits bigint, OUT misses bigint,
+										 OUT evictions bigint, OUT cached_blocks bigint,
+										 OUT cached_bytes bigint, OUT capacity_bytes bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
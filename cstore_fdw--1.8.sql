@@ -1,4 +1,4 @@
-/* cstore_fdw/cstore_fdw--1.7.sql */
+/* cstore_fdw/cstore_fdw--1.8.sql */
 
 -- complain if script is sourced in psql, rather than via CREATE EXTENSION
 \echo Use "CREATE EXTENSION cstore_fdw" to load this file. \quit
@@ -36,6 +36,13 @@ RETURNS void
 AS 'MODULE_PATHNAME'
 LANGUAGE C STRICT;
 
+CREATE FUNCTION cstore_block_cache_stats(OUT hits bigint, OUT misses bigint,
+										 OUT evictions bigint, OUT cached_blocks bigint,
+										 OUT cached_bytes bigint, OUT capacity_bytes bigint)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT;
+
 CREATE OR REPLACE FUNCTION cstore_drop_trigger()
 	RETURNS event_trigger
 	LANGUAGE plpgsql
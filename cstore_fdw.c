@@ -16,16 +16,26 @@
 
 #include "postgres.h"
 #include "cstore_fdw.h"
+#include "cstore_block_cache.h"
+#include "cstore_compression_pool.h"
+#include "cstore_metadata_cache.h"
 #include "cstore_version_compat.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
 #include <limits.h>
+#include <math.h>
 #include "access/htup_details.h"
+#include "access/nbtree.h"
+#if PG_VERSION_NUM >= 100000
+#include "access/parallel.h"
+#endif
 #include "access/reloptions.h"
 #include "access/sysattr.h"
 #include "access/tuptoaster.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_am.h"
 #include "catalog/pg_foreign_table.h"
 #include "catalog/pg_namespace.h"
 #include "commands/copy.h"
@@ -35,12 +45,16 @@
 #include "commands/explain.h"
 #include "commands/extension.h"
 #include "commands/vacuum.h"
+#include "executor/nodeSubplan.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
 #include "optimizer/cost.h"
 #include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
 #include "optimizer/planmain.h"
 #include "optimizer/restrictinfo.h"
 #if PG_VERSION_NUM >= 120000
@@ -49,19 +63,28 @@
 #include "executor/tuptable.h"
 #include "optimizer/optimizer.h"
 #else
+#include "optimizer/clauses.h"
 #include "optimizer/var.h"
 #endif
 #include "parser/parser.h"
 #include "parser/parsetree.h"
 #include "parser/parse_coerce.h"
 #include "parser/parse_type.h"
+#include "rewrite/rewriteManip.h"
 #include "storage/fd.h"
 #include "tcop/utility.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
 #include "utils/fmgroids.h"
+#include "utils/guc.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
+#if PG_VERSION_NUM >= 90500
+#include "utils/ruleutils.h"
+#endif
 #include "utils/rel.h"
+#include "utils/syscache.h"
+#include "utils/typcache.h"
 #if PG_VERSION_NUM >= 120000
 #include "utils/snapmgr.h"
 #else
@@ -109,14 +132,42 @@ static HeapTuple GetSlotHeapTuple(TupleTableSlot *tts);
 static CStoreFdwOptions * CStoreGetOptions(Oid foreignTableId);
 static char * CStoreGetOptionValue(Oid foreignTableId, const char *optionName);
 static void ValidateForeignTableOptions(char *filename, char *compressionTypeString,
+										char *compressionLevelString,
 										char *stripeRowCountString,
 										char *blockRowCountString);
 static char * CStoreDefaultFilePath(Oid foreignTableId);
+static void ValidateColumnOptions(char *compressionTypeString,
+								  char *compressionLevelString, char *encodingString);
+static void ValidateCompressionLevel(CompressionType compressionType,
+									 int32 compressionLevel);
+static ColumnOptions * CStoreGetColumnOptions(Oid foreignTableId,
+											  CompressionType compressionType,
+											  int32 compressionLevel);
+static bool ColumnBloomFilterEnabled(Oid foreignTableId, AttrNumber attributeNumber);
 static CompressionType ParseCompressionType(const char *compressionTypeString);
+static EncodingOption ParseEncodingOption(const char *encodingString);
 static void CStoreGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel,
 									Oid foreignTableId);
 static void CStoreGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel,
 								  Oid foreignTableId);
+static void AddParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel,
+								  Relation relation, CStoreFdwOptions *cstoreFdwOptions,
+								  double tupleCountEstimate, double startupCost,
+								  double cpuCostPerTuple, double totalDiskAccessCost);
+static List * ParameterizableClauseList(PlannerInfo *root, RelOptInfo *baserel);
+static bool EquivalenceMemberMatchesColumn(PlannerInfo *root, RelOptInfo *baserel,
+										   EquivalenceClass *equivalenceClass,
+										   EquivalenceMember *equivalenceMember,
+										   void *columnNumberPointer);
+static AttrNumber JoinClauseColumn(RestrictInfo *restrictInfo, RelOptInfo *baserel,
+								   bool *equalityClause);
+static double ParameterizedReadFraction(ParamPathInfo *paramPathInfo,
+										RelOptInfo *baserel, Relation relation,
+										CStoreFdwOptions *cstoreFdwOptions,
+										double tupleCountEstimate,
+										double *stripeReadFraction);
+static double ColumnStripeOrder(RelOptInfo *baserel, Relation relation,
+								const char *filename, uint32 columnIndex);
 #if PG_VERSION_NUM >= 90500
 static ForeignScan * CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
 										  Oid foreignTableId, ForeignPath *bestPath,
@@ -130,12 +181,16 @@ static ForeignScan * CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel
 static double TupleCountEstimate(RelOptInfo *baserel, const char *filename);
 static BlockNumber PageCount(const char *filename);
 static List * ColumnList(RelOptInfo *baserel, Oid foreignTableId);
+static Oid ForeignScanRelationId(ForeignScanState *scanState);
 static void CStoreExplainForeignScan(ForeignScanState *scanState,
 									 ExplainState *explainState);
 static void CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags);
 static TupleTableSlot * CStoreIterateForeignScan(ForeignScanState *scanState);
+static TupleTableSlot * IterateAggregateScan(ForeignScanState *scanState);
 static void CStoreEndForeignScan(ForeignScanState *scanState);
+static List * ScanWhereClauseList(ForeignScan *foreignScan);
 static void CStoreReScanForeignScan(ForeignScanState *scanState);
+static Node * ParameterValueMutator(Node *node, void *exprContext);
 static bool CStoreAnalyzeForeignTable(Relation relation,
 									  AcquireSampleRowsFunc *acquireSampleRowsFunc,
 									  BlockNumber *totalPageCount);
@@ -158,6 +213,30 @@ static void CStoreEndForeignInsert(EState *executorState, ResultRelInfo *relatio
 #if PG_VERSION_NUM >= 90600
 static bool CStoreIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
 											RangeTblEntry *rte);
+#if PG_VERSION_NUM >= 110000
+static void CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+									   RelOptInfo *inputRel, RelOptInfo *outputRel,
+									   void *extra);
+#else
+static void CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+									   RelOptInfo *inputRel, RelOptInfo *outputRel);
+#endif
+static bool SupportedAggregate(Node *targetExpr, TupleDesc tupleDescriptor,
+							   ColumnAggregateType *aggregateType,
+							   uint32 *columnIndex);
+#endif
+#if PG_VERSION_NUM >= 100000
+static double ParallelDivisor(int parallelWorkerCount);
+static Size CStoreEstimateDSMForeignScan(ForeignScanState *scanState,
+										 ParallelContext *parallelContext);
+static void CStoreInitializeDSMForeignScan(ForeignScanState *scanState,
+										   ParallelContext *parallelContext,
+										   void *coordinate);
+static void CStoreReInitializeDSMForeignScan(ForeignScanState *scanState,
+											 ParallelContext *parallelContext,
+											 void *coordinate);
+static void CStoreInitializeWorkerForeignScan(ForeignScanState *scanState,
+											  shm_toc *toc, void *coordinate);
 #endif
 
 /* declarations for dynamic loading */
@@ -168,21 +247,128 @@ PG_FUNCTION_INFO_V1(cstore_table_size);
 PG_FUNCTION_INFO_V1(cstore_fdw_handler);
 PG_FUNCTION_INFO_V1(cstore_fdw_validator);
 PG_FUNCTION_INFO_V1(cstore_clean_table_resources);
+PG_FUNCTION_INFO_V1(cstore_block_cache_stats);
 
 
 /* saved hook value in case of unload */
 static ProcessUtility_hook_type PreviousProcessUtilityHook = NULL;
 
+/* configuration parameters */
+bool EnableAggregatePushdown = true;
+
+/* valid values for cstore_fdw.auto_compression_objective */
+static const struct config_enum_entry CompressionObjectiveOptions[] =
+{
+	{ "size", COMPRESSION_OBJECTIVE_SIZE, false },
+	{ "decode_speed", COMPRESSION_OBJECTIVE_DECODE_SPEED, false },
+	{ "balanced", COMPRESSION_OBJECTIVE_BALANCED, false },
+	{ NULL, 0, false }
+};
+
 
 /*
  * _PG_init is called when the module is loaded. In this function we save the
  * previous utility hook, and then install our hook to pre-intercept calls to
- * the copy command.
+ * the copy command. We also define the extension's configuration parameters,
+ * and reserve shared memory for the metadata cache.
  */
 void _PG_init(void)
 {
 	PreviousProcessUtilityHook = ProcessUtility_hook;
 	ProcessUtility_hook = CStoreProcessUtility;
+
+	DefineCustomIntVariable("cstore_fdw.read_coalesce_gap",
+							"Sets the largest gap between two file segments that "
+							"are read with a single read call.",
+							"Column blocks which are closer to each other than "
+							"this are read together, and the bytes between them "
+							"are discarded. Zero only merges adjacent blocks.",
+							&ReadCoalesceGap, DEFAULT_READ_COALESCE_GAP, 0,
+							READ_COALESCE_GAP_MAXIMUM, PGC_USERSET, GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("cstore_fdw.prefetch_depth",
+							"Sets the number of stripes to prefetch ahead of "
+							"the stripe being read.",
+							"The data of upcoming stripes is read by the "
+							"kernel in the background. Zero disables "
+							"prefetching.",
+							&PrefetchDepth, DEFAULT_PREFETCH_DEPTH, 0,
+							PREFETCH_DEPTH_MAXIMUM, PGC_USERSET, 0,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("cstore_fdw.use_mmap",
+							 "Reads cstore files through a memory mapping.",
+							 "Column blocks are then used in place instead of "
+							 "being copied into separate buffers.",
+							 &UseMmap, false, PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("cstore_fdw.use_direct_write",
+							 "Writes cstore files with direct I/O.",
+							 "Loaded data then bypasses the page cache, which "
+							 "helps for large loads that aren't read soon.",
+							 &UseDirectWrite, false, PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("cstore_fdw.enable_zstd_dictionaries",
+							 "Trains a zstd dictionary for each column of a "
+							 "stripe during data loads.",
+							 "A dictionary is kept if it makes the column's "
+							 "blocks smaller, which takes compressing them "
+							 "twice. When off, blocks are compressed once.",
+							 &EnableZstdDictionaries, true, PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("cstore_fdw.metadata_cache_size",
+							"Sets the shared memory used for caching table "
+							"footers and skip lists.",
+							"The cache is only used when cstore_fdw is in "
+							"shared_preload_libraries. Zero disables it.",
+							&MetadataCacheSize, DEFAULT_METADATA_CACHE_SIZE, 0,
+							METADATA_CACHE_SIZE_MAXIMUM, PGC_POSTMASTER, GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("cstore_fdw.block_cache_size",
+							"Sets the shared memory used for caching "
+							"decompressed column blocks.",
+							"The cache is only used when cstore_fdw is in "
+							"shared_preload_libraries. Zero disables it.",
+							&BlockCacheSize, DEFAULT_BLOCK_CACHE_SIZE, 0,
+							BLOCK_CACHE_SIZE_MAXIMUM, PGC_POSTMASTER, GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("cstore_fdw.enable_aggregate_pushdown",
+							 "Computes count, min and max aggregates within "
+							 "the foreign scan.",
+							 "These aggregates are then mostly answered from "
+							 "the min/max values in skip lists.",
+							 &EnableAggregatePushdown, true, PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomEnumVariable("cstore_fdw.auto_compression_objective",
+							 "Sets what auto compression picks compression "
+							 "types for.",
+							 "Valid values are size, decode_speed and "
+							 "balanced, which estimates the time to read and "
+							 "decompress a block.",
+							 &AutoCompressionObjective,
+							 COMPRESSION_OBJECTIVE_BALANCED,
+							 CompressionObjectiveOptions, PGC_USERSET, 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("cstore_fdw.compression_workers",
+							"Sets the number of threads that compress column "
+							"blocks during a data load.",
+							"The backend keeps parsing rows while blocks are "
+							"compressed. pglz blocks are always compressed by "
+							"the backend. Zero disables compression threads.",
+							&CompressionWorkerCount, DEFAULT_COMPRESSION_WORKER_COUNT,
+							0, COMPRESSION_WORKER_COUNT_MAXIMUM, PGC_USERSET, 0,
+							NULL, NULL, NULL);
+
+	InitializeMetadataCache();
+	InitializeBlockCache();
 }
 
 
@@ -526,6 +712,7 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 	bool *columnNulls = NULL;
 	TableWriteState *writeState = NULL;
 	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	ColumnOptions *columnOptionsArray = NULL;
 	MemoryContext tupleContext = NULL;
 
 	/* Only superuser can copy from or to local file */
@@ -547,6 +734,9 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 	columnNulls = palloc0(columnCount * sizeof(bool));
 
 	cstoreFdwOptions = CStoreGetOptions(relationId);
+	columnOptionsArray = CStoreGetColumnOptions(relationId,
+												cstoreFdwOptions->compressionType,
+												cstoreFdwOptions->compressionLevel);
 
 	/*
 	 * We create a new memory context called tuple context, and read and write
@@ -581,7 +771,7 @@ CopyIntoCStoreTable(const CopyStmt *copyStatement, const char *queryString)
 
 	/* init state to write to the cstore file */
 	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
-								  cstoreFdwOptions->compressionType,
+								  columnOptionsArray,
 								  cstoreFdwOptions->stripeRowCount,
 								  cstoreFdwOptions->blockRowCount,
 								  tupleDescriptor);
@@ -881,6 +1071,11 @@ DeleteCStoreTableFiles(char *filename)
 	StringInfo tableFooterFilename = makeStringInfo();
 	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
 
+	/* new files may reuse the inodes, so drop cached metadata first */
+	MetadataCacheInvalidateFile(tableFooterFilename->data);
+	MetadataCacheInvalidateFile(filename);
+	BlockCacheInvalidateFile(filename);
+
 	/* delete the footer file */
 	footerFileRemoved = unlink(tableFooterFilename->data);
 	if (footerFileRemoved != 0)
@@ -912,14 +1107,18 @@ static void InitializeCStoreTableFile(Oid relationId, Relation relation)
 	TableWriteState *writeState = NULL;
 	TupleDesc tupleDescriptor = RelationGetDescr(relation);
 	CStoreFdwOptions* cstoreFdwOptions = CStoreGetOptions(relationId);
+	ColumnOptions *columnOptionsArray =
+		CStoreGetColumnOptions(relationId, cstoreFdwOptions->compressionType,
+							   cstoreFdwOptions->compressionLevel);
 
 	/*
 	 * Initialize state to write to the cstore file. This creates an
 	 * empty data file and a valid footer file for the table.
 	 */
 	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
-			cstoreFdwOptions->compressionType, cstoreFdwOptions->stripeRowCount,
-			cstoreFdwOptions->blockRowCount, tupleDescriptor);
+			columnOptionsArray,
+			cstoreFdwOptions->stripeRowCount, cstoreFdwOptions->blockRowCount,
+			tupleDescriptor);
 	CStoreEndWrite(writeState);
 }
 
@@ -1147,6 +1346,9 @@ RemoveCStoreDatabaseDirectory(Oid databaseOid)
 
 	if (DirectoryExists(cstoreDatabaseDirectoryPath))
 	{
+		/* we don't know which files are in the directory, so forget them all */
+		MetadataCacheReset();
+		BlockCacheReset();
 		rmtree(cstoreDatabaseDirectoryPath->data, true);
 	}
 }
@@ -1205,6 +1407,40 @@ cstore_table_size(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * cstore_block_cache_stats returns the usage counters of the shared block
+ * cache as a single row. All counters are zero when the cache is disabled.
+ */
+Datum
+cstore_block_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	HeapTuple statsTuple = NULL;
+	BlockCacheStats cacheStats;
+	Datum values[6];
+	bool nulls[6];
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		ereport(ERROR, (errmsg("return type must be a row type")));
+	}
+
+	BlockCacheGetStats(&cacheStats);
+
+	memset(nulls, false, sizeof(nulls));
+	values[0] = Int64GetDatum((int64) cacheStats.hitCount);
+	values[1] = Int64GetDatum((int64) cacheStats.missCount);
+	values[2] = Int64GetDatum((int64) cacheStats.evictionCount);
+	values[3] = Int64GetDatum((int64) cacheStats.cachedBlockCount);
+	values[4] = Int64GetDatum((int64) cacheStats.cachedByteCount);
+	values[5] = Int64GetDatum((int64) cacheStats.capacityByteCount);
+
+	statsTuple = heap_form_tuple(BlessTupleDesc(tupleDescriptor), values, nulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(statsTuple));
+}
+
+
 /*
  * cstore_fdw_handler creates and returns a struct with pointers to foreign
  * table callback functions.
@@ -1235,6 +1471,14 @@ cstore_fdw_handler(PG_FUNCTION_ARGS)
 
 #if PG_VERSION_NUM >= 90600
 	fdwRoutine->IsForeignScanParallelSafe = CStoreIsForeignScanParallelSafe;
+	fdwRoutine->GetForeignUpperPaths = CStoreGetForeignUpperPaths;
+#endif
+
+#if PG_VERSION_NUM >= 100000
+	fdwRoutine->EstimateDSMForeignScan = CStoreEstimateDSMForeignScan;
+	fdwRoutine->InitializeDSMForeignScan = CStoreInitializeDSMForeignScan;
+	fdwRoutine->ReInitializeDSMForeignScan = CStoreReInitializeDSMForeignScan;
+	fdwRoutine->InitializeWorkerForeignScan = CStoreInitializeWorkerForeignScan;
 #endif
 
 	PG_RETURN_POINTER(fdwRoutine);
@@ -1255,8 +1499,10 @@ cstore_fdw_validator(PG_FUNCTION_ARGS)
 	ListCell *optionCell = NULL;
 	char *filename = NULL;
 	char *compressionTypeString = NULL;
+	char *compressionLevelString = NULL;
 	char *stripeRowCountString = NULL;
 	char *blockRowCountString = NULL;
+	char *encodingString = NULL;
 
 	foreach(optionCell, optionList)
 	{
@@ -1304,12 +1550,31 @@ cstore_fdw_validator(PG_FUNCTION_ARGS)
 		{
 			blockRowCountString = defGetString(optionDef);
 		}
+		else if (strncmp(optionName, OPTION_NAME_COMPRESSION_LEVEL, NAMEDATALEN) == 0)
+		{
+			compressionLevelString = defGetString(optionDef);
+		}
+		else if (strncmp(optionName, OPTION_NAME_ENCODING, NAMEDATALEN) == 0)
+		{
+			encodingString = defGetString(optionDef);
+		}
+		else if (strncmp(optionName, OPTION_NAME_BLOOM_FILTER, NAMEDATALEN) == 0)
+		{
+			/* defGetBoolean() errors out if the value is not a valid boolean */
+			(void) defGetBoolean(optionDef);
+		}
 	}
 
 	if (optionContextId == ForeignTableRelationId)
 	{
 		ValidateForeignTableOptions(filename, compressionTypeString,
-									stripeRowCountString, blockRowCountString);
+									compressionLevelString, stripeRowCountString,
+									blockRowCountString);
+	}
+	else if (optionContextId == AttributeRelationId)
+	{
+		ValidateColumnOptions(compressionTypeString, compressionLevelString,
+							  encodingString);
 	}
 
 	PG_RETURN_VOID();
@@ -1408,28 +1673,37 @@ CStoreGetOptions(Oid foreignTableId)
 	CStoreFdwOptions *cstoreFdwOptions = NULL;
 	char *filename = NULL;
 	CompressionType compressionType = DEFAULT_COMPRESSION_TYPE;
+	int32 compressionLevel = DEFAULT_COMPRESSION_LEVEL;
 	int32 stripeRowCount = DEFAULT_STRIPE_ROW_COUNT;
 	int32 blockRowCount = DEFAULT_BLOCK_ROW_COUNT;
 	char *compressionTypeString = NULL;
+	char *compressionLevelString = NULL;
 	char *stripeRowCountString = NULL;
 	char *blockRowCountString = NULL;
 
 	filename = CStoreGetOptionValue(foreignTableId, OPTION_NAME_FILENAME);
 	compressionTypeString = CStoreGetOptionValue(foreignTableId,
 												 OPTION_NAME_COMPRESSION_TYPE);
+	compressionLevelString = CStoreGetOptionValue(foreignTableId,
+												  OPTION_NAME_COMPRESSION_LEVEL);
 	stripeRowCountString = CStoreGetOptionValue(foreignTableId,
 												OPTION_NAME_STRIPE_ROW_COUNT);
 	blockRowCountString = CStoreGetOptionValue(foreignTableId,
 											   OPTION_NAME_BLOCK_ROW_COUNT);
 
 	ValidateForeignTableOptions(filename, compressionTypeString,
-								stripeRowCountString, blockRowCountString);
+								compressionLevelString, stripeRowCountString,
+								blockRowCountString);
 
 	/* parse provided options */
 	if (compressionTypeString != NULL)
 	{
 		compressionType = ParseCompressionType(compressionTypeString);
 	}
+	if (compressionLevelString != NULL)
+	{
+		compressionLevel = pg_atoi(compressionLevelString, sizeof(int32), 0);
+	}
 	if (stripeRowCountString != NULL)
 	{
 		stripeRowCount = pg_atoi(stripeRowCountString, sizeof(int32), 0);
@@ -1448,6 +1722,7 @@ CStoreGetOptions(Oid foreignTableId)
 	cstoreFdwOptions = palloc0(sizeof(CStoreFdwOptions));
 	cstoreFdwOptions->filename = filename;
 	cstoreFdwOptions->compressionType = compressionType;
+	cstoreFdwOptions->compressionLevel = compressionLevel;
 	cstoreFdwOptions->stripeRowCount = stripeRowCount;
 	cstoreFdwOptions->blockRowCount = blockRowCount;
 
@@ -1455,6 +1730,109 @@ CStoreGetOptions(Oid foreignTableId)
 }
 
 
+/*
+ * CStoreGetColumnOptions resolves the compression, encoding and bloom filter
+ * options of each of the foreign table's columns. A column without a compression
+ * option uses the table's compression type and level, and a column that only
+ * sets the compression level applies it to the table's compression type. Since the
+ * table and column options are validated separately, the function checks that
+ * the resolved level is valid for the resolved compression type. A column's
+ * level may stop fitting its codec when the table's compression changes, so we
+ * only resolve column options when writing, and leave reads unaffected.
+ */
+static ColumnOptions *
+CStoreGetColumnOptions(Oid foreignTableId, CompressionType compressionType,
+					   int32 compressionLevel)
+{
+	int columnCount = get_relnatts(foreignTableId);
+	ColumnOptions *columnOptionsArray = palloc0(columnCount * sizeof(ColumnOptions));
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnOptions *columnOptions = &columnOptionsArray[columnIndex];
+		AttrNumber attributeNumber = (AttrNumber) (columnIndex + 1);
+		List *optionList = GetForeignColumnOptions(foreignTableId, attributeNumber);
+		ListCell *optionCell = NULL;
+		bool compressionTypeSet = false;
+		bool compressionLevelSet = false;
+
+		columnOptions->compressionType = compressionType;
+		columnOptions->compressionLevel = compressionLevel;
+		columnOptions->encodingOption = ENCODING_OPTION_AUTO;
+
+		foreach(optionCell, optionList)
+		{
+			DefElem *optionDef = (DefElem *) lfirst(optionCell);
+			char *optionName = optionDef->defname;
+			char *optionValue = defGetString(optionDef);
+
+			if (strncmp(optionName, OPTION_NAME_COMPRESSION_TYPE, NAMEDATALEN) == 0)
+			{
+				columnOptions->compressionType = ParseCompressionType(optionValue);
+				compressionTypeSet = true;
+			}
+			else if (strncmp(optionName, OPTION_NAME_COMPRESSION_LEVEL,
+							 NAMEDATALEN) == 0)
+			{
+				columnOptions->compressionLevel = pg_atoi(optionValue,
+														  sizeof(int32), 0);
+				compressionLevelSet = true;
+			}
+			else if (strncmp(optionName, OPTION_NAME_ENCODING, NAMEDATALEN) == 0)
+			{
+				columnOptions->encodingOption = ParseEncodingOption(optionValue);
+			}
+			else if (strncmp(optionName, OPTION_NAME_BLOOM_FILTER, NAMEDATALEN) == 0)
+			{
+				columnOptions->bloomFilter = defGetBoolean(optionDef);
+			}
+		}
+
+		/* the table's compression level doesn't carry over to another codec */
+		if (compressionTypeSet && !compressionLevelSet)
+		{
+			columnOptions->compressionLevel = DEFAULT_COMPRESSION_LEVEL;
+		}
+
+		if (columnOptions->compressionLevel != DEFAULT_COMPRESSION_LEVEL)
+		{
+			ValidateCompressionLevel(columnOptions->compressionType,
+									 columnOptions->compressionLevel);
+		}
+	}
+
+	return columnOptionsArray;
+}
+
+
+/*
+ * ColumnBloomFilterEnabled returns whether the given column of the foreign
+ * table has its bloom_filter option set. Unlike CStoreGetColumnOptions(), the
+ * function doesn't look at or validate the column's other options, so planning
+ * can use it on tables whose compression options were changed later.
+ */
+static bool
+ColumnBloomFilterEnabled(Oid foreignTableId, AttrNumber attributeNumber)
+{
+	List *optionList = GetForeignColumnOptions(foreignTableId, attributeNumber);
+	ListCell *optionCell = NULL;
+	bool bloomFilter = false;
+
+	foreach(optionCell, optionList)
+	{
+		DefElem *optionDef = (DefElem *) lfirst(optionCell);
+
+		if (strncmp(optionDef->defname, OPTION_NAME_BLOOM_FILTER, NAMEDATALEN) == 0)
+		{
+			bloomFilter = defGetBoolean(optionDef);
+		}
+	}
+
+	return bloomFilter;
+}
+
+
 /*
  * CStoreGetOptionValue walks over foreign table and foreign server options, and
  * looks for the option with the given name. If found, the function returns the
@@ -1498,15 +1876,18 @@ CStoreGetOptionValue(Oid foreignTableId, const char *optionName)
  */
 static void
 ValidateForeignTableOptions(char *filename, char *compressionTypeString,
-							char *stripeRowCountString, char *blockRowCountString)
+							char *compressionLevelString, char *stripeRowCountString,
+							char *blockRowCountString)
 {
+	CompressionType compressionType = DEFAULT_COMPRESSION_TYPE;
+
 	/* we currently do not have any checks for filename */
 	(void) filename;
 
 	/* check if the provided compression type is valid */
 	if (compressionTypeString != NULL)
 	{
-		CompressionType compressionType = ParseCompressionType(compressionTypeString);
+		compressionType = ParseCompressionType(compressionTypeString);
 		if (compressionType == COMPRESSION_TYPE_INVALID)
 		{
 			ereport(ERROR, (errmsg("invalid compression type"),
@@ -1515,6 +1896,14 @@ ValidateForeignTableOptions(char *filename, char *compressionTypeString,
 		}
 	}
 
+	/* check if the compression type has levels, and the level is in its range */
+	if (compressionLevelString != NULL)
+	{
+		/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
+		int32 compressionLevel = pg_atoi(compressionLevelString, sizeof(int32), 0);
+		ValidateCompressionLevel(compressionType, compressionLevel);
+	}
+
 	/* check if the provided stripe row count has correct format and range */
 	if (stripeRowCountString != NULL)
 	{
@@ -1547,6 +1936,90 @@ ValidateForeignTableOptions(char *filename, char *compressionTypeString,
 }
 
 
+/*
+ * ValidateColumnOptions verifies if given options are valid cstore_fdw column
+ * options. A compression level without a compression type may apply to the
+ * table's compression type, so we can only check it against the widest range
+ * here; CStoreGetColumnOptions() checks it again once the type is resolved.
+ */
+static void
+ValidateColumnOptions(char *compressionTypeString, char *compressionLevelString,
+					  char *encodingString)
+{
+	CompressionType compressionType = COMPRESSION_ZSTD;
+
+	/* check if the provided compression type is valid */
+	if (compressionTypeString != NULL)
+	{
+		compressionType = ParseCompressionType(compressionTypeString);
+		if (compressionType == COMPRESSION_TYPE_INVALID)
+		{
+			ereport(ERROR, (errmsg("invalid compression type"),
+							errhint("Valid options are: %s",
+									COMPRESSION_STRING_DELIMITED_LIST)));
+		}
+	}
+
+	if (compressionLevelString != NULL)
+	{
+		/* pg_atoi() errors out if the given string is not a valid 32-bit integer */
+		int32 compressionLevel = pg_atoi(compressionLevelString, sizeof(int32), 0);
+		ValidateCompressionLevel(compressionType, compressionLevel);
+	}
+
+	/* check if the provided encoding is valid */
+	if (encodingString != NULL)
+	{
+		EncodingOption encodingOption = ParseEncodingOption(encodingString);
+		if (encodingOption == ENCODING_OPTION_INVALID)
+		{
+			ereport(ERROR, (errmsg("invalid encoding"),
+							errhint("Valid options are: %s",
+									ENCODING_STRING_DELIMITED_LIST)));
+		}
+	}
+}
+
+
+/*
+ * ValidateCompressionLevel errors out if the given compression type doesn't
+ * have levels, or if the given level is out of the compression type's range.
+ */
+static void
+ValidateCompressionLevel(CompressionType compressionType, int32 compressionLevel)
+{
+	int32 compressionLevelMaximum = 0;
+
+	if (compressionType == COMPRESSION_DEFLATE)
+	{
+		compressionLevelMaximum = DEFLATE_COMPRESSION_LEVEL_MAXIMUM;
+	}
+	else if (compressionType == COMPRESSION_LZ4)
+	{
+		compressionLevelMaximum = LZ4_COMPRESSION_LEVEL_MAXIMUM;
+	}
+	else if (compressionType == COMPRESSION_ZSTD)
+	{
+		compressionLevelMaximum = ZSTD_COMPRESSION_LEVEL_MAXIMUM;
+	}
+	else
+	{
+		ereport(ERROR, (errmsg("invalid compression level"),
+						errhint("Compression level can only be set for "
+								"deflate, lz4 and zstd compression")));
+	}
+
+	if (compressionLevel < COMPRESSION_LEVEL_MINIMUM ||
+		compressionLevel > compressionLevelMaximum)
+	{
+		ereport(ERROR, (errmsg("invalid compression level"),
+						errhint("Compression level must be an integer between "
+								"%d and %d", COMPRESSION_LEVEL_MINIMUM,
+								compressionLevelMaximum)));
+	}
+}
+
+
 /*
  * CStoreDefaultFilePath constructs the default file path to use for a cstore_fdw
  * table. The path is of the form $PGDATA/cstore_fdw/{databaseOid}/{relfilenode}.
@@ -1600,11 +2073,55 @@ ParseCompressionType(const char *compressionTypeString)
 	{
 		compressionType = COMPRESSION_DEFLATE;
 	}
+	else if (strncmp(compressionTypeString, COMPRESSION_STRING_LZ4, NAMEDATALEN) == 0)
+	{
+		compressionType = COMPRESSION_LZ4;
+	}
+	else if (strncmp(compressionTypeString, COMPRESSION_STRING_ZSTD, NAMEDATALEN) == 0)
+	{
+		compressionType = COMPRESSION_ZSTD;
+	}
+	else if (strncmp(compressionTypeString, COMPRESSION_STRING_AUTO, NAMEDATALEN) == 0)
+	{
+		compressionType = COMPRESSION_AUTO;
+	}
 
 	return compressionType;
 }
 
 
+/* ParseEncodingOption converts a string to a column encoding option. */
+static EncodingOption
+ParseEncodingOption(const char *encodingString)
+{
+	EncodingOption encodingOption = ENCODING_OPTION_INVALID;
+	Assert(encodingString != NULL);
+
+	if (strncmp(encodingString, ENCODING_STRING_AUTO, NAMEDATALEN) == 0)
+	{
+		encodingOption = ENCODING_OPTION_AUTO;
+	}
+	else if (strncmp(encodingString, ENCODING_STRING_NONE, NAMEDATALEN) == 0)
+	{
+		encodingOption = ENCODING_OPTION_NONE;
+	}
+	else if (strncmp(encodingString, ENCODING_STRING_DICTIONARY, NAMEDATALEN) == 0)
+	{
+		encodingOption = ENCODING_OPTION_DICTIONARY;
+	}
+	else if (strncmp(encodingString, ENCODING_STRING_RUN_LENGTH, NAMEDATALEN) == 0)
+	{
+		encodingOption = ENCODING_OPTION_RUN_LENGTH;
+	}
+	else if (strncmp(encodingString, ENCODING_STRING_BIT_PACKED, NAMEDATALEN) == 0)
+	{
+		encodingOption = ENCODING_OPTION_BIT_PACKED;
+	}
+
+	return encodingOption;
+}
+
+
 /*
  * CStoreGetForeignRelSize obtains relation size estimates for a foreign table and
  * puts its estimate for row count into baserel->rows.
@@ -1618,15 +2135,32 @@ CStoreGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTable
 												   0, JOIN_INNER, NULL);
 
 	double outputRowCount = clamp_row_est(tupleCountEstimate * rowSelectivity);
+	double *stripeOrderArray = NULL;
+	int columnIndex = 0;
+
 	baserel->rows = outputRowCount;
+
+	/*
+	 * Costing parameterized paths needs the stripe order of joined columns,
+	 * which takes a pass over the table footer. We compute each column's order
+	 * when it's first needed, and keep it here for the rest of planning.
+	 */
+	stripeOrderArray = palloc(baserel->max_attr * sizeof(double));
+	for (columnIndex = 0; columnIndex < baserel->max_attr; columnIndex++)
+	{
+		stripeOrderArray[columnIndex] = -1.0;
+	}
+
+	baserel->fdw_private = stripeOrderArray;
 }
 
 
 /*
  * CStoreGetForeignPaths creates possible access paths for a scan on the foreign
- * table. We currently have one possible access path. This path filters out row
- * blocks that are refuted by where clauses, and only returns values for the
- * projected columns.
+ * table. We create a regular path which filters out row blocks that are refuted
+ * by where clauses, and only returns values for the projected columns. When the
+ * relation can be scanned in parallel, we also create a partial path of the
+ * same kind, in which participating backends split the stripes among themselves.
  */
 static void
 CStoreGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId)
@@ -1700,85 +2234,610 @@ CStoreGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId
 #endif
 
 	add_path(baserel, foreignScanPath);
+
+	/*
+	 * Join clauses on columns with min/max statistics can also be checked with
+	 * the values of each outer row of a nested loop join, so that the scan only
+	 * reads the stripes and blocks that may have matching rows.
+	 */
+	AddParameterizedPaths(root, baserel, relation, cstoreFdwOptions,
+						  tupleCountEstimate, startupCost, cpuCostPerTuple,
+						  totalDiskAccessCost);
+
+#if PG_VERSION_NUM >= 100000
+	if (baserel->consider_parallel)
+	{
+		int parallelWorkerCount = ComputeParallelWorkerCount(baserel,
+															 relationPageCount);
+		if (parallelWorkerCount > 0)
+		{
+			/*
+			 * Each participant reads whole stripes, so the CPU cost and the row
+			 * count are split between participants. Like cost_seqscan(), we do
+			 * not discount the disk access cost.
+			 */
+			double parallelDivisor = ParallelDivisor(parallelWorkerCount);
+			double partialRowCount = clamp_row_est(baserel->rows / parallelDivisor);
+			double partialCpuCost = totalCpuCost / parallelDivisor;
+			double partialTotalCost = startupCost + partialCpuCost + totalDiskAccessCost;
+
+			Path *partialScanPath = (Path *)
+				create_foreignscan_path(root, baserel,
+										NULL, /* path target */
+										partialRowCount,
+										startupCost, partialTotalCost,
+										NIL,  /* no known ordering */
+										NULL, /* not parameterized */
+										NULL, /* no outer path */
+										NIL); /* no fdw_private */
+
+			partialScanPath->parallel_aware = true;
+			partialScanPath->parallel_safe = true;
+			partialScanPath->parallel_workers = parallelWorkerCount;
+
+			add_partial_path(baserel, partialScanPath);
+		}
+	}
+#endif
+
 	heap_close(relation, AccessShareLock);
 }
 
 
 /*
- * CStoreGetForeignPlan creates a ForeignScan plan node for scanning the foreign
- * table. We also add the query column list to scan nodes private list, because
- * we need it later for skipping over unused columns in the query.
+ * AddParameterizedPaths creates a parameterized path for each set of outer
+ * relations that the join clauses on the table's columns refer to. The scan
+ * compiles these clauses with each outer row's values, and skips the stripes
+ * and blocks whose min/max values refute them. How much of the table that
+ * leaves depends on the order of the column's values in the file, so the cost
+ * of a rescan is estimated by ParameterizedReadFraction(). Each rescan also
+ * reads the footer and skip lists of every stripe it doesn't skip again, which
+ * we add to the cost of the rescan.
  */
-#if PG_VERSION_NUM >= 90500
-static ForeignScan *
-CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
-					 ForeignPath *bestPath, List *targetList, List *scanClauses,
-					 Plan *outerPlan)
-#else
-static ForeignScan *
-CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
-					 ForeignPath *bestPath, List *targetList, List *scanClauses)
-#endif
+static void
+AddParameterizedPaths(PlannerInfo *root, RelOptInfo *baserel, Relation relation,
+					  CStoreFdwOptions *cstoreFdwOptions, double tupleCountEstimate,
+					  double startupCost, double cpuCostPerTuple,
+					  double totalDiskAccessCost)
 {
-	ForeignScan *foreignScan = NULL;
-	List *columnList = NIL;
-	List *foreignPrivateList = NIL;
+	List *joinClauseList = ParameterizableClauseList(root, baserel);
+	List *requiredOuterList = NIL;
+	ListCell *joinClauseCell = NULL;
+	double stripeCount = ceil(tupleCountEstimate / cstoreFdwOptions->stripeRowCount);
+	double stripeBlockCount = ceil((double) cstoreFdwOptions->stripeRowCount /
+								   cstoreFdwOptions->blockRowCount);
 
-	/*
-	 * Although we skip row blocks that are refuted by the WHERE clause, but
-	 * we have no native ability to evaluate restriction clauses and make sure
-	 * that all non-related rows are filtered out. So we just put all of the
-	 * scanClauses into the plan node's qual list for the executor to check.
-	 */
-	scanClauses = extract_actual_clauses(scanClauses,
-										 false); /* extract regular clauses */
+	/* a stripe's footer and skip lists take a read, and a check for each block */
+	double stripeMetadataCost = seq_page_cost + cpu_operator_cost * stripeBlockCount;
 
-	/*
-	 * As an optimization, we only read columns that are present in the query.
-	 * To find these columns, we need baserel. We don't have access to baserel
-	 * in executor's callback functions, so we get the column list here and put
-	 * it into foreign scan node's private list.
-	 */
-	columnList = ColumnList(baserel, foreignTableId);
-	foreignPrivateList = list_make1(columnList);
+	foreach(joinClauseCell, joinClauseList)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(joinClauseCell);
+		Relids requiredOuter = NULL;
+		ParamPathInfo *paramPathInfo = NULL;
+		ListCell *requiredOuterCell = NULL;
+		bool requiredOuterFound = false;
+		QualCost joinClauseCost;
+		double readFraction = 0.0;
+		double stripeReadFraction = 0.0;
+		double tuplesRead = 0.0;
+		double parameterizedStartupCost = 0.0;
+		double parameterizedTotalCost = 0.0;
+		Path *parameterizedPath = NULL;
+
+		requiredOuter = bms_union(restrictInfo->clause_relids, baserel->lateral_relids);
+		requiredOuter = bms_del_member(requiredOuter, baserel->relid);
+		if (bms_is_empty(requiredOuter))
+		{
+			continue;
+		}
 
-	/* create the foreign scan node */
-#if PG_VERSION_NUM >= 90500
-	foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
-								   NIL, /* no expressions to evaluate */
-								   foreignPrivateList,
-								   NIL,
-								   NIL,
-								   NULL); /* no outer path */
+		/* a path checks all join clauses with its outer relations, so add it once */
+		foreach(requiredOuterCell, requiredOuterList)
+		{
+			if (bms_equal((Relids) lfirst(requiredOuterCell), requiredOuter))
+			{
+				requiredOuterFound = true;
+				break;
+			}
+		}
+
+		if (requiredOuterFound)
+		{
+			continue;
+		}
+
+		requiredOuterList = lappend(requiredOuterList, requiredOuter);
+
+		paramPathInfo = get_baserel_parampathinfo(root, baserel, requiredOuter);
+		readFraction = ParameterizedReadFraction(paramPathInfo, baserel, relation,
+												 cstoreFdwOptions, tupleCountEstimate,
+												 &stripeReadFraction);
+		tuplesRead = tupleCountEstimate * readFraction;
+
+		/* the executor also checks the join clauses on every row read */
+		cost_qual_eval(&joinClauseCost, paramPathInfo->ppi_clauses, root);
+
+		parameterizedStartupCost = startupCost + joinClauseCost.startup;
+		parameterizedTotalCost = parameterizedStartupCost +
+								 (cpuCostPerTuple + joinClauseCost.per_tuple) * tuplesRead +
+								 totalDiskAccessCost * readFraction +
+								 stripeMetadataCost * stripeCount * stripeReadFraction;
+
+#if PG_VERSION_NUM >= 90600
+		parameterizedPath = (Path *) create_foreignscan_path(root, baserel,
+															 NULL, /* path target */
+															 paramPathInfo->ppi_rows,
+															 parameterizedStartupCost,
+															 parameterizedTotalCost,
+															 NIL, /* no known ordering */
+															 requiredOuter,
+															 NULL, /* no outer path */
+															 NIL); /* no fdw_private */
+#elif PG_VERSION_NUM >= 90500
+		parameterizedPath = (Path *) create_foreignscan_path(root, baserel,
+															 paramPathInfo->ppi_rows,
+															 parameterizedStartupCost,
+															 parameterizedTotalCost,
+															 NIL, /* no known ordering */
+															 requiredOuter,
+															 NULL, /* no outer path */
+															 NIL); /* no fdw_private */
 #else
-	foreignScan = make_foreignscan(targetList, scanClauses, baserel->relid,
-								   NIL, /* no expressions to evaluate */
-								   foreignPrivateList);
+		parameterizedPath = (Path *) create_foreignscan_path(root, baserel,
+															 paramPathInfo->ppi_rows,
+															 parameterizedStartupCost,
+															 parameterizedTotalCost,
+															 NIL, /* no known ordering */
+															 requiredOuter,
+															 NIL); /* no fdw_private */
 #endif
 
-	return foreignScan;
+		add_path(baserel, parameterizedPath);
+	}
 }
 
 
 /*
- * TupleCountEstimate estimates the number of base relation tuples in the given
- * file.
+ * ParameterizableClauseList returns the join clauses that compare a column of
+ * the given relation with expressions of other relations using btree operators,
+ * and that can be checked in a scan of the relation. These are the movable
+ * clauses in the relation's join info, and the equality clauses implied by the
+ * equivalence classes of its columns.
  */
-static double
-TupleCountEstimate(RelOptInfo *baserel, const char *filename)
+static List *
+ParameterizableClauseList(PlannerInfo *root, RelOptInfo *baserel)
 {
-	double tupleCountEstimate = 0.0;
+	List *clauseList = NIL;
+	ListCell *restrictInfoCell = NULL;
+	AttrNumber columnNumber = 0;
+	bool equalityClause = false;
 
-	/* check if the user executed Analyze on this foreign table before */
-	if (baserel->pages > 0)
+	foreach(restrictInfoCell, baserel->joininfo)
 	{
-		/*
-		 * We have number of pages and number of tuples from pg_class (from a
-		 * previous ANALYZE), so compute a tuples-per-page estimate and scale
-		 * that by the current file size.
-		 */
-		double tupleDensity = baserel->tuples / (double) baserel->pages;
-		BlockNumber pageCount = PageCount(filename);
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+
+		if (JoinClauseIsMovableTo(restrictInfo, baserel) &&
+			JoinClauseColumn(restrictInfo, baserel, &equalityClause) != InvalidAttrNumber)
+		{
+			clauseList = lappend(clauseList, restrictInfo);
+		}
+	}
+
+	/* equality joins are kept in equivalence classes rather than join info */
+	if (!baserel->has_eclass_joins)
+	{
+		return clauseList;
+	}
+
+	for (columnNumber = 1; columnNumber <= baserel->max_attr; columnNumber++)
+	{
+		List *equalityClauseList =
+			generate_implied_equalities_for_column(root, baserel,
+												   EquivalenceMemberMatchesColumn,
+												   (void *) &columnNumber,
+												   baserel->lateral_referencers);
+
+		foreach(restrictInfoCell, equalityClauseList)
+		{
+			RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+
+			if (JoinClauseColumn(restrictInfo, baserel, &equalityClause) !=
+				InvalidAttrNumber)
+			{
+				clauseList = lappend(clauseList, restrictInfo);
+			}
+		}
+	}
+
+	return clauseList;
+}
+
+
+/*
+ * EquivalenceMemberMatchesColumn is the callback that picks the equivalence
+ * class members for generate_implied_equalities_for_column(). It returns true
+ * if the member is the given column of the relation.
+ */
+static bool
+EquivalenceMemberMatchesColumn(PlannerInfo *root, RelOptInfo *baserel,
+							   EquivalenceClass *equivalenceClass,
+							   EquivalenceMember *equivalenceMember,
+							   void *columnNumberPointer)
+{
+	AttrNumber columnNumber = *((AttrNumber *) columnNumberPointer);
+	Node *memberExpression = (Node *) equivalenceMember->em_expr;
+	Var *column = NULL;
+
+	if (IsA(memberExpression, RelabelType))
+	{
+		memberExpression = (Node *) ((RelabelType *) memberExpression)->arg;
+	}
+
+	if (!IsA(memberExpression, Var))
+	{
+		return false;
+	}
+
+	column = (Var *) memberExpression;
+	return (column->varno == baserel->relid && column->varattno == columnNumber &&
+			column->varlevelsup == 0);
+}
+
+
+/*
+ * JoinClauseColumn returns the number of the relation's column that the given
+ * join clause compares with expressions of other relations, if the clause's
+ * operator is a <, <=, =, >= or > operator of a btree operator family. Such
+ * clauses can be compiled into bounds checked against min/max values once the
+ * other side is known. The function also sets equalityClause for = operators,
+ * which can be checked against bloom filters as well. For other clauses, the
+ * function returns InvalidAttrNumber.
+ */
+static AttrNumber
+JoinClauseColumn(RestrictInfo *restrictInfo, RelOptInfo *baserel, bool *equalityClause)
+{
+	OpExpr *operatorExpression = NULL;
+	Node *columnOperand = NULL;
+	List *interpretationList = NIL;
+	ListCell *interpretationCell = NULL;
+	AttrNumber columnNumber = InvalidAttrNumber;
+
+	(*equalityClause) = false;
+
+	if (!IsA(restrictInfo->clause, OpExpr))
+	{
+		return InvalidAttrNumber;
+	}
+
+	operatorExpression = (OpExpr *) restrictInfo->clause;
+	if (list_length(operatorExpression->args) != 2)
+	{
+		return InvalidAttrNumber;
+	}
+
+	if (bms_equal(restrictInfo->left_relids, baserel->relids) &&
+		!bms_overlap(restrictInfo->right_relids, baserel->relids))
+	{
+		columnOperand = (Node *) linitial(operatorExpression->args);
+	}
+	else if (bms_equal(restrictInfo->right_relids, baserel->relids) &&
+			 !bms_overlap(restrictInfo->left_relids, baserel->relids))
+	{
+		columnOperand = (Node *) lsecond(operatorExpression->args);
+	}
+	else
+	{
+		return InvalidAttrNumber;
+	}
+
+	if (IsA(columnOperand, RelabelType))
+	{
+		columnOperand = (Node *) ((RelabelType *) columnOperand)->arg;
+	}
+
+	if (!IsA(columnOperand, Var) || ((Var *) columnOperand)->varattno <= 0)
+	{
+		return InvalidAttrNumber;
+	}
+
+	interpretationList = get_op_btree_interpretation(operatorExpression->opno);
+	foreach(interpretationCell, interpretationList)
+	{
+		OpBtreeInterpretation *interpretation = lfirst(interpretationCell);
+
+		if (interpretation->strategy >= BTLessStrategyNumber &&
+			interpretation->strategy <= BTGreaterStrategyNumber)
+		{
+			columnNumber = ((Var *) columnOperand)->varattno;
+			(*equalityClause) = (interpretation->strategy == BTEqualStrategyNumber);
+			break;
+		}
+	}
+
+	return columnNumber;
+}
+
+
+/*
+ * ParameterizedReadFraction estimates the fraction of the table that a scan with
+ * the given parameterization reads for each outer row. If a joined column's
+ * values are in file order, skip lists leave the blocks holding the matching
+ * rows, and one more for rows that cross block boundaries. If they aren't, the
+ * min/max values of most blocks admit any value, and the whole table is read.
+ * Like btcostestimate(), we interpolate between the two using the square of the
+ * column's correlation with file order, which we take from stripe statistics.
+ *
+ * Bloom filters of a column compared for equality don't depend on the order of
+ * values, and leave at most a block for each matching row, and the blocks that
+ * pass as false positives. So a small set of join values, such as the keys of
+ * a filtered dimension table, reads little of the table even if it's unsorted.
+ *
+ * Blocks are only checked after the stripe's footer and skip lists are read,
+ * so the function also sets stripeReadFraction to the fraction of stripes that
+ * stripe statistics leave. Bloom filters are kept per block and don't skip
+ * stripes, so that fraction only depends on the order of joined columns.
+ */
+static double
+ParameterizedReadFraction(ParamPathInfo *paramPathInfo, RelOptInfo *baserel,
+						  Relation relation, CStoreFdwOptions *cstoreFdwOptions,
+						  double tupleCountEstimate, double *stripeReadFraction)
+{
+	double blockRowCount = (double) cstoreFdwOptions->blockRowCount;
+	double stripeRowCount = (double) cstoreFdwOptions->stripeRowCount;
+	double rowCount = paramPathInfo->ppi_rows;
+	double tableBlockCount = Max(tupleCountEstimate, 1.0) / blockRowCount;
+	double tableStripeCount = Max(tupleCountEstimate, 1.0) / stripeRowCount;
+	double orderedReadFraction = 0.0;
+	double orderedStripeReadFraction = 0.0;
+	double bloomFilterReadFraction = 0.0;
+	double readFraction = 1.0;
+	ListCell *restrictInfoCell = NULL;
+
+	(*stripeReadFraction) = 1.0;
+
+	orderedReadFraction = Min(1.0, (ceil(rowCount / blockRowCount) + 1) /
+							  tableBlockCount);
+	orderedStripeReadFraction = Min(1.0, (ceil(rowCount / stripeRowCount) + 1) /
+									tableStripeCount);
+	bloomFilterReadFraction = Min(1.0, rowCount / tableBlockCount +
+								  BLOOM_FILTER_FALSE_POSITIVE_RATE);
+
+	foreach(restrictInfoCell, paramPathInfo->ppi_clauses)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+		bool equalityClause = false;
+		AttrNumber columnNumber = JoinClauseColumn(restrictInfo, baserel,
+												   &equalityClause);
+		uint32 columnIndex = 0;
+		double stripeOrder = 0.0;
+		double columnReadFraction = 0.0;
+
+		if (columnNumber == InvalidAttrNumber)
+		{
+			continue;
+		}
+
+		columnIndex = (uint32) (columnNumber - 1);
+		stripeOrder = ColumnStripeOrder(baserel, relation, cstoreFdwOptions->filename,
+										columnIndex);
+		columnReadFraction = 1.0 + stripeOrder * stripeOrder *
+							 (orderedReadFraction - 1.0);
+		(*stripeReadFraction) = Min(*stripeReadFraction,
+									1.0 + stripeOrder * stripeOrder *
+									(orderedStripeReadFraction - 1.0));
+
+		if (equalityClause &&
+			ColumnBloomFilterEnabled(RelationGetRelid(relation), columnNumber))
+		{
+			columnReadFraction = Min(columnReadFraction, bloomFilterReadFraction);
+		}
+
+		readFraction = Min(readFraction, columnReadFraction);
+	}
+
+	return readFraction;
+}
+
+
+/*
+ * ColumnStripeOrder returns the stripe order of the given column as computed by
+ * CStoreColumnStripeOrder(). Every parameterized path checks the order of its
+ * joined columns, so the order is computed once for the relation and kept in
+ * the stripe order array that CStoreGetForeignRelSize() sets up.
+ */
+static double
+ColumnStripeOrder(RelOptInfo *baserel, Relation relation, const char *filename,
+				  uint32 columnIndex)
+{
+	double *stripeOrderArray = (double *) baserel->fdw_private;
+
+	if (stripeOrderArray[columnIndex] < 0.0)
+	{
+		stripeOrderArray[columnIndex] =
+			CStoreColumnStripeOrder(filename, RelationGetDescr(relation), columnIndex);
+	}
+
+	return stripeOrderArray[columnIndex];
+}
+
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * ParallelDivisor estimates the fraction of the scan each participant performs.
+ * The calculation follows get_parallel_divisor() in costsize.c, which accounts
+ * for the leader spending part of its time on collecting worker results.
+ */
+static double
+ParallelDivisor(int parallelWorkerCount)
+{
+	double parallelDivisor = parallelWorkerCount;
+
+#if PG_VERSION_NUM >= 110000
+	if (parallel_leader_participation)
+#endif
+	{
+		double leaderContribution = 1.0 - (0.3 * parallelWorkerCount);
+		if (leaderContribution > 0)
+		{
+			parallelDivisor += leaderContribution;
+		}
+	}
+
+	return parallelDivisor;
+}
+#endif
+
+
+/*
+ * CStoreGetForeignPlan creates a ForeignScan plan node for scanning the foreign
+ * table. We also add the query column list to scan nodes private list, because
+ * we need it later for skipping over unused columns in the query.
+ */
+#if PG_VERSION_NUM >= 90500
+static ForeignScan *
+CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
+					 ForeignPath *bestPath, List *targetList, List *scanClauses,
+					 Plan *outerPlan)
+#else
+static ForeignScan *
+CStoreGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel, Oid foreignTableId,
+					 ForeignPath *bestPath, List *targetList, List *scanClauses)
+#endif
+{
+	ForeignScan *foreignScan = NULL;
+	List *columnList = NIL;
+	List *pushdownClauseList = NIL;
+	List *parameterClauseList = NIL;
+	List *foreignPrivateList = NIL;
+	List *qualClauseList = NIL;
+	ListCell *scanClauseCell = NULL;
+	Relation relation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+
+#if PG_VERSION_NUM >= 90600
+
+	/*
+	 * Aggregate scans don't scan a base relation. They return the aggregates in
+	 * the target list instead, and their path already has the private list.
+	 */
+	if (baserel->reloptkind == RELOPT_UPPER_REL)
+	{
+		foreignScan = make_foreignscan(targetList, NIL, 0,
+									   NIL, /* no expressions to evaluate */
+									   bestPath->fdw_private,
+									   targetList, /* scan tuples have aggregates */
+									   NIL,
+									   NULL); /* no outer path */
+
+		return foreignScan;
+	}
+#endif
+
+	/*
+	 * The reader evaluates simple restriction clauses itself, and only returns
+	 * rows that pass them. We pass these clauses to the reader separately, and
+	 * leave clauses of security barrier views out unless they are leakproof,
+	 * since the reader evaluates them before any other qual.
+	 *
+	 * Join clauses of parameterized scans refer to columns of outer rows. We
+	 * pass them as expressions to evaluate, so that the planner replaces these
+	 * columns with executor parameters, and the reader gets the clauses with
+	 * each outer row's values on rescan. This way, the reader filters out rows
+	 * that don't join before they are turned into tuples.
+	 *
+	 * The executor checks the remaining clauses in the plan node's qual list.
+	 * Pushed down clauses that the reader evaluates exactly, such as btree
+	 * comparisons with constants, IN lists and null tests, are left out of
+	 * it, so that rows passing them aren't checked a second time. The reader
+	 * still uses both lists to skip row blocks. We keep parameterized clauses
+	 * in the qual list, since the reader doesn't filter when an outer value
+	 * is null.
+	 */
+	relation = heap_open(foreignTableId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(relation);
+
+	foreach(scanClauseCell, scanClauses)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(scanClauseCell);
+
+		if (restrictInfo->pseudoconstant)
+		{
+			continue;
+		}
+
+#if PG_VERSION_NUM >= 100000
+		if (restrictInfo->security_level > baserel->baserestrict_min_security &&
+			contain_leaked_vars((Node *) restrictInfo->clause))
+		{
+			qualClauseList = lappend(qualClauseList, restrictInfo->clause);
+			continue;
+		}
+#endif
+
+		if (!bms_is_subset(restrictInfo->clause_relids, baserel->relids))
+		{
+			parameterClauseList = lappend(parameterClauseList, restrictInfo->clause);
+			qualClauseList = lappend(qualClauseList, restrictInfo->clause);
+			continue;
+		}
+
+		pushdownClauseList = lappend(pushdownClauseList, restrictInfo->clause);
+
+		if (!CStorePredicateSupported((Node *) restrictInfo->clause, tupleDescriptor))
+		{
+			qualClauseList = lappend(qualClauseList, restrictInfo->clause);
+		}
+	}
+
+	heap_close(relation, AccessShareLock);
+
+	/*
+	 * As an optimization, we only read columns that are present in the query.
+	 * To find these columns, we need baserel. We don't have access to baserel
+	 * in executor's callback functions, so we get the column list here and put
+	 * it into foreign scan node's private list.
+	 */
+	columnList = ColumnList(baserel, foreignTableId);
+	foreignPrivateList = list_make2(columnList, pushdownClauseList);
+
+	/* create the foreign scan node */
+#if PG_VERSION_NUM >= 90500
+	foreignScan = make_foreignscan(targetList, qualClauseList, baserel->relid,
+								   parameterClauseList,
+								   foreignPrivateList,
+								   NIL,
+								   NIL,
+								   NULL); /* no outer path */
+#else
+	foreignScan = make_foreignscan(targetList, qualClauseList, baserel->relid,
+								   parameterClauseList,
+								   foreignPrivateList);
+#endif
+
+	return foreignScan;
+}
+
+
+/*
+ * TupleCountEstimate estimates the number of base relation tuples in the given
+ * file.
+ */
+static double
+TupleCountEstimate(RelOptInfo *baserel, const char *filename)
+{
+	double tupleCountEstimate = 0.0;
+
+	/* check if the user executed Analyze on this foreign table before */
+	if (baserel->pages > 0)
+	{
+		/*
+		 * We have number of pages and number of tuples from pg_class (from a
+		 * previous ANALYZE), so compute a tuples-per-page estimate and scale
+		 * that by the current file size.
+		 */
+		double tupleDensity = baserel->tuples / (double) baserel->pages;
+		BlockNumber pageCount = PageCount(filename);
 
 		tupleCountEstimate = clamp_row_est(tupleDensity * (double) pageCount);
 	}
@@ -1925,11 +2984,33 @@ ColumnList(RelOptInfo *baserel, Oid foreignTableId)
 }
 
 
+/*
+ * ForeignScanRelationId returns the OID of the table that the given scan reads.
+ * Aggregate scans don't have a scan relation, so they keep the table's OID in
+ * their private list.
+ */
+static Oid
+ForeignScanRelationId(ForeignScanState *scanState)
+{
+	ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+	List *aggregatePrivateList = NIL;
+
+	if (foreignScan->scan.scanrelid > 0)
+	{
+		return RelationGetRelid(scanState->ss.ss_currentRelation);
+	}
+
+	aggregatePrivateList = (List *) lthird(foreignScan->fdw_private);
+
+	return linitial_oid((List *) linitial(aggregatePrivateList));
+}
+
+
 /* CStoreExplainForeignScan produces extra output for the Explain command. */
 static void
 CStoreExplainForeignScan(ForeignScanState *scanState, ExplainState *explainState)
 {
-	Oid foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
+	Oid foreignTableId = ForeignScanRelationId(scanState);
 	CStoreFdwOptions *cstoreFdwOptions = CStoreGetOptions(foreignTableId);
 
 	ExplainPropertyText("CStore File", cstoreFdwOptions->filename, explainState);
@@ -1946,6 +3027,77 @@ CStoreExplainForeignScan(ForeignScanState *scanState, ExplainState *explainState
 								explainState);
 		}
 	}
+
+	/*
+	 * Pushed down clauses that the reader evaluates exactly aren't in the plan
+	 * node's qual list, so EXPLAIN doesn't show them as a filter. We show them
+	 * here, and also the number of rows they removed if the executor has no
+	 * filter of its own to report it with.
+	 */
+	if (scanState->ss.ss_currentRelation != NULL)
+	{
+		ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+		List *columnList = (List *) linitial(foreignScan->fdw_private);
+		List *pushdownClauseList = (List *) lsecond(foreignScan->fdw_private);
+		TupleDesc tupleDescriptor = RelationGetDescr(scanState->ss.ss_currentRelation);
+		Instrumentation *instrument = scanState->ss.ps.instrument;
+		List *readerClauseList = NIL;
+		ListCell *pushdownClauseCell = NULL;
+
+		foreach(pushdownClauseCell, pushdownClauseList)
+		{
+			Node *pushdownClause = (Node *) lfirst(pushdownClauseCell);
+			if (CStorePredicateSupported(pushdownClause, tupleDescriptor))
+			{
+				readerClauseList = lappend(readerClauseList, pushdownClause);
+			}
+		}
+
+		if (readerClauseList != NIL)
+		{
+			Var *column = (Var *) linitial(columnList);
+			Node *readerClause = copyObject(make_ands_explicit(readerClauseList));
+			List *deparseContext = PlanStateDeparseContext(scanState, explainState);
+			char *readerClauseString = NULL;
+
+			/* private clauses keep the range table index the planner gave them */
+			ChangeVarNodes(readerClause, column->varno, foreignScan->scan.scanrelid, 0);
+
+			readerClauseString = deparse_expression(readerClause, deparseContext,
+													explainState->verbose, false);
+			ExplainPropertyText("CStore Filter", readerClauseString, explainState);
+		}
+
+		if (readerClauseList != NIL && foreignScan->scan.plan.qual == NIL &&
+			explainState->analyze && instrument != NULL && instrument->nloops > 0)
+		{
+			long filteredRowCount = (long) rint(instrument->nfiltered1 /
+												instrument->nloops);
+
+			if (filteredRowCount > 0 || explainState->format != EXPLAIN_FORMAT_TEXT)
+			{
+				ExplainPropertyLong("Rows Removed by Filter", filteredRowCount,
+									explainState);
+			}
+		}
+	}
+
+	/* show how long this backend waited on stripe reads */
+	if (explainState->analyze && scanState->fdw_state != NULL)
+	{
+		TableReadState *readState = (TableReadState *) scanState->fdw_state;
+		double readWaitTime = INSTR_TIME_GET_MILLISEC(readState->readWaitTime);
+
+		ExplainPropertyLong("CStore Stripes Read", (long) readState->readStripeCount,
+							explainState);
+		ExplainPropertyLong("CStore Stripes Skipped",
+							(long) readState->skippedStripeCount, explainState);
+		if (explainState->timing)
+		{
+			ExplainPropertyMilliseconds("CStore Read Wait Time", readWaitTime,
+										explainState);
+		}
+	}
 }
 
 
@@ -1957,11 +3109,12 @@ CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags)
 	Oid foreignTableId = InvalidOid;
 	CStoreFdwOptions *cstoreFdwOptions = NULL;
 	Relation currentRelation = scanState->ss.ss_currentRelation;
-	TupleDesc tupleDescriptor = RelationGetDescr(currentRelation);
+	TupleDesc tupleDescriptor = NULL;
 	List *columnList = NIL;
 	ForeignScan *foreignScan = NULL;
 	List *foreignPrivateList = NIL;
 	List *whereClauseList = NIL;
+	List *pushdownClauseList = NIL;
 
 	/* if Explain with no Analyze, do nothing */
 	if (executorFlags & EXEC_FLAG_EXPLAIN_ONLY)
@@ -1969,16 +3122,33 @@ CStoreBeginForeignScan(ForeignScanState *scanState, int executorFlags)
 		return;
 	}
 
-	foreignTableId = RelationGetRelid(scanState->ss.ss_currentRelation);
+	foreignTableId = ForeignScanRelationId(scanState);
 	cstoreFdwOptions = CStoreGetOptions(foreignTableId);
 
 	foreignScan = (ForeignScan *) scanState->ss.ps.plan;
 	foreignPrivateList = (List *) foreignScan->fdw_private;
-	whereClauseList = foreignScan->scan.plan.qual;
+	whereClauseList = ScanWhereClauseList(foreignScan);
 
 	columnList = (List *) linitial(foreignPrivateList);
+	pushdownClauseList = (List *) lsecond(foreignPrivateList);
+
+	/*
+	 * Aggregate scans have no scan relation, so we copy the table's descriptor.
+	 * The executor already holds a lock on the table.
+	 */
+	if (currentRelation != NULL)
+	{
+		tupleDescriptor = RelationGetDescr(currentRelation);
+	}
+	else
+	{
+		Relation relation = heap_open(foreignTableId, AccessShareLock);
+		tupleDescriptor = CreateTupleDescCopy(RelationGetDescr(relation));
+		heap_close(relation, NoLock);
+	}
+
 	readState = CStoreBeginRead(cstoreFdwOptions->filename, tupleDescriptor,
-								columnList, whereClauseList);
+								columnList, whereClauseList, pushdownClauseList);
 
 	scanState->fdw_state = (void *) readState;
 }
@@ -1993,26 +3163,111 @@ static TupleTableSlot *
 CStoreIterateForeignScan(ForeignScanState *scanState)
 {
 	TableReadState *readState = (TableReadState *) scanState->fdw_state;
+	TableReadBatch *readBatch = &readState->readBatch;
 	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
-	bool nextRowFound = false;
 
 	TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
 	Datum *columnValues = tupleSlot->tts_values;
 	bool *columnNulls = tupleSlot->tts_isnull;
 	uint32 columnCount = tupleDescriptor->natts;
 
-	/* initialize all values for this row to null */
-	memset(columnValues, 0, columnCount * sizeof(Datum));
-	memset(columnNulls, true, columnCount * sizeof(bool));
+	if (scanState->ss.ss_currentRelation == NULL)
+	{
+		return IterateAggregateScan(scanState);
+	}
+
+	ExecClearTuple(tupleSlot);
+
+	if (readState->readBatchRowIndex >= readBatch->rowCount)
+	{
+		bool batchFound = CStoreReadNextBatch(readState, readBatch);
+
+		/* rows removed by the reader show up as removed by the scan's filter */
+		InstrCountFiltered1(scanState, readBatch->filteredRowCount);
+
+		if (!batchFound)
+		{
+			return tupleSlot;
+		}
+
+		readState->readBatchRowIndex = 0;
+
+		/*
+		 * Initialize all values to null once per batch. Rows in the batch only
+		 * overwrite the entries of projected columns.
+		 */
+		memset(columnValues, 0, columnCount * sizeof(Datum));
+		memset(columnNulls, true, columnCount * sizeof(bool));
+	}
+
+	CStoreReadBatchRow(readBatch, readState->readBatchRowIndex,
+					   columnValues, columnNulls);
+	readState->readBatchRowIndex++;
+
+	ExecStoreVirtualTuple(tupleSlot);
+
+	return tupleSlot;
+}
+
+
+/*
+ * IterateAggregateScan has the reader compute the aggregates of an aggregate
+ * scan, and returns them as the scan's only tuple.
+ */
+static TupleTableSlot *
+IterateAggregateScan(ForeignScanState *scanState)
+{
+	TableReadState *readState = (TableReadState *) scanState->fdw_state;
+	TupleTableSlot *tupleSlot = scanState->ss.ss_ScanTupleSlot;
+	ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+	List *aggregatePrivateList = (List *) lthird(foreignScan->fdw_private);
+	List *aggregateTypeList = (List *) lsecond(aggregatePrivateList);
+	List *aggregateColumnList = (List *) lthird(aggregatePrivateList);
+	uint32 aggregateCount = list_length(aggregateTypeList);
+	ColumnAggregate *aggregateArray = NULL;
+	uint32 aggregateIndex = 0;
+	ListCell *aggregateTypeCell = NULL;
+	ListCell *aggregateColumnCell = NULL;
+
+	ExecClearTuple(tupleSlot);
+
+	if (CStoreReadFinished(readState))
+	{
+		return tupleSlot;
+	}
+
+	aggregateArray = palloc0(aggregateCount * sizeof(ColumnAggregate));
+	forboth(aggregateTypeCell, aggregateTypeList, aggregateColumnCell,
+			aggregateColumnList)
+	{
+		ColumnAggregate *aggregate = &aggregateArray[aggregateIndex];
+
+		aggregate->aggregateType = (ColumnAggregateType) lfirst_int(aggregateTypeCell);
+		aggregate->columnIndex = (uint32) lfirst_int(aggregateColumnCell);
+		aggregateIndex++;
+	}
 
-	ExecClearTuple(tupleSlot);
+	CStoreReadAggregates(readState, aggregateArray, aggregateCount);
 
-	nextRowFound = CStoreReadNextRow(readState, columnValues, columnNulls);
-	if (nextRowFound)
+	for (aggregateIndex = 0; aggregateIndex < aggregateCount; aggregateIndex++)
 	{
-		ExecStoreVirtualTuple(tupleSlot);
+		ColumnAggregate *aggregate = &aggregateArray[aggregateIndex];
+
+		if (aggregate->aggregateType == AGGREGATE_COUNT_ROWS ||
+			aggregate->aggregateType == AGGREGATE_COUNT_VALUES)
+		{
+			tupleSlot->tts_values[aggregateIndex] = Int64GetDatum(aggregate->valueCount);
+			tupleSlot->tts_isnull[aggregateIndex] = false;
+		}
+		else
+		{
+			tupleSlot->tts_values[aggregateIndex] = aggregate->value;
+			tupleSlot->tts_isnull[aggregateIndex] = !aggregate->hasValue;
+		}
 	}
 
+	ExecStoreVirtualTuple(tupleSlot);
+
 	return tupleSlot;
 }
 
@@ -2029,12 +3284,100 @@ CStoreEndForeignScan(ForeignScanState *scanState)
 }
 
 
-/* CStoreReScanForeignScan rescans the foreign table. */
+/*
+ * ScanWhereClauseList returns the clauses that the reader uses for skipping row
+ * blocks. These are the pushed down clauses, which the executor doesn't check
+ * again if the reader evaluates them exactly, and the rest of the plan node's
+ * qual list. Aggregate scans only have pushed down clauses.
+ */
+static List *
+ScanWhereClauseList(ForeignScan *foreignScan)
+{
+	List *pushdownClauseList = (List *) lsecond(foreignScan->fdw_private);
+	List *qualClauseList = foreignScan->scan.plan.qual;
+
+	return list_concat_unique(list_copy(pushdownClauseList), qualClauseList);
+}
+
+
+/*
+ * CStoreReScanForeignScan rescans the foreign table. The read state keeps the
+ * open file and its footer, and only compiles the scan's clauses again for
+ * skipping stripes and blocks. Clauses of parameterized scans get the current
+ * values of the executor parameters, which for a nested loop join come from
+ * the new outer row. If this is a parallel scan, the read state keeps claiming
+ * stripes from the same dispenser, which the executor resets through
+ * CStoreReInitializeDSMForeignScan().
+ */
 static void
 CStoreReScanForeignScan(ForeignScanState *scanState)
 {
-	CStoreEndForeignScan(scanState);
-	CStoreBeginForeignScan(scanState, 0);
+	TableReadState *readState = (TableReadState *) scanState->fdw_state;
+	ForeignScan *foreignScan = (ForeignScan *) scanState->ss.ps.plan;
+	ExprContext *exprContext = scanState->ss.ps.ps_ExprContext;
+	List *whereClauseList = NIL;
+	List *parameterClauseList = foreignScan->fdw_exprs;
+	MemoryContext oldContext = NULL;
+
+	if (readState == NULL)
+	{
+		return;
+	}
+
+	/* the reader copies the clauses, so they only need to live until then */
+	oldContext = MemoryContextSwitchTo(exprContext->ecxt_per_tuple_memory);
+	whereClauseList = ScanWhereClauseList(foreignScan);
+	whereClauseList = (List *) ParameterValueMutator((Node *) whereClauseList,
+													 (void *) exprContext);
+	parameterClauseList = (List *) ParameterValueMutator((Node *) parameterClauseList,
+														 (void *) exprContext);
+	MemoryContextSwitchTo(oldContext);
+
+	CStoreRescanRead(readState, whereClauseList, parameterClauseList);
+}
+
+
+/*
+ * ParameterValueMutator replaces the executor parameters in the given clauses
+ * with constants of their current values, so that the reader can compile the
+ * clauses into bounds and bloom filter probes. Parameters set by init plans are
+ * computed on first use, like the executor does when evaluating them.
+ */
+static Node *
+ParameterValueMutator(Node *node, void *exprContext)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(node, Param) && ((Param *) node)->paramkind == PARAM_EXEC)
+	{
+		Param *parameter = (Param *) node;
+		ExprContext *parameterContext = (ExprContext *) exprContext;
+		ParamExecData *parameterData =
+			&(parameterContext->ecxt_param_exec_vals[parameter->paramid]);
+		int16 typeLength = 0;
+		bool typeByValue = false;
+		Datum parameterValue = 0;
+
+		if (parameterData->execPlan != NULL)
+		{
+			ExecSetParamPlan((SubPlanState *) parameterData->execPlan, parameterContext);
+		}
+
+		get_typlenbyval(parameter->paramtype, &typeLength, &typeByValue);
+		if (!parameterData->isnull)
+		{
+			parameterValue = datumCopy(parameterData->value, typeByValue, typeLength);
+		}
+
+		return (Node *) makeConst(parameter->paramtype, parameter->paramtypmod,
+								  parameter->paramcollid, typeLength, parameterValue,
+								  parameterData->isnull, typeByValue);
+	}
+
+	return expression_tree_mutator(node, ParameterValueMutator, exprContext);
 }
 
 
@@ -2088,11 +3431,10 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
 	double rowCount = 0.0;
 	double rowCountToSkip = -1;	/* -1 means not set yet */
 	double selectionState = 0;
-	MemoryContext oldContext = CurrentMemoryContext;
-	MemoryContext tupleContext = NULL;
 	Datum *columnValues = NULL;
 	bool *columnNulls = NULL;
-	TupleTableSlot *scanTupleSlot = NULL;
+	TableReadState *readState = NULL;
+	TableReadBatch readBatch;
 	List *columnList = NIL;
 	List *foreignPrivateList = NULL;
 	ForeignScanState *scanState = NULL;
@@ -2120,113 +3462,99 @@ CStoreAcquireSampleRows(Relation relation, int logLevel,
 	}
 
 	/* setup foreign scan plan node */
-	foreignPrivateList = list_make1(columnList);
+	foreignPrivateList = list_make2(columnList, NIL);
 	foreignScan = makeNode(ForeignScan);
 	foreignScan->fdw_private = foreignPrivateList;
 
-	/* set up tuple slot */
+	/* dropped columns stay null, other entries are set for each sampled row */
 	columnValues = palloc0(columnCount * sizeof(Datum));
 	columnNulls = palloc0(columnCount * sizeof(bool));
-#if PG_VERSION_NUM >= 120000
-	scanTupleSlot = MakeTupleTableSlot(NULL, &TTSOpsVirtual);
-#elif PG_VERSION_NUM >= 110000
-	scanTupleSlot = MakeTupleTableSlot(NULL);
-#else
-	scanTupleSlot = MakeTupleTableSlot();
-#endif
-	scanTupleSlot->tts_tupleDescriptor = tupleDescriptor;
-	scanTupleSlot->tts_values = columnValues;
-	scanTupleSlot->tts_isnull = columnNulls;
+	memset(columnNulls, true, columnCount * sizeof(bool));
 
 	/* setup scan state */
 	scanState = makeNode(ForeignScanState);
 	scanState->ss.ss_currentRelation = relation;
 	scanState->ss.ps.plan = (Plan *) foreignScan;
-	scanState->ss.ss_ScanTupleSlot = scanTupleSlot;
-
-	/*
-	 * Use per-tuple memory context to prevent leak of memory used to read and
-	 * parse rows from the file.
-	 */
-	tupleContext = AllocSetContextCreate(CurrentMemoryContext,
-										 "cstore_fdw temporary context",
-										 ALLOCSET_DEFAULT_SIZES);
 
 	CStoreBeginForeignScan(scanState, executorFlags);
+	readState = (TableReadState *) scanState->fdw_state;
 
 	/* prepare for sampling rows */
 	selectionState = anl_init_selection_state(targetRowCount);
 
-	for (;;)
+	/*
+	 * Read rows in batches. Stripe and block data are allocated in the read
+	 * state's own memory context, so only rows picked for the sample are
+	 * copied out of the batch and formed into tuples.
+	 */
+	memset(&readBatch, 0, sizeof(TableReadBatch));
+	while (CStoreReadNextBatch(readState, &readBatch))
 	{
-		/* check for user-requested abort or sleep */
-		vacuum_delay_point();
-
-		memset(columnValues, 0, columnCount * sizeof(Datum));
-		memset(columnNulls, true, columnCount * sizeof(bool));
-
-		MemoryContextReset(tupleContext);
-		MemoryContextSwitchTo(tupleContext);
-
-		/* read the next record */
-		CStoreIterateForeignScan(scanState);
-
-		MemoryContextSwitchTo(oldContext);
+		uint32 batchRowIndex = 0;
 
-		/* if there are no more records to read, break */
-		if (TTS_EMPTY(scanTupleSlot))
+		for (batchRowIndex = 0; batchRowIndex < readBatch.rowCount; batchRowIndex++)
 		{
-			break;
-		}
+			/* check for user-requested abort or sleep */
+			vacuum_delay_point();
 
-		/*
-		 * The first targetRowCount sample rows are simply copied into the
-		 * reservoir. Then we start replacing tuples in the sample until we
-		 * reach the end of the relation. This algorithm is from Jeff Vitter's
-		 * paper (see more info in commands/analyze.c).
-		 */
-		if (sampleRowCount < targetRowCount)
-		{
-			sampleRows[sampleRowCount] = heap_form_tuple(tupleDescriptor, columnValues,
-														 columnNulls);
-			sampleRowCount++;
-		}
-		else
-		{
 			/*
-			 * t in Vitter's paper is the number of records already processed.
-			 * If we need to compute a new S value, we must use the "not yet
-			 * incremented" value of rowCount as t.
+			 * The first targetRowCount sample rows are simply copied into the
+			 * reservoir. Then we start replacing tuples in the sample until we
+			 * reach the end of the relation. This algorithm is from Jeff Vitter's
+			 * paper (see more info in commands/analyze.c).
 			 */
-			if (rowCountToSkip < 0)
+			if (sampleRowCount < targetRowCount)
 			{
-				rowCountToSkip = anl_get_next_S(rowCount, targetRowCount,
-												&selectionState);
+				CStoreReadBatchRow(&readBatch, batchRowIndex, columnValues, columnNulls);
+				sampleRows[sampleRowCount] = heap_form_tuple(tupleDescriptor,
+															 columnValues, columnNulls);
+				sampleRowCount++;
 			}
-
-			if (rowCountToSkip <= 0)
+			else
 			{
 				/*
-				 * Found a suitable tuple, so save it, replacing one old tuple
-				 * at random.
+				 * t in Vitter's paper is the number of records already processed.
+				 * If we need to compute a new S value, we must use the "not yet
+				 * incremented" value of rowCount as t.
 				 */
-				int rowIndex = (int) (targetRowCount * anl_random_fract());
-				Assert(rowIndex >= 0);
-				Assert(rowIndex < targetRowCount);
+				if (rowCountToSkip < 0)
+				{
+					rowCountToSkip = anl_get_next_S(rowCount, targetRowCount,
+													&selectionState);
+				}
 
-				heap_freetuple(sampleRows[rowIndex]);
-				sampleRows[rowIndex] = heap_form_tuple(tupleDescriptor,
-													   columnValues, columnNulls);
+				if (rowCountToSkip <= 0)
+				{
+					/*
+					 * Found a suitable tuple, so save it, replacing one old tuple
+					 * at random.
+					 */
+					int rowIndex = (int) (targetRowCount * anl_random_fract());
+					Assert(rowIndex >= 0);
+					Assert(rowIndex < targetRowCount);
+
+					CStoreReadBatchRow(&readBatch, batchRowIndex,
+									   columnValues, columnNulls);
+
+					heap_freetuple(sampleRows[rowIndex]);
+					sampleRows[rowIndex] = heap_form_tuple(tupleDescriptor,
+														   columnValues, columnNulls);
+				}
+
+				rowCountToSkip--;
 			}
 
-			rowCountToSkip--;
+			rowCount++;
 		}
-
-		rowCount++;
 	}
 
 	/* clean up */
-	MemoryContextDelete(tupleContext);
+	if (readBatch.columnValues != NULL)
+	{
+		pfree(readBatch.columnValues);
+		pfree(readBatch.columnExists);
+	}
+
 	pfree(columnValues);
 	pfree(columnNulls);
 
@@ -2320,6 +3648,7 @@ CStoreBeginForeignInsert(ModifyTableState *modifyTableState, ResultRelInfo *rela
 {
 	Oid  foreignTableOid = InvalidOid;
 	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	ColumnOptions *columnOptionsArray = NULL;
 	TupleDesc tupleDescriptor = NULL;
 	TableWriteState *writeState = NULL;
 	Relation relation = NULL;
@@ -2327,10 +3656,13 @@ CStoreBeginForeignInsert(ModifyTableState *modifyTableState, ResultRelInfo *rela
 	foreignTableOid = RelationGetRelid(relationInfo->ri_RelationDesc);
 	relation = heap_open(foreignTableOid, ShareUpdateExclusiveLock);
 	cstoreFdwOptions = CStoreGetOptions(foreignTableOid);
+	columnOptionsArray = CStoreGetColumnOptions(foreignTableOid,
+												cstoreFdwOptions->compressionType,
+												cstoreFdwOptions->compressionLevel);
 	tupleDescriptor = RelationGetDescr(relationInfo->ri_RelationDesc);
 
 	writeState = CStoreBeginWrite(cstoreFdwOptions->filename,
-								  cstoreFdwOptions->compressionType,
+								  columnOptionsArray,
 								  cstoreFdwOptions->stripeRowCount,
 								  cstoreFdwOptions->blockRowCount,
 								  tupleDescriptor);
@@ -2406,8 +3738,8 @@ CStoreEndForeignInsert(EState *executorState, ResultRelInfo *relationInfo)
 /*
  * CStoreIsForeignScanParallelSafe always returns true to indicate that
  * reading from a cstore_fdw table in a parallel worker is safe. This
- * does not enable parallelism for queries on individual cstore_fdw
- * tables, but does allow parallel scans of cstore_fdw partitions.
+ * allows parallel scans of cstore_fdw partitions, and on PostgreSQL 10
+ * and later, partial paths in which workers split a table's stripes.
  *
  * cstore_fdw is parallel-safe because all writes are immediately committed
  * to disk and then read from disk. There is no uncommitted state that needs
@@ -2419,4 +3751,353 @@ CStoreIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
 {
 	return true;
 }
+
+
+/*
+ * CStoreGetForeignUpperPaths adds a path that computes the query's aggregates
+ * within the foreign scan. We only do this for queries without grouping that
+ * aggregate a single cstore table with count(*), count(column), min(column) and
+ * max(column), and whose restriction clauses are all evaluated by the reader.
+ * The reader answers these aggregates from block skip lists, and decompresses
+ * only the blocks whose min/max values neither refute nor imply the clauses.
+ */
+#if PG_VERSION_NUM >= 110000
+static void
+CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+						   RelOptInfo *inputRel, RelOptInfo *outputRel, void *extra)
+#else
+static void
+CStoreGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+						   RelOptInfo *inputRel, RelOptInfo *outputRel)
+#endif
+{
+	Query *query = root->parse;
+	PathTarget *groupingTarget = root->upper_targets[UPPERREL_GROUP_AGG];
+	RangeTblEntry *rangeTableEntry = NULL;
+	Oid foreignTableId = InvalidOid;
+	Relation relation = NULL;
+	TupleDesc tupleDescriptor = NULL;
+	CStoreFdwOptions *cstoreFdwOptions = NULL;
+	List *aggregateTypeList = NIL;
+	List *aggregateColumnList = NIL;
+	List *pushdownClauseList = NIL;
+	List *columnList = NIL;
+	List *aggregatePrivateList = NIL;
+	List *foreignPrivateList = NIL;
+	ListCell *targetExprCell = NULL;
+	ListCell *restrictInfoCell = NULL;
+	bool aggregatesSupported = true;
+	Path *aggregateScanPath = NULL;
+	double tupleCountEstimate = 0.0;
+	double stripeCountEstimate = 0.0;
+	double blockCountEstimate = 0.0;
+	double boundaryRowEstimate = 0.0;
+	double startupCost = 0.0;
+	double totalCost = 0.0;
+
+	if (!EnableAggregatePushdown || stage != UPPERREL_GROUP_AGG ||
+		inputRel->reloptkind != RELOPT_BASEREL)
+	{
+		return;
+	}
+
+	if (query->groupClause != NIL || query->groupingSets != NIL ||
+		query->havingQual != NULL)
+	{
+		return;
+	}
+
+	/* inheritance parents also need their children's rows */
+	rangeTableEntry = planner_rt_fetch(inputRel->relid, root);
+	if (rangeTableEntry->inh)
+	{
+		return;
+	}
+
+	foreignTableId = rangeTableEntry->relid;
+	relation = heap_open(foreignTableId, AccessShareLock);
+	tupleDescriptor = RelationGetDescr(relation);
+
+	foreach(targetExprCell, groupingTarget->exprs)
+	{
+		Node *targetExpr = (Node *) lfirst(targetExprCell);
+		ColumnAggregateType aggregateType = AGGREGATE_COUNT_ROWS;
+		uint32 columnIndex = 0;
+
+		if (!SupportedAggregate(targetExpr, tupleDescriptor, &aggregateType,
+								&columnIndex))
+		{
+			aggregatesSupported = false;
+			break;
+		}
+
+		aggregateTypeList = lappend_int(aggregateTypeList, (int) aggregateType);
+		aggregateColumnList = lappend_int(aggregateColumnList, (int) columnIndex);
+	}
+
+	/*
+	 * There is no filter above the aggregate scan, so the reader has to
+	 * evaluate every restriction clause. Like in CStoreGetForeignPlan(), we
+	 * don't evaluate clauses of security barrier views early unless they are
+	 * leakproof.
+	 */
+	foreach(restrictInfoCell, inputRel->baserestrictinfo)
+	{
+		RestrictInfo *restrictInfo = (RestrictInfo *) lfirst(restrictInfoCell);
+		Node *clause = (Node *) restrictInfo->clause;
+
+		if (!aggregatesSupported)
+		{
+			break;
+		}
+
+		if (restrictInfo->pseudoconstant ||
+			!CStorePredicateSupported(clause, tupleDescriptor))
+		{
+			aggregatesSupported = false;
+			break;
+		}
+
+#if PG_VERSION_NUM >= 100000
+		if (restrictInfo->security_level > inputRel->baserestrict_min_security &&
+			contain_leaked_vars(clause))
+		{
+			aggregatesSupported = false;
+			break;
+		}
+#endif
+
+		pushdownClauseList = lappend(pushdownClauseList, clause);
+	}
+
+	heap_close(relation, AccessShareLock);
+
+	if (!aggregatesSupported)
+	{
+		return;
+	}
+
+	/*
+	 * The aggregate scan reads the skip lists of every stripe and visits every
+	 * block's skip node. Blocks that straddle a clause's boundary still need to
+	 * be read and filtered, and we assume each clause leaves about one such
+	 * block per stripe.
+	 */
+	cstoreFdwOptions = CStoreGetOptions(foreignTableId);
+	tupleCountEstimate = TupleCountEstimate(inputRel, cstoreFdwOptions->filename);
+	stripeCountEstimate = ceil(tupleCountEstimate / cstoreFdwOptions->stripeRowCount);
+	blockCountEstimate = ceil(tupleCountEstimate / cstoreFdwOptions->blockRowCount);
+	boundaryRowEstimate = stripeCountEstimate * cstoreFdwOptions->blockRowCount *
+						  list_length(pushdownClauseList);
+	boundaryRowEstimate = Min(boundaryRowEstimate, tupleCountEstimate);
+
+	startupCost = (seq_page_cost * stripeCountEstimate) +
+				  (cpu_operator_cost * blockCountEstimate);
+	startupCost += (cpu_tuple_cost + inputRel->baserestrictcost.per_tuple) *
+				   boundaryRowEstimate * CSTORE_TUPLE_COST_MULTIPLIER;
+	totalCost = startupCost + cpu_tuple_cost;
+
+	columnList = ColumnList(inputRel, foreignTableId);
+	aggregatePrivateList = list_make3(list_make1_oid(foreignTableId),
+									  aggregateTypeList, aggregateColumnList);
+	foreignPrivateList = list_make3(columnList, pushdownClauseList,
+									aggregatePrivateList);
+
+#if PG_VERSION_NUM >= 120000
+	aggregateScanPath = (Path *) create_foreign_upper_path(root, outputRel,
+														   groupingTarget,
+														   1, /* single row */
+														   startupCost, totalCost,
+														   NIL,  /* no pathkeys */
+														   NULL, /* no outer path */
+														   foreignPrivateList);
+#else
+	aggregateScanPath = (Path *) create_foreignscan_path(root, outputRel,
+														 groupingTarget,
+														 1, /* single row */
+														 startupCost, totalCost,
+														 NIL,  /* no pathkeys */
+														 NULL, /* not parameterized */
+														 NULL, /* no outer path */
+														 foreignPrivateList);
+#endif
+
+	add_path(outputRel, aggregateScanPath);
+}
+
+
+/*
+ * SupportedAggregate checks whether the given target expression is a count(*),
+ * count(column), min(column) or max(column) aggregate that the reader computes
+ * itself, and if so, sets the aggregate's type and column index. Like planagg.c,
+ * we recognize min and max aggregates by their sort operator.
+ */
+static bool
+SupportedAggregate(Node *targetExpr, TupleDesc tupleDescriptor,
+				   ColumnAggregateType *aggregateType, uint32 *columnIndex)
+{
+	Aggref *aggregate = NULL;
+	TargetEntry *argumentEntry = NULL;
+	Node *argument = NULL;
+	Var *column = NULL;
+	Form_pg_attribute attributeForm = NULL;
+	HeapTuple aggregateTuple = NULL;
+	Oid sortOperatorId = InvalidOid;
+	TypeCacheEntry *typeCacheEntry = NULL;
+
+	if (!IsA(targetExpr, Aggref))
+	{
+		return false;
+	}
+
+	aggregate = (Aggref *) targetExpr;
+	if (aggregate->aggdistinct != NIL || aggregate->aggorder != NIL ||
+		aggregate->aggfilter != NULL || aggregate->aggdirectargs != NIL ||
+		aggregate->aggkind != AGGKIND_NORMAL || aggregate->agglevelsup != 0 ||
+		aggregate->aggsplit != AGGSPLIT_SIMPLE)
+	{
+		return false;
+	}
+
+	if (aggregate->aggfnoid == COUNT_STAR_FUNCTION_OID)
+	{
+		*aggregateType = AGGREGATE_COUNT_ROWS;
+		*columnIndex = 0;
+		return true;
+	}
+
+	if (list_length(aggregate->args) != 1)
+	{
+		return false;
+	}
+
+	argumentEntry = (TargetEntry *) linitial(aggregate->args);
+	argument = (Node *) argumentEntry->expr;
+	if (IsA(argument, RelabelType))
+	{
+		argument = (Node *) ((RelabelType *) argument)->arg;
+	}
+
+	if (!IsA(argument, Var))
+	{
+		return false;
+	}
+
+	column = (Var *) argument;
+	if (column->varattno <= 0 || column->varlevelsup != 0)
+	{
+		return false;
+	}
+
+	attributeForm = TupleDescAttr(tupleDescriptor, column->varattno - 1);
+	*columnIndex = column->varattno - 1;
+
+	if (aggregate->aggfnoid == COUNT_ANY_FUNCTION_OID)
+	{
+		*aggregateType = AGGREGATE_COUNT_VALUES;
+		return true;
+	}
+
+	aggregateTuple = SearchSysCache1(AGGFNOID, ObjectIdGetDatum(aggregate->aggfnoid));
+	if (!HeapTupleIsValid(aggregateTuple))
+	{
+		return false;
+	}
+
+	sortOperatorId = ((Form_pg_aggregate) GETSTRUCT(aggregateTuple))->aggsortop;
+	ReleaseSysCache(aggregateTuple);
+
+	/*
+	 * Skip lists and the reader order values with the default btree operator
+	 * class of the column's type, using the column's collation. So the
+	 * aggregate's sort operator and collation need to match these.
+	 */
+	if (sortOperatorId == InvalidOid ||
+		aggregate->inputcollid != attributeForm->attcollation ||
+		!IsBinaryCoercible(attributeForm->atttypid, aggregate->aggtype) ||
+		GetFunctionInfoOrNull(attributeForm->atttypid, BTREE_AM_OID,
+							  BTORDER_PROC) == NULL)
+	{
+		return false;
+	}
+
+	typeCacheEntry = lookup_type_cache(attributeForm->atttypid,
+									   TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+	if (sortOperatorId == typeCacheEntry->lt_opr)
+	{
+		*aggregateType = AGGREGATE_MINIMUM;
+	}
+	else if (sortOperatorId == typeCacheEntry->gt_opr)
+	{
+		*aggregateType = AGGREGATE_MAXIMUM;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+
+#if PG_VERSION_NUM >= 100000
+/*
+ * CStoreEstimateDSMForeignScan returns the size of dynamic shared memory needed
+ * to coordinate a parallel scan, which is the shared stripe dispenser.
+ */
+static Size
+CStoreEstimateDSMForeignScan(ForeignScanState *scanState,
+							 ParallelContext *parallelContext)
+{
+	return sizeof(SharedStripeDispenser);
+}
+
+
+/*
+ * CStoreInitializeDSMForeignScan initializes the shared stripe dispenser in the
+ * leader, and attaches the leader's read state to it. The dispenser records the
+ * leader's stripe count, so that workers don't read stripes appended afterwards.
+ */
+static void
+CStoreInitializeDSMForeignScan(ForeignScanState *scanState,
+							   ParallelContext *parallelContext, void *coordinate)
+{
+	TableReadState *readState = (TableReadState *) scanState->fdw_state;
+	SharedStripeDispenser *stripeDispenser = (SharedStripeDispenser *) coordinate;
+	List *stripeMetadataList = readState->tableFooter->stripeMetadataList;
+
+	pg_atomic_init_u32(&stripeDispenser->nextStripeIndex, 0);
+	stripeDispenser->stripeCount = list_length(stripeMetadataList);
+
+	readState->stripeDispenser = stripeDispenser;
+}
+
+
+/*
+ * CStoreReInitializeDSMForeignScan resets the shared stripe dispenser so that
+ * the scan can be restarted from the first stripe.
+ */
+static void
+CStoreReInitializeDSMForeignScan(ForeignScanState *scanState,
+								 ParallelContext *parallelContext, void *coordinate)
+{
+	SharedStripeDispenser *stripeDispenser = (SharedStripeDispenser *) coordinate;
+
+	pg_atomic_write_u32(&stripeDispenser->nextStripeIndex, 0);
+}
+
+
+/*
+ * CStoreInitializeWorkerForeignScan attaches a parallel worker's read state to
+ * the stripe dispenser the leader set up in dynamic shared memory.
+ */
+static void
+CStoreInitializeWorkerForeignScan(ForeignScanState *scanState, shm_toc *toc,
+								  void *coordinate)
+{
+	TableReadState *readState = (TableReadState *) scanState->fdw_state;
+
+	readState->stripeDispenser = (SharedStripeDispenser *) coordinate;
+}
 #endif
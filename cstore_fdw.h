@@ -20,6 +20,10 @@
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
 #include "lib/stringinfo.h"
+#include "portability/instr_time.h"
+#if PG_VERSION_NUM >= 100000
+#include "port/atomics.h"
+#endif
 #include "utils/rel.h"
 
 
@@ -28,29 +32,55 @@
 #define OPTION_NAME_COMPRESSION_TYPE "compression"
 #define OPTION_NAME_STRIPE_ROW_COUNT "stripe_row_count"
 #define OPTION_NAME_BLOCK_ROW_COUNT "block_row_count"
+#define OPTION_NAME_COMPRESSION_LEVEL "compression_level"
+#define OPTION_NAME_ENCODING "encoding"
+#define OPTION_NAME_BLOOM_FILTER "bloom_filter"
 
 /* Default values for option parameters */
 #define DEFAULT_COMPRESSION_TYPE COMPRESSION_NONE
 #define DEFAULT_STRIPE_ROW_COUNT 150000
 #define DEFAULT_BLOCK_ROW_COUNT 10000
+#define DEFAULT_COMPRESSION_LEVEL 0
 
 /* Limits for option parameters */
 #define STRIPE_ROW_COUNT_MINIMUM 1000
 #define STRIPE_ROW_COUNT_MAXIMUM 10000000
 #define BLOCK_ROW_COUNT_MINIMUM 1000
 #define BLOCK_ROW_COUNT_MAXIMUM 100000
+#define COMPRESSION_LEVEL_MINIMUM 1
+#define DEFLATE_COMPRESSION_LEVEL_MAXIMUM 9
+#define LZ4_COMPRESSION_LEVEL_MAXIMUM 12
+#define ZSTD_COMPRESSION_LEVEL_MAXIMUM 22
+
+/* Defaults and limits for configuration parameters, sizes are in kB */
+#define DEFAULT_READ_COALESCE_GAP 64
+#define READ_COALESCE_GAP_MAXIMUM (1024 * 1024)
+#define MAX_COALESCED_READ_SIZE (16 * 1024 * 1024)
+#define DEFAULT_PREFETCH_DEPTH 1
+#define PREFETCH_DEPTH_MAXIMUM 64
 
 /* String representations of compression types */
 #define COMPRESSION_STRING_NONE "none"
 #define COMPRESSION_STRING_PG_LZ "pglz"
 #define COMPRESSION_STRING_SNAPPY "snappy"
 #define COMPRESSION_STRING_DEFLATE "deflate"
-#define COMPRESSION_STRING_DELIMITED_LIST "none, pglz, snappy, deflate"
+#define COMPRESSION_STRING_LZ4 "lz4"
+#define COMPRESSION_STRING_ZSTD "zstd"
+#define COMPRESSION_STRING_AUTO "auto"
+#define COMPRESSION_STRING_DELIMITED_LIST "none, pglz, snappy, deflate, lz4, zstd, auto"
+
+/* String representations of column encoding options */
+#define ENCODING_STRING_AUTO "auto"
+#define ENCODING_STRING_NONE "none"
+#define ENCODING_STRING_DICTIONARY "dict"
+#define ENCODING_STRING_RUN_LENGTH "rle"
+#define ENCODING_STRING_BIT_PACKED "bitpack"
+#define ENCODING_STRING_DELIMITED_LIST "auto, none, dict, rle, bitpack"
 
 /* CStore file signature */
 #define CSTORE_MAGIC_NUMBER "citus_cstore"
 #define CSTORE_VERSION_MAJOR 1
-#define CSTORE_VERSION_MINOR 7
+#define CSTORE_VERSION_MINOR 8
 
 /* miscellaneous defines */
 #define CSTORE_FDW_NAME "cstore_fdw"
@@ -59,6 +89,19 @@
 #define CSTORE_TUPLE_COST_MULTIPLIER 10
 #define CSTORE_POSTSCRIPT_SIZE_LENGTH 1
 #define CSTORE_POSTSCRIPT_SIZE_MAX 256
+#define CSTORE_DIRECT_IO_ALIGNMENT 4096
+#define CSTORE_DIRECT_WRITE_BUFFER_SIZE (8 * 1024 * 1024)
+
+/* bloom filter parameters, for a false positive rate of about one percent */
+#define BLOOM_FILTER_BITS_PER_VALUE 10
+#define BLOOM_FILTER_HASH_COUNT 7
+#define BLOOM_FILTER_MINIMUM_BIT_COUNT 64
+#define BLOOM_FILTER_MAXIMUM_BIT_COUNT (1024 * 1024)
+#define BLOOM_FILTER_FALSE_POSITIVE_RATE 0.01
+
+/* aggregate functions whose results the reader can compute itself */
+#define COUNT_ANY_FUNCTION_OID 2147
+#define COUNT_STAR_FUNCTION_OID 2803
 
 /* table containing information about how to partition distributed tables */
 #define CITUS_EXTENSION_NAME "citus"
@@ -84,14 +127,21 @@ typedef struct CStoreValidOption
 
 
 /* Array of options that are valid for cstore_fdw */
-static const uint32 ValidOptionCount = 4;
+static const uint32 ValidOptionCount = 9;
 static const CStoreValidOption ValidOptionArray[] =
 {
 	/* foreign table options */
 	{ OPTION_NAME_FILENAME, ForeignTableRelationId },
 	{ OPTION_NAME_COMPRESSION_TYPE, ForeignTableRelationId },
 	{ OPTION_NAME_STRIPE_ROW_COUNT, ForeignTableRelationId },
-	{ OPTION_NAME_BLOCK_ROW_COUNT, ForeignTableRelationId }
+	{ OPTION_NAME_BLOCK_ROW_COUNT, ForeignTableRelationId },
+	{ OPTION_NAME_COMPRESSION_LEVEL, ForeignTableRelationId },
+
+	/* column options */
+	{ OPTION_NAME_COMPRESSION_TYPE, AttributeRelationId },
+	{ OPTION_NAME_COMPRESSION_LEVEL, AttributeRelationId },
+	{ OPTION_NAME_ENCODING, AttributeRelationId },
+	{ OPTION_NAME_BLOOM_FILTER, AttributeRelationId }
 };
 
 
@@ -103,12 +153,78 @@ typedef enum
 	COMPRESSION_PG_LZ = 1,
 	COMPRESSION_SNAPPY = 2,
 	COMPRESSION_DEFLATE = 3,
+	COMPRESSION_LZ4 = 4,
+	COMPRESSION_ZSTD = 5,
+
+	/* auto is only a write option, blocks record the compression it picked */
+	COMPRESSION_AUTO = 6,
 
 	COMPRESSION_COUNT
 
 } CompressionType;
 
 
+/*
+ * Enumeration for the objective that auto compression picks compression types
+ * by. Balanced estimates the time to read and decompress a block.
+ */
+typedef enum
+{
+	COMPRESSION_OBJECTIVE_SIZE = 0,
+	COMPRESSION_OBJECTIVE_DECODE_SPEED = 1,
+	COMPRESSION_OBJECTIVE_BALANCED = 2
+
+} CompressionObjective;
+
+
+/*
+ * Enumeration for the encoding of a column block's serialized values, which is
+ * applied before compression.
+ */
+typedef enum
+{
+	ENCODING_NONE = 0,
+	ENCODING_DICTIONARY = 1,
+	ENCODING_RUN_LENGTH = 2,
+	ENCODING_FRAME_OF_REFERENCE = 3,
+	ENCODING_DELTA = 4
+
+} EncodingType;
+
+
+/*
+ * Enumeration for a column's encoding option, which limits the encodings the
+ * writer considers for the column's blocks. With auto, the writer considers
+ * all encodings that apply to the column's type.
+ */
+typedef enum
+{
+	ENCODING_OPTION_INVALID = -1,
+	ENCODING_OPTION_AUTO = 0,
+	ENCODING_OPTION_NONE = 1,
+	ENCODING_OPTION_DICTIONARY = 2,
+	ENCODING_OPTION_RUN_LENGTH = 3,
+	ENCODING_OPTION_BIT_PACKED = 4
+
+} EncodingOption;
+
+
+/*
+ * ColumnOptions holds the compression and encoding options to use when writing
+ * a column. Options that aren't set on the column fall back to the table's.
+ * If bloomFilter is set, each block of the column gets a bloom filter of its
+ * values.
+ */
+typedef struct ColumnOptions
+{
+	CompressionType compressionType;
+	int compressionLevel;
+	EncodingOption encodingOption;
+	bool bloomFilter;
+
+} ColumnOptions;
+
+
 /*
  * CStoreFdwOptions holds the option values to be used when reading or writing
  * a cstore file. To resolve these values, we first check foreign table's options,
@@ -118,15 +234,36 @@ typedef struct CStoreFdwOptions
 {
 	char *filename;
 	CompressionType compressionType;
+	int compressionLevel;
 	uint64 stripeRowCount;
 	uint32 blockRowCount;
 
 } CStoreFdwOptions;
 
 
+/*
+ * ColumnStripeSkipNode contains statistics for a column across a whole stripe,
+ * rolled up from the column's block skip nodes. Table footers are read without
+ * knowing column types, so minimum and maximum values are kept in their
+ * serialized form, and are turned into datums with DeserializeDatum().
+ */
+typedef struct ColumnStripeSkipNode
+{
+	uint64 nullCount;
+	bool hasMinMax;
+	char *minimumValue;
+	uint32 minimumLength;
+	char *maximumValue;
+	uint32 maximumLength;
+
+} ColumnStripeSkipNode;
+
+
 /*
  * StripeMetadata represents information about a stripe. This information is
- * stored in the cstore file's footer.
+ * stored in the cstore file's footer. The row count and the column statistics
+ * let scans skip stripes without reading them. Stripes written by older
+ * versions don't have them, and have a NULL columnSkipNodeArray.
  */
 typedef struct StripeMetadata
 {
@@ -135,6 +272,10 @@ typedef struct StripeMetadata
 	uint64 dataLength;
 	uint64 footerLength;
 
+	uint64 rowCount;
+	uint32 columnCount;
+	ColumnStripeSkipNode *columnSkipNodeArray;
+
 } StripeMetadata;
 
 
@@ -167,6 +308,11 @@ typedef struct ColumnBlockSkipNode
 	uint64 existsLength;
 
 	CompressionType valueCompressionType;
+	EncodingType valueEncodingType;
+
+	/* bloom filter of the block's values, NULL if the column doesn't have one */
+	char *bloomFilter;
+	uint32 bloomFilterLength;
 
 } ColumnBlockSkipNode;
 
@@ -207,7 +353,8 @@ typedef struct ColumnBlockData
  * ColumnBlockBuffers represents a block of serialized data in a column.
  * valueBuffer stores the serialized values of data, and existsBuffer stores
  * serialized value of presence information. valueCompressionType contains
- * compression type if valueBuffer is compressed. Finally rowCount has
+ * compression type if valueBuffer is compressed, and valueEncodingType the
+ * encoding of the values underneath the compression. Finally rowCount has
  * the number of rows in this block.
  */
 typedef struct ColumnBlockBuffers
@@ -215,17 +362,25 @@ typedef struct ColumnBlockBuffers
 	StringInfo existsBuffer;
 	StringInfo valueBuffer;
 	CompressionType valueCompressionType;
+	EncodingType valueEncodingType;
+
+	/* position of the value block in the file, used as block cache key */
+	uint64 valueFileOffset;
 
 } ColumnBlockBuffers;
 
 
 /*
  * ColumnBuffers represents data buffers for a column in a row stripe. Each
- * column is made of multiple column blocks.
+ * column is made of multiple column blocks. compressionDictionary holds the
+ * dictionary that the column's blocks in this stripe were compressed with, if
+ * any. nullCount is only kept while the stripe is written.
  */
 typedef struct ColumnBuffers
 {
 	ColumnBlockBuffers **blockBuffersArray;
+	StringInfo compressionDictionary;
+	uint64 nullCount;
 
 } ColumnBuffers;
 
@@ -243,7 +398,8 @@ typedef struct StripeBuffers
 /*
  * StripeFooter represents a stripe's footer. In this footer, we keep three
  * arrays of sizes. The number of elements in each of the arrays is equal
- * to the number of columns.
+ * to the number of columns. The footer also keeps each column's compression
+ * dictionary, which is NULL for columns compressed without one.
  */
 typedef struct StripeFooter
 {
@@ -251,10 +407,195 @@ typedef struct StripeFooter
 	uint64 *skipListSizeArray;
 	uint64 *existsSizeArray;
 	uint64 *valueSizeArray;
+	StringInfo *compressionDictionaryArray;
 
 } StripeFooter;
 
 
+#if PG_VERSION_NUM >= 100000
+/*
+ * SharedStripeDispenser lives in the dynamic shared memory of a parallel scan.
+ * Each participating backend claims the next unread stripe by atomically
+ * incrementing nextStripeIndex. The leader also records the stripe count it
+ * saw when the scan started, so that all participants read the same stripes
+ * even if a concurrent load appends new stripes to the file.
+ */
+typedef struct SharedStripeDispenser
+{
+	pg_atomic_uint32 nextStripeIndex;
+	uint32 stripeCount;
+
+} SharedStripeDispenser;
+#endif
+
+
+/* FileMapping describes a cstore file that is mapped into memory for reading. */
+typedef struct FileMapping
+{
+	char *address;
+	uint64 size;
+
+} FileMapping;
+
+
+/* ColumnPredicateType enumerates the kinds of predicates the reader evaluates. */
+typedef enum
+{
+	PREDICATE_COMPARISON = 0,
+	PREDICATE_ANY_ARRAY = 1,
+	PREDICATE_ALL_ARRAY = 2,
+	PREDICATE_IS_NULL = 3,
+	PREDICATE_IS_NOT_NULL = 4
+
+} ColumnPredicateType;
+
+
+/*
+ * ComparisonKernel enumerates the fixed-width value kinds that comparisons are
+ * evaluated on directly, without calling the operator's function.
+ */
+typedef enum
+{
+	COMPARISON_KERNEL_NONE = 0,
+	COMPARISON_KERNEL_INTEGER = 1,
+	COMPARISON_KERNEL_FLOAT = 2
+
+} ComparisonKernel;
+
+
+/*
+ * ColumnPredicate is a restriction clause on a single column that the reader
+ * evaluates natively over deserialized column blocks. Comparisons hold one
+ * constant, array predicates (IN lists) hold the array's non-null elements,
+ * and null tests hold no constants. The operator is called with the constant
+ * as its first argument if constantFirst is set.
+ *
+ * strategyNumber is the comparison's btree strategy for the column's default
+ * ordering, with the column on the left; it is zero if the comparison doesn't
+ * follow the ordering of the column's min/max values in skip lists.
+ *
+ * Comparisons on integer, date, timestamp and float8 columns use a comparison
+ * kernel instead. The kernel compares each value against the constant, and
+ * looks up whether the row passes in comparisonResultMatches, indexed by the
+ * comparison's result plus one.
+ */
+typedef struct ColumnPredicate
+{
+	ColumnPredicateType predicateType;
+	uint32 columnIndex;
+	FmgrInfo operatorFunction;
+	Oid collationId;
+	bool constantFirst;
+	Datum *constantArray;
+	uint32 constantCount;
+	int16 strategyNumber;
+
+	ComparisonKernel comparisonKernel;
+	Oid columnTypeId;
+	int64 integerConstant;
+	float8 floatConstant;
+	bool comparisonResultMatches[3];
+
+} ColumnPredicate;
+
+
+/*
+ * ColumnBound is a comparison between a column and a constant, compiled from a
+ * restriction qualifier for skipping blocks and stripes by their min/max values.
+ * strategyNumber is the comparison's btree strategy with the column on the left,
+ * and comparisonFunction is the btree support function that compares a column
+ * value with the constant.
+ */
+typedef struct ColumnBound
+{
+	uint32 columnIndex;
+	int16 strategyNumber;
+	Datum constant;
+	Oid collationId;
+	FmgrInfo comparisonFunction;
+
+} ColumnBound;
+
+
+/*
+ * ColumnHashProbe holds the hashes of the constants that an equality or IN
+ * qualifier compares a column with. Blocks whose bloom filters contain none of
+ * these hashes have no matching rows.
+ */
+typedef struct ColumnHashProbe
+{
+	uint32 columnIndex;
+	uint32 *hashValueArray;
+	uint32 hashValueCount;
+
+} ColumnHashProbe;
+
+
+/*
+ * TableReadBatch holds a batch of rows read from a cstore file, laid out as
+ * column vectors. For each projected column, columnValues and columnExists
+ * point to arrays of vector entries; entries for other columns are NULL.
+ * If the reader filtered out rows, selectedRowArray lists the vector entries
+ * of the rowCount surviving rows; otherwise it is NULL and the vectors hold
+ * exactly rowCount entries. filteredRowCount is the number of rows removed by
+ * the reader's predicates since the previous batch. The vectors point into the
+ * read state's block data, and are only valid until the next read call.
+ */
+typedef struct TableReadBatch
+{
+	uint32 rowCount;
+	uint32 *selectedRowArray;
+	uint32 filteredRowCount;
+	uint32 projectedColumnCount;
+	uint32 *projectedColumnIndexArray;
+	Datum **columnValues;
+	bool **columnExists;
+
+} TableReadBatch;
+
+
+/* ColumnAggregateType enumerates the aggregates the reader computes itself. */
+typedef enum
+{
+	AGGREGATE_COUNT_ROWS = 0,
+	AGGREGATE_COUNT_VALUES = 1,
+	AGGREGATE_MINIMUM = 2,
+	AGGREGATE_MAXIMUM = 3
+
+} ColumnAggregateType;
+
+
+/*
+ * ColumnAggregate describes a count(*), count(column), min(column) or
+ * max(column) aggregate over the rows that pass the read state's predicates,
+ * and holds its result once the aggregates are read. Minimum and maximum
+ * values are ordered by the column type's default btree operator class and
+ * the column's collation, like the min/max values in skip lists.
+ */
+typedef struct ColumnAggregate
+{
+	ColumnAggregateType aggregateType;
+	uint32 columnIndex;
+
+	int64 valueCount;
+	bool hasValue;
+	Datum value;
+
+} ColumnAggregate;
+
+
+/*
+ * CompressionState and DecompressionState keep compression contexts that are
+ * reused across the blocks a data load compresses, or a scan decompresses.
+ * Their definitions are private to cstore_compression.c.
+ */
+typedef struct CompressionState CompressionState;
+typedef struct DecompressionState DecompressionState;
+
+/* CompressionPool is private to cstore_compression_pool.c */
+typedef struct CompressionPool CompressionPool;
+
+
 /* TableReadState represents state of a cstore file read operation. */
 typedef struct TableReadState
 {
@@ -272,10 +613,87 @@ typedef struct TableReadState
 	List *whereClauseList;
 	MemoryContext stripeReadContext;
 	StripeBuffers *stripeBuffers;
-	uint32 readStripeCount;
+	uint32 nextStripeIndex;
 	uint64 stripeReadRowCount;
 	ColumnBlockData **blockDataArray;
-	int32 deserializedBlockIndex;
+
+	/* indexes of projected columns, in increasing order */
+	uint32 *projectedColumnIndexArray;
+	uint32 projectedColumnCount;
+
+	/*
+	 * Predicates evaluated over each block before the block is returned, and
+	 * the columns they reference. Such columns are deserialized first, and the
+	 * remaining projected columns only if any rows in the block survive. The
+	 * predicates of pushed down clauses are kept in pushdownPredicateList, and
+	 * parameterized scans add predicates of join clauses on every rescan.
+	 */
+	List *columnPredicateList;
+	List *pushdownPredicateList;
+	bool *predicateColumnMask;
+	bool *remainingColumnMask;
+	uint32 *selectedRowArray;
+	MemoryContext predicateContext;
+
+	/* batch that CStoreReadNextRow serves rows from */
+	TableReadBatch readBatch;
+	uint32 readBatchRowIndex;
+	bool readFinished;
+
+	/* stripes below this index have already been prefetched */
+	uint32 prefetchedStripeCount;
+
+	/*
+	 * Restriction qualifiers compiled once for skipping blocks and stripes.
+	 * Column bounds are checked with a comparison function call or two per
+	 * block. Only the remaining qualifiers go through the planner's predicate
+	 * prover, against constraints updated in place from baseConstraintArray,
+	 * which has an entry for each projected column with a comparison function.
+	 * Equality and IN qualifiers are also checked against block bloom filters.
+	 * These live in qualifierContext, and are compiled again with the values of
+	 * executor parameters when a parameterized scan is rescanned.
+	 */
+	List *columnBoundList;
+	List *columnHashProbeList;
+	List *residualRestrictInfoList;
+	Node **baseConstraintArray;
+	MemoryContext qualifierContext;
+
+	/*
+	 * Stripes whose statistics in the table footer refute the restriction
+	 * qualifiers are skipped without being read. selectedStripeMask is NULL
+	 * if there are no qualifiers to check.
+	 */
+	bool *selectedStripeMask;
+
+	/*
+	 * Stripes read and skipped, and the total time spent blocked in reads of
+	 * stripe data. These are shown in EXPLAIN ANALYZE, and add up over all
+	 * rescans of the scan node.
+	 */
+	uint32 readStripeCount;
+	uint32 skippedStripeCount;
+	instr_time readWaitTime;
+
+	/* memory mapping of the table file when cstore_fdw.use_mmap is set */
+	FileMapping *fileMapping;
+
+	/*
+	 * Decompressed blocks of each column are written into the same buffer in
+	 * blockDataArray, which lives in decompressionContext for the whole scan
+	 * along with the zlib and zstd contexts in decompressionState.
+	 */
+	MemoryContext decompressionContext;
+	DecompressionState *decompressionState;
+
+	/* identity of the table file for the metadata cache, zero if unknown */
+	uint64 fileDevice;
+	uint64 fileInode;
+
+#if PG_VERSION_NUM >= 100000
+	/* hands out stripes to backends in a parallel scan, NULL otherwise */
+	SharedStripeDispenser *stripeDispenser;
+#endif
 
 } TableReadState;
 
@@ -286,7 +704,7 @@ typedef struct TableWriteState
 	FILE *tableFile;
 	TableFooter *tableFooter;
 	StringInfo tableFooterFilename;
-	CompressionType compressionType;
+	ColumnOptions *columnOptionsArray;
 	TupleDesc tupleDescriptor;
 	FmgrInfo **comparisonFunctionArray;
 	uint64 currentFileOffset;
@@ -300,13 +718,59 @@ typedef struct TableWriteState
 	/*
 	 * compressionBuffer buffer is used as temporary storage during
 	 * data value compression operation. It is kept here to minimize
-	 * memory allocations. It lives in stripeWriteContext and gets
-	 * deallocated when memory context is reset.
+	 * memory allocations. It lives for the whole data load, so that it
+	 * only grows until it fits the largest block. compressionState
+	 * keeps the codecs' compression contexts for the load.
 	 */
 	StringInfo compressionBuffer;
+	StringInfo encodingBuffer;
+	CompressionState *compressionState;
+
+	/*
+	 * autoCompressionTypeArray keeps the compression type picked for each
+	 * column with auto compression in the current stripe, and is
+	 * COMPRESSION_AUTO until the column's first non-empty block is serialized.
+	 */
+	CompressionType *autoCompressionTypeArray;
+
+	/*
+	 * For columns with bloom filters, hashFunctionArray has the hash function
+	 * of the column's type, and blockHashArray collects the hashes of the
+	 * current block's values until the block's filter is built. Entries of
+	 * other columns are NULL.
+	 */
+	FmgrInfo **hashFunctionArray;
+	uint32 **blockHashArray;
+	uint32 *blockHashCount;
+
+	/*
+	 * compressionPool compresses blocks in worker threads if the load uses
+	 * them. compressionJobList keeps the stripe's blocks whose compression is
+	 * still pending, so FlushStripe() can collect them.
+	 */
+	CompressionPool *compressionPool;
+	List *compressionJobList;
+
+	/*
+	 * With direct writes, directWriteBuffer is an aligned buffer that holds
+	 * the data to be written from the aligned directWriteOffset on. It is
+	 * NULL when writes go through the page cache.
+	 */
+	char *directWriteBuffer;
+	uint64 directWriteOffset;
+	uint32 directWriteLength;
 
 } TableWriteState;
 
+/* Configuration parameters */
+extern int ReadCoalesceGap;
+extern int PrefetchDepth;
+extern bool UseMmap;
+extern bool UseDirectWrite;
+extern bool EnableZstdDictionaries;
+extern bool EnableAggregatePushdown;
+extern int AutoCompressionObjective;
+
 /* Function declarations for extension loading and unloading */
 extern void _PG_init(void);
 extern void _PG_fini(void);
@@ -317,6 +781,7 @@ extern Datum cstore_ddl_event_end_trigger(PG_FUNCTION_ARGS);
 /* Function declarations for utility UDFs */
 extern Datum cstore_table_size(PG_FUNCTION_ARGS);
 extern Datum cstore_clean_table_resources(PG_FUNCTION_ARGS);
+extern Datum cstore_block_cache_stats(PG_FUNCTION_ARGS);
 
 /* Function declarations for foreign data wrapper */
 extern Datum cstore_fdw_handler(PG_FUNCTION_ARGS);
@@ -324,7 +789,7 @@ extern Datum cstore_fdw_validator(PG_FUNCTION_ARGS);
 
 /* Function declarations for writing to a cstore file */
 extern TableWriteState * CStoreBeginWrite(const char *filename,
-										  CompressionType compressionType,
+										  ColumnOptions *columnOptionsArray,
 										  uint64 stripeMaxRowCount,
 										  uint32 blockRowCount,
 										  TupleDesc tupleDescriptor);
@@ -334,11 +799,20 @@ extern void CStoreEndWrite(TableWriteState * state);
 
 /* Function declarations for reading from a cstore file */
 extern TableReadState * CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
-										List *projectedColumnList, List *qualConditions);
+										List *projectedColumnList, List *qualConditions,
+										List *pushdownClauseList);
 extern TableFooter * CStoreReadFooter(StringInfo tableFooterFilename);
 extern bool CStoreReadFinished(TableReadState *state);
+extern void CStoreRescanRead(TableReadState *state, List *qualConditions,
+							 List *parameterClauseList);
 extern bool CStoreReadNextRow(TableReadState *state, Datum *columnValues,
 							  bool *columnNulls);
+extern bool CStoreReadNextBatch(TableReadState *state, TableReadBatch *readBatch);
+extern void CStoreReadBatchRow(TableReadBatch *readBatch, uint32 rowIndex,
+							   Datum *columnValues, bool *columnNulls);
+extern void CStoreReadAggregates(TableReadState *state, ColumnAggregate *aggregateArray,
+								 uint32 aggregateCount);
+extern bool CStorePredicateSupported(Node *clause, TupleDesc tupleDescriptor);
 extern void CStoreEndRead(TableReadState *state);
 
 /* Function declarations for common functions */
@@ -349,9 +823,50 @@ extern ColumnBlockData ** CreateEmptyBlockDataArray(uint32 columnCount, bool *co
 extern void FreeColumnBlockDataArray(ColumnBlockData **blockDataArray,
 									 uint32 columnCount);
 extern uint64 CStoreTableRowCount(const char *filename);
+extern double CStoreColumnStripeOrder(const char *filename, TupleDesc tupleDescriptor,
+									  uint32 columnIndex);
 extern bool CompressBuffer(StringInfo inputBuffer, StringInfo outputBuffer,
-						   CompressionType compressionType);
-extern StringInfo DecompressBuffer(StringInfo buffer, CompressionType compressionType);
+						   CompressionType compressionType, int compressionLevel,
+						   StringInfo compressionDictionary,
+						   CompressionState *compressionState);
+extern uint64 CompressedLengthBound(CompressionType compressionType, uint32 inputLength);
+extern bool CompressData(const char *inputData, uint32 inputLength, char *outputData,
+						 uint64 outputCapacity, CompressionType compressionType,
+						 int compressionLevel, StringInfo compressionDictionary,
+						 CompressionState *compressionState, uint32 *compressedLength);
+extern CompressionState * CreateCompressionState(void);
+extern void PrepareCompressionState(CompressionState *compressionState,
+									CompressionType compressionType,
+									int compressionLevel);
+extern bool CompressionContextFailed(CompressionState *compressionState);
+extern void ReleaseCompressionState(CompressionState *compressionState);
+extern StringInfo DecompressBuffer(StringInfo buffer, CompressionType compressionType,
+								   StringInfo compressionDictionary);
+extern void DecompressBufferInto(StringInfo buffer, CompressionType compressionType,
+								 StringInfo compressionDictionary,
+								 DecompressionState *decompressionState,
+								 StringInfo outputBuffer);
+extern DecompressionState * CreateDecompressionState(void);
+extern void ReleaseDecompressionState(DecompressionState *decompressionState);
+extern CompressionType ChooseCompressionType(StringInfo inputBuffer,
+											 StringInfo outputBuffer,
+											 CompressionObjective objective,
+											 CompressionState *compressionState);
+extern StringInfo TrainCompressionDictionary(StringInfo *sampleBufferArray,
+											 uint32 sampleCount,
+											 CompressionType compressionType);
+extern EncodingType EncodeValueBuffer(StringInfo inputBuffer, StringInfo outputBuffer,
+									  uint32 valueCount, bool datumTypeByValue,
+									  int datumTypeLength, char datumTypeAlign,
+									  EncodingOption encodingOption);
+extern void DecodeDatumArray(StringInfo datumBuffer, EncodingType encodingType,
+							 bool *existsArray, uint32 datumCount, bool datumTypeByValue,
+							 int datumTypeLength, char datumTypeAlign,
+							 Datum *datumArray);
+extern char * BuildBloomFilter(uint32 *hashArray, uint32 hashCount,
+							   uint32 *bloomFilterLength);
+extern bool BloomFilterMayContain(const char *bloomFilter, uint32 bloomFilterLength,
+								  uint32 hashValue);
 
 
 #endif   /* CSTORE_FDW_H */ 
@@ -0,0 +1,506 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_metadata_cache.c
+ *
+ * This file contains function definitions for caching cstore file metadata
+ * in shared memory. Cached values are opaque byte strings; callers decide how
+ * table footers, row counts and skip lists are laid out in them.
+ *
+ * Values are stored in fixed size chunks that are linked together, and a hash
+ * table maps cache keys to their first chunk. When the cache is full, entries
+ * are evicted in approximately least recently used order until the new value
+ * fits. Lookups only hold the cache lock shared, so they mark the entries they
+ * use instead of reordering the LRU list, and eviction gives marked entries a
+ * second chance. The cache is only available when cstore_fdw is loaded through
+ * shared_preload_libraries.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+
+#include "postgres.h"
+#include "cstore_fdw.h"
+#include "cstore_metadata_cache.h"
+
+#include <sys/stat.h>
+#include "lib/ilist.h"
+#include "miscadmin.h"
+#if PG_VERSION_NUM >= 90600
+#include "port/atomics.h"
+#endif
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+
+/* size of the value chunks in the cache */
+#define METADATA_CACHE_CHUNK_SIZE 1024
+#define INVALID_CHUNK_INDEX PG_UINT32_MAX
+
+/* name used for the cache's shared memory segment and lock */
+#define METADATA_CACHE_NAME "cstore_fdw metadata cache"
+#define METADATA_CACHE_HASH_NAME "cstore_fdw metadata cache hash"
+
+
+/* MetadataCacheEntry is a hash table entry for a cached value. */
+typedef struct MetadataCacheEntry
+{
+	MetadataCacheKey key;	/* hash key, must be first */
+	dlist_node lruNode;
+	uint32 firstChunkIndex;
+	uint32 valueLength;
+#if PG_VERSION_NUM >= 90600
+	pg_atomic_uint32 referenced;	/* set by lookups since the entry last moved */
+#endif
+
+} MetadataCacheEntry;
+
+
+/*
+ * MetadataCacheControl is the shared state of the cache. It is followed in
+ * shared memory by the chunk link array, and then by the chunk data.
+ */
+typedef struct MetadataCacheControl
+{
+	LWLock *lock;
+
+	/*
+	 * cache entries in order of insertion or their last second chance, most
+	 * recent first
+	 */
+	dlist_head lruList;
+
+	uint32 chunkCount;
+	uint32 freeChunkCount;
+	uint32 freeChunkIndex;
+
+} MetadataCacheControl;
+
+
+/* Configuration parameters for the metadata cache */
+int MetadataCacheSize = DEFAULT_METADATA_CACHE_SIZE;
+
+#if PG_VERSION_NUM >= 90600
+
+/* pointers into shared memory, set when the cache is attached */
+static MetadataCacheControl *CacheControl = NULL;
+static HTAB *CacheHash = NULL;
+static uint32 *ChunkLinkArray = NULL;
+static char *ChunkDataArray = NULL;
+
+/* saved hook value in case of unload */
+static shmem_startup_hook_type PreviousShmemStartupHook = NULL;
+
+/* local functions forward declarations */
+static uint32 MetadataCacheChunkCount(void);
+static Size MetadataCacheControlSize(uint32 chunkCount);
+static void MetadataCacheShmemStartup(void);
+static MetadataCacheEntry * LeastRecentlyUsedEntry(void);
+static void EvictCacheEntry(MetadataCacheEntry *cacheEntry);
+static void FreeChunkChain(uint32 chunkIndex);
+#endif
+
+
+/*
+ * InitializeMetadataCache reserves shared memory for the metadata cache. It is
+ * called from _PG_init, and does nothing unless the extension is being loaded
+ * through shared_preload_libraries. Named lock tranches are only available in
+ * PostgreSQL 9.6 and later, so the cache is disabled on older releases.
+ */
+void
+InitializeMetadataCache(void)
+{
+#if PG_VERSION_NUM >= 90600
+	uint32 chunkCount = 0;
+	Size cacheSize = 0;
+
+	if (!process_shared_preload_libraries_in_progress || MetadataCacheSize == 0)
+	{
+		return;
+	}
+
+	chunkCount = MetadataCacheChunkCount();
+	cacheSize = add_size(MetadataCacheControlSize(chunkCount),
+						 hash_estimate_size(chunkCount, sizeof(MetadataCacheEntry)));
+
+	RequestAddinShmemSpace(cacheSize);
+	RequestNamedLWLockTranche(METADATA_CACHE_NAME, 1);
+
+	PreviousShmemStartupHook = shmem_startup_hook;
+	shmem_startup_hook = MetadataCacheShmemStartup;
+#endif
+}
+
+
+/*
+ * InitMetadataCacheKey zeroes the given cache key, including any padding
+ * bytes, and sets its entry type.
+ */
+void
+InitMetadataCacheKey(MetadataCacheKey *cacheKey, MetadataCacheEntryType entryType)
+{
+	memset(cacheKey, 0, sizeof(MetadataCacheKey));
+	cacheKey->entryType = (uint32) entryType;
+}
+
+
+/*
+ * MetadataCacheLookup finds the value cached for the given key, and returns a
+ * copy of it in the current memory context. If the key isn't cached, or if the
+ * cache is disabled, the function returns NULL. Lookups hold the cache lock
+ * shared, so that planning and scans in different backends don't serialize on
+ * it; a hit only marks the entry as referenced.
+ */
+StringInfo
+MetadataCacheLookup(MetadataCacheKey *cacheKey)
+{
+	StringInfo value = NULL;
+
+#if PG_VERSION_NUM >= 90600
+	MetadataCacheEntry *cacheEntry = NULL;
+
+	if (CacheControl == NULL)
+	{
+		return NULL;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_SHARED);
+
+	cacheEntry = (MetadataCacheEntry *) hash_search(CacheHash, cacheKey, HASH_FIND,
+													NULL);
+	if (cacheEntry != NULL)
+	{
+		uint32 chunkIndex = cacheEntry->firstChunkIndex;
+		uint32 copiedLength = 0;
+
+		if (pg_atomic_read_u32(&cacheEntry->referenced) == 0)
+		{
+			pg_atomic_write_u32(&cacheEntry->referenced, 1);
+		}
+
+		value = makeStringInfo();
+		enlargeStringInfo(value, cacheEntry->valueLength);
+
+		while (copiedLength < cacheEntry->valueLength)
+		{
+			uint32 copyLength = Min(cacheEntry->valueLength - copiedLength,
+									METADATA_CACHE_CHUNK_SIZE);
+			char *chunkData = ChunkDataArray +
+							  ((Size) chunkIndex) * METADATA_CACHE_CHUNK_SIZE;
+
+			memcpy(value->data + copiedLength, chunkData, copyLength);
+
+			copiedLength += copyLength;
+			chunkIndex = ChunkLinkArray[chunkIndex];
+		}
+
+		value->len = cacheEntry->valueLength;
+		value->data[value->len] = '\0';
+	}
+
+	LWLockRelease(CacheControl->lock);
+#endif
+
+	return value;
+}
+
+
+/*
+ * MetadataCacheInsert stores a copy of the given value under the given key. If
+ * there isn't enough free space, least recently used entries are evicted. Values
+ * larger than a quarter of the cache aren't stored, so that a single large
+ * footer can't flush everything else out of the cache.
+ */
+void
+MetadataCacheInsert(MetadataCacheKey *cacheKey, StringInfo value)
+{
+#if PG_VERSION_NUM >= 90600
+	MetadataCacheEntry *cacheEntry = NULL;
+	uint32 requiredChunkCount = 0;
+	uint32 copiedLength = 0;
+	uint32 previousChunkIndex = INVALID_CHUNK_INDEX;
+	bool found = false;
+
+	if (CacheControl == NULL)
+	{
+		return;
+	}
+
+	requiredChunkCount = (value->len + METADATA_CACHE_CHUNK_SIZE - 1) /
+						 METADATA_CACHE_CHUNK_SIZE;
+	if (requiredChunkCount > CacheControl->chunkCount / 4)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_EXCLUSIVE);
+
+	/* another backend may have cached the same value in the meantime */
+	hash_search(CacheHash, cacheKey, HASH_FIND, &found);
+	if (found)
+	{
+		LWLockRelease(CacheControl->lock);
+		return;
+	}
+
+	while (CacheControl->freeChunkCount < requiredChunkCount &&
+		   !dlist_is_empty(&CacheControl->lruList))
+	{
+		EvictCacheEntry(LeastRecentlyUsedEntry());
+	}
+
+	cacheEntry = (MetadataCacheEntry *) hash_search(CacheHash, cacheKey,
+													HASH_ENTER_NULL, &found);
+	if (cacheEntry == NULL || CacheControl->freeChunkCount < requiredChunkCount)
+	{
+		if (cacheEntry != NULL)
+		{
+			hash_search(CacheHash, cacheKey, HASH_REMOVE, NULL);
+		}
+
+		LWLockRelease(CacheControl->lock);
+		return;
+	}
+
+	cacheEntry->firstChunkIndex = INVALID_CHUNK_INDEX;
+	cacheEntry->valueLength = value->len;
+	pg_atomic_init_u32(&cacheEntry->referenced, 0);
+
+	/* take chunks from the free list, and copy the value into them */
+	while (copiedLength < (uint32) value->len)
+	{
+		uint32 chunkIndex = CacheControl->freeChunkIndex;
+		uint32 copyLength = Min(value->len - copiedLength, METADATA_CACHE_CHUNK_SIZE);
+		char *chunkData = ChunkDataArray + ((Size) chunkIndex) * METADATA_CACHE_CHUNK_SIZE;
+
+		CacheControl->freeChunkIndex = ChunkLinkArray[chunkIndex];
+		CacheControl->freeChunkCount--;
+
+		memcpy(chunkData, value->data + copiedLength, copyLength);
+		ChunkLinkArray[chunkIndex] = INVALID_CHUNK_INDEX;
+
+		if (previousChunkIndex == INVALID_CHUNK_INDEX)
+		{
+			cacheEntry->firstChunkIndex = chunkIndex;
+		}
+		else
+		{
+			ChunkLinkArray[previousChunkIndex] = chunkIndex;
+		}
+
+		previousChunkIndex = chunkIndex;
+		copiedLength += copyLength;
+	}
+
+	dlist_push_head(&CacheControl->lruList, &cacheEntry->lruNode);
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+/*
+ * MetadataCacheInvalidateFile removes all cached metadata of the given file.
+ * It should be called before a cstore file is deleted, since a file created
+ * later may reuse the same inode number.
+ */
+void
+MetadataCacheInvalidateFile(const char *filename)
+{
+#if PG_VERSION_NUM >= 90600
+	HASH_SEQ_STATUS hashStatus;
+	MetadataCacheEntry *cacheEntry = NULL;
+	struct stat fileStat;
+
+	if (CacheControl == NULL || stat(filename, &fileStat) != 0)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&hashStatus, CacheHash);
+	while ((cacheEntry = (MetadataCacheEntry *) hash_seq_search(&hashStatus)) != NULL)
+	{
+		if (cacheEntry->key.fileDevice == (uint64) fileStat.st_dev &&
+			cacheEntry->key.fileInode == (uint64) fileStat.st_ino)
+		{
+			EvictCacheEntry(cacheEntry);
+		}
+	}
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+/*
+ * MetadataCacheReset removes all entries from the cache. We use it when whole
+ * cstore directories are removed, and we don't know which files they held.
+ */
+void
+MetadataCacheReset(void)
+{
+#if PG_VERSION_NUM >= 90600
+	HASH_SEQ_STATUS hashStatus;
+	MetadataCacheEntry *cacheEntry = NULL;
+
+	if (CacheControl == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(CacheControl->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&hashStatus, CacheHash);
+	while ((cacheEntry = (MetadataCacheEntry *) hash_seq_search(&hashStatus)) != NULL)
+	{
+		EvictCacheEntry(cacheEntry);
+	}
+
+	LWLockRelease(CacheControl->lock);
+#endif
+}
+
+
+#if PG_VERSION_NUM >= 90600
+
+/* MetadataCacheChunkCount returns the number of chunks that fit the cache size. */
+static uint32
+MetadataCacheChunkCount(void)
+{
+	uint64 cacheSizeBytes = ((uint64) MetadataCacheSize) * 1024;
+	uint64 chunkCount = cacheSizeBytes / (METADATA_CACHE_CHUNK_SIZE + sizeof(uint32));
+
+	return (uint32) Max(chunkCount, 1);
+}
+
+
+/* MetadataCacheControlSize returns the shared memory size of the cache's chunks. */
+static Size
+MetadataCacheControlSize(uint32 chunkCount)
+{
+	Size controlSize = MAXALIGN(sizeof(MetadataCacheControl));
+	controlSize = add_size(controlSize, MAXALIGN(mul_size(chunkCount, sizeof(uint32))));
+	controlSize = add_size(controlSize, mul_size(chunkCount, METADATA_CACHE_CHUNK_SIZE));
+
+	return controlSize;
+}
+
+
+/*
+ * MetadataCacheShmemStartup creates or attaches to the cache's shared memory.
+ * The first backend to get here initializes the chunk free list.
+ */
+static void
+MetadataCacheShmemStartup(void)
+{
+	uint32 chunkCount = MetadataCacheChunkCount();
+	HASHCTL hashInfo;
+	bool found = false;
+
+	if (PreviousShmemStartupHook != NULL)
+	{
+		PreviousShmemStartupHook();
+	}
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	CacheControl = ShmemInitStruct(METADATA_CACHE_NAME,
+								   MetadataCacheControlSize(chunkCount), &found);
+	ChunkLinkArray = (uint32 *) (((char *) CacheControl) +
+								 MAXALIGN(sizeof(MetadataCacheControl)));
+	ChunkDataArray = ((char *) ChunkLinkArray) +
+					 MAXALIGN(((Size) chunkCount) * sizeof(uint32));
+
+	if (!found)
+	{
+		uint32 chunkIndex = 0;
+
+		CacheControl->lock = &(GetNamedLWLockTranche(METADATA_CACHE_NAME))->lock;
+		dlist_init(&CacheControl->lruList);
+		CacheControl->chunkCount = chunkCount;
+		CacheControl->freeChunkCount = chunkCount;
+		CacheControl->freeChunkIndex = 0;
+
+		for (chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++)
+		{
+			ChunkLinkArray[chunkIndex] = chunkIndex + 1;
+		}
+		ChunkLinkArray[chunkCount - 1] = INVALID_CHUNK_INDEX;
+	}
+
+	/* every entry takes at least one chunk, so this many entries always fit */
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(MetadataCacheKey);
+	hashInfo.entrysize = sizeof(MetadataCacheEntry);
+
+	CacheHash = ShmemInitHash(METADATA_CACHE_HASH_NAME, chunkCount, chunkCount,
+							  &hashInfo, HASH_ELEM | HASH_BLOBS);
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+
+/*
+ * LeastRecentlyUsedEntry returns the entry to evict next. Entries at the tail
+ * of the LRU list that were referenced since they last moved get a second
+ * chance: they are unmarked and moved to the head. Every entry is moved at most
+ * once, so the function returns an entry as long as the list isn't empty. The
+ * caller must hold the cache lock exclusively.
+ */
+static MetadataCacheEntry *
+LeastRecentlyUsedEntry(void)
+{
+	for (;;)
+	{
+		MetadataCacheEntry *cacheEntry =
+			dlist_tail_element(MetadataCacheEntry, lruNode, &CacheControl->lruList);
+
+		if (pg_atomic_read_u32(&cacheEntry->referenced) == 0)
+		{
+			return cacheEntry;
+		}
+
+		pg_atomic_write_u32(&cacheEntry->referenced, 0);
+		dlist_move_head(&CacheControl->lruList, &cacheEntry->lruNode);
+	}
+}
+
+
+/*
+ * EvictCacheEntry removes the given entry from the cache, and returns its
+ * chunks to the free list. The caller must hold the cache lock exclusively.
+ */
+static void
+EvictCacheEntry(MetadataCacheEntry *cacheEntry)
+{
+	FreeChunkChain(cacheEntry->firstChunkIndex);
+	dlist_delete(&cacheEntry->lruNode);
+
+	hash_search(CacheHash, &cacheEntry->key, HASH_REMOVE, NULL);
+}
+
+
+/* FreeChunkChain returns the given chain of chunks to the free list. */
+static void
+FreeChunkChain(uint32 chunkIndex)
+{
+	while (chunkIndex != INVALID_CHUNK_INDEX)
+	{
+		uint32 nextChunkIndex = ChunkLinkArray[chunkIndex];
+
+		ChunkLinkArray[chunkIndex] = CacheControl->freeChunkIndex;
+		CacheControl->freeChunkIndex = chunkIndex;
+		CacheControl->freeChunkCount++;
+
+		chunkIndex = nextChunkIndex;
+	}
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*-------------------------------------------------------------------------
+ *
+ * cstore_metadata_cache.h
+ *
+ * Type and function declarations for the shared memory cache of cstore file
+ * metadata.
+ *
+ * Copyright (c) 2016, Citus Data, Inc.
+ *
+ * $Id$
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef CSTORE_METADATA_CACHE_H
+#define CSTORE_METADATA_CACHE_H
+
+#include "lib/stringinfo.h"
+
+
+/* Default and limits for the cache size configuration parameter, in kB */
+#define DEFAULT_METADATA_CACHE_SIZE (16 * 1024)
+#define METADATA_CACHE_SIZE_MAXIMUM (1024 * 1024)
+
+
+/* MetadataCacheEntryType identifies the kind of metadata in a cache entry. */
+typedef enum
+{
+	CACHE_ENTRY_TABLE_FOOTER = 1,
+	CACHE_ENTRY_ROW_COUNT = 2,
+	CACHE_ENTRY_SKIP_LIST = 3
+
+} MetadataCacheEntryType;
+
+
+/*
+ * MetadataCacheKey identifies a cached piece of file metadata. Files are
+ * identified by device and inode numbers. Table footers and row counts also
+ * record the footer file's modification time and size, since the footer is
+ * rewritten on every load. Skip lists never change once written, so they are
+ * identified by their stripe's position in the data file, and are invalidated
+ * explicitly when the data file is deleted. Keys are compared as raw bytes, so
+ * they must be zeroed with InitMetadataCacheKey before being filled in.
+ */
+typedef struct MetadataCacheKey
+{
+	uint32 entryType;
+	uint32 columnIndex;
+	uint64 fileDevice;
+	uint64 fileInode;
+	int64 modificationTime;
+	uint64 fileSize;
+	uint64 stripeOffset;
+	uint64 stripeLength;
+	Oid typeId;
+
+} MetadataCacheKey;
+
+
+/* Configuration parameters */
+extern int MetadataCacheSize;
+
+/* Function declarations for the metadata cache */
+extern void InitializeMetadataCache(void);
+extern void InitMetadataCacheKey(MetadataCacheKey *cacheKey,
+								 MetadataCacheEntryType entryType);
+extern StringInfo MetadataCacheLookup(MetadataCacheKey *cacheKey);
+extern void MetadataCacheInsert(MetadataCacheKey *cacheKey, StringInfo value);
+extern void MetadataCacheInvalidateFile(const char *filename);
+extern void MetadataCacheReset(void);
+
+
+#endif   /* CSTORE_METADATA_CACHE_H */
@@ -21,6 +21,11 @@
 
 
 /* local functions forward declarations */
+static Protobuf__ColumnStripeSkipNode ** SerializeColumnStripeSkipNodes(
+	StripeMetadata *stripeMetadata);
+static ColumnStripeSkipNode * DeserializeColumnStripeSkipNodes(
+	Protobuf__StripeMetadata *protobufStripeMetadata);
+static char * CopyProtobufBinary(ProtobufCBinaryData protobufBinary);
 static ProtobufCBinaryData DatumToProtobufBinary(Datum datum, bool typeByValue,
 												 int typeLength);
 static Datum ProtobufBinaryToDatum(ProtobufCBinaryData protobufBinary,
@@ -95,6 +100,15 @@ SerializeTableFooter(TableFooter *tableFooter)
 		protobufStripeMetadata->has_footerlength = true;
 		protobufStripeMetadata->footerlength = stripeMetadata->footerLength;
 
+		if (stripeMetadata->columnSkipNodeArray != NULL)
+		{
+			protobufStripeMetadata->has_rowcount = true;
+			protobufStripeMetadata->rowcount = stripeMetadata->rowCount;
+			protobufStripeMetadata->n_columnskipnodearray = stripeMetadata->columnCount;
+			protobufStripeMetadata->columnskipnodearray =
+				SerializeColumnStripeSkipNodes(stripeMetadata);
+		}
+
 		stripeMetadataArray[stripeIndex] = protobufStripeMetadata;
 		stripeIndex++;
 	}
@@ -128,6 +142,8 @@ SerializeStripeFooter(StripeFooter *stripeFooter)
 	Protobuf__StripeFooter protobufStripeFooter = PROTOBUF__STRIPE_FOOTER__INIT;
 	uint8 *stripeFooterData = NULL;
 	uint32 stripeFooterSize = 0;
+	uint32 columnIndex = 0;
+	bool hasCompressionDictionary = false;
 
 	protobufStripeFooter.n_skiplistsizearray = stripeFooter->columnCount;
 	protobufStripeFooter.skiplistsizearray = (uint64_t *) stripeFooter->skipListSizeArray;
@@ -136,6 +152,37 @@ SerializeStripeFooter(StripeFooter *stripeFooter)
 	protobufStripeFooter.n_valuesizearray = stripeFooter->columnCount;
 	protobufStripeFooter.valuesizearray = (uint64_t *) stripeFooter->valueSizeArray;
 
+	for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+	{
+		if (stripeFooter->compressionDictionaryArray != NULL &&
+			stripeFooter->compressionDictionaryArray[columnIndex] != NULL)
+		{
+			hasCompressionDictionary = true;
+		}
+	}
+
+	/* only stripes that use compression dictionaries store the array */
+	if (hasCompressionDictionary)
+	{
+		ProtobufCBinaryData *dictionaryArray =
+			palloc0(stripeFooter->columnCount * sizeof(ProtobufCBinaryData));
+
+		for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+		{
+			StringInfo compressionDictionary =
+				stripeFooter->compressionDictionaryArray[columnIndex];
+
+			if (compressionDictionary != NULL)
+			{
+				dictionaryArray[columnIndex].len = compressionDictionary->len;
+				dictionaryArray[columnIndex].data = (uint8 *) compressionDictionary->data;
+			}
+		}
+
+		protobufStripeFooter.n_compressiondictionaryarray = stripeFooter->columnCount;
+		protobufStripeFooter.compressiondictionaryarray = dictionaryArray;
+	}
+
 	stripeFooterSize = protobuf__stripe_footer__get_packed_size(&protobufStripeFooter);
 	stripeFooterData = palloc0(stripeFooterSize);
 	protobuf__stripe_footer__pack(&protobufStripeFooter, stripeFooterData);
@@ -202,6 +249,16 @@ SerializeColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCou
 		protobufBlockSkipNode->has_valuecompressiontype = true;
 		protobufBlockSkipNode->valuecompressiontype =
 			(Protobuf__CompressionType) blockSkipNode.valueCompressionType;
+		protobufBlockSkipNode->has_valueencodingtype = true;
+		protobufBlockSkipNode->valueencodingtype =
+			(Protobuf__EncodingType) blockSkipNode.valueEncodingType;
+
+		if (blockSkipNode.bloomFilter != NULL)
+		{
+			protobufBlockSkipNode->has_bloomfilter = true;
+			protobufBlockSkipNode->bloomfilter.data = (uint8 *) blockSkipNode.bloomFilter;
+			protobufBlockSkipNode->bloomfilter.len = blockSkipNode.bloomFilterLength;
+		}
 
 		protobufBlockSkipNodeArray[blockIndex] = protobufBlockSkipNode;
 	}
@@ -315,6 +372,15 @@ DeserializeTableFooter(StringInfo buffer)
 		stripeMetadata->dataLength = protobufStripeMetadata->datalength;
 		stripeMetadata->footerLength = protobufStripeMetadata->footerlength;
 
+		/* stripes written by older versions don't have statistics */
+		if (protobufStripeMetadata->has_rowcount)
+		{
+			stripeMetadata->rowCount = protobufStripeMetadata->rowcount;
+			stripeMetadata->columnCount = protobufStripeMetadata->n_columnskipnodearray;
+			stripeMetadata->columnSkipNodeArray =
+				DeserializeColumnStripeSkipNodes(protobufStripeMetadata);
+		}
+
 		stripeMetadataList = lappend(stripeMetadataList, stripeMetadata);
 	}
 
@@ -340,8 +406,10 @@ DeserializeStripeFooter(StringInfo buffer)
 	uint64 *skipListSizeArray = NULL;
 	uint64 *existsSizeArray = NULL;
 	uint64 *valueSizeArray = NULL;
+	StringInfo *compressionDictionaryArray = NULL;
 	uint64 sizeArrayLength = 0;
 	uint32 columnCount = 0;
+	uint32 columnIndex = 0;
 
 	protobufStripeFooter = protobuf__stripe_footer__unpack(NULL, buffer->len,
 														   (uint8 *) buffer->data);
@@ -359,6 +427,13 @@ DeserializeStripeFooter(StringInfo buffer)
 						errdetail("stripe size array lengths don't match")));
 	}
 
+	if (protobufStripeFooter->n_compressiondictionaryarray != 0 &&
+		protobufStripeFooter->n_compressiondictionaryarray != columnCount)
+	{
+		ereport(ERROR, (errmsg("could not unpack column store"),
+						errdetail("stripe dictionary array length doesn't match")));
+	}
+
 	sizeArrayLength = columnCount * sizeof(uint64);
 
 	skipListSizeArray = palloc0(sizeArrayLength);
@@ -369,12 +444,31 @@ DeserializeStripeFooter(StringInfo buffer)
 	memcpy(existsSizeArray, protobufStripeFooter->existssizearray, sizeArrayLength);
 	memcpy(valueSizeArray, protobufStripeFooter->valuesizearray, sizeArrayLength);
 
+	compressionDictionaryArray = palloc0(columnCount * sizeof(StringInfo));
+	for (columnIndex = 0; columnIndex < protobufStripeFooter->n_compressiondictionaryarray;
+		 columnIndex++)
+	{
+		ProtobufCBinaryData protobufDictionary =
+			protobufStripeFooter->compressiondictionaryarray[columnIndex];
+
+		if (protobufDictionary.len > 0)
+		{
+			StringInfo compressionDictionary = makeStringInfo();
+			appendBinaryStringInfo(compressionDictionary,
+								   (char *) protobufDictionary.data,
+								   protobufDictionary.len);
+
+			compressionDictionaryArray[columnIndex] = compressionDictionary;
+		}
+	}
+
 	protobuf__stripe_footer__free_unpacked(protobufStripeFooter, NULL);
 
 	stripeFooter = palloc0(sizeof(StripeFooter));
 	stripeFooter->skipListSizeArray = skipListSizeArray;
 	stripeFooter->existsSizeArray = existsSizeArray;
 	stripeFooter->valueSizeArray = valueSizeArray;
+	stripeFooter->compressionDictionaryArray = compressionDictionaryArray;
 	stripeFooter->columnCount = columnCount;
 
 	return stripeFooter;
@@ -521,6 +615,15 @@ DeserializeColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
 		blockSkipNode->valueLength = protobufBlockSkipNode->valuelength;
 		blockSkipNode->valueCompressionType =
 			(CompressionType) protobufBlockSkipNode->valuecompressiontype;
+		blockSkipNode->valueEncodingType =
+			(EncodingType) protobufBlockSkipNode->valueencodingtype;
+
+		if (protobufBlockSkipNode->has_bloomfilter)
+		{
+			blockSkipNode->bloomFilter =
+				CopyProtobufBinary(protobufBlockSkipNode->bloomfilter);
+			blockSkipNode->bloomFilterLength = protobufBlockSkipNode->bloomfilter.len;
+		}
 	}
 
 	protobuf__column_block_skip_list__free_unpacked(protobufBlockSkipList, NULL);
@@ -529,14 +632,92 @@ DeserializeColumnSkipList(StringInfo buffer, bool typeByValue, int typeLength,
 }
 
 
-/* Converts a datum to a ProtobufCBinaryData. */
-static ProtobufCBinaryData
-DatumToProtobufBinary(Datum datum, bool datumTypeByValue, int datumTypeLength)
+/*
+ * SerializeColumnStripeSkipNodes converts the given stripe's column statistics
+ * to their protobuf form.
+ */
+static Protobuf__ColumnStripeSkipNode **
+SerializeColumnStripeSkipNodes(StripeMetadata *stripeMetadata)
 {
-	ProtobufCBinaryData protobufBinary = {0, 0};
+	uint32 columnCount = stripeMetadata->columnCount;
+	uint32 columnIndex = 0;
+	Protobuf__ColumnStripeSkipNode **protobufSkipNodeArray =
+		palloc0(columnCount * sizeof(Protobuf__ColumnStripeSkipNode *));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnStripeSkipNode *skipNode = &stripeMetadata->columnSkipNodeArray[columnIndex];
+		Protobuf__ColumnStripeSkipNode *protobufSkipNode =
+			palloc0(sizeof(Protobuf__ColumnStripeSkipNode));
+
+		protobuf__column_stripe_skip_node__init(protobufSkipNode);
+		protobufSkipNode->has_nullcount = true;
+		protobufSkipNode->nullcount = skipNode->nullCount;
+
+		if (skipNode->hasMinMax)
+		{
+			protobufSkipNode->has_minimumvalue = true;
+			protobufSkipNode->minimumvalue.data = (uint8 *) skipNode->minimumValue;
+			protobufSkipNode->minimumvalue.len = skipNode->minimumLength;
+			protobufSkipNode->has_maximumvalue = true;
+			protobufSkipNode->maximumvalue.data = (uint8 *) skipNode->maximumValue;
+			protobufSkipNode->maximumvalue.len = skipNode->maximumLength;
+		}
+
+		protobufSkipNodeArray[columnIndex] = protobufSkipNode;
+	}
+
+	return protobufSkipNodeArray;
+}
+
+
+/*
+ * DeserializeColumnStripeSkipNodes builds the column statistics of the given
+ * protobuf stripe metadata. Minimum and maximum values are copied, so they live
+ * after the unpacked protobuf struct is freed.
+ */
+static ColumnStripeSkipNode *
+DeserializeColumnStripeSkipNodes(Protobuf__StripeMetadata *protobufStripeMetadata)
+{
+	uint32 columnCount = protobufStripeMetadata->n_columnskipnodearray;
+	uint32 columnIndex = 0;
+	ColumnStripeSkipNode *skipNodeArray = palloc0(columnCount *
+												  sizeof(ColumnStripeSkipNode));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Protobuf__ColumnStripeSkipNode *protobufSkipNode =
+			protobufStripeMetadata->columnskipnodearray[columnIndex];
+		ColumnStripeSkipNode *skipNode = &skipNodeArray[columnIndex];
+
+		skipNode->nullCount = protobufSkipNode->nullcount;
+
+		if (protobufSkipNode->has_minimumvalue && protobufSkipNode->has_maximumvalue)
+		{
+			skipNode->hasMinMax = true;
+			skipNode->minimumValue = CopyProtobufBinary(protobufSkipNode->minimumvalue);
+			skipNode->minimumLength = protobufSkipNode->minimumvalue.len;
+			skipNode->maximumValue = CopyProtobufBinary(protobufSkipNode->maximumvalue);
+			skipNode->maximumLength = protobufSkipNode->maximumvalue.len;
+		}
+	}
+
+	return skipNodeArray;
+}
 
-	int datumLength = att_addlength_datum(0, datumTypeLength, datum);
-	char *datumBuffer = palloc0(datumLength);
+
+/*
+ * SerializeDatum serializes the given datum the way skip lists store minimum
+ * and maximum values, and sets datumLength to the length of the result.
+ */
+char *
+SerializeDatum(Datum datum, bool datumTypeByValue, int datumTypeLength,
+			   uint32 *datumLength)
+{
+	char *datumBuffer = NULL;
+
+	(*datumLength) = att_addlength_datum(0, datumTypeLength, datum);
+	datumBuffer = palloc0(*datumLength);
 
 	if (datumTypeLength > 0)
 	{
@@ -551,9 +732,33 @@ DatumToProtobufBinary(Datum datum, bool datumTypeByValue, int datumTypeLength)
 	}
 	else
 	{
-		memcpy(datumBuffer, DatumGetPointer(datum), datumLength);
+		memcpy(datumBuffer, DatumGetPointer(datum), *datumLength);
 	}
 
+	return datumBuffer;
+}
+
+
+/*
+ * DeserializeDatum returns the datum serialized in the given data, which must
+ * be maximally aligned. By-reference datums point into the given data.
+ */
+Datum
+DeserializeDatum(char *datumData, bool datumTypeByValue, int datumTypeLength)
+{
+	return fetch_att(datumData, datumTypeByValue, datumTypeLength);
+}
+
+
+/* Converts a datum to a ProtobufCBinaryData. */
+static ProtobufCBinaryData
+DatumToProtobufBinary(Datum datum, bool datumTypeByValue, int datumTypeLength)
+{
+	ProtobufCBinaryData protobufBinary = {0, 0};
+	uint32 datumLength = 0;
+	char *datumBuffer = SerializeDatum(datum, datumTypeByValue, datumTypeLength,
+									   &datumLength);
+
 	protobufBinary.data = (uint8 *) datumBuffer;
 	protobufBinary.len = datumLength;
 
@@ -572,10 +777,20 @@ ProtobufBinaryToDatum(ProtobufCBinaryData protobufBinary, bool datumTypeByValue,
 	 * We copy the protobuf data so the result of this function lives even
 	 * after the unpacked protobuf struct is freed.
 	 */
-	char *binaryDataCopy = palloc0(protobufBinary.len);
-	memcpy(binaryDataCopy, protobufBinary.data, protobufBinary.len);
+	char *binaryDataCopy = CopyProtobufBinary(protobufBinary);
 
-	datum = fetch_att(binaryDataCopy, datumTypeByValue, datumTypeLength);
+	datum = DeserializeDatum(binaryDataCopy, datumTypeByValue, datumTypeLength);
 
 	return datum;
 }
+
+
+/* Copies the given ProtobufCBinaryData into palloc'd, maximally aligned memory. */
+static char *
+CopyProtobufBinary(ProtobufCBinaryData protobufBinary)
+{
+	char *binaryDataCopy = palloc0(protobufBinary.len);
+	memcpy(binaryDataCopy, protobufBinary.data, protobufBinary.len);
+
+	return binaryDataCopy;
+}
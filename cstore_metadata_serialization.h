@@ -27,6 +27,8 @@ extern StringInfo SerializeStripeFooter(StripeFooter *stripeFooter);
 extern StringInfo SerializeColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray,
 										  uint32 blockCount, bool typeByValue,
 										  int typeLength);
+extern char * SerializeDatum(Datum datum, bool typeByValue, int typeLength,
+							 uint32 *datumLength);
 
 /* Function declarations for metadata deserialization */
 extern void DeserializePostScript(StringInfo buffer, uint64 *tableFooterLength);
@@ -37,6 +39,7 @@ extern StripeFooter * DeserializeStripeFooter(StringInfo buffer);
 extern ColumnBlockSkipNode * DeserializeColumnSkipList(StringInfo buffer,
 													   bool typeByValue, int typeLength,
 													   uint32 blockCount);
+extern Datum DeserializeDatum(char *datumData, bool typeByValue, int typeLength);
 
 
 #endif   /* CSTORE_SERIALIZATION_H */ 
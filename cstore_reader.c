@@ -16,11 +16,19 @@
 
 #include "postgres.h"
 #include "cstore_fdw.h"
+#include "cstore_block_cache.h"
+#include "cstore_metadata_cache.h"
 #include "cstore_metadata_serialization.h"
 #include "cstore_version_compat.h"
 
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "access/hash.h"
 #include "access/nbtree.h"
 #include "access/skey.h"
+#include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "nodes/makefuncs.h"
 #if PG_VERSION_NUM >= 120000
@@ -35,36 +43,107 @@
 #include "optimizer/restrictinfo.h"
 #include "port.h"
 #include "storage/fd.h"
+#include "utils/array.h"
+#include "utils/datum.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
 
+/*
+ * On x86-64, comparison kernels have an AVX2 version, which is compiled for
+ * AVX2 with a function attribute and picked at run time if the CPU supports
+ * it. The kernel loads values straight from datums, so it needs pass-by-value
+ * 8-byte datums.
+ */
+#if defined(__x86_64__) && SIZEOF_DATUM == 8 && defined(USE_FLOAT8_BYVAL) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define USE_AVX2_COMPARISON_KERNEL 1
+#include <immintrin.h>
+#endif
+
+
+/*
+ * ReadRequest describes a segment of the cstore file that should be read into
+ * the given buffer. Requests for a stripe are collected first, and then read
+ * together so that adjacent segments can be read with a single system call.
+ */
+typedef struct ReadRequest
+{
+	uint64 fileOffset;
+	uint64 length;
+	StringInfo buffer;
+
+} ReadRequest;
+
+
+/* Configuration parameters for reading cstore files */
+int ReadCoalesceGap = DEFAULT_READ_COALESCE_GAP;
+int PrefetchDepth = DEFAULT_PREFETCH_DEPTH;
+bool UseMmap = false;
+
 
 /* static function declarations */
-static StripeBuffers * LoadFilteredStripeBuffers(FILE *tableFile,
-												 StripeMetadata *stripeMetadata,
-												 TupleDesc tupleDescriptor,
-												 List *projectedColumnList,
-												 List *whereClauseList);
-static void ReadStripeNextRow(StripeBuffers *stripeBuffers, List *projectedColumnList,
-							  uint64 blockIndex, uint64 blockRowIndex,
-							  ColumnBlockData **blockDataArray,
-							  Datum *columnValues, bool *columnNulls);
-static ColumnBuffers * LoadColumnBuffers(FILE *tableFile,
-										 ColumnBlockSkipNode *blockSkipNodeArray,
+static StripeBuffers * LoadFilteredStripeBuffers(TableReadState *readState,
+												 StripeMetadata *stripeMetadata);
+static uint32 StripeBlockRowCount(uint64 stripeRowCount, uint64 blockRowCount,
+								  uint32 blockIndex);
+static void AggregateStripe(TableReadState *readState, StripeMetadata *stripeMetadata,
+							ColumnAggregate *aggregateArray, uint32 aggregateCount,
+							FmgrInfo **comparisonFunctionArray,
+							bool *existsColumnMask, bool *existsArray,
+							MemoryContext aggregateContext);
+static bool BlockPredicatesImplied(List *columnPredicateList,
+								   StripeSkipList *stripeSkipList, uint32 blockIndex);
+static void AggregateBlockSkipNodes(TableReadState *readState,
+									StripeSkipList *stripeSkipList, uint32 blockIndex,
+									ColumnAggregate *aggregateArray,
+									uint32 aggregateCount,
+									FmgrInfo **comparisonFunctionArray,
+									MemoryContext aggregateContext);
+static void AggregateBlockRows(TableReadState *readState, uint32 *selectedRowArray,
+							   uint32 selectedRowCount, ColumnAggregate *aggregateArray,
+							   uint32 aggregateCount, FmgrInfo **comparisonFunctionArray,
+							   MemoryContext aggregateContext);
+static void UpdateAggregateValue(TableReadState *readState, ColumnAggregate *aggregate,
+								 Datum value, FmgrInfo *comparisonFunction,
+								 MemoryContext aggregateContext);
+static StripeBuffers * LoadStripeBuffers(StripeMetadata *stripeMetadata,
+										 StripeFooter *stripeFooter,
+										 StripeSkipList *stripeSkipList,
+										 bool *columnMask, bool *blockMask,
+										 bool loadValues, List **readRequestList);
+static ColumnBuffers * LoadColumnBuffers(ColumnBlockSkipNode *blockSkipNodeArray,
 										 uint32 blockCount, uint64 existsFileOffset,
-										 uint64 valueFileOffset,
-										 Form_pg_attribute attributeForm);
-static StripeFooter * LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
+										 uint64 valueFileOffset, bool loadValues,
+										 List **readRequestList);
+static StripeFooter * LoadStripeFooter(TableReadState *readState,
+									   StripeMetadata *stripeMetadata,
 									   uint32 columnCount);
-static StripeSkipList * LoadStripeSkipList(FILE *tableFile,
+static StripeSkipList * LoadStripeSkipList(TableReadState *readState,
 										   StripeMetadata *stripeMetadata,
 										   StripeFooter *stripeFooter,
 										   uint32 columnCount,
 										   bool *projectedColumnMask,
 										   TupleDesc tupleDescriptor);
-static bool * SelectedBlockMask(StripeSkipList *stripeSkipList,
-								List *projectedColumnList, List *whereClauseList);
+static void CompileReadQualifiers(TableReadState *readState, List *whereClauseList,
+								  List *parameterClauseList);
+static bool * SelectedBlockMask(TableReadState *readState,
+								StripeSkipList *stripeSkipList);
+static List * BuildColumnBoundList(List *clauseList, TupleDesc tupleDescriptor,
+								   bool *projectedColumnMask,
+								   List **residualClauseList);
+static ColumnBound * BuildColumnBound(Expr *clause, TupleDesc tupleDescriptor,
+									  bool *projectedColumnMask);
+static List * BuildColumnHashProbeList(List *clauseList, TupleDesc tupleDescriptor,
+									   bool *projectedColumnMask);
+static ColumnHashProbe * BuildColumnHashProbe(Expr *clause, TupleDesc tupleDescriptor,
+											  bool *projectedColumnMask);
+static bool BloomFilterMayContainAny(ColumnHashProbe *columnHashProbe,
+									 ColumnBlockSkipNode *blockSkipNode);
+static bool ColumnBoundAdmitsRange(ColumnBound *columnBound, Datum minimumValue,
+								   Datum maximumValue);
+static Node ** BuildBaseConstraintArray(TupleDesc tupleDescriptor,
+										List *projectedColumnList);
 static List * BuildRestrictInfoList(List *whereClauseList);
 static Node * BuildBaseConstraint(Var *variable);
 static OpExpr * MakeOpExpression(Var *variable, int16 strategyNumber);
@@ -75,22 +154,90 @@ static StripeSkipList * SelectedBlockSkipList(StripeSkipList *stripeSkipList,
 											  bool *selectedBlockMask);
 static uint32 StripeSkipListRowCount(StripeSkipList *stripeSkipList);
 static bool * ProjectedColumnMask(uint32 columnCount, List *projectedColumnList);
-static void DeserializeBoolArray(StringInfo boolArrayBuffer, bool *boolArray,
+static bool DeserializeBoolArray(StringInfo boolArrayBuffer, bool *boolArray,
 								 uint32 boolArrayLength);
 static void DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray,
-								  uint32 datumCount, bool datumTypeByValue,
-								  int datumTypeLength, char datumTypeAlign,
-								  Datum *datumArray);
-static void DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
-								 uint32 rowCount, ColumnBlockData **blockDataArray,
-								 TupleDesc tupleDescriptor);
+								  bool allDatumsExist, uint32 datumCount,
+								  bool datumTypeByValue, int datumTypeLength,
+								  char datumTypeAlign, Datum *datumArray);
+static void DeserializeBlockData(TableReadState *readState, uint64 blockIndex,
+								 uint32 rowCount, bool *columnMask);
+static List * BuildColumnPredicateList(List *clauseList, TupleDesc tupleDescriptor,
+									   bool *projectedColumnMask);
+static ColumnPredicate * BuildColumnPredicate(Expr *clause, TupleDesc tupleDescriptor,
+											  bool *projectedColumnMask);
+static int32 PredicateColumnIndex(Node *operand, TupleDesc tupleDescriptor,
+								  bool *projectedColumnMask);
+static uint32 EvaluateColumnPredicates(TableReadState *readState, uint32 rowCount);
+static uint32 EvaluateColumnPredicate(ColumnPredicate *columnPredicate,
+									  ColumnBlockData *blockData,
+									  uint32 *selectedRowArray,
+									  uint32 selectedRowCount);
+static bool ColumnPredicateMatches(ColumnPredicate *columnPredicate, Datum value);
+static int16 ComparisonStrategyNumber(Oid operatorId, Oid columnTypeId,
+									  bool constantFirst);
+static void SetComparisonKernel(ColumnPredicate *columnPredicate, Oid columnTypeId,
+								Const *constant);
+static uint32 EvaluateComparisonKernel(ColumnPredicate *columnPredicate,
+									   ColumnBlockData *blockData,
+									   uint32 *selectedRowArray,
+									   uint32 selectedRowCount);
+#ifdef USE_AVX2_COMPARISON_KERNEL
+static uint32 EvaluateComparisonKernelAVX2(ColumnPredicate *columnPredicate,
+										   ColumnBlockData *blockData,
+										   uint32 *selectedRowArray,
+										   uint32 selectedRowCount,
+										   uint32 *passingRowCount)
+	__attribute__((target("avx2")));
+#endif
+static inline int64 IntegerDatumValue(Datum datum, Oid typeId);
+static inline int CompareFloat8Values(float8 leftValue, float8 rightValue);
+static StringInfo DecompressBlockValues(TableReadState *readState,
+										StringInfo compressionDictionary,
+										ColumnBlockBuffers *blockBuffers,
+										StringInfo outputBuffer);
 static Datum ColumnDefaultValue(TupleConstr *tupleConstraints,
 								Form_pg_attribute attributeForm);
 static int64 FILESize(FILE *file);
+static void PrefetchStripes(TableReadState *readState, uint32 currentStripeIndex);
+static void PrefetchStripe(TableReadState *readState, StripeMetadata *stripeMetadata);
 static StringInfo ReadFromFile(FILE *file, uint64 offset, uint32 size);
-static void ResetUncompressedBlockData(ColumnBlockData **blockDataArray,
-									   uint32 columnCount);
+static void ReadFileSegment(FILE *file, uint64 offset, char *buffer, uint64 size);
+static void ReadStripeSegment(TableReadState *readState, uint64 offset, char *buffer,
+							  uint64 size);
+static StringInfo AddReadRequest(List **readRequestList, uint64 fileOffset,
+								 uint64 length);
+static void ReadCoalescedRequests(TableReadState *readState, List *readRequestList);
+static int CompareReadRequests(const void *leftElement, const void *rightElement);
 static uint64 StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata);
+static bool NextStripeIndex(TableReadState *readState, uint32 *stripeIndex);
+static bool * SelectedStripeMask(TableReadState *readState);
+static bool StripeBoundsRefuted(List *columnBoundList, StripeMetadata *stripeMetadata,
+								TupleDesc tupleDescriptor);
+static List * StripeConstraintList(StripeMetadata *stripeMetadata,
+								   TupleDesc tupleDescriptor, List *projectedColumnList,
+								   Node **baseConstraintArray);
+static NullTest * MakeNullTest(Var *variable, NullTestType nullTestType);
+static void MapTableFile(TableReadState *readState);
+static void UnmapTableFile(void *arg);
+static FILE * OpenFooterFile(const char *footerFilename);
+static TableFooter * ReadFooterFile(FILE *tableFooterFile);
+static bool FooterCacheKey(FILE *footerFile, MetadataCacheEntryType entryType,
+						   MetadataCacheKey *cacheKey);
+static bool SkipListCacheKey(TableReadState *readState, StripeMetadata *stripeMetadata,
+							 uint32 columnIndex, Oid typeId,
+							 MetadataCacheKey *cacheKey);
+static StringInfo FlattenTableFooter(TableFooter *tableFooter);
+static TableFooter * UnflattenTableFooter(StringInfo buffer);
+static StringInfo FlattenColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray,
+										uint32 blockCount, bool typeByValue,
+										int typeLength);
+static ColumnBlockSkipNode * UnflattenColumnSkipList(StringInfo buffer,
+													 bool typeByValue,
+													 uint32 *blockCount);
+static Datum AppendFlatDatum(StringInfo buffer, Datum value, int typeLength);
+static Size AppendFlatData(StringInfo buffer, const char *data, Size dataLength);
+static char * CopyFlatData(StringInfo buffer, Size dataOffset, Size dataLength);
 
 
 /*
@@ -99,15 +246,22 @@ static uint64 StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata);
  */
 TableReadState *
 CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
-				List *projectedColumnList, List *whereClauseList)
+				List *projectedColumnList, List *whereClauseList,
+				List *pushdownClauseList)
 {
 	TableReadState *readState = NULL;
 	TableFooter *tableFooter = NULL;
 	FILE *tableFile = NULL;
 	MemoryContext stripeReadContext = NULL;
 	uint32 columnCount = 0;
+	uint32 columnIndex = 0;
 	bool *projectedColumnMask = NULL;
+	uint32 *projectedColumnIndexArray = NULL;
+	uint32 projectedColumnCount = 0;
+	List *columnPredicateList = NIL;
 	ColumnBlockData **blockDataArray  = NULL;
+	MemoryContext oldContext = NULL;
+	struct stat tableFileStat;
 
 	StringInfo tableFooterFilename = makeStringInfo();
 	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
@@ -139,34 +293,155 @@ CStoreBeginRead(const char *filename, TupleDesc tupleDescriptor,
 	blockDataArray = CreateEmptyBlockDataArray(columnCount, projectedColumnMask,
 										 	   tableFooter->blockRowCount);
 
+	/* batches and rows are filled in by walking over projected column indexes */
+	projectedColumnIndexArray = palloc0(columnCount * sizeof(uint32));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		if (projectedColumnMask[columnIndex])
+		{
+			projectedColumnIndexArray[projectedColumnCount] = columnIndex;
+			projectedColumnCount++;
+		}
+	}
+
+	/*
+	 * Column predicates of the pushed down clauses are built once. Predicates of
+	 * join clauses that take outer row values are added when they are known.
+	 */
+	columnPredicateList = BuildColumnPredicateList(pushdownClauseList, tupleDescriptor,
+												   projectedColumnMask);
+
 	readState = palloc0(sizeof(TableReadState));
 	readState->tableFile = tableFile;
 	readState->tableFooter = tableFooter;
 	readState->projectedColumnList = projectedColumnList;
-	readState->whereClauseList = whereClauseList;
 	readState->stripeBuffers = NULL;
+	readState->nextStripeIndex = 0;
 	readState->readStripeCount = 0;
 	readState->stripeReadRowCount = 0;
 	readState->tupleDescriptor = tupleDescriptor;
 	readState->stripeReadContext = stripeReadContext;
+	readState->prefetchedStripeCount = 0;
+	readState->skippedStripeCount = 0;
+	INSTR_TIME_SET_ZERO(readState->readWaitTime);
 	readState->blockDataArray = blockDataArray;
-	readState->deserializedBlockIndex = -1;
+	readState->projectedColumnIndexArray = projectedColumnIndexArray;
+	readState->projectedColumnCount = projectedColumnCount;
+	readState->pushdownPredicateList = columnPredicateList;
+	readState->predicateColumnMask = palloc0(columnCount * sizeof(bool));
+	readState->remainingColumnMask = palloc0(columnCount * sizeof(bool));
+	readState->selectedRowArray = palloc0(tableFooter->blockRowCount * sizeof(uint32));
+	readState->predicateContext = AllocSetContextCreate(CurrentMemoryContext,
+														"Column Predicate Context",
+														ALLOCSET_DEFAULT_SIZES);
+	readState->readBatchRowIndex = 0;
+	readState->readFinished = false;
+#if PG_VERSION_NUM >= 100000
+	readState->stripeDispenser = NULL;
+#endif
+	readState->fileMapping = NULL;
+	readState->fileDevice = 0;
+	readState->fileInode = 0;
+
+	/*
+	 * Compile the qualifiers for skipping blocks once, so that simple column
+	 * comparisons are checked directly against min/max values and bloom
+	 * filters, and only other qualifiers go through the predicate prover.
+	 */
+	readState->qualifierContext = AllocSetContextCreate(CurrentMemoryContext,
+														"Qualifier Context",
+														ALLOCSET_DEFAULT_SIZES);
+	CompileReadQualifiers(readState, whereClauseList, NIL);
+
+	/*
+	 * Each column decompresses its blocks into one buffer that is reused for
+	 * the whole scan, so that we don't allocate a buffer for every block.
+	 */
+	readState->decompressionContext = AllocSetContextCreate(CurrentMemoryContext,
+															"Decompression Context",
+															ALLOCSET_DEFAULT_SIZES);
+	oldContext = MemoryContextSwitchTo(readState->decompressionContext);
+
+	readState->decompressionState = CreateDecompressionState();
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBlockData *blockData = blockDataArray[columnIndex];
+		if (blockData != NULL)
+		{
+			blockData->valueBuffer = makeStringInfo();
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	if (fstat(fileno(tableFile), &tableFileStat) == 0)
+	{
+		readState->fileDevice = (uint64) tableFileStat.st_dev;
+		readState->fileInode = (uint64) tableFileStat.st_ino;
+	}
+
+	if (UseMmap)
+	{
+		MapTableFile(readState);
+	}
 
 	return readState;
 }
 
 
 /*
- * CStoreReadFooter reads the cstore file footer from the given file. First, the
- * function reads the last byte of the file as the postscript size. Then, the
- * function reads the postscript. Last, the function reads and deserializes the
- * footer.
+ * CStoreReadFooter reads the cstore file footer from the given file. Footers are
+ * kept in the shared metadata cache, so the file is only read if this version of
+ * the footer isn't cached yet.
  */
 TableFooter *
 CStoreReadFooter(StringInfo tableFooterFilename)
 {
 	TableFooter *tableFooter = NULL;
-	FILE *tableFooterFile = NULL;
+	FILE *tableFooterFile = OpenFooterFile(tableFooterFilename->data);
+	int freeResult = 0;
+
+	tableFooter = ReadFooterFile(tableFooterFile);
+
+	freeResult = FreeFile(tableFooterFile);
+	if (freeResult != 0)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not close file: %m")));
+	}
+
+	return tableFooter;
+}
+
+
+/* OpenFooterFile opens the given footer file for reading, and errors out if it can't. */
+static FILE *
+OpenFooterFile(const char *footerFilename)
+{
+	FILE *tableFooterFile = AllocateFile(footerFilename, PG_BINARY_R);
+	if (tableFooterFile == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\" for reading: %m",
+							   footerFilename),
+						errhint("Try copying in data to the table.")));
+	}
+
+	return tableFooterFile;
+}
+
+
+/*
+ * ReadFooterFile reads the footer from the given open footer file. First, the
+ * function reads the last byte of the file as the postscript size. Then, the
+ * function reads the postscript. Last, the function reads and deserializes the
+ * footer. The cache key comes from the open file, so a footer that is renamed
+ * into place concurrently can't be cached under the key of the one we read.
+ */
+static TableFooter *
+ReadFooterFile(FILE *tableFooterFile)
+{
+	TableFooter *tableFooter = NULL;
 	uint64 footerOffset = 0;
 	uint64 footerLength = 0;
 	StringInfo postscriptBuffer = NULL;
@@ -176,15 +451,22 @@ CStoreReadFooter(StringInfo tableFooterFilename)
 	uint64 footerFileSize = 0;
 	uint64 postscriptOffset = 0;
 	StringInfo footerBuffer = NULL;
-	int freeResult = 0;
+	MetadataCacheKey cacheKey;
+	bool cacheKeyFound = FooterCacheKey(tableFooterFile, CACHE_ENTRY_TABLE_FOOTER,
+										&cacheKey);
 
-	tableFooterFile = AllocateFile(tableFooterFilename->data, PG_BINARY_R);
-	if (tableFooterFile == NULL)
+	if (cacheKeyFound)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not open file \"%s\" for reading: %m",
-							   tableFooterFilename->data),
-						errhint("Try copying in data to the table.")));
+		StringInfo cachedFooterBuffer = MetadataCacheLookup(&cacheKey);
+		if (cachedFooterBuffer != NULL)
+		{
+			tableFooter = UnflattenTableFooter(cachedFooterBuffer);
+
+			pfree(cachedFooterBuffer->data);
+			pfree(cachedFooterBuffer);
+
+			return tableFooter;
+		}
 	}
 
 	footerFileSize = FILESize(tableFooterFile);
@@ -215,11 +497,13 @@ CStoreReadFooter(StringInfo tableFooterFilename)
 	footerBuffer = ReadFromFile(tableFooterFile, footerOffset, footerLength);
 	tableFooter = DeserializeTableFooter(footerBuffer);
 
-	freeResult = FreeFile(tableFooterFile);
-	if (freeResult != 0)
+	if (cacheKeyFound)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not close file: %m")));
+		StringInfo flatFooterBuffer = FlattenTableFooter(tableFooter);
+		MetadataCacheInsert(&cacheKey, flatFooterBuffer);
+
+		pfree(flatFooterBuffer->data);
+		pfree(flatFooterBuffer);
 	}
 
 	return tableFooter;
@@ -229,956 +513,3968 @@ CStoreReadFooter(StringInfo tableFooterFilename)
 /*
  * CStoreReadNextRow tries to read a row from the cstore file. On success, it sets
  * column values and nulls, and returns true. If there are no more rows to read,
- * the function returns false.
+ * the function returns false. Rows are served from the read state's batch, which
+ * is refilled by CStoreReadNextBatch once all of its rows are returned.
  */
 bool
 CStoreReadNextRow(TableReadState *readState, Datum *columnValues, bool *columnNulls)
 {
-	uint32 blockIndex = 0;
-	uint32 blockRowIndex = 0;
-	TableFooter *tableFooter = readState->tableFooter;
-	MemoryContext oldContext = NULL;
+	TableReadBatch *readBatch = &readState->readBatch;
 
-	/*
-	 * If no stripes are loaded, load the next non-empty stripe. Note that when
-	 * loading stripes, we skip over blocks whose contents can be filtered with
-	 * the query's restriction qualifiers. So, even when a stripe is physically
-	 * not empty, we may end up loading it as an empty stripe.
-	 */
-	while (readState->stripeBuffers == NULL)
+	if (readState->readBatchRowIndex >= readBatch->rowCount)
 	{
-		StripeBuffers *stripeBuffers = NULL;
-		StripeMetadata *stripeMetadata = NULL;
-		List *stripeMetadataList = tableFooter->stripeMetadataList;
-		uint32 stripeCount = list_length(stripeMetadataList);
-
-		/* if we have read all stripes, return false */
-		if (readState->readStripeCount == stripeCount)
+		bool batchFound = CStoreReadNextBatch(readState, readBatch);
+		if (!batchFound)
 		{
 			return false;
 		}
 
-		oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
-		MemoryContextReset(readState->stripeReadContext);
+		readState->readBatchRowIndex = 0;
+	}
 
-		stripeMetadata = list_nth(stripeMetadataList, readState->readStripeCount);
-		stripeBuffers = LoadFilteredStripeBuffers(readState->tableFile, stripeMetadata,
-												  readState->tupleDescriptor,
-												  readState->projectedColumnList,
-												  readState->whereClauseList);
-		readState->readStripeCount++;
+	/* set all columns to null by default */
+	memset(columnNulls, 1, readState->tupleDescriptor->natts * sizeof(bool));
 
-		MemoryContextSwitchTo(oldContext);
+	CStoreReadBatchRow(readBatch, readState->readBatchRowIndex,
+					   columnValues, columnNulls);
+	readState->readBatchRowIndex++;
+
+	return true;
+}
+
+
+/*
+ * CStoreReadNextBatch reads the next batch of rows from the cstore file. A batch
+ * holds the rows of a column block that pass the read state's column predicates,
+ * and gives the values of each projected column as a Datum vector and an exists
+ * vector. These vectors point into the deserialized block data, so they are only
+ * valid until the next read call on this read state. Vectors of columns that
+ * aren't projected are NULL. The function returns false if there are no more
+ * rows to read.
+ */
+bool
+CStoreReadNextBatch(TableReadState *readState, TableReadBatch *readBatch)
+{
+	uint32 blockRowCount = 0;
+	uint32 selectedRowCount = 0;
+	uint32 columnCount = readState->tupleDescriptor->natts;
+	uint32 projectedColumnIndex = 0;
+	TableFooter *tableFooter = readState->tableFooter;
+	MemoryContext oldContext = NULL;
+
+	readBatch->rowCount = 0;
+	readBatch->filteredRowCount = 0;
+
+	while (selectedRowCount == 0)
+	{
+		uint32 blockIndex = 0;
 
-		if (stripeBuffers->rowCount != 0)
+		/*
+		 * If no stripes are loaded, load the next non-empty stripe. Note that
+		 * when loading stripes, we skip over blocks whose contents can be
+		 * filtered with the query's restriction qualifiers. So, even when a
+		 * stripe is physically not empty, we may end up loading it as an empty
+		 * stripe.
+		 */
+		while (readState->stripeBuffers == NULL)
 		{
-			readState->stripeBuffers = stripeBuffers;
-			readState->stripeReadRowCount = 0;
-			readState->deserializedBlockIndex = -1;
-			ResetUncompressedBlockData(readState->blockDataArray,
-									   stripeBuffers->columnCount);
-			break;
+			StripeBuffers *stripeBuffers = NULL;
+			StripeMetadata *stripeMetadata = NULL;
+			List *stripeMetadataList = tableFooter->stripeMetadataList;
+			uint32 stripeIndex = 0;
+
+			/* if we have read all stripes, return false */
+			bool stripeFound = NextStripeIndex(readState, &stripeIndex);
+			if (!stripeFound)
+			{
+				readState->readFinished = true;
+				return false;
+			}
+
+			oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+			MemoryContextReset(readState->stripeReadContext);
+
+			stripeMetadata = list_nth(stripeMetadataList, stripeIndex);
+			stripeBuffers = LoadFilteredStripeBuffers(readState, stripeMetadata);
+			readState->readStripeCount++;
+
+			/* let the kernel read upcoming stripes while we process this one */
+			PrefetchStripes(readState, stripeIndex);
+
+			MemoryContextSwitchTo(oldContext);
+
+			if (stripeBuffers->rowCount != 0)
+			{
+				readState->stripeBuffers = stripeBuffers;
+				readState->stripeReadRowCount = 0;
+				break;
+			}
 		}
-	}
 
-	blockIndex = readState->stripeReadRowCount / tableFooter->blockRowCount;
-	blockRowIndex = readState->stripeReadRowCount % tableFooter->blockRowCount;
+		/* batches always start at a block boundary and cover the whole block */
+		blockIndex = readState->stripeReadRowCount / tableFooter->blockRowCount;
+		blockRowCount = StripeBlockRowCount(readState->stripeBuffers->rowCount,
+											tableFooter->blockRowCount, blockIndex);
 
-	if (blockIndex != readState->deserializedBlockIndex)
-	{
-		uint32 lastBlockIndex = 0;
-		uint32 blockRowCount = 0;
-		uint32 stripeRowCount = 0;
+		oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
 
-		stripeRowCount = readState->stripeBuffers->rowCount;
-		lastBlockIndex = stripeRowCount / tableFooter->blockRowCount;
-		if (blockIndex == lastBlockIndex)
+		if (readState->columnPredicateList == NIL)
 		{
-			blockRowCount = stripeRowCount % tableFooter->blockRowCount;
+			DeserializeBlockData(readState, blockIndex, blockRowCount, NULL);
+			selectedRowCount = blockRowCount;
 		}
 		else
 		{
-			blockRowCount = tableFooter->blockRowCount;
-		}
-
-		oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+			DeserializeBlockData(readState, blockIndex, blockRowCount,
+								 readState->predicateColumnMask);
+			selectedRowCount = EvaluateColumnPredicates(readState, blockRowCount);
 
-		DeserializeBlockData(readState->stripeBuffers, blockIndex,
-							 blockRowCount, readState->blockDataArray,
-							 readState->tupleDescriptor);
+			/* only deserialize other columns if some rows survived */
+			if (selectedRowCount > 0)
+			{
+				DeserializeBlockData(readState, blockIndex, blockRowCount,
+									 readState->remainingColumnMask);
+			}
+		}
 
 		MemoryContextSwitchTo(oldContext);
 
-		readState->deserializedBlockIndex = blockIndex;
+		readBatch->filteredRowCount += blockRowCount - selectedRowCount;
+
+		/*
+		 * If we finished reading the current stripe, set stripe data to NULL.
+		 * That way, we will load a new stripe the next time we get here. Block
+		 * data stays valid until then.
+		 */
+		readState->stripeReadRowCount += blockRowCount;
+		if (readState->stripeReadRowCount == readState->stripeBuffers->rowCount)
+		{
+			readState->stripeBuffers = NULL;
+		}
 	}
 
-	ReadStripeNextRow(readState->stripeBuffers, readState->projectedColumnList,
-					  blockIndex, blockRowIndex, readState->blockDataArray,
-					  columnValues, columnNulls);
+	/* vector arrays are allocated on first use, in the caller's memory context */
+	if (readBatch->columnValues == NULL)
+	{
+		readBatch->columnValues = palloc0(columnCount * sizeof(Datum *));
+		readBatch->columnExists = palloc0(columnCount * sizeof(bool *));
+	}
 
-	/*
-	 * If we finished reading the current stripe, set stripe data to NULL. That
-	 * way, we will load a new stripe the next time this function gets called.
-	 */
-	readState->stripeReadRowCount++;
-	if (readState->stripeReadRowCount == readState->stripeBuffers->rowCount)
+	readBatch->rowCount = selectedRowCount;
+	readBatch->selectedRowArray = NULL;
+	if (selectedRowCount < blockRowCount)
 	{
-		readState->stripeBuffers = NULL;
+		readBatch->selectedRowArray = readState->selectedRowArray;
 	}
 
-	return true;
-}
+	readBatch->projectedColumnCount = readState->projectedColumnCount;
+	readBatch->projectedColumnIndexArray = readState->projectedColumnIndexArray;
 
+	for (projectedColumnIndex = 0; projectedColumnIndex < readState->projectedColumnCount;
+		 projectedColumnIndex++)
+	{
+		uint32 columnIndex = readState->projectedColumnIndexArray[projectedColumnIndex];
+		ColumnBlockData *blockData = readState->blockDataArray[columnIndex];
 
-/* Finishes a cstore read operation. */
-void
-CStoreEndRead(TableReadState *readState)
-{
-	int columnCount = readState->tupleDescriptor->natts;
+		readBatch->columnValues[columnIndex] = blockData->valueArray;
+		readBatch->columnExists[columnIndex] = blockData->existsArray;
+	}
 
-	MemoryContextDelete(readState->stripeReadContext);
-	FreeFile(readState->tableFile);
-	list_free_deep(readState->tableFooter->stripeMetadataList);
-	FreeColumnBlockDataArray(readState->blockDataArray, columnCount);
-	pfree(readState->tableFooter);
-	pfree(readState);
+	return true;
 }
 
 
 /*
- * CreateEmptyBlockDataArray creates data buffers to keep deserialized exist and
- * value arrays for requested columns in columnMask.
+ * CStoreReadBatchRow copies the values of projected columns in the given batch
+ * row into the given arrays. Entries of columns that aren't projected are left
+ * untouched, so callers set them to null once.
  */
-ColumnBlockData **
-CreateEmptyBlockDataArray(uint32 columnCount, bool *columnMask, uint32 blockRowCount)
+void
+CStoreReadBatchRow(TableReadBatch *readBatch, uint32 rowIndex, Datum *columnValues,
+				   bool *columnNulls)
 {
-	uint32 columnIndex = 0;
-	ColumnBlockData **blockDataArray = palloc0(columnCount * sizeof(ColumnBlockData*));
+	uint32 projectedColumnIndex = 0;
 
-	/* allocate block memory for deserialized data */
-	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	if (readBatch->selectedRowArray != NULL)
 	{
-		if (columnMask[columnIndex])
-		{
-			ColumnBlockData *blockData = palloc0(sizeof(ColumnBlockData));
+		rowIndex = readBatch->selectedRowArray[rowIndex];
+	}
 
-			blockData->existsArray = palloc0(blockRowCount * sizeof(bool));
-			blockData->valueArray = palloc0(blockRowCount * sizeof(Datum));
-			blockData->valueBuffer = NULL;
-			blockDataArray[columnIndex] = blockData;
+	for (projectedColumnIndex = 0; projectedColumnIndex < readBatch->projectedColumnCount;
+		 projectedColumnIndex++)
+	{
+		uint32 columnIndex = readBatch->projectedColumnIndexArray[projectedColumnIndex];
+		bool columnExists = readBatch->columnExists[columnIndex][rowIndex];
+
+		columnNulls[columnIndex] = !columnExists;
+		if (columnExists)
+		{
+			columnValues[columnIndex] = readBatch->columnValues[columnIndex][rowIndex];
 		}
 	}
+}
 
-	return blockDataArray;
+
+/*
+ * CStoreReadFinished returns true if the read operation has run out of stripes
+ * to read.
+ */
+bool
+CStoreReadFinished(TableReadState *readState)
+{
+	return readState->readFinished;
 }
 
 
 /*
- * FreeColumnBlockDataArray deallocates data buffers to keep deserialized exist and
- * value arrays for requested columns in columnMask.
- * ColumnBlockData->serializedValueBuffer lives in memory read/write context
- * so it is deallocated automatically when the context is deleted.
+ * CStoreRescanRead restarts the given read operation from its first stripe, and
+ * compiles the given restriction qualifiers for skipping stripes and blocks in
+ * place of the previous ones. Parameterized scans call this with the values of
+ * each outer row, and also pass the join clauses that compare columns with
+ * these values, which the reader then evaluates along with the pushed down
+ * clauses. The table file, its footer and the read buffers are kept, so a
+ * rescan only costs as much as selecting the stripes again. In a parallel scan,
+ * the read keeps claiming stripes from the same stripe dispenser. Counts of read
+ * and skipped stripes and the read wait time are kept, so EXPLAIN ANALYZE shows
+ * their totals over all rescans.
  */
 void
-FreeColumnBlockDataArray(ColumnBlockData **blockDataArray, uint32 columnCount)
+CStoreRescanRead(TableReadState *readState, List *whereClauseList,
+				 List *parameterClauseList)
 {
-	uint32 columnIndex = 0;
-	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
-	{
-		ColumnBlockData *blockData = blockDataArray[columnIndex];
-		if (blockData != NULL)
-		{
-			pfree(blockData->existsArray);
-			pfree(blockData->valueArray);
-			pfree(blockData);
-		}
-	}
+	MemoryContextReset(readState->stripeReadContext);
 
-	pfree(blockDataArray);
+	readState->stripeBuffers = NULL;
+	readState->nextStripeIndex = 0;
+	readState->stripeReadRowCount = 0;
+	readState->prefetchedStripeCount = 0;
+	readState->readBatch.rowCount = 0;
+	readState->readBatch.filteredRowCount = 0;
+	readState->readBatchRowIndex = 0;
+	readState->readFinished = false;
+
+	CompileReadQualifiers(readState, whereClauseList, parameterClauseList);
 }
 
 
-/* CStoreTableRowCount returns the exact row count of a table using skiplists */
-uint64
-CStoreTableRowCount(const char *filename)
+/*
+ * CompileReadQualifiers compiles the given restriction qualifiers into column
+ * bounds, bloom filter probes and residual clauses for the predicate prover,
+ * and checks stripe statistics against them. It also builds column predicates
+ * for the given parameter clauses, and splits projected columns into those
+ * referenced by column predicates, which are deserialized first, and those
+ * deserialized only for blocks that have rows passing the predicates.
+ * Everything is built from a copy of the clauses in the read state's qualifier
+ * context, which is reset when the qualifiers are compiled again.
+ */
+static void
+CompileReadQualifiers(TableReadState *readState, List *whereClauseList,
+					  List *parameterClauseList)
 {
-	TableFooter *tableFooter = NULL;
-	FILE *tableFile;
-	ListCell *stripeMetadataCell = NULL;
-	uint64 totalRowCount = 0;
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint32 columnIndex = 0;
+	List *projectedColumnList = readState->projectedColumnList;
+	List *residualClauseList = NIL;
+	List *parameterPredicateList = NIL;
+	ListCell *columnPredicateCell = NULL;
+	bool *projectedColumnMask = NULL;
+	MemoryContext oldContext = NULL;
 
-	StringInfo tableFooterFilename = makeStringInfo();
+	MemoryContextReset(readState->qualifierContext);
+	oldContext = MemoryContextSwitchTo(readState->qualifierContext);
 
-	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+	whereClauseList = (List *) copyObject(whereClauseList);
+	parameterClauseList = (List *) copyObject(parameterClauseList);
+	projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
 
-	tableFooter = CStoreReadFooter(tableFooterFilename);
+	parameterPredicateList = BuildColumnPredicateList(parameterClauseList,
+													  tupleDescriptor,
+													  projectedColumnMask);
+	readState->columnPredicateList = list_concat(list_copy(readState->pushdownPredicateList),
+												 parameterPredicateList);
 
-	pfree(tableFooterFilename->data);
-	pfree(tableFooterFilename);
+	memset(readState->predicateColumnMask, false, columnCount * sizeof(bool));
+	foreach(columnPredicateCell, readState->columnPredicateList)
+	{
+		ColumnPredicate *columnPredicate = lfirst(columnPredicateCell);
+		readState->predicateColumnMask[columnPredicate->columnIndex] = true;
+	}
 
-	tableFile = AllocateFile(filename, PG_BINARY_R);
-	if (tableFile == NULL)
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not open file \"%s\" for reading: %m", filename)));
+		readState->remainingColumnMask[columnIndex] =
+			projectedColumnMask[columnIndex] &&
+			!readState->predicateColumnMask[columnIndex];
 	}
 
-	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	readState->whereClauseList = whereClauseList;
+	readState->columnBoundList = BuildColumnBoundList(whereClauseList, tupleDescriptor,
+													  projectedColumnMask,
+													  &residualClauseList);
+	readState->columnHashProbeList = BuildColumnHashProbeList(whereClauseList,
+															  tupleDescriptor,
+															  projectedColumnMask);
+	readState->residualRestrictInfoList = BuildRestrictInfoList(residualClauseList);
+	readState->baseConstraintArray = NULL;
+	if (residualClauseList != NIL)
 	{
-		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
-		totalRowCount += StripeRowCount(tableFile, stripeMetadata);
+		readState->baseConstraintArray = BuildBaseConstraintArray(tupleDescriptor,
+																  projectedColumnList);
 	}
 
-	FreeFile(tableFile);
+	readState->selectedStripeMask = SelectedStripeMask(readState);
 
-	return totalRowCount;
+	MemoryContextSwitchTo(oldContext);
 }
 
 
 /*
- * StripeRowCount reads serialized stripe footer, the first column's
- * skip list, and returns number of rows for given stripe.
+ * CStoreReadAggregates computes the given aggregates over all rows that pass the
+ * read state's column predicates, and stores their results in the aggregate
+ * array. Blocks whose min/max values refute the predicates are skipped, and
+ * blocks whose min/max values imply the predicates are aggregated from their
+ * skip nodes; for these we only read the exists streams of columns that are
+ * counted or filtered, since skip nodes don't record nulls. Only the remaining
+ * boundary blocks are decompressed and filtered row by row. Result values are
+ * allocated in the caller's memory context.
  */
-static uint64
-StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata)
+void
+CStoreReadAggregates(TableReadState *readState, ColumnAggregate *aggregateArray,
+					 uint32 aggregateCount)
 {
-	uint64 rowCount = 0;
-	StripeFooter *stripeFooter = NULL;
-	StringInfo footerBuffer = NULL;
-	StringInfo firstColumnSkipListBuffer = NULL;
-	uint64 footerOffset = 0;
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint32 aggregateIndex = 0;
+	uint32 columnIndex = 0;
+	uint32 stripeIndex = 0;
+	MemoryContext aggregateContext = CurrentMemoryContext;
+	FmgrInfo **comparisonFunctionArray = palloc0(aggregateCount * sizeof(FmgrInfo *));
+	bool *existsColumnMask = palloc0(columnCount * sizeof(bool));
+	bool *existsArray = palloc0(readState->tableFooter->blockRowCount * sizeof(bool));
 
-	footerOffset += stripeMetadata->fileOffset;
-	footerOffset += stripeMetadata->skipListLength;
-	footerOffset += stripeMetadata->dataLength;
+	for (aggregateIndex = 0; aggregateIndex < aggregateCount; aggregateIndex++)
+	{
+		ColumnAggregate *aggregate = &aggregateArray[aggregateIndex];
+		Form_pg_attribute attributeForm = NULL;
 
-	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
-	stripeFooter = DeserializeStripeFooter(footerBuffer);
+		aggregate->valueCount = 0;
+		aggregate->hasValue = false;
+		aggregate->value = (Datum) 0;
 
-	firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
-	                                         stripeFooter->skipListSizeArray[0]);
-	rowCount =  DeserializeRowCount(firstColumnSkipListBuffer);
+		if (aggregate->aggregateType == AGGREGATE_COUNT_ROWS)
+		{
+			continue;
+		}
 
-	return rowCount;
+		attributeForm = TupleDescAttr(tupleDescriptor, aggregate->columnIndex);
+		if (aggregate->aggregateType == AGGREGATE_COUNT_VALUES)
+		{
+			existsColumnMask[aggregate->columnIndex] = true;
+			continue;
+		}
+
+		comparisonFunctionArray[aggregateIndex] =
+			GetFunctionInfoOrNull(attributeForm->atttypid, BTREE_AM_OID, BTORDER_PROC);
+		if (comparisonFunctionArray[aggregateIndex] == NULL)
+		{
+			ereport(ERROR, (errmsg("could not find comparison function for column "
+								   "\"%s\"", NameStr(attributeForm->attname))));
+		}
+	}
+
+	/* implied blocks also need to be checked for nulls in filtered columns */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		existsColumnMask[columnIndex] |= readState->predicateColumnMask[columnIndex];
+	}
+
+	while (NextStripeIndex(readState, &stripeIndex))
+	{
+		List *stripeMetadataList = readState->tableFooter->stripeMetadataList;
+		StripeMetadata *stripeMetadata = list_nth(stripeMetadataList, stripeIndex);
+		MemoryContext oldContext = MemoryContextSwitchTo(readState->stripeReadContext);
+
+		MemoryContextReset(readState->stripeReadContext);
+
+		AggregateStripe(readState, stripeMetadata, aggregateArray, aggregateCount,
+						comparisonFunctionArray, existsColumnMask, existsArray,
+						aggregateContext);
+		readState->readStripeCount++;
+
+		MemoryContextSwitchTo(oldContext);
+	}
+
+	readState->readFinished = true;
+
+	pfree(existsArray);
+	pfree(existsColumnMask);
+	pfree(comparisonFunctionArray);
 }
 
 
 /*
- * LoadFilteredStripeBuffers reads serialized stripe data from the given file.
- * The function skips over blocks whose rows are refuted by restriction qualifiers,
- * and only loads columns that are projected in the query.
+ * AggregateStripe adds the rows of the given stripe to the aggregates. The
+ * function classifies the stripe's blocks using their skip nodes, reads the
+ * exists streams of implied blocks and the data of boundary blocks, and then
+ * aggregates each block. Implied blocks that turn out to have nulls in a
+ * filtered column are handled as boundary blocks.
  */
-static StripeBuffers *
-LoadFilteredStripeBuffers(FILE *tableFile, StripeMetadata *stripeMetadata,
-						  TupleDesc tupleDescriptor, List *projectedColumnList,
-						  List *whereClauseList)
+static void
+AggregateStripe(TableReadState *readState, StripeMetadata *stripeMetadata,
+				ColumnAggregate *aggregateArray, uint32 aggregateCount,
+				FmgrInfo **comparisonFunctionArray, bool *existsColumnMask,
+				bool *existsArray, MemoryContext aggregateContext)
 {
-	StripeBuffers *stripeBuffers = NULL;
-	ColumnBuffers **columnBuffersArray = NULL;
-	uint64 currentColumnFileOffset = 0;
-	uint32 columnIndex = 0;
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
 	uint32 columnCount = tupleDescriptor->natts;
-
-	StripeFooter *stripeFooter = LoadStripeFooter(tableFile, stripeMetadata,
-												  columnCount);
+	List *projectedColumnList = readState->projectedColumnList;
 	bool *projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
+	StripeFooter *stripeFooter = NULL;
+	StripeSkipList *stripeSkipList = NULL;
+	StripeBuffers *existsStripeBuffers = NULL;
+	bool *selectedBlockMask = NULL;
+	bool *impliedBlockMask = NULL;
+	bool *boundaryBlockMask = NULL;
+	List *readRequestList = NIL;
+	uint32 blockIndex = 0;
+	uint32 impliedBlockIndex = 0;
+	uint32 boundaryBlockIndex = 0;
+	uint32 boundaryBlockCount = 0;
 
-	StripeSkipList *stripeSkipList = LoadStripeSkipList(tableFile, stripeMetadata,
-														stripeFooter, columnCount,
-														projectedColumnMask,
-														tupleDescriptor);
+	stripeFooter = LoadStripeFooter(readState, stripeMetadata, columnCount);
+	stripeSkipList = LoadStripeSkipList(readState, stripeMetadata, stripeFooter,
+										columnCount, projectedColumnMask,
+										tupleDescriptor);
+	selectedBlockMask = SelectedBlockMask(readState, stripeSkipList);
 
-	bool *selectedBlockMask = SelectedBlockMask(stripeSkipList, projectedColumnList,
-												whereClauseList);
+	impliedBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
+	boundaryBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
 
-	StripeSkipList *selectedBlockSkipList =
-		SelectedBlockSkipList(stripeSkipList, projectedColumnMask,
-							  selectedBlockMask);
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		if (selectedBlockMask[blockIndex])
+		{
+			impliedBlockMask[blockIndex] =
+				BlockPredicatesImplied(readState->columnPredicateList, stripeSkipList,
+									   blockIndex);
+		}
+	}
 
-	/* load column data for projected columns */
-	columnBuffersArray = palloc0(columnCount * sizeof(ColumnBuffers *));
-	currentColumnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
+	existsStripeBuffers = LoadStripeBuffers(stripeMetadata, stripeFooter, stripeSkipList,
+											existsColumnMask, impliedBlockMask, false,
+											&readRequestList);
+	ReadCoalescedRequests(readState, readRequestList);
 
-	for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+	/* aggregate implied blocks, and find the blocks that need to be filtered */
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
 	{
-		uint64 existsSize = stripeFooter->existsSizeArray[columnIndex];
-		uint64 valueSize = stripeFooter->valueSizeArray[columnIndex];
-		uint64 existsFileOffset = currentColumnFileOffset;
-		uint64 valueFileOffset = currentColumnFileOffset + existsSize;
+		uint32 rowCount = stripeSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+		bool blockImplied = impliedBlockMask[blockIndex];
+		uint32 columnIndex = 0;
+		uint32 aggregateIndex = 0;
 
-		if (projectedColumnMask[columnIndex])
+		if (!blockImplied)
 		{
-			ColumnBlockSkipNode *blockSkipNode =
-				selectedBlockSkipList->blockSkipNodeArray[columnIndex];
-			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
-			uint32 blockCount = selectedBlockSkipList->blockCount;
+			boundaryBlockMask[blockIndex] = selectedBlockMask[blockIndex];
+			continue;
+		}
 
-			ColumnBuffers *columnBuffers = LoadColumnBuffers(tableFile, blockSkipNode,
-															 blockCount,
-															 existsFileOffset,
-															 valueFileOffset,
-															 attributeForm);
+		/* skip nodes don't cover nulls, so filtered columns must not have any */
+		for (columnIndex = 0; columnIndex < columnCount && blockImplied; columnIndex++)
+		{
+			ColumnBuffers *columnBuffers = NULL;
+			StringInfo existsBuffer = NULL;
+
+			if (!readState->predicateColumnMask[columnIndex])
+			{
+				continue;
+			}
+
+			/* columns added after the stripe was written only have nulls */
+			columnBuffers = existsStripeBuffers->columnBuffersArray[columnIndex];
+			if (columnBuffers == NULL)
+			{
+				blockImplied = false;
+				break;
+			}
+
+			existsBuffer = columnBuffers->blockBuffersArray[impliedBlockIndex]->existsBuffer;
+			blockImplied = DeserializeBoolArray(existsBuffer, existsArray, rowCount);
+		}
+
+		for (aggregateIndex = 0; aggregateIndex < aggregateCount && blockImplied;
+			 aggregateIndex++)
+		{
+			ColumnAggregate *aggregate = &aggregateArray[aggregateIndex];
+			ColumnBuffers *columnBuffers = NULL;
+			StringInfo existsBuffer = NULL;
+			bool allValuesExist = false;
+			uint32 rowIndex = 0;
+
+			if (aggregate->aggregateType != AGGREGATE_COUNT_VALUES)
+			{
+				continue;
+			}
+
+			columnBuffers = existsStripeBuffers->columnBuffersArray[aggregate->columnIndex];
+			if (columnBuffers == NULL)
+			{
+				continue;
+			}
+
+			existsBuffer = columnBuffers->blockBuffersArray[impliedBlockIndex]->existsBuffer;
+			allValuesExist = DeserializeBoolArray(existsBuffer, existsArray, rowCount);
+			if (allValuesExist)
+			{
+				aggregate->valueCount += rowCount;
+				continue;
+			}
+
+			for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+			{
+				aggregate->valueCount += existsArray[rowIndex];
+			}
+		}
+
+		if (blockImplied)
+		{
+			AggregateBlockSkipNodes(readState, stripeSkipList, blockIndex,
+									aggregateArray, aggregateCount,
+									comparisonFunctionArray, aggregateContext);
+		}
+		else
+		{
+			boundaryBlockMask[blockIndex] = true;
+		}
+
+		impliedBlockIndex++;
+	}
+
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		boundaryBlockCount += boundaryBlockMask[blockIndex];
+	}
+
+	if (boundaryBlockCount > 0)
+	{
+		readRequestList = NIL;
+		readState->stripeBuffers = LoadStripeBuffers(stripeMetadata, stripeFooter,
+													 stripeSkipList, projectedColumnMask,
+													 boundaryBlockMask, true,
+													 &readRequestList);
+		ReadCoalescedRequests(readState, readRequestList);
+	}
+
+	/* decompress and filter boundary blocks */
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		uint32 rowCount = stripeSkipList->blockSkipNodeArray[0][blockIndex].rowCount;
+		uint32 selectedRowCount = rowCount;
+		uint32 *selectedRowArray = NULL;
+
+		if (!boundaryBlockMask[blockIndex])
+		{
+			continue;
+		}
+
+		DeserializeBlockData(readState, boundaryBlockIndex, rowCount, NULL);
+		boundaryBlockIndex++;
+
+		if (readState->columnPredicateList != NIL)
+		{
+			selectedRowCount = EvaluateColumnPredicates(readState, rowCount);
+			selectedRowArray = readState->selectedRowArray;
+		}
+
+		AggregateBlockRows(readState, selectedRowArray, selectedRowCount,
+						   aggregateArray, aggregateCount, comparisonFunctionArray,
+						   aggregateContext);
+	}
+
+	readState->stripeBuffers = NULL;
+}
+
+
+/*
+ * BlockPredicatesImplied returns true if the min/max values of the given block
+ * imply all column predicates for the block's non-null values. Callers still
+ * need to check that filtered columns have no nulls in the block.
+ */
+static bool
+BlockPredicatesImplied(List *columnPredicateList, StripeSkipList *stripeSkipList,
+					   uint32 blockIndex)
+{
+	ListCell *columnPredicateCell = NULL;
+
+	foreach(columnPredicateCell, columnPredicateList)
+	{
+		ColumnPredicate *columnPredicate = lfirst(columnPredicateCell);
+		ColumnBlockSkipNode *columnSkipList =
+			stripeSkipList->blockSkipNodeArray[columnPredicate->columnIndex];
+		ColumnBlockSkipNode *blockSkipNode = NULL;
+		Datum minimumValue = 0;
+		Datum maximumValue = 0;
+		bool predicateImplied = false;
+
+		if (columnPredicate->predicateType == PREDICATE_IS_NOT_NULL)
+		{
+			continue;
+		}
+		else if (columnPredicate->predicateType != PREDICATE_COMPARISON ||
+				 columnSkipList == NULL || !columnSkipList[blockIndex].hasMinMax)
+		{
+			return false;
+		}
+
+		blockSkipNode = &columnSkipList[blockIndex];
+		minimumValue = blockSkipNode->minimumValue;
+		maximumValue = blockSkipNode->maximumValue;
+
+		switch (columnPredicate->strategyNumber)
+		{
+			case BTLessStrategyNumber:
+			case BTLessEqualStrategyNumber:
+			{
+				predicateImplied = ColumnPredicateMatches(columnPredicate, maximumValue);
+				break;
+			}
+
+			case BTGreaterEqualStrategyNumber:
+			case BTGreaterStrategyNumber:
+			{
+				predicateImplied = ColumnPredicateMatches(columnPredicate, minimumValue);
+				break;
+			}
+
+			case BTEqualStrategyNumber:
+			{
+				predicateImplied = ColumnPredicateMatches(columnPredicate, minimumValue) &&
+								   ColumnPredicateMatches(columnPredicate, maximumValue);
+				break;
+			}
+
+			default:
+			{
+				predicateImplied = false;
+				break;
+			}
+		}
+
+		if (!predicateImplied)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * AggregateBlockSkipNodes adds a block whose rows all pass the predicates to
+ * the row count and min/max aggregates, using the block's skip nodes. Value
+ * counts are added by the caller, since they need the block's exists stream.
+ */
+static void
+AggregateBlockSkipNodes(TableReadState *readState, StripeSkipList *stripeSkipList,
+						uint32 blockIndex, ColumnAggregate *aggregateArray,
+						uint32 aggregateCount, FmgrInfo **comparisonFunctionArray,
+						MemoryContext aggregateContext)
+{
+	uint32 aggregateIndex = 0;
+
+	for (aggregateIndex = 0; aggregateIndex < aggregateCount; aggregateIndex++)
+	{
+		ColumnAggregate *aggregate = &aggregateArray[aggregateIndex];
+		FmgrInfo *comparisonFunction = comparisonFunctionArray[aggregateIndex];
+		ColumnBlockSkipNode *blockSkipNode = NULL;
+
+		if (aggregate->aggregateType == AGGREGATE_COUNT_ROWS)
+		{
+			blockSkipNode = &stripeSkipList->blockSkipNodeArray[0][blockIndex];
+			aggregate->valueCount += blockSkipNode->rowCount;
+			continue;
+		}
+		else if (aggregate->aggregateType == AGGREGATE_COUNT_VALUES)
+		{
+			continue;
+		}
+
+		/* blocks without min/max values only have nulls */
+		if (stripeSkipList->blockSkipNodeArray[aggregate->columnIndex] == NULL)
+		{
+			continue;
+		}
+
+		blockSkipNode =
+			&stripeSkipList->blockSkipNodeArray[aggregate->columnIndex][blockIndex];
+		if (!blockSkipNode->hasMinMax)
+		{
+			continue;
+		}
+
+		if (aggregate->aggregateType == AGGREGATE_MINIMUM)
+		{
+			UpdateAggregateValue(readState, aggregate, blockSkipNode->minimumValue,
+								 comparisonFunction, aggregateContext);
+		}
+		else
+		{
+			UpdateAggregateValue(readState, aggregate, blockSkipNode->maximumValue,
+								 comparisonFunction, aggregateContext);
+		}
+	}
+}
+
+
+/*
+ * AggregateBlockRows adds the selected rows of the deserialized block to the
+ * aggregates. If selectedRowArray is NULL, the first selectedRowCount rows of
+ * the block are selected. For min/max aggregates, we first find the block's
+ * best value, so that only one value per block is copied.
+ */
+static void
+AggregateBlockRows(TableReadState *readState, uint32 *selectedRowArray,
+				   uint32 selectedRowCount, ColumnAggregate *aggregateArray,
+				   uint32 aggregateCount, FmgrInfo **comparisonFunctionArray,
+				   MemoryContext aggregateContext)
+{
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	uint32 aggregateIndex = 0;
+
+	for (aggregateIndex = 0; aggregateIndex < aggregateCount; aggregateIndex++)
+	{
+		ColumnAggregate *aggregate = &aggregateArray[aggregateIndex];
+		FmgrInfo *comparisonFunction = comparisonFunctionArray[aggregateIndex];
+		ColumnBlockData *blockData = NULL;
+		Oid collationId = InvalidOid;
+		bool hasBestValue = false;
+		Datum bestValue = 0;
+		uint32 selectedRowIndex = 0;
+
+		if (aggregate->aggregateType == AGGREGATE_COUNT_ROWS)
+		{
+			aggregate->valueCount += selectedRowCount;
+			continue;
+		}
+
+		blockData = readState->blockDataArray[aggregate->columnIndex];
+		collationId = TupleDescAttr(tupleDescriptor, aggregate->columnIndex)->attcollation;
+
+		for (selectedRowIndex = 0; selectedRowIndex < selectedRowCount; selectedRowIndex++)
+		{
+			uint32 rowIndex = selectedRowIndex;
+			Datum value = 0;
+
+			if (selectedRowArray != NULL)
+			{
+				rowIndex = selectedRowArray[selectedRowIndex];
+			}
+
+			if (!blockData->existsArray[rowIndex])
+			{
+				continue;
+			}
+
+			if (aggregate->aggregateType == AGGREGATE_COUNT_VALUES)
+			{
+				aggregate->valueCount++;
+				continue;
+			}
+
+			value = blockData->valueArray[rowIndex];
+			if (hasBestValue)
+			{
+				Datum comparisonDatum = FunctionCall2Coll(comparisonFunction, collationId,
+														  value, bestValue);
+				int comparison = DatumGetInt32(comparisonDatum);
+
+				if ((aggregate->aggregateType == AGGREGATE_MINIMUM && comparison >= 0) ||
+					(aggregate->aggregateType == AGGREGATE_MAXIMUM && comparison <= 0))
+				{
+					continue;
+				}
+			}
+
+			bestValue = value;
+			hasBestValue = true;
+		}
+
+		if (hasBestValue)
+		{
+			UpdateAggregateValue(readState, aggregate, bestValue, comparisonFunction,
+								 aggregateContext);
+		}
+	}
+}
+
+
+/*
+ * UpdateAggregateValue replaces the min or max aggregate's value with the given
+ * value if it is smaller or larger, respectively. Aggregate values are copied
+ * into the given memory context, since stripe data doesn't live long enough.
+ */
+static void
+UpdateAggregateValue(TableReadState *readState, ColumnAggregate *aggregate, Datum value,
+					 FmgrInfo *comparisonFunction, MemoryContext aggregateContext)
+{
+	Form_pg_attribute attributeForm = TupleDescAttr(readState->tupleDescriptor,
+													aggregate->columnIndex);
+	MemoryContext oldContext = NULL;
+
+	if (aggregate->hasValue)
+	{
+		Datum comparisonDatum = FunctionCall2Coll(comparisonFunction,
+												  attributeForm->attcollation,
+												  value, aggregate->value);
+		int comparison = DatumGetInt32(comparisonDatum);
+
+		if ((aggregate->aggregateType == AGGREGATE_MINIMUM && comparison >= 0) ||
+			(aggregate->aggregateType == AGGREGATE_MAXIMUM && comparison <= 0))
+		{
+			return;
+		}
+
+		if (!attributeForm->attbyval)
+		{
+			pfree(DatumGetPointer(aggregate->value));
+		}
+	}
+
+	oldContext = MemoryContextSwitchTo(aggregateContext);
+	aggregate->value = datumCopy(value, attributeForm->attbyval, attributeForm->attlen);
+	aggregate->hasValue = true;
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * CStorePredicateSupported returns true if the reader can evaluate the given
+ * restriction clause on a table with the given tuple descriptor by itself. The
+ * reader's result is then exact, so the executor doesn't check it again.
+ */
+bool
+CStorePredicateSupported(Node *clause, TupleDesc tupleDescriptor)
+{
+	uint32 columnCount = tupleDescriptor->natts;
+	bool *columnMask = palloc0(columnCount * sizeof(bool));
+	ColumnPredicate *columnPredicate = NULL;
+
+	memset(columnMask, true, columnCount * sizeof(bool));
+	columnPredicate = BuildColumnPredicate((Expr *) clause, tupleDescriptor, columnMask);
+
+	pfree(columnMask);
+
+	return (columnPredicate != NULL);
+}
+
+
+/*
+ * StripeBlockRowCount returns the number of rows in the given block of a stripe.
+ * All blocks are full except for the last one.
+ */
+static uint32
+StripeBlockRowCount(uint64 stripeRowCount, uint64 blockRowCount, uint32 blockIndex)
+{
+	uint32 lastBlockIndex = stripeRowCount / blockRowCount;
+
+	if (blockIndex == lastBlockIndex)
+	{
+		return stripeRowCount % blockRowCount;
+	}
+
+	return blockRowCount;
+}
+
+
+/*
+ * NextStripeIndex finds the index of the next stripe this backend should read,
+ * and returns false if there are no stripes left. In a parallel scan, stripes
+ * are claimed from the shared stripe dispenser so that every stripe is read by
+ * exactly one participant. Otherwise, stripes are read in file order.
+ */
+static bool
+NextStripeIndex(TableReadState *readState, uint32 *stripeIndex)
+{
+	List *stripeMetadataList = readState->tableFooter->stripeMetadataList;
+	uint32 stripeCount = list_length(stripeMetadataList);
+	bool *selectedStripeMask = readState->selectedStripeMask;
+	uint32 nextStripeIndex = 0;
+#if PG_VERSION_NUM >= 100000
+	SharedStripeDispenser *stripeDispenser = readState->stripeDispenser;
+#endif
+
+	/* stripes refuted by their statistics are skipped without being read */
+	for (;;)
+	{
+		nextStripeIndex = readState->nextStripeIndex;
+
+#if PG_VERSION_NUM >= 100000
+		if (stripeDispenser != NULL)
+		{
+			nextStripeIndex = pg_atomic_fetch_add_u32(&stripeDispenser->nextStripeIndex,
+													  1);
+			stripeCount = Min(stripeCount, stripeDispenser->stripeCount);
+		}
+#endif
+
+		if (nextStripeIndex >= stripeCount)
+		{
+			return false;
+		}
+
+		readState->nextStripeIndex = nextStripeIndex + 1;
+
+		if (selectedStripeMask == NULL || selectedStripeMask[nextStripeIndex])
+		{
+			break;
+		}
+
+		readState->skippedStripeCount++;
+	}
+
+	(*stripeIndex) = nextStripeIndex;
+	return true;
+}
+
+
+/*
+ * SelectedStripeMask checks each stripe's column statistics in the table footer
+ * against the read state's compiled qualifiers, and returns a mask of the
+ * stripes that can have matching rows. Refuted stripes are then skipped without
+ * reading their skip lists or data. The function returns NULL if there are no
+ * qualifiers.
+ */
+static bool *
+SelectedStripeMask(TableReadState *readState)
+{
+	List *stripeMetadataList = readState->tableFooter->stripeMetadataList;
+	uint32 stripeCount = list_length(stripeMetadataList);
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	List *residualRestrictInfoList = readState->residualRestrictInfoList;
+	bool *selectedStripeMask = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	uint32 stripeIndex = 0;
+
+	if ((readState->columnBoundList == NIL && residualRestrictInfoList == NIL) ||
+		stripeCount == 0)
+	{
+		return NULL;
+	}
+
+	selectedStripeMask = palloc0(stripeCount * sizeof(bool));
+
+	foreach(stripeMetadataCell, stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = lfirst(stripeMetadataCell);
+		bool predicateRefuted = StripeBoundsRefuted(readState->columnBoundList,
+													stripeMetadata, tupleDescriptor);
+
+		if (!predicateRefuted && residualRestrictInfoList != NIL)
+		{
+			List *constraintList = StripeConstraintList(stripeMetadata, tupleDescriptor,
+														readState->projectedColumnList,
+														readState->baseConstraintArray);
+			if (constraintList != NIL)
+			{
+#if (PG_VERSION_NUM >= 100000)
+				predicateRefuted = predicate_refuted_by(constraintList,
+														residualRestrictInfoList, false);
+#else
+				predicateRefuted = predicate_refuted_by(constraintList,
+														residualRestrictInfoList);
+#endif
+			}
+		}
+
+		selectedStripeMask[stripeIndex] = !predicateRefuted;
+		stripeIndex++;
+	}
+
+	return selectedStripeMask;
+}
+
+
+/*
+ * StripeBoundsRefuted returns true if the given stripe's column statistics show
+ * that none of its rows can satisfy all column bounds. Comparisons are never
+ * true for nulls, so stripes in which a bounded column is all null are refuted
+ * as well.
+ */
+static bool
+StripeBoundsRefuted(List *columnBoundList, StripeMetadata *stripeMetadata,
+					TupleDesc tupleDescriptor)
+{
+	ListCell *columnBoundCell = NULL;
+
+	if (stripeMetadata->columnSkipNodeArray == NULL)
+	{
+		return false;
+	}
+
+	foreach(columnBoundCell, columnBoundList)
+	{
+		ColumnBound *columnBound = lfirst(columnBoundCell);
+		uint32 columnIndex = columnBound->columnIndex;
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		ColumnStripeSkipNode *skipNode = NULL;
+		Datum minimumValue = 0;
+		Datum maximumValue = 0;
+
+		if (columnIndex >= stripeMetadata->columnCount)
+		{
+			continue;
+		}
+
+		skipNode = &stripeMetadata->columnSkipNodeArray[columnIndex];
+		if (skipNode->nullCount == stripeMetadata->rowCount)
+		{
+			return true;
+		}
+		else if (!skipNode->hasMinMax)
+		{
+			continue;
+		}
+
+		minimumValue = DeserializeDatum(skipNode->minimumValue, attributeForm->attbyval,
+										attributeForm->attlen);
+		maximumValue = DeserializeDatum(skipNode->maximumValue, attributeForm->attbyval,
+										attributeForm->attlen);
+
+		if (!ColumnBoundAdmitsRange(columnBound, minimumValue, maximumValue))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * StripeConstraintList returns constraints that hold for all rows of the given
+ * stripe, built from the statistics of its projected columns: the range of a
+ * column's values, and whether the column has no nulls or only nulls. Stripes
+ * written by older versions don't have statistics, and get no constraints.
+ */
+static List *
+StripeConstraintList(StripeMetadata *stripeMetadata, TupleDesc tupleDescriptor,
+					 List *projectedColumnList, Node **baseConstraintArray)
+{
+	List *constraintList = NIL;
+	ListCell *columnCell = NULL;
+
+	if (stripeMetadata->columnSkipNodeArray == NULL)
+	{
+		return NIL;
+	}
+
+	foreach(columnCell, projectedColumnList)
+	{
+		Var *column = lfirst(columnCell);
+		uint32 columnIndex = column->varattno - 1;
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		Node *baseConstraint = baseConstraintArray[columnIndex];
+		ColumnStripeSkipNode *skipNode = NULL;
+
+		/* columns added after the stripe was written have their default value */
+		if (columnIndex >= stripeMetadata->columnCount)
+		{
+			continue;
+		}
+
+		skipNode = &stripeMetadata->columnSkipNodeArray[columnIndex];
+		if (skipNode->nullCount == stripeMetadata->rowCount)
+		{
+			constraintList = lappend(constraintList, MakeNullTest(column, IS_NULL));
+			continue;
+		}
+
+		if (skipNode->nullCount == 0)
+		{
+			constraintList = lappend(constraintList, MakeNullTest(column, IS_NOT_NULL));
+		}
+
+		if (skipNode->hasMinMax && baseConstraint != NULL)
+		{
+			Datum minimumValue = DeserializeDatum(skipNode->minimumValue,
+												  attributeForm->attbyval,
+												  attributeForm->attlen);
+			Datum maximumValue = DeserializeDatum(skipNode->maximumValue,
+												  attributeForm->attbyval,
+												  attributeForm->attlen);
+
+			/* the constraint is updated in place, so it only holds for this stripe */
+			UpdateConstraint(baseConstraint, minimumValue, maximumValue);
+			constraintList = lappend(constraintList, baseConstraint);
+		}
+	}
+
+	return constraintList;
+}
+
+
+/* MakeNullTest builds a null test of the given type for the given variable. */
+static NullTest *
+MakeNullTest(Var *variable, NullTestType nullTestType)
+{
+	NullTest *nullTest = makeNode(NullTest);
+	nullTest->arg = (Expr *) variable;
+	nullTest->nulltesttype = nullTestType;
+	nullTest->argisrow = false;
+	nullTest->location = -1;
+
+	return nullTest;
+}
+
+
+/*
+ * PrefetchStripes advises the kernel that we will soon read the stripes that
+ * follow the current stripe, so that their metadata is read in the background
+ * while we deserialize the current stripe. At most cstore_fdw.prefetch_depth
+ * stripes are prefetched ahead, and each stripe is prefetched only once. In a
+ * parallel scan the next stripe of this backend isn't known in advance, so we
+ * don't prefetch there.
+ */
+static void
+PrefetchStripes(TableReadState *readState, uint32 currentStripeIndex)
+{
+#ifdef USE_POSIX_FADVISE
+	List *stripeMetadataList = readState->tableFooter->stripeMetadataList;
+	uint32 stripeCount = list_length(stripeMetadataList);
+	uint32 stripeIndex = Max(readState->prefetchedStripeCount, currentStripeIndex + 1);
+	uint32 lastStripeIndex = currentStripeIndex + PrefetchDepth;
+
+#if PG_VERSION_NUM >= 100000
+	if (readState->stripeDispenser != NULL)
+	{
+		return;
+	}
+#endif
+
+	for (; stripeIndex <= lastStripeIndex && stripeIndex < stripeCount; stripeIndex++)
+	{
+		StripeMetadata *stripeMetadata = list_nth(stripeMetadataList, stripeIndex);
+
+		/* stripes that are skipped won't be read */
+		if (readState->selectedStripeMask == NULL ||
+			readState->selectedStripeMask[stripeIndex])
+		{
+			PrefetchStripe(readState, stripeMetadata);
+		}
+
+		readState->prefetchedStripeCount = stripeIndex + 1;
+	}
+#endif
+}
+
+
+/*
+ * PrefetchStripe issues read-ahead advice for the given stripe's skip lists and
+ * footer, whose locations are known from the stripe's metadata. These are read
+ * first when the stripe is loaded, and only then tell which blocks of which
+ * columns to read. We don't read the footer here to advise the column data,
+ * since that would only move the wait for the footer here, and read it twice.
+ */
+static void
+PrefetchStripe(TableReadState *readState, StripeMetadata *stripeMetadata)
+{
+#ifdef USE_POSIX_FADVISE
+	int fileDescriptor = fileno(readState->tableFile);
+	uint64 footerOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength +
+						  stripeMetadata->dataLength;
+
+	/* skip lists are at the start of the stripe, and the footer at its end */
+	(void) posix_fadvise(fileDescriptor, stripeMetadata->fileOffset,
+						 stripeMetadata->skipListLength, POSIX_FADV_WILLNEED);
+	(void) posix_fadvise(fileDescriptor, footerOffset, stripeMetadata->footerLength,
+						 POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+/*
+ * MapTableFile maps the table file into memory, so that column blocks can be
+ * used in place instead of being copied into palloc'd buffers. The mapping is
+ * released when the read finishes, or when the current memory context goes
+ * away if the read is aborted by an error. If the file can't be mapped, we
+ * silently fall back to reading it.
+ */
+static void
+MapTableFile(TableReadState *readState)
+{
+#if PG_VERSION_NUM >= 90500
+	int64 fileSize = FILESize(readState->tableFile);
+	FileMapping *fileMapping = NULL;
+	MemoryContextCallback *unmapCallback = NULL;
+	void *mappedAddress = NULL;
+
+	if (fileSize <= 0 || (uint64) fileSize > (uint64) SIZE_MAX)
+	{
+		return;
+	}
+
+	mappedAddress = mmap(NULL, (size_t) fileSize, PROT_READ, MAP_SHARED,
+						 fileno(readState->tableFile), 0);
+	if (mappedAddress == MAP_FAILED)
+	{
+		ereport(DEBUG1, (errmsg("could not map cstore file, reading it instead: %m")));
+		return;
+	}
+
+	/*
+	 * The mapping and its callback outlive the read state, since callbacks
+	 * can't be unregistered. CStoreEndRead only unmaps the file.
+	 */
+	fileMapping = palloc0(sizeof(FileMapping));
+	fileMapping->address = (char *) mappedAddress;
+	fileMapping->size = (uint64) fileSize;
+
+	unmapCallback = palloc0(sizeof(MemoryContextCallback));
+	unmapCallback->func = UnmapTableFile;
+	unmapCallback->arg = fileMapping;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, unmapCallback);
+
+	readState->fileMapping = fileMapping;
+#endif
+}
+
+
+/* UnmapTableFile releases the given file mapping, if it is still mapped. */
+static void
+UnmapTableFile(void *arg)
+{
+	FileMapping *fileMapping = (FileMapping *) arg;
+
+	if (fileMapping->address != NULL)
+	{
+		munmap(fileMapping->address, (size_t) fileMapping->size);
+
+		fileMapping->address = NULL;
+		fileMapping->size = 0;
+	}
+}
+
+
+/*
+ * FooterCacheKey builds the metadata cache key for the given open footer file.
+ * The key includes the footer's modification time and size, so a rewritten
+ * footer gets a new key. We examine the open file rather than its path, since
+ * writers rename a new footer into place. The function returns false if the
+ * file can't be examined.
+ */
+static bool
+FooterCacheKey(FILE *footerFile, MetadataCacheEntryType entryType,
+			   MetadataCacheKey *cacheKey)
+{
+	struct stat footerFileStat;
+
+	if (fstat(fileno(footerFile), &footerFileStat) != 0)
+	{
+		return false;
+	}
+
+	InitMetadataCacheKey(cacheKey, entryType);
+	cacheKey->fileDevice = (uint64) footerFileStat.st_dev;
+	cacheKey->fileInode = (uint64) footerFileStat.st_ino;
+	cacheKey->modificationTime = (int64) footerFileStat.st_mtime;
+	cacheKey->fileSize = (uint64) footerFileStat.st_size;
+
+	return true;
+}
+
+
+/*
+ * SkipListCacheKey builds the metadata cache key for a column's skip list in
+ * the given stripe. Stripes are never modified after they are written, so the
+ * stripe's location identifies its contents. The column type is part of the
+ * key since it determines how minimum and maximum values are laid out.
+ */
+static bool
+SkipListCacheKey(TableReadState *readState, StripeMetadata *stripeMetadata,
+				 uint32 columnIndex, Oid typeId, MetadataCacheKey *cacheKey)
+{
+	if (readState->fileInode == 0)
+	{
+		return false;
+	}
+
+	InitMetadataCacheKey(cacheKey, CACHE_ENTRY_SKIP_LIST);
+	cacheKey->fileDevice = readState->fileDevice;
+	cacheKey->fileInode = readState->fileInode;
+	cacheKey->stripeOffset = stripeMetadata->fileOffset;
+	cacheKey->stripeLength = stripeMetadata->skipListLength +
+							 stripeMetadata->dataLength + stripeMetadata->footerLength;
+	cacheKey->columnIndex = columnIndex;
+	cacheKey->typeId = typeId;
+
+	return true;
+}
+
+
+/*
+ * FlattenTableFooter lays out the given table footer in a single buffer: the
+ * block row count and the stripe count, followed by the stripe metadata array,
+ * and then by each stripe's column statistics and their minimum and maximum
+ * values. In the flattened structs, pointers are replaced with offsets within
+ * the buffer.
+ */
+static StringInfo
+FlattenTableFooter(TableFooter *tableFooter)
+{
+	StringInfo buffer = makeStringInfo();
+	uint64 stripeCount = list_length(tableFooter->stripeMetadataList);
+	ListCell *stripeMetadataCell = NULL;
+	uint64 stripeIndex = 0;
+	Size stripeMetadataOffset = 2 * sizeof(uint64);
+
+	appendBinaryStringInfo(buffer, (char *) &tableFooter->blockRowCount, sizeof(uint64));
+	appendBinaryStringInfo(buffer, (char *) &stripeCount, sizeof(uint64));
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		appendBinaryStringInfo(buffer, (char *) stripeMetadata, sizeof(StripeMetadata));
+	}
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		ColumnStripeSkipNode *skipNodeArray = stripeMetadata->columnSkipNodeArray;
+		uint32 columnCount = stripeMetadata->columnCount;
+		uint32 columnIndex = 0;
+		Size skipNodeArrayOffset = 0;
+		StripeMetadata *flatStripeMetadata = NULL;
+
+		stripeIndex++;
+		if (skipNodeArray == NULL)
+		{
+			continue;
+		}
+
+		skipNodeArrayOffset = AppendFlatData(buffer, (char *) skipNodeArray,
+											 columnCount * sizeof(ColumnStripeSkipNode));
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			ColumnStripeSkipNode *skipNode = &skipNodeArray[columnIndex];
+			ColumnStripeSkipNode *flatSkipNode = NULL;
+			Size minimumOffset = 0;
+			Size maximumOffset = 0;
+
+			if (!skipNode->hasMinMax)
+			{
+				continue;
+			}
+
+			minimumOffset = AppendFlatData(buffer, skipNode->minimumValue,
+										   skipNode->minimumLength);
+			maximumOffset = AppendFlatData(buffer, skipNode->maximumValue,
+										   skipNode->maximumLength);
+
+			/* buffer may have been reallocated, so find the flat node again */
+			flatSkipNode = ((ColumnStripeSkipNode *) (buffer->data +
+													  skipNodeArrayOffset)) + columnIndex;
+			flatSkipNode->minimumValue = (char *) minimumOffset;
+			flatSkipNode->maximumValue = (char *) maximumOffset;
+		}
+
+		flatStripeMetadata = ((StripeMetadata *) (buffer->data + stripeMetadataOffset)) +
+							 (stripeIndex - 1);
+		flatStripeMetadata->columnSkipNodeArray =
+			(ColumnStripeSkipNode *) skipNodeArrayOffset;
+	}
+
+	return buffer;
+}
+
+
+/*
+ * UnflattenTableFooter builds a table footer from a flattened footer buffer. The
+ * footer is copied out of the buffer, so the buffer can be freed afterwards.
+ */
+static TableFooter *
+UnflattenTableFooter(StringInfo buffer)
+{
+	TableFooter *tableFooter = palloc0(sizeof(TableFooter));
+	uint64 stripeCount = 0;
+	uint64 stripeIndex = 0;
+	char *stripeMetadataData = buffer->data + 2 * sizeof(uint64);
+
+	memcpy(&tableFooter->blockRowCount, buffer->data, sizeof(uint64));
+	memcpy(&stripeCount, buffer->data + sizeof(uint64), sizeof(uint64));
+
+	for (stripeIndex = 0; stripeIndex < stripeCount; stripeIndex++)
+	{
+		StripeMetadata *stripeMetadata = palloc0(sizeof(StripeMetadata));
+		uint32 columnIndex = 0;
+
+		memcpy(stripeMetadata, stripeMetadataData + stripeIndex * sizeof(StripeMetadata),
+			   sizeof(StripeMetadata));
+
+		if (stripeMetadata->columnSkipNodeArray != NULL)
+		{
+			Size skipNodeArrayOffset = (Size) stripeMetadata->columnSkipNodeArray;
+			uint32 columnCount = stripeMetadata->columnCount;
+			ColumnStripeSkipNode *skipNodeArray = (ColumnStripeSkipNode *)
+				CopyFlatData(buffer, skipNodeArrayOffset,
+							 columnCount * sizeof(ColumnStripeSkipNode));
+
+			for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+			{
+				ColumnStripeSkipNode *skipNode = &skipNodeArray[columnIndex];
+				if (!skipNode->hasMinMax)
+				{
+					continue;
+				}
+
+				skipNode->minimumValue = CopyFlatData(buffer,
+													  (Size) skipNode->minimumValue,
+													  skipNode->minimumLength);
+				skipNode->maximumValue = CopyFlatData(buffer,
+													  (Size) skipNode->maximumValue,
+													  skipNode->maximumLength);
+			}
+
+			stripeMetadata->columnSkipNodeArray = skipNodeArray;
+		}
+
+		tableFooter->stripeMetadataList = lappend(tableFooter->stripeMetadataList,
+												  stripeMetadata);
+	}
+
+	return tableFooter;
+}
+
+
+/*
+ * FlattenColumnSkipList lays out the given skip list in a single buffer: the
+ * block count, followed by the skip node array, and then by the values of
+ * by-reference minimums and maximums and by bloom filters. In the flattened
+ * skip nodes, these values are replaced with their offsets within the buffer.
+ */
+static StringInfo
+FlattenColumnSkipList(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCount,
+					  bool typeByValue, int typeLength)
+{
+	StringInfo buffer = makeStringInfo();
+	uint64 flatBlockCount = blockCount;
+	uint32 blockIndex = 0;
+
+	appendBinaryStringInfo(buffer, (char *) &flatBlockCount, sizeof(uint64));
+	appendBinaryStringInfo(buffer, (char *) blockSkipNodeArray,
+						   blockCount * sizeof(ColumnBlockSkipNode));
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		ColumnBlockSkipNode *flatSkipNode = NULL;
+		bool flattenMinMax = (blockSkipNode->hasMinMax && !typeByValue);
+		Datum minimumOffset = 0;
+		Datum maximumOffset = 0;
+		Size bloomFilterOffset = 0;
+
+		if (!flattenMinMax && blockSkipNode->bloomFilter == NULL)
+		{
+			continue;
+		}
+
+		if (flattenMinMax)
+		{
+			minimumOffset = AppendFlatDatum(buffer, blockSkipNode->minimumValue,
+											typeLength);
+			maximumOffset = AppendFlatDatum(buffer, blockSkipNode->maximumValue,
+											typeLength);
+		}
+
+		if (blockSkipNode->bloomFilter != NULL)
+		{
+			bloomFilterOffset = AppendFlatData(buffer, blockSkipNode->bloomFilter,
+											   blockSkipNode->bloomFilterLength);
+		}
+
+		/* buffer may have been reallocated, so find the flat node again */
+		flatSkipNode = ((ColumnBlockSkipNode *) (buffer->data + sizeof(uint64))) +
+					   blockIndex;
+		if (flattenMinMax)
+		{
+			flatSkipNode->minimumValue = minimumOffset;
+			flatSkipNode->maximumValue = maximumOffset;
+		}
+		if (blockSkipNode->bloomFilter != NULL)
+		{
+			flatSkipNode->bloomFilter = (char *) bloomFilterOffset;
+		}
+	}
+
+	return buffer;
+}
+
+
+/*
+ * UnflattenColumnSkipList returns the skip node array in the given flattened
+ * skip list buffer, and sets the block count. The nodes are used in place, so
+ * the buffer must live as long as the skip list.
+ */
+static ColumnBlockSkipNode *
+UnflattenColumnSkipList(StringInfo buffer, bool typeByValue, uint32 *blockCount)
+{
+	ColumnBlockSkipNode *blockSkipNodeArray =
+		(ColumnBlockSkipNode *) (buffer->data + sizeof(uint64));
+	uint64 flatBlockCount = 0;
+	uint32 blockIndex = 0;
+
+	memcpy(&flatBlockCount, buffer->data, sizeof(uint64));
+
+	for (blockIndex = 0; blockIndex < flatBlockCount; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+		if (blockSkipNode->hasMinMax && !typeByValue)
+		{
+			Size minimumOffset = (Size) blockSkipNode->minimumValue;
+			Size maximumOffset = (Size) blockSkipNode->maximumValue;
+
+			blockSkipNode->minimumValue = PointerGetDatum(buffer->data + minimumOffset);
+			blockSkipNode->maximumValue = PointerGetDatum(buffer->data + maximumOffset);
+		}
+
+		if (blockSkipNode->bloomFilter != NULL)
+		{
+			Size bloomFilterOffset = (Size) blockSkipNode->bloomFilter;
+			blockSkipNode->bloomFilter = buffer->data + bloomFilterOffset;
+		}
+	}
+
+	(*blockCount) = (uint32) flatBlockCount;
+	return blockSkipNodeArray;
+}
+
+
+/*
+ * AppendFlatDatum appends the given by-reference value to the buffer at a
+ * maximally aligned offset, and returns that offset.
+ */
+static Datum
+AppendFlatDatum(StringInfo buffer, Datum value, int typeLength)
+{
+	Size datumSize = datumGetSize(value, false, typeLength);
+	Size datumOffset = AppendFlatData(buffer, DatumGetPointer(value), datumSize);
+
+	return (Datum) datumOffset;
+}
+
+
+/*
+ * AppendFlatData appends the given data to the buffer at a maximally aligned
+ * offset, and returns that offset.
+ */
+static Size
+AppendFlatData(StringInfo buffer, const char *data, Size dataLength)
+{
+	Size dataOffset = MAXALIGN(buffer->len);
+
+	while (buffer->len < dataOffset)
+	{
+		appendStringInfoChar(buffer, '\0');
+	}
+
+	appendBinaryStringInfo(buffer, data, dataLength);
+
+	return dataOffset;
+}
+
+
+/* CopyFlatData returns a palloc'd copy of the data at the given buffer offset. */
+static char *
+CopyFlatData(StringInfo buffer, Size dataOffset, Size dataLength)
+{
+	char *dataCopy = palloc(dataLength);
+	memcpy(dataCopy, buffer->data + dataOffset, dataLength);
+
+	return dataCopy;
+}
+
+
+/* Finishes a cstore read operation. */
+void
+CStoreEndRead(TableReadState *readState)
+{
+	int columnCount = readState->tupleDescriptor->natts;
+
+	MemoryContextDelete(readState->stripeReadContext);
+	MemoryContextDelete(readState->predicateContext);
+	MemoryContextDelete(readState->qualifierContext);
+	ReleaseDecompressionState(readState->decompressionState);
+	MemoryContextDelete(readState->decompressionContext);
+	if (readState->fileMapping != NULL)
+	{
+		UnmapTableFile(readState->fileMapping);
+	}
+	FreeFile(readState->tableFile);
+	list_free_deep(readState->tableFooter->stripeMetadataList);
+	FreeColumnBlockDataArray(readState->blockDataArray, columnCount);
+	pfree(readState->tableFooter);
+	pfree(readState);
+}
+
+
+/*
+ * CreateEmptyBlockDataArray creates data buffers to keep deserialized exist and
+ * value arrays for requested columns in columnMask.
+ */
+ColumnBlockData **
+CreateEmptyBlockDataArray(uint32 columnCount, bool *columnMask, uint32 blockRowCount)
+{
+	uint32 columnIndex = 0;
+	ColumnBlockData **blockDataArray = palloc0(columnCount * sizeof(ColumnBlockData*));
+
+	/* allocate block memory for deserialized data */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		if (columnMask[columnIndex])
+		{
+			ColumnBlockData *blockData = palloc0(sizeof(ColumnBlockData));
+
+			blockData->existsArray = palloc0(blockRowCount * sizeof(bool));
+			blockData->valueArray = palloc0(blockRowCount * sizeof(Datum));
+			blockData->valueBuffer = NULL;
+			blockDataArray[columnIndex] = blockData;
+		}
+	}
+
+	return blockDataArray;
+}
+
+
+/*
+ * FreeColumnBlockDataArray deallocates data buffers to keep deserialized exist and
+ * value arrays for requested columns in columnMask.
+ * ColumnBlockData->serializedValueBuffer lives in memory read/write context
+ * so it is deallocated automatically when the context is deleted.
+ */
+void
+FreeColumnBlockDataArray(ColumnBlockData **blockDataArray, uint32 columnCount)
+{
+	uint32 columnIndex = 0;
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBlockData *blockData = blockDataArray[columnIndex];
+		if (blockData != NULL)
+		{
+			pfree(blockData->existsArray);
+			pfree(blockData->valueArray);
+			pfree(blockData);
+		}
+	}
+
+	pfree(blockDataArray);
+}
+
+
+/*
+ * CStoreTableRowCount returns the exact row count of a table using skiplists.
+ * The planner calls this for every query, so the row count is cached for each
+ * version of the table footer.
+ */
+uint64
+CStoreTableRowCount(const char *filename)
+{
+	TableFooter *tableFooter = NULL;
+	FILE *tableFooterFile = NULL;
+	FILE *tableFile = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	uint64 totalRowCount = 0;
+	MetadataCacheKey cacheKey;
+	bool cacheKeyFound = false;
+	StringInfo rowCountBuffer = NULL;
+
+	StringInfo tableFooterFilename = makeStringInfo();
+
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+
+	/* the row count is cached under the key of the footer that we read it from */
+	tableFooterFile = OpenFooterFile(tableFooterFilename->data);
+	cacheKeyFound = FooterCacheKey(tableFooterFile, CACHE_ENTRY_ROW_COUNT, &cacheKey);
+	if (cacheKeyFound)
+	{
+		rowCountBuffer = MetadataCacheLookup(&cacheKey);
+		if (rowCountBuffer != NULL && rowCountBuffer->len == sizeof(uint64))
+		{
+			memcpy(&totalRowCount, rowCountBuffer->data, sizeof(uint64));
+			FreeFile(tableFooterFile);
+			return totalRowCount;
+		}
+	}
+
+	tableFooter = ReadFooterFile(tableFooterFile);
+	FreeFile(tableFooterFile);
+
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+
+		/* only stripes written by older versions need their skip lists read */
+		if (stripeMetadata->columnSkipNodeArray != NULL)
+		{
+			totalRowCount += stripeMetadata->rowCount;
+			continue;
+		}
+
+		if (tableFile == NULL)
+		{
+			tableFile = AllocateFile(filename, PG_BINARY_R);
+			if (tableFile == NULL)
+			{
+				ereport(ERROR, (errcode_for_file_access(),
+								errmsg("could not open file \"%s\" for reading: %m",
+									   filename)));
+			}
+		}
+
+		totalRowCount += StripeRowCount(tableFile, stripeMetadata);
+	}
+
+	if (tableFile != NULL)
+	{
+		FreeFile(tableFile);
+	}
+
+	if (cacheKeyFound)
+	{
+		rowCountBuffer = makeStringInfo();
+		appendBinaryStringInfo(rowCountBuffer, (char *) &totalRowCount, sizeof(uint64));
+		MetadataCacheInsert(&cacheKey, rowCountBuffer);
+	}
+
+	return totalRowCount;
+}
+
+
+/*
+ * CStoreColumnStripeOrder returns the fraction of consecutive stripes in the
+ * given file whose values of the given column are in order, meaning that the
+ * later stripe's minimum isn't below the earlier stripe's maximum. The planner
+ * uses this as the correlation between the column and the file order. Stripes
+ * without statistics for the column are ignored, and the function returns zero
+ * if there are fewer than two stripes to compare.
+ */
+double
+CStoreColumnStripeOrder(const char *filename, TupleDesc tupleDescriptor,
+						uint32 columnIndex)
+{
+	Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+	TableFooter *tableFooter = NULL;
+	ListCell *stripeMetadataCell = NULL;
+	Oid operatorClassId = InvalidOid;
+	Oid comparisonFunctionId = InvalidOid;
+	FmgrInfo comparisonFunction;
+	Datum previousMaximumValue = 0;
+	bool previousStripeFound = false;
+	uint32 stripePairCount = 0;
+	uint32 orderedPairCount = 0;
+	StringInfo tableFooterFilename = NULL;
+
+	operatorClassId = GetDefaultOpClass(attributeForm->atttypid, BTREE_AM_OID);
+	if (operatorClassId == InvalidOid)
+	{
+		return 0.0;
+	}
+
+	comparisonFunctionId = get_opfamily_proc(get_opclass_family(operatorClassId),
+											 get_opclass_input_type(operatorClassId),
+											 get_opclass_input_type(operatorClassId),
+											 BTORDER_PROC);
+	if (comparisonFunctionId == InvalidOid)
+	{
+		return 0.0;
+	}
+
+	fmgr_info(comparisonFunctionId, &comparisonFunction);
+
+	tableFooterFilename = makeStringInfo();
+	appendStringInfo(tableFooterFilename, "%s%s", filename, CSTORE_FOOTER_FILE_SUFFIX);
+
+	tableFooter = CStoreReadFooter(tableFooterFilename);
+
+	pfree(tableFooterFilename->data);
+	pfree(tableFooterFilename);
+
+	foreach(stripeMetadataCell, tableFooter->stripeMetadataList)
+	{
+		StripeMetadata *stripeMetadata = (StripeMetadata *) lfirst(stripeMetadataCell);
+		ColumnStripeSkipNode *skipNode = NULL;
+		Datum minimumValue = 0;
+		Datum maximumValue = 0;
+
+		if (stripeMetadata->columnSkipNodeArray == NULL ||
+			columnIndex >= stripeMetadata->columnCount)
+		{
+			continue;
+		}
+
+		skipNode = &stripeMetadata->columnSkipNodeArray[columnIndex];
+		if (!skipNode->hasMinMax)
+		{
+			continue;
+		}
+
+		minimumValue = DeserializeDatum(skipNode->minimumValue, attributeForm->attbyval,
+										attributeForm->attlen);
+		maximumValue = DeserializeDatum(skipNode->maximumValue, attributeForm->attbyval,
+										attributeForm->attlen);
+
+		if (previousStripeFound)
+		{
+			Datum comparisonDatum = FunctionCall2Coll(&comparisonFunction,
+													  attributeForm->attcollation,
+													  previousMaximumValue,
+													  minimumValue);
+
+			stripePairCount++;
+			if (DatumGetInt32(comparisonDatum) <= 0)
+			{
+				orderedPairCount++;
+			}
+		}
+
+		previousMaximumValue = maximumValue;
+		previousStripeFound = true;
+	}
+
+	if (stripePairCount == 0)
+	{
+		return 0.0;
+	}
+
+	return (double) orderedPairCount / stripePairCount;
+}
+
+
+/*
+ * StripeRowCount reads serialized stripe footer, the first column's
+ * skip list, and returns number of rows for given stripe.
+ */
+static uint64
+StripeRowCount(FILE *tableFile, StripeMetadata *stripeMetadata)
+{
+	uint64 rowCount = 0;
+	StripeFooter *stripeFooter = NULL;
+	StringInfo footerBuffer = NULL;
+	StringInfo firstColumnSkipListBuffer = NULL;
+	uint64 footerOffset = 0;
+
+	footerOffset += stripeMetadata->fileOffset;
+	footerOffset += stripeMetadata->skipListLength;
+	footerOffset += stripeMetadata->dataLength;
+
+	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
+	stripeFooter = DeserializeStripeFooter(footerBuffer);
+
+	firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
+	                                         stripeFooter->skipListSizeArray[0]);
+	rowCount =  DeserializeRowCount(firstColumnSkipListBuffer);
+
+	return rowCount;
+}
+
+
+/*
+ * LoadFilteredStripeBuffers reads serialized stripe data from the table file.
+ * The function skips over blocks whose rows are refuted by restriction qualifiers,
+ * and only loads columns that are projected in the query.
+ */
+static StripeBuffers *
+LoadFilteredStripeBuffers(TableReadState *readState, StripeMetadata *stripeMetadata)
+{
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
+	List *projectedColumnList = readState->projectedColumnList;
+	StripeBuffers *stripeBuffers = NULL;
+	List *readRequestList = NIL;
+	uint32 columnCount = tupleDescriptor->natts;
+
+	StripeFooter *stripeFooter = LoadStripeFooter(readState, stripeMetadata,
+												  columnCount);
+	bool *projectedColumnMask = ProjectedColumnMask(columnCount, projectedColumnList);
+
+	StripeSkipList *stripeSkipList = LoadStripeSkipList(readState, stripeMetadata,
+														stripeFooter, columnCount,
+														projectedColumnMask,
+														tupleDescriptor);
+
+	bool *selectedBlockMask = SelectedBlockMask(readState, stripeSkipList);
+
+	stripeBuffers = LoadStripeBuffers(stripeMetadata, stripeFooter, stripeSkipList,
+									  projectedColumnMask, selectedBlockMask, true,
+									  &readRequestList);
+
+	/* read selected blocks of all projected columns with as few reads as possible */
+	ReadCoalescedRequests(readState, readRequestList);
+
+	return stripeBuffers;
+}
+
+
+/*
+ * LoadStripeBuffers creates stripe buffers for the blocks in the given block
+ * mask and the columns in the given column mask, and adds the requests to read
+ * their data to the given read request list. If loadValues is false, only the
+ * exists streams are requested, and value buffers are left NULL. The buffers
+ * are filled in when the caller executes the read requests.
+ */
+static StripeBuffers *
+LoadStripeBuffers(StripeMetadata *stripeMetadata, StripeFooter *stripeFooter,
+				  StripeSkipList *stripeSkipList, bool *columnMask,
+				  bool *blockMask, bool loadValues, List **readRequestList)
+{
+	StripeBuffers *stripeBuffers = NULL;
+	ColumnBuffers **columnBuffersArray = NULL;
+	uint64 currentColumnFileOffset = 0;
+	uint32 columnIndex = 0;
+	uint32 columnCount = stripeSkipList->columnCount;
+
+	StripeSkipList *selectedBlockSkipList =
+		SelectedBlockSkipList(stripeSkipList, columnMask, blockMask);
+
+	/* load column data for requested columns */
+	columnBuffersArray = palloc0(columnCount * sizeof(ColumnBuffers *));
+	currentColumnFileOffset = stripeMetadata->fileOffset + stripeMetadata->skipListLength;
+
+	for (columnIndex = 0; columnIndex < stripeFooter->columnCount; columnIndex++)
+	{
+		uint64 existsSize = stripeFooter->existsSizeArray[columnIndex];
+		uint64 valueSize = stripeFooter->valueSizeArray[columnIndex];
+		uint64 existsFileOffset = currentColumnFileOffset;
+		uint64 valueFileOffset = currentColumnFileOffset + existsSize;
+
+		if (columnMask[columnIndex])
+		{
+			ColumnBlockSkipNode *blockSkipNode =
+				selectedBlockSkipList->blockSkipNodeArray[columnIndex];
+			uint32 blockCount = selectedBlockSkipList->blockCount;
+
+			ColumnBuffers *columnBuffers = LoadColumnBuffers(blockSkipNode, blockCount,
+															 existsFileOffset,
+															 valueFileOffset,
+															 loadValues,
+															 readRequestList);
+
+			columnBuffers->compressionDictionary =
+				stripeFooter->compressionDictionaryArray[columnIndex];
+			columnBuffersArray[columnIndex] = columnBuffers;
+		}
+
+		currentColumnFileOffset += existsSize;
+		currentColumnFileOffset += valueSize;
+	}
+
+	stripeBuffers = palloc0(sizeof(StripeBuffers));
+	stripeBuffers->columnCount = columnCount;
+	stripeBuffers->rowCount = StripeSkipListRowCount(selectedBlockSkipList);
+	stripeBuffers->columnBuffersArray = columnBuffersArray;
+
+	return stripeBuffers;
+}
+
+
+/*
+ * LoadColumnBuffers creates buffers for serialized column data, and adds the
+ * requests to read them to the given read request list. These column data are
+ * laid out as sequential blocks in the file; and block positions and lengths
+ * are retrieved from the column block skip node array. The buffers are filled
+ * in when the caller executes the read requests. If loadValues is false, only
+ * the "exists" blocks are requested.
+ */
+static ColumnBuffers *
+LoadColumnBuffers(ColumnBlockSkipNode *blockSkipNodeArray, uint32 blockCount,
+				  uint64 existsFileOffset, uint64 valueFileOffset, bool loadValues,
+				  List **readRequestList)
+{
+	ColumnBuffers *columnBuffers = NULL;
+	uint32 blockIndex = 0;
+	ColumnBlockBuffers **blockBuffersArray =
+			palloc0(blockCount * sizeof(ColumnBlockBuffers *));
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		blockBuffersArray[blockIndex] = palloc0(sizeof(ColumnBlockBuffers));
+	}
+
+	/*
+	 * We first request the "exists" blocks, and then the "values" blocks. Both
+	 * are stored sequentially on disk, so requests for neighboring blocks can
+	 * later be merged into a single read.
+	 */
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		uint64 existsOffset = existsFileOffset + blockSkipNode->existsBlockOffset;
+		StringInfo rawExistsBuffer = AddReadRequest(readRequestList, existsOffset,
+													blockSkipNode->existsLength);
+
+		blockBuffersArray[blockIndex]->existsBuffer = rawExistsBuffer;
+	}
+
+	for (blockIndex = 0; blockIndex < blockCount && loadValues; blockIndex++)
+	{
+		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+		CompressionType compressionType = blockSkipNode->valueCompressionType;
+		uint64 valueOffset = valueFileOffset + blockSkipNode->valueBlockOffset;
+		StringInfo rawValueBuffer = AddReadRequest(readRequestList, valueOffset,
+												   blockSkipNode->valueLength);
+
+		blockBuffersArray[blockIndex]->valueBuffer = rawValueBuffer;
+		blockBuffersArray[blockIndex]->valueCompressionType = compressionType;
+		blockBuffersArray[blockIndex]->valueEncodingType =
+			blockSkipNode->valueEncodingType;
+		blockBuffersArray[blockIndex]->valueFileOffset = valueOffset;
+	}
+
+	columnBuffers = palloc0(sizeof(ColumnBuffers));
+	columnBuffers->blockBuffersArray = blockBuffersArray;
+
+	return columnBuffers;
+}
+
+
+/* Reads and returns the given stripe's footer. */
+static StripeFooter *
+LoadStripeFooter(TableReadState *readState, StripeMetadata *stripeMetadata,
+				 uint32 columnCount)
+{
+	StripeFooter *stripeFooter = NULL;
+	StringInfo footerBuffer = makeStringInfo();
+	uint32 footerLength = stripeMetadata->footerLength;
+	uint64 footerOffset = 0;
+
+	footerOffset += stripeMetadata->fileOffset;
+	footerOffset += stripeMetadata->skipListLength;
+	footerOffset += stripeMetadata->dataLength;
+
+	enlargeStringInfo(footerBuffer, footerLength);
+	ReadStripeSegment(readState, footerOffset, footerBuffer->data, footerLength);
+	footerBuffer->len = footerLength;
+
+	stripeFooter = DeserializeStripeFooter(footerBuffer);
+	if (stripeFooter->columnCount > columnCount)
+	{
+		ereport(ERROR, (errmsg("stripe footer column count and table column count "
+							   "don't match")));
+	}
+
+	return stripeFooter;
+}
+
+
+/* Reads the skip list for the given stripe. */
+static StripeSkipList *
+LoadStripeSkipList(TableReadState *readState, StripeMetadata *stripeMetadata,
+				   StripeFooter *stripeFooter, uint32 columnCount,
+				   bool *projectedColumnMask,
+				   TupleDesc tupleDescriptor)
+{
+	StripeSkipList *stripeSkipList = NULL;
+	ColumnBlockSkipNode **blockSkipNodeArray = NULL;
+	StringInfo *columnSkipListBufferArray = NULL;
+	List *readRequestList = NIL;
+	uint64 currentColumnSkipListFileOffset = 0;
+	uint32 columnIndex = 0;
+	uint32 stripeBlockCount = 0;
+	uint32 stripeColumnCount = stripeFooter->columnCount;
+
+	/*
+	 * Only selected columns' column skip lists are read. However, the first
+	 * column's skip list is read regardless of being selected. It is used for
+	 * finding the block count, and by StripeSkipListRowCount later. Skip lists
+	 * found in the metadata cache are used as they are. The rest are stored
+	 * next to each other, so we read them together.
+	 */
+	blockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
+	columnSkipListBufferArray = palloc0(stripeColumnCount * sizeof(StringInfo));
+	currentColumnSkipListFileOffset = stripeMetadata->fileOffset;
+
+	for (columnIndex = 0; columnIndex < stripeColumnCount; columnIndex++)
+	{
+		uint64 columnSkipListSize = stripeFooter->skipListSizeArray[columnIndex];
+		bool firstColumn = columnIndex == 0;
+
+		if (projectedColumnMask[columnIndex] || firstColumn)
+		{
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+			StringInfo cachedSkipListBuffer = NULL;
+			MetadataCacheKey cacheKey;
+
+			if (SkipListCacheKey(readState, stripeMetadata, columnIndex,
+								 attributeForm->atttypid, &cacheKey))
+			{
+				cachedSkipListBuffer = MetadataCacheLookup(&cacheKey);
+			}
+
+			if (cachedSkipListBuffer != NULL)
+			{
+				blockSkipNodeArray[columnIndex] =
+					UnflattenColumnSkipList(cachedSkipListBuffer, attributeForm->attbyval,
+											&stripeBlockCount);
+			}
+			else
+			{
+				columnSkipListBufferArray[columnIndex] =
+					AddReadRequest(&readRequestList, currentColumnSkipListFileOffset,
+								   columnSkipListSize);
+			}
+		}
+
+		currentColumnSkipListFileOffset += columnSkipListSize;
+	}
+
+	ReadCoalescedRequests(readState, readRequestList);
+
+	/* deserialize block count, unless the first column's skip list was cached */
+	if (columnSkipListBufferArray[0] != NULL)
+	{
+		stripeBlockCount = DeserializeBlockCount(columnSkipListBufferArray[0]);
+	}
+
+	/* deserialize column skip lists which weren't cached, and cache them */
+	for (columnIndex = 0; columnIndex < stripeColumnCount; columnIndex++)
+	{
+		StringInfo columnSkipListBuffer = columnSkipListBufferArray[columnIndex];
+
+		if (columnSkipListBuffer != NULL)
+		{
+			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+			MetadataCacheKey cacheKey;
+
+			ColumnBlockSkipNode *columnSkipList =
+				DeserializeColumnSkipList(columnSkipListBuffer, attributeForm->attbyval,
+										  attributeForm->attlen, stripeBlockCount);
+			blockSkipNodeArray[columnIndex] = columnSkipList;
+
+			if (SkipListCacheKey(readState, stripeMetadata, columnIndex,
+								 attributeForm->atttypid, &cacheKey))
+			{
+				StringInfo flatSkipListBuffer =
+					FlattenColumnSkipList(columnSkipList, stripeBlockCount,
+										  attributeForm->attbyval,
+										  attributeForm->attlen);
+				MetadataCacheInsert(&cacheKey, flatSkipListBuffer);
+			}
+		}
+	}
+
+	/* table contains additional columns added after this stripe is created */
+	for (columnIndex = stripeColumnCount; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnBlockSkipNode *columnSkipList = NULL;
+		uint32 blockIndex = 0;
+		bool firstColumn = columnIndex == 0;
+
+		/* no need to create ColumnBlockSkipList if the column is not selected */
+		if (!projectedColumnMask[columnIndex] && !firstColumn)
+		{
+			blockSkipNodeArray[columnIndex] = NULL;
+			continue;
+		}
+
+		/* create empty ColumnBlockSkipNode for missing columns*/
+		columnSkipList = palloc0(stripeBlockCount * sizeof(ColumnBlockSkipNode));
+
+		for (blockIndex = 0; blockIndex < stripeBlockCount; blockIndex++)
+		{
+			columnSkipList[blockIndex].rowCount = 0;
+			columnSkipList[blockIndex].hasMinMax = false;
+			columnSkipList[blockIndex].minimumValue = 0;
+			columnSkipList[blockIndex].maximumValue = 0;
+			columnSkipList[blockIndex].existsBlockOffset = 0;
+			columnSkipList[blockIndex].valueBlockOffset = 0;
+			columnSkipList[blockIndex].existsLength = 0;
+			columnSkipList[blockIndex].valueLength = 0;
+			columnSkipList[blockIndex].valueCompressionType = COMPRESSION_NONE;
+			columnSkipList[blockIndex].valueEncodingType = ENCODING_NONE;
+		}
+		blockSkipNodeArray[columnIndex] = columnSkipList;
+	}
+
+	stripeSkipList = palloc0(sizeof(StripeSkipList));
+	stripeSkipList->blockSkipNodeArray = blockSkipNodeArray;
+	stripeSkipList->columnCount = columnCount;
+	stripeSkipList->blockCount = stripeBlockCount;
+
+	return stripeSkipList;
+}
+
+
+/*
+ * SelectedBlockMask walks over each column's blocks and checks if a block can
+ * be filtered without reading its data. The filtering happens when all rows in
+ * the block can be refuted by the read state's qualifiers. Column bounds are
+ * checked first with direct comparisons against the blocks' min/max values, and
+ * equality qualifiers against the blocks' bloom filters. The predicate prover
+ * is only called for the remaining qualifiers and blocks.
+ */
+static bool *
+SelectedBlockMask(TableReadState *readState, StripeSkipList *stripeSkipList)
+{
+	bool *selectedBlockMask = NULL;
+	ListCell *columnBoundCell = NULL;
+	ListCell *columnHashProbeCell = NULL;
+	ListCell *columnCell = NULL;
+	uint32 blockIndex = 0;
+	uint32 blockCount = stripeSkipList->blockCount;
+	List *residualRestrictInfoList = readState->residualRestrictInfoList;
+
+	selectedBlockMask = palloc0(blockCount * sizeof(bool));
+	memset(selectedBlockMask, true, blockCount * sizeof(bool));
+
+	foreach(columnBoundCell, readState->columnBoundList)
+	{
+		ColumnBound *columnBound = lfirst(columnBoundCell);
+		ColumnBlockSkipNode *blockSkipNodeArray =
+			stripeSkipList->blockSkipNodeArray[columnBound->columnIndex];
+
+		if (blockSkipNodeArray == NULL)
+		{
+			continue;
+		}
+
+		for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+		{
+			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+			/*
+			 * A column block with comparable data type can miss min/max values
+			 * if all values in the block are NULL.
+			 */
+			if (!selectedBlockMask[blockIndex] || !blockSkipNode->hasMinMax)
+			{
+				continue;
+			}
+
+			if (!ColumnBoundAdmitsRange(columnBound, blockSkipNode->minimumValue,
+										blockSkipNode->maximumValue))
+			{
+				selectedBlockMask[blockIndex] = false;
+			}
+		}
+	}
+
+	/* unsorted columns with many distinct values are filtered by bloom filters */
+	foreach(columnHashProbeCell, readState->columnHashProbeList)
+	{
+		ColumnHashProbe *columnHashProbe = lfirst(columnHashProbeCell);
+		ColumnBlockSkipNode *blockSkipNodeArray =
+			stripeSkipList->blockSkipNodeArray[columnHashProbe->columnIndex];
+
+		if (blockSkipNodeArray == NULL)
+		{
+			continue;
+		}
+
+		for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+		{
+			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+			if (!selectedBlockMask[blockIndex] || blockSkipNode->bloomFilter == NULL)
+			{
+				continue;
+			}
+
+			if (!BloomFilterMayContainAny(columnHashProbe, blockSkipNode))
+			{
+				selectedBlockMask[blockIndex] = false;
+			}
+		}
+	}
+
+	if (residualRestrictInfoList == NIL)
+	{
+		return selectedBlockMask;
+	}
+
+	foreach(columnCell, readState->projectedColumnList)
+	{
+		Var *column = lfirst(columnCell);
+		uint32 columnIndex = column->varattno - 1;
+		Node *baseConstraint = readState->baseConstraintArray[columnIndex];
+		ColumnBlockSkipNode *blockSkipNodeArray =
+			stripeSkipList->blockSkipNodeArray[columnIndex];
+
+		/* if this column's data type doesn't have a comparator, skip it */
+		if (baseConstraint == NULL)
+		{
+			continue;
+		}
+
+		for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+		{
+			bool predicateRefuted = false;
+			List *constraintList = NIL;
+			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+
+			if (!selectedBlockMask[blockIndex] || !blockSkipNode->hasMinMax)
+			{
+				continue;
+			}
+
+			UpdateConstraint(baseConstraint, blockSkipNode->minimumValue,
+							 blockSkipNode->maximumValue);
+
+			constraintList = list_make1(baseConstraint);
+#if (PG_VERSION_NUM >= 100000)
+			predicateRefuted = predicate_refuted_by(constraintList,
+													residualRestrictInfoList, false);
+#else
+			predicateRefuted = predicate_refuted_by(constraintList,
+													residualRestrictInfoList);
+#endif
+			if (predicateRefuted)
+			{
+				selectedBlockMask[blockIndex] = false;
+			}
+		}
+	}
+
+	return selectedBlockMask;
+}
+
+
+/*
+ * BuildColumnBoundList compiles the restriction clauses that compare a projected
+ * column with a constant into column bounds, and adds the other clauses to the
+ * residual clause list.
+ */
+static List *
+BuildColumnBoundList(List *clauseList, TupleDesc tupleDescriptor,
+					 bool *projectedColumnMask, List **residualClauseList)
+{
+	List *columnBoundList = NIL;
+	ListCell *clauseCell = NULL;
+
+	foreach(clauseCell, clauseList)
+	{
+		Expr *clause = (Expr *) lfirst(clauseCell);
+		ColumnBound *columnBound = BuildColumnBound(clause, tupleDescriptor,
+													projectedColumnMask);
+		if (columnBound != NULL)
+		{
+			columnBoundList = lappend(columnBoundList, columnBound);
+		}
+		else
+		{
+			(*residualClauseList) = lappend(*residualClauseList, clause);
+		}
+	}
+
+	return columnBoundList;
+}
+
+
+/*
+ * BuildColumnBound builds a column bound for the given clause if it is a <, <=,
+ * =, >= or > comparison between a column and a constant, and the operator is in
+ * the default btree operator family of the column's type. The family also needs
+ * a comparison function for the column and constant types. Skip list min/max
+ * values follow the column's collation, so the comparison has to use it too.
+ * For other clauses, the function returns NULL.
+ */
+static ColumnBound *
+BuildColumnBound(Expr *clause, TupleDesc tupleDescriptor, bool *projectedColumnMask)
+{
+	OpExpr *operatorExpression = NULL;
+	Node *leftOperand = NULL;
+	Node *rightOperand = NULL;
+	Const *constant = NULL;
+	int32 columnIndex = -1;
+	bool constantFirst = false;
+	Form_pg_attribute attributeForm = NULL;
+	int16 strategyNumber = 0;
+	Oid operatorClassId = InvalidOid;
+	Oid comparisonFunctionId = InvalidOid;
+	ColumnBound *columnBound = NULL;
+
+	if (!IsA(clause, OpExpr))
+	{
+		return NULL;
+	}
+
+	operatorExpression = (OpExpr *) clause;
+	if (list_length(operatorExpression->args) != 2)
+	{
+		return NULL;
+	}
+
+	leftOperand = (Node *) linitial(operatorExpression->args);
+	rightOperand = (Node *) lsecond(operatorExpression->args);
+
+	if (IsA(rightOperand, Const))
+	{
+		constant = (Const *) rightOperand;
+		columnIndex = PredicateColumnIndex(leftOperand, tupleDescriptor,
+										   projectedColumnMask);
+	}
+	else if (IsA(leftOperand, Const))
+	{
+		constant = (Const *) leftOperand;
+		columnIndex = PredicateColumnIndex(rightOperand, tupleDescriptor,
+										   projectedColumnMask);
+		constantFirst = true;
+	}
+
+	if (constant == NULL || constant->constisnull || columnIndex < 0)
+	{
+		return NULL;
+	}
+
+	attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+	if (attributeForm->attcollation != InvalidOid &&
+		attributeForm->attcollation != operatorExpression->inputcollid)
+	{
+		return NULL;
+	}
+
+	strategyNumber = ComparisonStrategyNumber(operatorExpression->opno,
+											  attributeForm->atttypid, constantFirst);
+	if (strategyNumber < BTLessStrategyNumber || strategyNumber > BTGreaterStrategyNumber)
+	{
+		return NULL;
+	}
+
+	operatorClassId = GetDefaultOpClass(attributeForm->atttypid, BTREE_AM_OID);
+	comparisonFunctionId = get_opfamily_proc(get_opclass_family(operatorClassId),
+											 get_opclass_input_type(operatorClassId),
+											 constant->consttype, BTORDER_PROC);
+	if (comparisonFunctionId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	columnBound = palloc0(sizeof(ColumnBound));
+	columnBound->columnIndex = (uint32) columnIndex;
+	columnBound->strategyNumber = strategyNumber;
+	columnBound->constant = constant->constvalue;
+	columnBound->collationId = attributeForm->attcollation;
+	fmgr_info(comparisonFunctionId, &columnBound->comparisonFunction);
+
+	return columnBound;
+}
+
+
+/*
+ * BuildColumnHashProbeList builds column hash probes for the restriction clauses
+ * that compare a projected column with a constant or a constant array for
+ * equality, and skips the other clauses.
+ */
+static List *
+BuildColumnHashProbeList(List *clauseList, TupleDesc tupleDescriptor,
+						 bool *projectedColumnMask)
+{
+	List *columnHashProbeList = NIL;
+	ListCell *clauseCell = NULL;
+
+	foreach(clauseCell, clauseList)
+	{
+		Expr *clause = (Expr *) lfirst(clauseCell);
+		ColumnHashProbe *columnHashProbe = BuildColumnHashProbe(clause, tupleDescriptor,
+																projectedColumnMask);
+		if (columnHashProbe != NULL)
+		{
+			columnHashProbeList = lappend(columnHashProbeList, columnHashProbe);
+		}
+	}
+
+	return columnHashProbeList;
+}
+
+
+/*
+ * BuildColumnHashProbe builds a column hash probe for the given clause if it is
+ * an equality comparison between a column and a constant, or a column = ANY
+ * comparison with a constant array, such as an IN list. The operator needs to
+ * be the equality operator of the default hash operator family of the column's
+ * type, which also has the hash function for the constants' type; values that
+ * are equal under the family's operators have the same hash. Hashes follow the
+ * column's collation, so the comparison has to use it too. For other clauses,
+ * the function returns NULL.
+ */
+static ColumnHashProbe *
+BuildColumnHashProbe(Expr *clause, TupleDesc tupleDescriptor, bool *projectedColumnMask)
+{
+	Oid operatorId = InvalidOid;
+	Oid inputCollationId = InvalidOid;
+	Node *columnOperand = NULL;
+	Const *constant = NULL;
+	int32 columnIndex = -1;
+	Datum *constantArray = NULL;
+	bool *constantNullArray = NULL;
+	int constantCount = 0;
+	int constantIndex = 0;
+	Oid constantTypeId = InvalidOid;
+	Form_pg_attribute attributeForm = NULL;
+	Oid operatorClassId = InvalidOid;
+	Oid operatorFamilyId = InvalidOid;
+	Oid hashFunctionId = InvalidOid;
+	FmgrInfo hashFunction;
+	ColumnHashProbe *columnHashProbe = NULL;
+
+	if (IsA(clause, OpExpr))
+	{
+		OpExpr *operatorExpression = (OpExpr *) clause;
+		Node *leftOperand = NULL;
+		Node *rightOperand = NULL;
+
+		if (list_length(operatorExpression->args) != 2)
+		{
+			return NULL;
+		}
+
+		leftOperand = (Node *) linitial(operatorExpression->args);
+		rightOperand = (Node *) lsecond(operatorExpression->args);
+		if (IsA(rightOperand, Const))
+		{
+			constant = (Const *) rightOperand;
+			columnOperand = leftOperand;
+		}
+		else if (IsA(leftOperand, Const))
+		{
+			constant = (Const *) leftOperand;
+			columnOperand = rightOperand;
+		}
+
+		if (constant == NULL || constant->constisnull)
+		{
+			return NULL;
+		}
+
+		operatorId = operatorExpression->opno;
+		inputCollationId = operatorExpression->inputcollid;
+		constantTypeId = constant->consttype;
+		constantArray = &constant->constvalue;
+		constantCount = 1;
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *arrayExpression = (ScalarArrayOpExpr *) clause;
+		Node *rightOperand = (Node *) lsecond(arrayExpression->args);
+		ArrayType *arrayObject = NULL;
+		int16 elementTypeLength = 0;
+		bool elementTypeByValue = false;
+		char elementTypeAlign = 0;
+
+		if (!arrayExpression->useOr || !IsA(rightOperand, Const) ||
+			((Const *) rightOperand)->constisnull)
+		{
+			return NULL;
+		}
+
+		arrayObject = DatumGetArrayTypeP(((Const *) rightOperand)->constvalue);
+		constantTypeId = ARR_ELEMTYPE(arrayObject);
+		get_typlenbyvalalign(constantTypeId, &elementTypeLength, &elementTypeByValue,
+							 &elementTypeAlign);
+		deconstruct_array(arrayObject, constantTypeId, elementTypeLength,
+						  elementTypeByValue, elementTypeAlign,
+						  &constantArray, &constantNullArray, &constantCount);
+
+		operatorId = arrayExpression->opno;
+		inputCollationId = arrayExpression->inputcollid;
+		columnOperand = (Node *) linitial(arrayExpression->args);
+	}
+	else
+	{
+		return NULL;
+	}
+
+	columnIndex = PredicateColumnIndex(columnOperand, tupleDescriptor,
+									   projectedColumnMask);
+	if (columnIndex < 0)
+	{
+		return NULL;
+	}
+
+	attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+	if (attributeForm->attcollation != InvalidOid &&
+		attributeForm->attcollation != inputCollationId)
+	{
+		return NULL;
+	}
+
+	operatorClassId = GetDefaultOpClass(attributeForm->atttypid, HASH_AM_OID);
+	if (operatorClassId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	operatorFamilyId = get_opclass_family(operatorClassId);
+	if (get_op_opfamily_strategy(operatorId, operatorFamilyId) != HTEqualStrategyNumber)
+	{
+		return NULL;
+	}
+
+	hashFunctionId = get_opfamily_proc(operatorFamilyId, constantTypeId, constantTypeId,
+									   HASHSTANDARD_PROC);
+	if (hashFunctionId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	fmgr_info(hashFunctionId, &hashFunction);
+
+	columnHashProbe = palloc0(sizeof(ColumnHashProbe));
+	columnHashProbe->columnIndex = (uint32) columnIndex;
+	columnHashProbe->hashValueArray = palloc0(constantCount * sizeof(uint32));
+
+	/* a null element never makes an ANY comparison true */
+	for (constantIndex = 0; constantIndex < constantCount; constantIndex++)
+	{
+		Datum hashDatum = 0;
+		uint32 hashValueIndex = columnHashProbe->hashValueCount;
+
+		if (constantNullArray != NULL && constantNullArray[constantIndex])
+		{
+			continue;
+		}
+
+		hashDatum = FunctionCall1Coll(&hashFunction, attributeForm->attcollation,
+									  constantArray[constantIndex]);
+		columnHashProbe->hashValueArray[hashValueIndex] = DatumGetUInt32(hashDatum);
+		columnHashProbe->hashValueCount++;
+	}
+
+	return columnHashProbe;
+}
+
+
+/*
+ * BloomFilterMayContainAny returns whether the given block's bloom filter might
+ * contain any of the probe's values.
+ */
+static bool
+BloomFilterMayContainAny(ColumnHashProbe *columnHashProbe,
+						 ColumnBlockSkipNode *blockSkipNode)
+{
+	uint32 hashValueIndex = 0;
+
+	for (hashValueIndex = 0; hashValueIndex < columnHashProbe->hashValueCount;
+		 hashValueIndex++)
+	{
+		uint32 hashValue = columnHashProbe->hashValueArray[hashValueIndex];
+		if (BloomFilterMayContain(blockSkipNode->bloomFilter,
+								  blockSkipNode->bloomFilterLength, hashValue))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ColumnBoundAdmitsRange returns whether some value between the given minimum
+ * and maximum values can satisfy the column bound. Each check takes one or two
+ * comparison function calls.
+ */
+static bool
+ColumnBoundAdmitsRange(ColumnBound *columnBound, Datum minimumValue,
+					   Datum maximumValue)
+{
+	FmgrInfo *comparisonFunction = &columnBound->comparisonFunction;
+	Oid collationId = columnBound->collationId;
+	Datum constant = columnBound->constant;
+	int32 minimumComparison = 0;
+	int32 maximumComparison = 0;
+
+	switch (columnBound->strategyNumber)
+	{
+		case BTLessStrategyNumber:
+		case BTLessEqualStrategyNumber:
+		{
+			minimumComparison = DatumGetInt32(FunctionCall2Coll(comparisonFunction,
+																collationId,
+																minimumValue,
+																constant));
+			return (columnBound->strategyNumber == BTLessStrategyNumber) ?
+				   (minimumComparison < 0) : (minimumComparison <= 0);
+		}
+
+		case BTGreaterEqualStrategyNumber:
+		case BTGreaterStrategyNumber:
+		{
+			maximumComparison = DatumGetInt32(FunctionCall2Coll(comparisonFunction,
+																collationId,
+																maximumValue,
+																constant));
+			return (columnBound->strategyNumber == BTGreaterStrategyNumber) ?
+				   (maximumComparison > 0) : (maximumComparison >= 0);
+		}
+
+		case BTEqualStrategyNumber:
+		{
+			minimumComparison = DatumGetInt32(FunctionCall2Coll(comparisonFunction,
+																collationId,
+																minimumValue,
+																constant));
+			if (minimumComparison > 0)
+			{
+				return false;
+			}
+
+			maximumComparison = DatumGetInt32(FunctionCall2Coll(comparisonFunction,
+																collationId,
+																maximumValue,
+																constant));
+			return maximumComparison >= 0;
+		}
+
+		default:
+		{
+			return true;
+		}
+	}
+}
+
+
+/*
+ * BuildBaseConstraintArray builds a base constraint for each projected column
+ * whose data type has a comparator, for checking blocks and stripes against the
+ * qualifiers that weren't compiled into column bounds. Other entries are NULL.
+ */
+static Node **
+BuildBaseConstraintArray(TupleDesc tupleDescriptor, List *projectedColumnList)
+{
+	Node **baseConstraintArray = palloc0(tupleDescriptor->natts * sizeof(Node *));
+	ListCell *columnCell = NULL;
+
+	foreach(columnCell, projectedColumnList)
+	{
+		Var *column = lfirst(columnCell);
+		uint32 columnIndex = column->varattno - 1;
+		FmgrInfo *comparisonFunction = GetFunctionInfoOrNull(column->vartype,
+															 BTREE_AM_OID,
+															 BTORDER_PROC);
+		if (comparisonFunction != NULL)
+		{
+			baseConstraintArray[columnIndex] = BuildBaseConstraint(column);
+		}
+	}
+
+	return baseConstraintArray;
+}
+
+
+/*
+ * GetFunctionInfoOrNull first resolves the operator for the given data type,
+ * access method, and support procedure. The function then uses the resolved
+ * operator's identifier to fill in a function manager object, and returns
+ * this object. This function is based on a similar function from CitusDB's code.
+ */
+FmgrInfo *
+GetFunctionInfoOrNull(Oid typeId, Oid accessMethodId, int16 procedureId)
+{
+	FmgrInfo *functionInfo = NULL;
+	Oid operatorClassId = InvalidOid;
+	Oid operatorFamilyId = InvalidOid;
+	Oid operatorId = InvalidOid;
+
+	/* get default operator class from pg_opclass for datum type */
+	operatorClassId = GetDefaultOpClass(typeId, accessMethodId);
+	if (operatorClassId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	operatorFamilyId = get_opclass_family(operatorClassId);
+	if (operatorFamilyId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	operatorId = get_opfamily_proc(operatorFamilyId, typeId, typeId, procedureId);
+	if (operatorId != InvalidOid)
+	{
+		functionInfo = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
+
+		/* fill in the FmgrInfo struct using the operatorId */
+		fmgr_info(operatorId, functionInfo);
+	}
+
+	return functionInfo;
+}
+
+
+/*
+ * BuildRestrictInfoList builds restrict info list using the selection criteria,
+ * and then return this list. The function is copied from CitusDB's shard pruning
+ * logic.
+ */
+static List *
+BuildRestrictInfoList(List *whereClauseList)
+{
+	List *restrictInfoList = NIL;
+
+	ListCell *qualCell = NULL;
+	foreach(qualCell, whereClauseList)
+	{
+		RestrictInfo *restrictInfo = NULL;
+		Node *qualNode = (Node *) lfirst(qualCell);
+
+		restrictInfo = make_simple_restrictinfo((Expr *) qualNode);
+		restrictInfoList = lappend(restrictInfoList, restrictInfo);
+	}
+
+	return restrictInfoList;
+}
+
+
+/*
+ * BuildBaseConstraint builds and returns a base constraint. This constraint
+ * implements an expression in the form of (var <= max && var >= min), where
+ * min and max values represent a block's min and max values. These block
+ * values are filled in after the constraint is built. This function is based
+ * on a similar function from CitusDB's shard pruning logic.
+ */
+static Node *
+BuildBaseConstraint(Var *variable)
+{
+	Node *baseConstraint = NULL;
+	OpExpr *lessThanExpr = NULL;
+	OpExpr *greaterThanExpr = NULL;
+
+	lessThanExpr = MakeOpExpression(variable, BTLessEqualStrategyNumber);
+	greaterThanExpr = MakeOpExpression(variable, BTGreaterEqualStrategyNumber);
+
+	baseConstraint = make_and_qual((Node *) lessThanExpr, (Node *) greaterThanExpr);
+
+	return baseConstraint;
+}
+
+
+/*
+ * MakeOpExpression builds an operator expression node. This operator expression
+ * implements the operator clause as defined by the variable and the strategy
+ * number. The function is copied from CitusDB's shard pruning logic.
+ */
+static OpExpr *
+MakeOpExpression(Var *variable, int16 strategyNumber)
+{
+	Oid typeId = variable->vartype;
+	Oid typeModId = variable->vartypmod;
+	Oid collationId = variable->varcollid;
+
+	Oid accessMethodId = BTREE_AM_OID;
+	Oid operatorId = InvalidOid;
+	Const  *constantValue = NULL;
+	OpExpr *expression = NULL;
+
+	/* Load the operator from system catalogs */
+	operatorId = GetOperatorByType(typeId, accessMethodId, strategyNumber);
+
+	constantValue = makeNullConst(typeId, typeModId, collationId);
+
+	/* Now make the expression with the given variable and a null constant */
+	expression = (OpExpr *) make_opclause(operatorId,
+										  InvalidOid, /* no result type yet */
+										  false,	  /* no return set */
+										  (Expr *) variable,
+										  (Expr *) constantValue,
+										  InvalidOid, collationId);
+
+	/* Set implementing function id and result type */
+	expression->opfuncid = get_opcode(operatorId);
+	expression->opresulttype = get_func_rettype(expression->opfuncid);
+
+	return expression;
+}
+
+
+/*
+ * GetOperatorByType returns operator Oid for the given type, access method,
+ * and strategy number. Note that this function incorrectly errors out when
+ * the given type doesn't have its own operator but can use another compatible
+ * type's default operator. The function is copied from CitusDB's shard pruning
+ * logic.
+ */
+static Oid
+GetOperatorByType(Oid typeId, Oid accessMethodId, int16 strategyNumber)
+{
+	/* Get default operator class from pg_opclass */
+	Oid operatorClassId = GetDefaultOpClass(typeId, accessMethodId);
+
+	Oid operatorFamily = get_opclass_family(operatorClassId);
+
+	Oid operatorId = get_opfamily_member(operatorFamily, typeId, typeId, strategyNumber);
+
+	return operatorId;
+}
+
+
+/*
+ * UpdateConstraint updates the base constraint with the given min/max values.
+ * The function is copied from CitusDB's shard pruning logic.
+ */
+static void
+UpdateConstraint(Node *baseConstraint, Datum minValue, Datum maxValue)
+{
+	BoolExpr *andExpr = (BoolExpr *) baseConstraint;
+	Node *lessThanExpr = (Node *) linitial(andExpr->args);
+	Node *greaterThanExpr = (Node *) lsecond(andExpr->args);
+
+	Node *minNode = get_rightop((Expr *) greaterThanExpr);
+	Node *maxNode = get_rightop((Expr *) lessThanExpr);
+	Const *minConstant = NULL;
+	Const *maxConstant = NULL;
+
+	Assert(IsA(minNode, Const));
+	Assert(IsA(maxNode, Const));
+
+	minConstant = (Const *) minNode;
+	maxConstant = (Const *) maxNode;
+
+	minConstant->constvalue = minValue;
+	maxConstant->constvalue = maxValue;
+
+	minConstant->constisnull = false;
+	maxConstant->constisnull = false;
+
+	minConstant->constbyval = true;
+	maxConstant->constbyval = true;
+}
+
+
+/*
+ * SelectedBlockSkipList constructs a new StripeSkipList in which the
+ * non-selected blocks are removed from the given stripeSkipList.
+ */
+static StripeSkipList *
+SelectedBlockSkipList(StripeSkipList *stripeSkipList, bool *projectedColumnMask,
+					  bool *selectedBlockMask)
+{
+	StripeSkipList *SelectedBlockSkipList = NULL;
+	ColumnBlockSkipNode **selectedBlockSkipNodeArray = NULL;
+	uint32 selectedBlockCount = 0;
+	uint32 blockIndex = 0;
+	uint32 columnIndex = 0;
+	uint32 columnCount = stripeSkipList->columnCount;
+
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	{
+		if (selectedBlockMask[blockIndex])
+		{
+			selectedBlockCount++;
+		}
+	}
+
+	selectedBlockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		uint32 selectedBlockIndex = 0;
+		bool firstColumn = columnIndex == 0;
+
+		/* first column's block skip node is always read */
+		if (!projectedColumnMask[columnIndex] && !firstColumn)
+		{
+			selectedBlockSkipNodeArray[columnIndex] = NULL;
+			continue;
+		}
+
+		Assert(stripeSkipList->blockSkipNodeArray[columnIndex] != NULL);
+
+		selectedBlockSkipNodeArray[columnIndex] = palloc0(selectedBlockCount *
+														  sizeof(ColumnBlockSkipNode));
 
-			columnBuffersArray[columnIndex] = columnBuffers;
+		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		{
+			if (selectedBlockMask[blockIndex])
+			{
+				selectedBlockSkipNodeArray[columnIndex][selectedBlockIndex] =
+					stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+				selectedBlockIndex++;
+			}
 		}
-
-		currentColumnFileOffset += existsSize;
-		currentColumnFileOffset += valueSize;
 	}
 
-	stripeBuffers = palloc0(sizeof(StripeBuffers));
-	stripeBuffers->columnCount = columnCount;
-	stripeBuffers->rowCount = StripeSkipListRowCount(selectedBlockSkipList);
-	stripeBuffers->columnBuffersArray = columnBuffersArray;
+	SelectedBlockSkipList = palloc0(sizeof(StripeSkipList));
+	SelectedBlockSkipList->blockSkipNodeArray = selectedBlockSkipNodeArray;
+	SelectedBlockSkipList->blockCount = selectedBlockCount;
+	SelectedBlockSkipList->columnCount = stripeSkipList->columnCount;
 
-	return stripeBuffers;
+	return SelectedBlockSkipList;
 }
 
 
 /*
- * ReadStripeNextRow reads the next row from the given stripe, finds the projected
- * column values within this row, and accordingly sets the column values and nulls.
- * Note that this function sets the values for all non-projected columns to null.
+ * StripeSkipListRowCount counts the number of rows in the given stripeSkipList.
+ * To do this, the function finds the first column, and sums up row counts across
+ * all blocks for that column.
  */
-static void
-ReadStripeNextRow(StripeBuffers *stripeBuffers, List *projectedColumnList,
-				  uint64 blockIndex, uint64 blockRowIndex,
-				  ColumnBlockData **blockDataArray, Datum *columnValues,
-				  bool *columnNulls)
+static uint32
+StripeSkipListRowCount(StripeSkipList *stripeSkipList)
 {
-	ListCell *projectedColumnCell = NULL;
-
-	/* set all columns to null by default */
-	memset(columnNulls, 1, stripeBuffers->columnCount * sizeof(bool));
+	uint32 stripeSkipListRowCount = 0;
+	uint32 blockIndex = 0;
+	ColumnBlockSkipNode *firstColumnSkipNodeArray =
+		stripeSkipList->blockSkipNodeArray[0];
 
-	foreach(projectedColumnCell, projectedColumnList)
+	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
 	{
-		Var *projectedColumn = lfirst(projectedColumnCell);
-		uint32 projectedColumnIndex = projectedColumn->varattno - 1;
-		ColumnBlockData *blockData = blockDataArray[projectedColumnIndex];
-
-		if (blockData->existsArray[blockRowIndex])
-		{
-			columnValues[projectedColumnIndex] = blockData->valueArray[blockRowIndex];
-			columnNulls[projectedColumnIndex] = false;
-		}
+		uint32 blockRowCount = firstColumnSkipNodeArray[blockIndex].rowCount;
+		stripeSkipListRowCount += blockRowCount;
 	}
+
+	return stripeSkipListRowCount;
 }
 
 
 /*
- * LoadColumnBuffers reads serialized column data from the given file. These
- * column data are laid out as sequential blocks in the file; and block positions
- * and lengths are retrieved from the column block skip node array.
+ * ProjectedColumnMask returns a boolean array in which the projected columns
+ * from the projected column list are marked as true.
  */
-static ColumnBuffers *
-LoadColumnBuffers(FILE *tableFile, ColumnBlockSkipNode *blockSkipNodeArray,
-				  uint32 blockCount, uint64 existsFileOffset, uint64 valueFileOffset,
-				  Form_pg_attribute attributeForm)
+static bool *
+ProjectedColumnMask(uint32 columnCount, List *projectedColumnList)
 {
-	ColumnBuffers *columnBuffers = NULL;
-	uint32 blockIndex = 0;
-	ColumnBlockBuffers **blockBuffersArray =
-			palloc0(blockCount * sizeof(ColumnBlockBuffers *));
+	bool *projectedColumnMask = palloc0(columnCount * sizeof(bool));
+	ListCell *columnCell = NULL;
 
-	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	foreach(columnCell, projectedColumnList)
 	{
-		blockBuffersArray[blockIndex] = palloc0(sizeof(ColumnBlockBuffers));
+		Var *column = (Var *) lfirst(columnCell);
+		uint32 columnIndex = column->varattno - 1;
+		projectedColumnMask[columnIndex] = true;
 	}
 
-	/*
-	 * We first read the "exists" blocks. We don't read "values" array here,
-	 * because "exists" blocks are stored sequentially on disk, and we want to
-	 * minimize disk seeks.
-	 */
-	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
-	{
-		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
-		uint64 existsOffset = existsFileOffset + blockSkipNode->existsBlockOffset;
-		StringInfo rawExistsBuffer = ReadFromFile(tableFile, existsOffset,
-												  blockSkipNode->existsLength);
+	return projectedColumnMask;
+}
 
-		blockBuffersArray[blockIndex]->existsBuffer = rawExistsBuffer;
-	}
 
-	/* then read "values" blocks, which are also stored sequentially on disk */
-	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
-	{
-		ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
-		CompressionType compressionType = blockSkipNode->valueCompressionType;
-		uint64 valueOffset = valueFileOffset + blockSkipNode->valueBlockOffset;
-		StringInfo rawValueBuffer = ReadFromFile(tableFile, valueOffset,
-												 blockSkipNode->valueLength);
+/*
+ * DeserializeBoolArray reads an array of bits from the given buffer and stores
+ * it in provided bool array. The function unpacks a byte at a time, and returns
+ * true if all bits are set. Bytes with all bits set or clear are common in the
+ * exists bitmap, so we fill their entries with memset.
+ */
+static bool
+DeserializeBoolArray(StringInfo boolArrayBuffer, bool *boolArray,
+					 uint32 boolArrayLength)
+{
+	uint32 boolArrayIndex = 0;
+	uint32 byteIndex = 0;
+	uint32 fullByteCount = boolArrayLength / 8;
+	const uint8 *byteArray = (const uint8 *) boolArrayBuffer->data;
+	bool allBitsSet = true;
 
-		blockBuffersArray[blockIndex]->valueBuffer = rawValueBuffer;
-		blockBuffersArray[blockIndex]->valueCompressionType = compressionType;
+	uint32 maximumBoolCount = boolArrayBuffer->len * 8;
+	if (boolArrayLength > maximumBoolCount)
+	{
+		ereport(ERROR, (errmsg("insufficient data for reading boolean array")));
 	}
 
-	columnBuffers = palloc0(sizeof(ColumnBuffers));
-	columnBuffers->blockBuffersArray = blockBuffersArray;
-
-	return columnBuffers;
-}
-
-
-/* Reads and returns the given stripe's footer. */
-static StripeFooter *
-LoadStripeFooter(FILE *tableFile, StripeMetadata *stripeMetadata,
-				 uint32 columnCount)
-{
-	StripeFooter *stripeFooter = NULL;
-	StringInfo footerBuffer = NULL;
-	uint64 footerOffset = 0;
+	for (byteIndex = 0; byteIndex < fullByteCount; byteIndex++)
+	{
+		uint8 currentByte = byteArray[byteIndex];
+		bool *currentBoolArray = boolArray + (byteIndex * 8);
 
-	footerOffset += stripeMetadata->fileOffset;
-	footerOffset += stripeMetadata->skipListLength;
-	footerOffset += stripeMetadata->dataLength;
+		if (currentByte == 0xFF)
+		{
+			memset(currentBoolArray, true, 8);
+		}
+		else if (currentByte == 0)
+		{
+			memset(currentBoolArray, false, 8);
+			allBitsSet = false;
+		}
+		else
+		{
+			currentBoolArray[0] = (currentByte & 0x01) != 0;
+			currentBoolArray[1] = (currentByte & 0x02) != 0;
+			currentBoolArray[2] = (currentByte & 0x04) != 0;
+			currentBoolArray[3] = (currentByte & 0x08) != 0;
+			currentBoolArray[4] = (currentByte & 0x10) != 0;
+			currentBoolArray[5] = (currentByte & 0x20) != 0;
+			currentBoolArray[6] = (currentByte & 0x40) != 0;
+			currentBoolArray[7] = (currentByte & 0x80) != 0;
+			allBitsSet = false;
+		}
+	}
 
-	footerBuffer = ReadFromFile(tableFile, footerOffset, stripeMetadata->footerLength);
-	stripeFooter = DeserializeStripeFooter(footerBuffer);
-	if (stripeFooter->columnCount > columnCount)
+	for (boolArrayIndex = fullByteCount * 8; boolArrayIndex < boolArrayLength;
+		 boolArrayIndex++)
 	{
-		ereport(ERROR, (errmsg("stripe footer column count and table column count "
-							   "don't match")));
+		uint32 bitIndex = boolArrayIndex % 8;
+		uint8 bitmask = (1 << bitIndex);
+
+		boolArray[boolArrayIndex] = (byteArray[fullByteCount] & bitmask) != 0;
+		allBitsSet &= boolArray[boolArrayIndex];
 	}
 
-	return stripeFooter;
+	return allBitsSet;
 }
 
 
-/* Reads the skip list for the given stripe. */
-static StripeSkipList *
-LoadStripeSkipList(FILE *tableFile, StripeMetadata *stripeMetadata,
-				   StripeFooter *stripeFooter, uint32 columnCount,
-				   bool *projectedColumnMask,
-				   TupleDesc tupleDescriptor)
+/*
+ * DeserializeDatumArray reads an array of datums from the given buffer and stores
+ * them in provided datumArray. If a value is marked as false in the exists array,
+ * the function assumes that the datum isn't in the buffer, and simply skips it.
+ * If all values exist and the type has a fixed length, datums are laid out with
+ * a fixed stride, so we read them without tracking per datum offsets.
+ */
+static void
+DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray, bool allDatumsExist,
+					  uint32 datumCount, bool datumTypeByValue, int datumTypeLength,
+					  char datumTypeAlign, Datum *datumArray)
 {
-	StripeSkipList *stripeSkipList = NULL;
-	ColumnBlockSkipNode **blockSkipNodeArray = NULL;
-	StringInfo firstColumnSkipListBuffer = NULL;
-	uint64 currentColumnSkipListFileOffset = 0;
-	uint32 columnIndex = 0;
-	uint32 stripeBlockCount = 0;
-	uint32 stripeColumnCount = stripeFooter->columnCount;
-
-	/* deserialize block count */
-	firstColumnSkipListBuffer = ReadFromFile(tableFile, stripeMetadata->fileOffset,
-											 stripeFooter->skipListSizeArray[0]);
-	stripeBlockCount = DeserializeBlockCount(firstColumnSkipListBuffer);
-
-	/* deserialize column skip lists */
-	blockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
-	currentColumnSkipListFileOffset = stripeMetadata->fileOffset;
+	uint32 datumIndex = 0;
+	uint32 currentDatumDataOffset = 0;
 
-	for (columnIndex = 0; columnIndex < stripeColumnCount; columnIndex++)
+	if (allDatumsExist && datumTypeLength > 0)
 	{
-		uint64 columnSkipListSize = stripeFooter->skipListSizeArray[columnIndex];
-		bool firstColumn = columnIndex == 0;
+		uint32 datumStride = att_align_nominal(datumTypeLength, datumTypeAlign);
+		char *datumData = datumBuffer->data;
 
-		/*
-		 * Only selected columns' column skip lists are read. However, the first
-		 * column's skip list is read regardless of being selected. It is used by
-		 * StripeSkipListRowCount later.
-		 */
-		if (projectedColumnMask[columnIndex] || firstColumn)
+		if ((uint64) datumCount * datumStride > (uint64) datumBuffer->len)
 		{
-			Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+		}
 
-			StringInfo columnSkipListBuffer =
-				ReadFromFile(tableFile, currentColumnSkipListFileOffset,
-							 columnSkipListSize);
-			ColumnBlockSkipNode *columnSkipList =
-				DeserializeColumnSkipList(columnSkipListBuffer, attributeForm->attbyval,
-										  attributeForm->attlen, stripeBlockCount);
-			blockSkipNodeArray[columnIndex] = columnSkipList;
+		for (datumIndex = 0; datumIndex < datumCount; datumIndex++)
+		{
+			datumArray[datumIndex] = fetch_att(datumData + (datumIndex * datumStride),
+											   datumTypeByValue, datumTypeLength);
 		}
 
-		currentColumnSkipListFileOffset += columnSkipListSize;
+		return;
 	}
 
-	/* table contains additional columns added after this stripe is created */
-	for (columnIndex = stripeColumnCount; columnIndex < columnCount; columnIndex++)
+	for (datumIndex = 0; datumIndex < datumCount; datumIndex++)
 	{
-		ColumnBlockSkipNode *columnSkipList = NULL;
-		uint32 blockIndex = 0;
-		bool firstColumn = columnIndex == 0;
+		char *currentDatumDataPointer = NULL;
 
-		/* no need to create ColumnBlockSkipList if the column is not selected */
-		if (!projectedColumnMask[columnIndex] && !firstColumn)
+		if (!existsArray[datumIndex])
 		{
-			blockSkipNodeArray[columnIndex] = NULL;
 			continue;
 		}
 
-		/* create empty ColumnBlockSkipNode for missing columns*/
-		columnSkipList = palloc0(stripeBlockCount * sizeof(ColumnBlockSkipNode));
+		currentDatumDataPointer = datumBuffer->data + currentDatumDataOffset;
 
-		for (blockIndex = 0; blockIndex < stripeBlockCount; blockIndex++)
+		datumArray[datumIndex] = fetch_att(currentDatumDataPointer, datumTypeByValue,
+										   datumTypeLength);
+		currentDatumDataOffset = att_addlength_datum(currentDatumDataOffset,
+													 datumTypeLength,
+													 currentDatumDataPointer);
+		currentDatumDataOffset = att_align_nominal(currentDatumDataOffset,
+												   datumTypeAlign);
+
+		if (currentDatumDataOffset > datumBuffer->len)
 		{
-			columnSkipList[blockIndex].rowCount = 0;
-			columnSkipList[blockIndex].hasMinMax = false;
-			columnSkipList[blockIndex].minimumValue = 0;
-			columnSkipList[blockIndex].maximumValue = 0;
-			columnSkipList[blockIndex].existsBlockOffset = 0;
-			columnSkipList[blockIndex].valueBlockOffset = 0;
-			columnSkipList[blockIndex].existsLength = 0;
-			columnSkipList[blockIndex].valueLength = 0;
-			columnSkipList[blockIndex].valueCompressionType = COMPRESSION_NONE;
+			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
 		}
-		blockSkipNodeArray[columnIndex] = columnSkipList;
 	}
+}
 
-	stripeSkipList = palloc0(sizeof(StripeSkipList));
-	stripeSkipList->blockSkipNodeArray = blockSkipNodeArray;
-	stripeSkipList->columnCount = columnCount;
-	stripeSkipList->blockCount = stripeBlockCount;
 
-	return stripeSkipList;
+/*
+ * BuildColumnPredicateList builds column predicates for the given restriction
+ * clauses that the reader can evaluate natively, and skips the other clauses.
+ * The planner leaves the clauses we skip in the scan's qual list, so that the
+ * executor checks them on the rows we return.
+ */
+static List *
+BuildColumnPredicateList(List *clauseList, TupleDesc tupleDescriptor,
+						 bool *projectedColumnMask)
+{
+	List *columnPredicateList = NIL;
+	ListCell *clauseCell = NULL;
+
+	foreach(clauseCell, clauseList)
+	{
+		Expr *clause = (Expr *) lfirst(clauseCell);
+		ColumnPredicate *columnPredicate = BuildColumnPredicate(clause, tupleDescriptor,
+																projectedColumnMask);
+		if (columnPredicate != NULL)
+		{
+			columnPredicateList = lappend(columnPredicateList, columnPredicate);
+		}
+	}
+
+	return columnPredicateList;
 }
 
 
 /*
- * SelectedBlockMask walks over each column's blocks and checks if a block can
- * be filtered without reading its data. The filtering happens when all rows in
- * the block can be refuted by the given qualifier conditions.
+ * BuildColumnPredicate builds a column predicate for the given clause if it is
+ * a btree comparison between a column and a constant, a comparison of a column
+ * against a constant array (such as an IN list), or a null test on a column.
+ * BETWEEN clauses reach us as two comparisons. For other clauses, the function
+ * returns NULL. We limit comparisons to btree operators, since these never
+ * return null or have side effects for non-null inputs.
  */
-static bool *
-SelectedBlockMask(StripeSkipList *stripeSkipList, List *projectedColumnList,
-				  List *whereClauseList)
+static ColumnPredicate *
+BuildColumnPredicate(Expr *clause, TupleDesc tupleDescriptor, bool *projectedColumnMask)
 {
-	bool *selectedBlockMask = NULL;
-	ListCell *columnCell = NULL;
-	uint32 blockIndex = 0;
-	List *restrictInfoList = BuildRestrictInfoList(whereClauseList);
+	ColumnPredicate *columnPredicate = NULL;
 
-	selectedBlockMask = palloc0(stripeSkipList->blockCount * sizeof(bool));
-	memset(selectedBlockMask, true, stripeSkipList->blockCount * sizeof(bool));
-
-	foreach(columnCell, projectedColumnList)
+	if (IsA(clause, OpExpr))
 	{
-		Var *column = lfirst(columnCell);
-		uint32 columnIndex = column->varattno - 1;
-		FmgrInfo *comparisonFunction = NULL;
-		Node *baseConstraint = NULL;
+		OpExpr *operatorExpression = (OpExpr *) clause;
+		Node *leftOperand = NULL;
+		Node *rightOperand = NULL;
+		Const *constant = NULL;
+		int32 columnIndex = -1;
+		bool constantFirst = false;
+		Form_pg_attribute attributeForm = NULL;
+
+		if (list_length(operatorExpression->args) != 2 ||
+			get_op_btree_interpretation(operatorExpression->opno) == NIL)
+		{
+			return NULL;
+		}
 
-		/* if this column's data type doesn't have a comparator, skip it */
-		comparisonFunction = GetFunctionInfoOrNull(column->vartype, BTREE_AM_OID,
-												   BTORDER_PROC);
-		if (comparisonFunction == NULL)
+		leftOperand = (Node *) linitial(operatorExpression->args);
+		rightOperand = (Node *) lsecond(operatorExpression->args);
+
+		if (IsA(rightOperand, Const))
 		{
-			continue;
+			constant = (Const *) rightOperand;
+			columnIndex = PredicateColumnIndex(leftOperand, tupleDescriptor,
+											   projectedColumnMask);
+		}
+		else if (IsA(leftOperand, Const))
+		{
+			constant = (Const *) leftOperand;
+			columnIndex = PredicateColumnIndex(rightOperand, tupleDescriptor,
+											   projectedColumnMask);
+			constantFirst = true;
 		}
 
-		baseConstraint = BuildBaseConstraint(column);
-		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		if (constant == NULL || constant->constisnull || columnIndex < 0)
 		{
-			bool predicateRefuted = false;
-			List *constraintList = NIL;
-			ColumnBlockSkipNode *blockSkipNodeArray =
-				stripeSkipList->blockSkipNodeArray[columnIndex];
-			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+			return NULL;
+		}
 
-			/*
-			 * A column block with comparable data type can miss min/max values
-			 * if all values in the block are NULL.
-			 */
-			if (!blockSkipNode->hasMinMax)
-			{
-				continue;
-			}
+		columnPredicate = palloc0(sizeof(ColumnPredicate));
+		columnPredicate->predicateType = PREDICATE_COMPARISON;
+		columnPredicate->columnIndex = (uint32) columnIndex;
+		columnPredicate->collationId = operatorExpression->inputcollid;
+		columnPredicate->constantFirst = constantFirst;
+		columnPredicate->constantArray = palloc0(sizeof(Datum));
+		columnPredicate->constantArray[0] = constant->constvalue;
+		columnPredicate->constantCount = 1;
+		fmgr_info(operatorExpression->opfuncid, &columnPredicate->operatorFunction);
+
+		/* min/max values in skip lists are ordered by the column's collation */
+		attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		if (attributeForm->attcollation == InvalidOid ||
+			attributeForm->attcollation == operatorExpression->inputcollid)
+		{
+			columnPredicate->strategyNumber =
+				ComparisonStrategyNumber(operatorExpression->opno,
+										 attributeForm->atttypid, constantFirst);
+		}
 
-			UpdateConstraint(baseConstraint, blockSkipNode->minimumValue,
-							 blockSkipNode->maximumValue);
+		SetComparisonKernel(columnPredicate, attributeForm->atttypid, constant);
+	}
+	else if (IsA(clause, ScalarArrayOpExpr))
+	{
+		ScalarArrayOpExpr *arrayExpression = (ScalarArrayOpExpr *) clause;
+		Node *leftOperand = (Node *) linitial(arrayExpression->args);
+		Node *rightOperand = (Node *) lsecond(arrayExpression->args);
+		Const *arrayConstant = NULL;
+		ArrayType *arrayObject = NULL;
+		Oid elementTypeId = InvalidOid;
+		int16 elementTypeLength = 0;
+		bool elementTypeByValue = false;
+		char elementTypeAlign = 0;
+		Datum *elementArray = NULL;
+		bool *elementNullArray = NULL;
+		int elementCount = 0;
+		int elementIndex = 0;
+		bool hasNullElement = false;
+		int32 columnIndex = PredicateColumnIndex(leftOperand, tupleDescriptor,
+												 projectedColumnMask);
+
+		if (columnIndex < 0 || !IsA(rightOperand, Const) ||
+			((Const *) rightOperand)->constisnull ||
+			get_op_btree_interpretation(arrayExpression->opno) == NIL)
+		{
+			return NULL;
+		}
+
+		arrayConstant = (Const *) rightOperand;
+		arrayObject = DatumGetArrayTypeP(arrayConstant->constvalue);
+		elementTypeId = ARR_ELEMTYPE(arrayObject);
+		get_typlenbyvalalign(elementTypeId, &elementTypeLength, &elementTypeByValue,
+							 &elementTypeAlign);
+		deconstruct_array(arrayObject, elementTypeId, elementTypeLength,
+						  elementTypeByValue, elementTypeAlign,
+						  &elementArray, &elementNullArray, &elementCount);
+
+		for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+		{
+			hasNullElement |= elementNullArray[elementIndex];
+		}
+
+		/*
+		 * A null element never makes an ANY comparison true, so we drop those
+		 * elements. We leave empty arrays and ALL comparisons with null elements
+		 * to the executor, since their results don't depend on the column value.
+		 */
+		if (elementCount == 0 || (!arrayExpression->useOr && hasNullElement))
+		{
+			return NULL;
+		}
 
-			constraintList = list_make1(baseConstraint);
-#if (PG_VERSION_NUM >= 100000)
-			predicateRefuted = predicate_refuted_by(constraintList, restrictInfoList, false);
-#else
-			predicateRefuted = predicate_refuted_by(constraintList, restrictInfoList);
-#endif
-			if (predicateRefuted)
+		columnPredicate = palloc0(sizeof(ColumnPredicate));
+		columnPredicate->predicateType = arrayExpression->useOr ? PREDICATE_ANY_ARRAY :
+										 PREDICATE_ALL_ARRAY;
+		columnPredicate->columnIndex = (uint32) columnIndex;
+		columnPredicate->collationId = arrayExpression->inputcollid;
+		columnPredicate->constantFirst = false;
+		columnPredicate->constantArray = palloc0(elementCount * sizeof(Datum));
+		columnPredicate->constantCount = 0;
+		fmgr_info(arrayExpression->opfuncid, &columnPredicate->operatorFunction);
+
+		for (elementIndex = 0; elementIndex < elementCount; elementIndex++)
+		{
+			if (!elementNullArray[elementIndex])
 			{
-				selectedBlockMask[blockIndex] = false;
+				uint32 constantIndex = columnPredicate->constantCount;
+				columnPredicate->constantArray[constantIndex] = elementArray[elementIndex];
+				columnPredicate->constantCount++;
 			}
 		}
 	}
+	else if (IsA(clause, NullTest))
+	{
+		NullTest *nullTest = (NullTest *) clause;
+		int32 columnIndex = PredicateColumnIndex((Node *) nullTest->arg,
+												 tupleDescriptor, projectedColumnMask);
 
-	return selectedBlockMask;
+		/* null tests on composite values look into the fields of each value */
+		if (columnIndex < 0 || nullTest->argisrow)
+		{
+			return NULL;
+		}
+
+		columnPredicate = palloc0(sizeof(ColumnPredicate));
+		columnPredicate->predicateType = (nullTest->nulltesttype == IS_NULL) ?
+										 PREDICATE_IS_NULL : PREDICATE_IS_NOT_NULL;
+		columnPredicate->columnIndex = (uint32) columnIndex;
+	}
+
+	return columnPredicate;
 }
 
 
 /*
- * GetFunctionInfoOrNull first resolves the operator for the given data type,
- * access method, and support procedure. The function then uses the resolved
- * operator's identifier to fill in a function manager object, and returns
- * this object. This function is based on a similar function from CitusDB's code.
+ * PredicateColumnIndex returns the index of the column that the given operand
+ * refers to, or -1 if the operand isn't a projected column of this table.
  */
-FmgrInfo *
-GetFunctionInfoOrNull(Oid typeId, Oid accessMethodId, int16 procedureId)
+static int32
+PredicateColumnIndex(Node *operand, TupleDesc tupleDescriptor, bool *projectedColumnMask)
 {
-	FmgrInfo *functionInfo = NULL;
-	Oid operatorClassId = InvalidOid;
-	Oid operatorFamilyId = InvalidOid;
-	Oid operatorId = InvalidOid;
+	Var *column = NULL;
 
-	/* get default operator class from pg_opclass for datum type */
-	operatorClassId = GetDefaultOpClass(typeId, accessMethodId);
-	if (operatorClassId == InvalidOid)
+	/* binary compatible casts, such as from varchar to text, keep the value */
+	if (IsA(operand, RelabelType))
 	{
-		return NULL;
+		operand = (Node *) ((RelabelType *) operand)->arg;
 	}
 
-	operatorFamilyId = get_opclass_family(operatorClassId);
-	if (operatorFamilyId == InvalidOid)
+	if (!IsA(operand, Var))
 	{
-		return NULL;
+		return -1;
 	}
 
-	operatorId = get_opfamily_proc(operatorFamilyId, typeId, typeId, procedureId);
-	if (operatorId != InvalidOid)
+	column = (Var *) operand;
+	if (column->varlevelsup != 0 || column->varattno <= 0 ||
+		column->varattno > tupleDescriptor->natts ||
+		!projectedColumnMask[column->varattno - 1])
 	{
-		functionInfo = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
-
-		/* fill in the FmgrInfo struct using the operatorId */
-		fmgr_info(operatorId, functionInfo);
+		return -1;
 	}
 
-	return functionInfo;
+	return column->varattno - 1;
 }
 
 
 /*
- * BuildRestrictInfoList builds restrict info list using the selection criteria,
- * and then return this list. The function is copied from CitusDB's shard pruning
- * logic.
+ * EvaluateColumnPredicates evaluates the read state's column predicates over
+ * the deserialized block, and fills the read state's selected row array with
+ * the indexes of rows that pass all predicates. The function returns the number
+ * of these rows. Each predicate only looks at rows that passed the previous
+ * ones, so we stop as soon as no rows are left.
  */
-static List *
-BuildRestrictInfoList(List *whereClauseList)
+static uint32
+EvaluateColumnPredicates(TableReadState *readState, uint32 rowCount)
 {
-	List *restrictInfoList = NIL;
+	uint32 *selectedRowArray = readState->selectedRowArray;
+	uint32 selectedRowCount = rowCount;
+	uint32 rowIndex = 0;
+	ListCell *columnPredicateCell = NULL;
+	MemoryContext oldContext = MemoryContextSwitchTo(readState->predicateContext);
 
-	ListCell *qualCell = NULL;
-	foreach(qualCell, whereClauseList)
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
 	{
-		RestrictInfo *restrictInfo = NULL;
-		Node *qualNode = (Node *) lfirst(qualCell);
-
-		restrictInfo = make_simple_restrictinfo((Expr *) qualNode);
-		restrictInfoList = lappend(restrictInfoList, restrictInfo);
+		selectedRowArray[rowIndex] = rowIndex;
 	}
 
-	return restrictInfoList;
-}
-
-
-/*
- * BuildBaseConstraint builds and returns a base constraint. This constraint
- * implements an expression in the form of (var <= max && var >= min), where
- * min and max values represent a block's min and max values. These block
- * values are filled in after the constraint is built. This function is based
- * on a similar function from CitusDB's shard pruning logic.
- */
-static Node *
-BuildBaseConstraint(Var *variable)
-{
-	Node *baseConstraint = NULL;
-	OpExpr *lessThanExpr = NULL;
-	OpExpr *greaterThanExpr = NULL;
+	foreach(columnPredicateCell, readState->columnPredicateList)
+	{
+		ColumnPredicate *columnPredicate = lfirst(columnPredicateCell);
+		ColumnBlockData *blockData = readState->blockDataArray[columnPredicate->columnIndex];
 
-	lessThanExpr = MakeOpExpression(variable, BTLessEqualStrategyNumber);
-	greaterThanExpr = MakeOpExpression(variable, BTGreaterEqualStrategyNumber);
+		selectedRowCount = EvaluateColumnPredicate(columnPredicate, blockData,
+												   selectedRowArray, selectedRowCount);
+		if (selectedRowCount == 0)
+		{
+			break;
+		}
+	}
 
-	baseConstraint = make_and_qual((Node *) lessThanExpr, (Node *) greaterThanExpr);
+	/* operators may allocate memory, for example when detoasting values */
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextReset(readState->predicateContext);
 
-	return baseConstraint;
+	return selectedRowCount;
 }
 
 
 /*
- * MakeOpExpression builds an operator expression node. This operator expression
- * implements the operator clause as defined by the variable and the strategy
- * number. The function is copied from CitusDB's shard pruning logic.
+ * EvaluateColumnPredicate evaluates the given predicate for the selected rows
+ * of the column block, and compacts the selected row array in place so that it
+ * only holds rows that pass the predicate. The function returns the number of
+ * remaining rows.
  */
-static OpExpr *
-MakeOpExpression(Var *variable, int16 strategyNumber)
+static uint32
+EvaluateColumnPredicate(ColumnPredicate *columnPredicate, ColumnBlockData *blockData,
+						uint32 *selectedRowArray, uint32 selectedRowCount)
 {
-	Oid typeId = variable->vartype;
-	Oid typeModId = variable->vartypmod;
-	Oid collationId = variable->varcollid;
-
-	Oid accessMethodId = BTREE_AM_OID;
-	Oid operatorId = InvalidOid;
-	Const  *constantValue = NULL;
-	OpExpr *expression = NULL;
+	bool *existsArray = blockData->existsArray;
+	Datum *valueArray = blockData->valueArray;
+	uint32 passingRowCount = 0;
+	uint32 selectedRowIndex = 0;
+	Datum lastValue = 0;
+	bool lastValuePasses = false;
+	bool haveLastValue = false;
+
+	if (columnPredicate->comparisonKernel != COMPARISON_KERNEL_NONE)
+	{
+		return EvaluateComparisonKernel(columnPredicate, blockData, selectedRowArray,
+										selectedRowCount);
+	}
 
-	/* Load the operator from system catalogs */
-	operatorId = GetOperatorByType(typeId, accessMethodId, strategyNumber);
+	for (selectedRowIndex = 0; selectedRowIndex < selectedRowCount; selectedRowIndex++)
+	{
+		uint32 rowIndex = selectedRowArray[selectedRowIndex];
+		bool rowPasses = false;
 
-	constantValue = makeNullConst(typeId, typeModId, collationId);
+		if (columnPredicate->predicateType == PREDICATE_IS_NULL)
+		{
+			rowPasses = !existsArray[rowIndex];
+		}
+		else if (columnPredicate->predicateType == PREDICATE_IS_NOT_NULL)
+		{
+			rowPasses = existsArray[rowIndex];
+		}
+		else if (existsArray[rowIndex] && haveLastValue &&
+				 valueArray[rowIndex] == lastValue)
+		{
+			/*
+			 * Run-length and dictionary decoding give all rows with the same
+			 * value the same datum, so we decide a whole run with one call.
+			 */
+			rowPasses = lastValuePasses;
+		}
+		else if (existsArray[rowIndex])
+		{
+			/* comparisons with null values are never true */
+			rowPasses = ColumnPredicateMatches(columnPredicate, valueArray[rowIndex]);
 
-	/* Now make the expression with the given variable and a null constant */
-	expression = (OpExpr *) make_opclause(operatorId,
-										  InvalidOid, /* no result type yet */
-										  false,	  /* no return set */
-										  (Expr *) variable,
-										  (Expr *) constantValue,
-										  InvalidOid, collationId);
+			lastValue = valueArray[rowIndex];
+			lastValuePasses = rowPasses;
+			haveLastValue = true;
+		}
 
-	/* Set implementing function id and result type */
-	expression->opfuncid = get_opcode(operatorId);
-	expression->opresulttype = get_func_rettype(expression->opfuncid);
+		if (rowPasses)
+		{
+			selectedRowArray[passingRowCount] = rowIndex;
+			passingRowCount++;
+		}
+	}
 
-	return expression;
+	return passingRowCount;
 }
 
 
 /*
- * GetOperatorByType returns operator Oid for the given type, access method,
- * and strategy number. Note that this function incorrectly errors out when
- * the given type doesn't have its own operator but can use another compatible
- * type's default operator. The function is copied from CitusDB's shard pruning
- * logic.
+ * ColumnPredicateMatches compares the given non-null value against the constants
+ * of a comparison or array predicate, and returns the predicate's result.
  */
-static Oid
-GetOperatorByType(Oid typeId, Oid accessMethodId, int16 strategyNumber)
+static bool
+ColumnPredicateMatches(ColumnPredicate *columnPredicate, Datum value)
 {
-	/* Get default operator class from pg_opclass */
-	Oid operatorClassId = GetDefaultOpClass(typeId, accessMethodId);
+	FmgrInfo *operatorFunction = &columnPredicate->operatorFunction;
+	Oid collationId = columnPredicate->collationId;
+	bool matchAll = (columnPredicate->predicateType == PREDICATE_ALL_ARRAY);
+	uint32 constantIndex = 0;
 
-	Oid operatorFamily = get_opclass_family(operatorClassId);
+	for (constantIndex = 0; constantIndex < columnPredicate->constantCount;
+		 constantIndex++)
+	{
+		Datum constant = columnPredicate->constantArray[constantIndex];
+		Datum result = 0;
+		bool matches = false;
 
-	Oid operatorId = get_opfamily_member(operatorFamily, typeId, typeId, strategyNumber);
+		if (columnPredicate->constantFirst)
+		{
+			result = FunctionCall2Coll(operatorFunction, collationId, constant, value);
+		}
+		else
+		{
+			result = FunctionCall2Coll(operatorFunction, collationId, value, constant);
+		}
 
-	return operatorId;
+		matches = DatumGetBool(result);
+		if (matches != matchAll)
+		{
+			return matches;
+		}
+	}
+
+	return matchAll;
 }
 
 
 /*
- * UpdateConstraint updates the base constraint with the given min/max values.
- * The function is copied from CitusDB's shard pruning logic.
+ * ComparisonStrategyNumber returns the btree strategy of the given comparison
+ * operator in the default btree operator family of the column's type. The
+ * strategy is commuted if the constant is the operator's first argument, so
+ * it always describes the column value compared against the constant. The
+ * function returns zero if the operator isn't in that family.
  */
-static void
-UpdateConstraint(Node *baseConstraint, Datum minValue, Datum maxValue)
+static int16
+ComparisonStrategyNumber(Oid operatorId, Oid columnTypeId, bool constantFirst)
 {
-	BoolExpr *andExpr = (BoolExpr *) baseConstraint;
-	Node *lessThanExpr = (Node *) linitial(andExpr->args);
-	Node *greaterThanExpr = (Node *) lsecond(andExpr->args);
-
-	Node *minNode = get_rightop((Expr *) greaterThanExpr);
-	Node *maxNode = get_rightop((Expr *) lessThanExpr);
-	Const *minConstant = NULL;
-	Const *maxConstant = NULL;
-
-	Assert(IsA(minNode, Const));
-	Assert(IsA(maxNode, Const));
+	Oid operatorClassId = GetDefaultOpClass(columnTypeId, BTREE_AM_OID);
+	Oid operatorFamilyId = InvalidOid;
+	int16 strategyNumber = 0;
+	List *interpretationList = NIL;
+	ListCell *interpretationCell = NULL;
 
-	minConstant = (Const *) minNode;
-	maxConstant = (Const *) maxNode;
+	if (operatorClassId == InvalidOid)
+	{
+		return 0;
+	}
 
-	minConstant->constvalue = minValue;
-	maxConstant->constvalue = maxValue;
+	operatorFamilyId = get_opclass_family(operatorClassId);
+	interpretationList = get_op_btree_interpretation(operatorId);
+	foreach(interpretationCell, interpretationList)
+	{
+		OpBtreeInterpretation *interpretation = lfirst(interpretationCell);
+		if (interpretation->opfamily_id == operatorFamilyId)
+		{
+			strategyNumber = interpretation->strategy;
+			break;
+		}
+	}
 
-	minConstant->constisnull = false;
-	maxConstant->constisnull = false;
+	if (constantFirst)
+	{
+		if (strategyNumber == BTLessStrategyNumber)
+		{
+			strategyNumber = BTGreaterStrategyNumber;
+		}
+		else if (strategyNumber == BTLessEqualStrategyNumber)
+		{
+			strategyNumber = BTGreaterEqualStrategyNumber;
+		}
+		else if (strategyNumber == BTGreaterEqualStrategyNumber)
+		{
+			strategyNumber = BTLessEqualStrategyNumber;
+		}
+		else if (strategyNumber == BTGreaterStrategyNumber)
+		{
+			strategyNumber = BTLessStrategyNumber;
+		}
+	}
 
-	minConstant->constbyval = true;
-	maxConstant->constbyval = true;
+	return strategyNumber;
 }
 
 
 /*
- * SelectedBlockSkipList constructs a new StripeSkipList in which the
- * non-selected blocks are removed from the given stripeSkipList.
+ * SetComparisonKernel sets up the given comparison predicate to be evaluated by
+ * a comparison kernel, if its operator is in the default btree operator family
+ * and compares two values of a fixed-width integer, date, timestamp or float8
+ * type. Otherwise, the predicate keeps calling the operator's function.
  */
-static StripeSkipList *
-SelectedBlockSkipList(StripeSkipList *stripeSkipList, bool *projectedColumnMask,
-					  bool *selectedBlockMask)
+static void
+SetComparisonKernel(ColumnPredicate *columnPredicate, Oid columnTypeId, Const *constant)
 {
-	StripeSkipList *SelectedBlockSkipList = NULL;
-	ColumnBlockSkipNode **selectedBlockSkipNodeArray = NULL;
-	uint32 selectedBlockCount = 0;
-	uint32 blockIndex = 0;
-	uint32 columnIndex = 0;
-	uint32 columnCount = stripeSkipList->columnCount;
+	ComparisonKernel comparisonKernel = COMPARISON_KERNEL_NONE;
 
-	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	switch (columnTypeId)
 	{
-		if (selectedBlockMask[blockIndex])
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case DATEOID:
+#if PG_VERSION_NUM >= 100000 || defined(HAVE_INT64_TIMESTAMP)
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+#endif
 		{
-			selectedBlockCount++;
+			comparisonKernel = COMPARISON_KERNEL_INTEGER;
+			break;
+		}
+
+		case FLOAT8OID:
+		{
+			comparisonKernel = COMPARISON_KERNEL_FLOAT;
+			break;
+		}
+
+		default:
+		{
+			return;
 		}
 	}
 
-	selectedBlockSkipNodeArray = palloc0(columnCount * sizeof(ColumnBlockSkipNode *));
-	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	if (constant->consttype != columnTypeId)
 	{
-		uint32 selectedBlockIndex = 0;
-		bool firstColumn = columnIndex == 0;
+		return;
+	}
 
-		/* first column's block skip node is always read */
-		if (!projectedColumnMask[columnIndex] && !firstColumn)
+	switch (columnPredicate->strategyNumber)
+	{
+		case BTLessStrategyNumber:
 		{
-			selectedBlockSkipNodeArray[columnIndex] = NULL;
-			continue;
+			columnPredicate->comparisonResultMatches[0] = true;
+			break;
 		}
 
-		Assert(stripeSkipList->blockSkipNodeArray[columnIndex] != NULL);
+		case BTLessEqualStrategyNumber:
+		{
+			columnPredicate->comparisonResultMatches[0] = true;
+			columnPredicate->comparisonResultMatches[1] = true;
+			break;
+		}
 
-		selectedBlockSkipNodeArray[columnIndex] = palloc0(selectedBlockCount *
-														  sizeof(ColumnBlockSkipNode));
+		case BTEqualStrategyNumber:
+		{
+			columnPredicate->comparisonResultMatches[1] = true;
+			break;
+		}
 
-		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		case BTGreaterEqualStrategyNumber:
 		{
-			if (selectedBlockMask[blockIndex])
-			{
-				selectedBlockSkipNodeArray[columnIndex][selectedBlockIndex] =
-					stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
-				selectedBlockIndex++;
-			}
+			columnPredicate->comparisonResultMatches[1] = true;
+			columnPredicate->comparisonResultMatches[2] = true;
+			break;
 		}
-	}
 
-	SelectedBlockSkipList = palloc0(sizeof(StripeSkipList));
-	SelectedBlockSkipList->blockSkipNodeArray = selectedBlockSkipNodeArray;
-	SelectedBlockSkipList->blockCount = selectedBlockCount;
-	SelectedBlockSkipList->columnCount = stripeSkipList->columnCount;
+		case BTGreaterStrategyNumber:
+		{
+			columnPredicate->comparisonResultMatches[2] = true;
+			break;
+		}
+
+		case ROWCOMPARE_NE:
+		{
+			columnPredicate->comparisonResultMatches[0] = true;
+			columnPredicate->comparisonResultMatches[2] = true;
+			break;
+		}
+
+		default:
+		{
+			/* no suitable interpretation, keep calling the operator's function */
+			return;
+		}
+	}
 
-	return SelectedBlockSkipList;
+	columnPredicate->comparisonKernel = comparisonKernel;
+	columnPredicate->columnTypeId = columnTypeId;
+	if (comparisonKernel == COMPARISON_KERNEL_INTEGER)
+	{
+		columnPredicate->integerConstant = IntegerDatumValue(constant->constvalue,
+															 columnTypeId);
+	}
+	else
+	{
+		columnPredicate->floatConstant = DatumGetFloat8(constant->constvalue);
+	}
 }
 
 
 /*
- * StripeSkipListRowCount counts the number of rows in the given stripeSkipList.
- * To do this, the function finds the first column, and sums up row counts across
- * all blocks for that column.
+ * EvaluateComparisonKernel evaluates the given comparison predicate for the
+ * selected rows of the column block by comparing values directly, and compacts
+ * the selected row array in place. The function returns the number of remaining
+ * rows. The loops avoid per row function calls and branches on the operator,
+ * and write the row index unconditionally so that only the count depends on
+ * the comparison's result. If the CPU supports AVX2, the AVX2 kernel evaluates
+ * rows four at a time, and the loops below only evaluate the remaining rows.
  */
 static uint32
-StripeSkipListRowCount(StripeSkipList *stripeSkipList)
+EvaluateComparisonKernel(ColumnPredicate *columnPredicate, ColumnBlockData *blockData,
+						 uint32 *selectedRowArray, uint32 selectedRowCount)
 {
-	uint32 stripeSkipListRowCount = 0;
-	uint32 blockIndex = 0;
-	ColumnBlockSkipNode *firstColumnSkipNodeArray =
-		stripeSkipList->blockSkipNodeArray[0];
-
-	for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+	bool *existsArray = blockData->existsArray;
+	Datum *valueArray = blockData->valueArray;
+	const bool *resultMatches = columnPredicate->comparisonResultMatches;
+	Oid columnTypeId = columnPredicate->columnTypeId;
+	uint32 passingRowCount = 0;
+	uint32 selectedRowIndex = 0;
+
+#ifdef USE_AVX2_COMPARISON_KERNEL
+	if (__builtin_cpu_supports("avx2"))
 	{
-		uint32 blockRowCount = firstColumnSkipNodeArray[blockIndex].rowCount;
-		stripeSkipListRowCount += blockRowCount;
+		selectedRowIndex = EvaluateComparisonKernelAVX2(columnPredicate, blockData,
+														selectedRowArray,
+														selectedRowCount,
+														&passingRowCount);
 	}
+#endif
 
-	return stripeSkipListRowCount;
-}
+	if (columnPredicate->comparisonKernel == COMPARISON_KERNEL_INTEGER)
+	{
+		int64 constant = columnPredicate->integerConstant;
 
+		for (; selectedRowIndex < selectedRowCount; selectedRowIndex++)
+		{
+			uint32 rowIndex = selectedRowArray[selectedRowIndex];
+			bool rowPasses = false;
 
-/*
- * ProjectedColumnMask returns a boolean array in which the projected columns
- * from the projected column list are marked as true.
- */
-static bool *
-ProjectedColumnMask(uint32 columnCount, List *projectedColumnList)
-{
-	bool *projectedColumnMask = palloc0(columnCount * sizeof(bool));
-	ListCell *columnCell = NULL;
+			/* comparisons with null values are never true */
+			if (existsArray[rowIndex])
+			{
+				int64 value = IntegerDatumValue(valueArray[rowIndex], columnTypeId);
+				int comparison = (value > constant) - (value < constant);
 
-	foreach(columnCell, projectedColumnList)
+				rowPasses = resultMatches[comparison + 1];
+			}
+
+			selectedRowArray[passingRowCount] = rowIndex;
+			passingRowCount += rowPasses;
+		}
+	}
+	else
 	{
-		Var *column = (Var *) lfirst(columnCell);
-		uint32 columnIndex = column->varattno - 1;
-		projectedColumnMask[columnIndex] = true;
+		float8 constant = columnPredicate->floatConstant;
+
+		for (; selectedRowIndex < selectedRowCount; selectedRowIndex++)
+		{
+			uint32 rowIndex = selectedRowArray[selectedRowIndex];
+			bool rowPasses = false;
+
+			if (existsArray[rowIndex])
+			{
+				float8 value = DatumGetFloat8(valueArray[rowIndex]);
+				int comparison = CompareFloat8Values(value, constant);
+
+				rowPasses = resultMatches[comparison + 1];
+			}
+
+			selectedRowArray[passingRowCount] = rowIndex;
+			passingRowCount += rowPasses;
+		}
 	}
 
-	return projectedColumnMask;
+	return passingRowCount;
 }
 
 
+#ifdef USE_AVX2_COMPARISON_KERNEL
+
 /*
- * DeserializeBoolArray reads an array of bits from the given buffer and stores
- * it in provided bool array.
+ * EvaluateComparisonKernelAVX2 evaluates the given comparison predicate for
+ * the selected rows in groups of four, like EvaluateComparisonKernel(). Values
+ * are gathered from the value array by row index. Integer values are sign
+ * extended from the datum's low bytes, as DatumGetInt16() and DatumGetInt32()
+ * do, and float8 comparisons follow the btree NaN ordering. The function sets
+ * passingRowCount to the number of remaining rows, and returns the number of
+ * selected rows it evaluated; the caller evaluates the rest.
  */
-static void
-DeserializeBoolArray(StringInfo boolArrayBuffer, bool *boolArray,
-					 uint32 boolArrayLength)
+__attribute__((target("avx2")))
+static uint32
+EvaluateComparisonKernelAVX2(ColumnPredicate *columnPredicate, ColumnBlockData *blockData,
+							 uint32 *selectedRowArray, uint32 selectedRowCount,
+							 uint32 *passingRowCount)
 {
-	uint32 boolArrayIndex = 0;
-
-	uint32 maximumBoolCount = boolArrayBuffer->len * 8;
-	if (boolArrayLength > maximumBoolCount)
+	bool *existsArray = blockData->existsArray;
+	const void *valueArray = (const void *) blockData->valueArray;
+	const bool *resultMatches = columnPredicate->comparisonResultMatches;
+	Oid columnTypeId = columnPredicate->columnTypeId;
+	bool integerKernel = (columnPredicate->comparisonKernel == COMPARISON_KERNEL_INTEGER);
+	float8 floatConstant = columnPredicate->floatConstant;
+	bool constantIsNaN = !integerKernel && isnan(floatConstant);
+	__m256i integerConstant = _mm256_set1_epi64x(columnPredicate->integerConstant);
+	__m256d floatConstantVector = _mm256_set1_pd(floatConstant);
+	__m256i lessMatches = _mm256_set1_epi64x(resultMatches[0] ? -1 : 0);
+	__m256i equalMatches = _mm256_set1_epi64x(resultMatches[1] ? -1 : 0);
+	__m256i greaterMatches = _mm256_set1_epi64x(resultMatches[2] ? -1 : 0);
+	__m256i allOnes = _mm256_set1_epi64x(-1);
+	uint32 passingCount = 0;
+	uint32 selectedRowIndex = 0;
+
+	for (selectedRowIndex = 0; selectedRowIndex + 4 <= selectedRowCount;
+		 selectedRowIndex += 4)
 	{
-		ereport(ERROR, (errmsg("insufficient data for reading boolean array")));
-	}
+		uint32 rowIndexArray[4];
+		__m128i rowIndexes = _mm_loadu_si128((const __m128i *)
+											 &selectedRowArray[selectedRowIndex]);
+		__m256i less;
+		__m256i greater;
+		__m256i equal;
+		__m256i passes;
+		uint32 rowMask = 0;
+		uint32 groupIndex = 0;
+
+		/* keep the row indexes, since we compact the array in place */
+		_mm_storeu_si128((__m128i *) rowIndexArray, rowIndexes);
+
+		if (integerKernel)
+		{
+			__m256i values;
 
-	for (boolArrayIndex = 0; boolArrayIndex < boolArrayLength; boolArrayIndex++)
-	{
-		uint32 byteIndex = boolArrayIndex / 8;
-		uint32 bitIndex = boolArrayIndex % 8;
-		uint8 bitmask = (1 << bitIndex);
+			if (columnTypeId == INT2OID || columnTypeId == INT4OID ||
+				columnTypeId == DATEOID)
+			{
+				__m128i lowValues = _mm_i32gather_epi32((const int *) valueArray,
+														rowIndexes, 8);
+				if (columnTypeId == INT2OID)
+				{
+					lowValues = _mm_srai_epi32(_mm_slli_epi32(lowValues, 16), 16);
+				}
 
-		uint8 shiftedBit = (boolArrayBuffer->data[byteIndex] & bitmask);
-		if (shiftedBit == 0)
-		{
-			boolArray[boolArrayIndex] = false;
+				values = _mm256_cvtepi32_epi64(lowValues);
+			}
+			else
+			{
+				values = _mm256_i32gather_epi64((const long long *) valueArray,
+												rowIndexes, 8);
+			}
+
+			less = _mm256_cmpgt_epi64(integerConstant, values);
+			greater = _mm256_cmpgt_epi64(values, integerConstant);
 		}
 		else
 		{
-			boolArray[boolArrayIndex] = true;
+			__m256d values = _mm256_i32gather_pd((const double *) valueArray,
+												 rowIndexes, 8);
+			__m256d valueIsNaN = _mm256_cmp_pd(values, values, _CMP_UNORD_Q);
+
+			if (constantIsNaN)
+			{
+				/* NaN equals NaN, and is greater than all other values */
+				less = _mm256_castpd_si256(_mm256_cmp_pd(values, values, _CMP_ORD_Q));
+				greater = _mm256_setzero_si256();
+			}
+			else
+			{
+				less = _mm256_castpd_si256(_mm256_cmp_pd(values, floatConstantVector,
+														 _CMP_LT_OQ));
+				greater = _mm256_castpd_si256(
+					_mm256_or_pd(_mm256_cmp_pd(values, floatConstantVector,
+											   _CMP_GT_OQ), valueIsNaN));
+			}
+		}
+
+		equal = _mm256_xor_si256(_mm256_or_si256(less, greater), allOnes);
+		passes = _mm256_or_si256(_mm256_and_si256(less, lessMatches),
+								 _mm256_or_si256(_mm256_and_si256(equal, equalMatches),
+												 _mm256_and_si256(greater,
+																  greaterMatches)));
+
+		/* comparisons with null values are never true */
+		rowMask = (uint32) _mm256_movemask_pd(_mm256_castsi256_pd(passes));
+		rowMask &= (uint32) existsArray[rowIndexArray[0]] |
+				   ((uint32) existsArray[rowIndexArray[1]] << 1) |
+				   ((uint32) existsArray[rowIndexArray[2]] << 2) |
+				   ((uint32) existsArray[rowIndexArray[3]] << 3);
+
+		for (groupIndex = 0; groupIndex < 4; groupIndex++)
+		{
+			selectedRowArray[passingCount] = rowIndexArray[groupIndex];
+			passingCount += (rowMask >> groupIndex) & 1;
 		}
 	}
+
+	*passingRowCount = passingCount;
+	return selectedRowIndex;
 }
 
+#endif
+
 
 /*
- * DeserializeDatumArray reads an array of datums from the given buffer and stores
- * them in provided datumArray. If a value is marked as false in the exists array,
- * the function assumes that the datum isn't in the buffer, and simply skips it.
+ * IntegerDatumValue returns the value of a datum of the given integer, date or
+ * timestamp type as a 64-bit integer.
  */
-static void
-DeserializeDatumArray(StringInfo datumBuffer, bool *existsArray, uint32 datumCount,
-					  bool datumTypeByValue, int datumTypeLength,
-					  char datumTypeAlign, Datum *datumArray)
+static inline int64
+IntegerDatumValue(Datum datum, Oid typeId)
 {
-	uint32 datumIndex = 0;
-	uint32 currentDatumDataOffset = 0;
-
-	for (datumIndex = 0; datumIndex < datumCount; datumIndex++)
+	switch (typeId)
 	{
-		char *currentDatumDataPointer = NULL;
-
-		if (!existsArray[datumIndex])
+		case INT2OID:
 		{
-			continue;
+			return DatumGetInt16(datum);
 		}
 
-		currentDatumDataPointer = datumBuffer->data + currentDatumDataOffset;
-
-		datumArray[datumIndex] = fetch_att(currentDatumDataPointer, datumTypeByValue,
-										   datumTypeLength);
-		currentDatumDataOffset = att_addlength_datum(currentDatumDataOffset,
-													 datumTypeLength,
-													 currentDatumDataPointer);
-		currentDatumDataOffset = att_align_nominal(currentDatumDataOffset,
-												   datumTypeAlign);
+		case INT4OID:
+		case DATEOID:
+		{
+			return DatumGetInt32(datum);
+		}
 
-		if (currentDatumDataOffset > datumBuffer->len)
+		default:
 		{
-			ereport(ERROR, (errmsg("insufficient data left in datum buffer")));
+			return DatumGetInt64(datum);
 		}
 	}
 }
 
 
 /*
- * DeserializeBlockData deserializes requested data block for all columns and
- * stores in blockDataArray. It uncompresses serialized data if necessary. The
- * function also deallocates data buffers used for previous block, and compressed
- * data buffers for the current block which will not be needed again. If a column
+ * CompareFloat8Values compares two float8 values the way btree float8 operators
+ * do, which treat NaN as equal to itself and greater than all other values.
+ */
+static inline int
+CompareFloat8Values(float8 leftValue, float8 rightValue)
+{
+	if (isnan(leftValue))
+	{
+		return isnan(rightValue) ? 0 : 1;
+	}
+	else if (isnan(rightValue))
+	{
+		return -1;
+	}
+
+	return (leftValue > rightValue) - (leftValue < rightValue);
+}
+
+
+/*
+ * DeserializeBlockData deserializes requested data block for columns in the
+ * given column mask, or for all columns if the mask is NULL, and stores in
+ * blockDataArray. It uncompresses serialized data if necessary, into each
+ * column's decompression buffer, which the previous block's data is replaced
+ * in. Raw buffers read from the file may share memory with each other, so
+ * they are only released when the stripe memory context is reset. If a column
  * data is not present serialized buffer, then default value (or null) is used
  * to fill value array.
  */
 static void
-DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
-					 uint32 rowCount,
-					 ColumnBlockData **blockDataArray, TupleDesc tupleDescriptor)
+DeserializeBlockData(TableReadState *readState, uint64 blockIndex, uint32 rowCount,
+					 bool *columnMask)
 {
+	StripeBuffers *stripeBuffers = readState->stripeBuffers;
+	ColumnBlockData **blockDataArray = readState->blockDataArray;
+	TupleDesc tupleDescriptor = readState->tupleDescriptor;
 	int columnIndex = 0;
 	for (columnIndex = 0; columnIndex < stripeBuffers->columnCount; columnIndex++)
 	{
@@ -1187,6 +4483,11 @@ DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
 		ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
 		bool columnAdded = false;
 
+		if (columnMask != NULL && !columnMask[columnIndex])
+		{
+			continue;
+		}
+
 		if ((columnBuffers == NULL) && (blockData != NULL))
 		{
 			columnAdded = true;
@@ -1196,31 +4497,47 @@ DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
 		{
 			ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
 			StringInfo valueBuffer = NULL;
+			bool allValuesExist = false;
 
-			/* free previous block's data buffers */
-			pfree(blockData->valueBuffer->data);
-			pfree(blockData->valueBuffer);
-
-			/* decompress and deserialize current block's data */
-			valueBuffer = DecompressBuffer(blockBuffers->valueBuffer,
-										   blockBuffers->valueCompressionType);
+			/*
+			 * Decompress and deserialize current block's data. This overwrites
+			 * the previous block's decompressed data, which the previous block's
+			 * datums may point into.
+			 */
+			valueBuffer = DecompressBlockValues(readState,
+												columnBuffers->compressionDictionary,
+												blockBuffers, blockData->valueBuffer);
 
-			if (blockBuffers->valueCompressionType != COMPRESSION_NONE)
+			/*
+			 * Datums are aligned relative to the start of the buffer, and raw
+			 * buffers may start at any offset within a coalesced read. So we
+			 * copy uncompressed data that isn't suitably aligned in memory.
+			 */
+			if (valueBuffer == blockBuffers->valueBuffer &&
+				valueBuffer->data != (char *) MAXALIGN(valueBuffer->data))
 			{
-				/* compressed data is not needed anymore */
-				pfree(blockBuffers->valueBuffer->data);
-				pfree(blockBuffers->valueBuffer);
+				valueBuffer = blockData->valueBuffer;
+				resetStringInfo(valueBuffer);
+				appendBinaryStringInfo(valueBuffer, blockBuffers->valueBuffer->data,
+									   blockBuffers->valueBuffer->len);
 			}
 
-			DeserializeBoolArray(blockBuffers->existsBuffer, blockData->existsArray,
-								 rowCount);
-			DeserializeDatumArray(valueBuffer, blockData->existsArray,
-								  rowCount, attributeForm->attbyval,
-								  attributeForm->attlen, attributeForm->attalign,
-								  blockData->valueArray);
-
-			/* store current block's data buffer to be freed at next block read */
-			blockData->valueBuffer = valueBuffer;
+			allValuesExist = DeserializeBoolArray(blockBuffers->existsBuffer,
+												  blockData->existsArray, rowCount);
+			if (blockBuffers->valueEncodingType != ENCODING_NONE)
+			{
+				DecodeDatumArray(valueBuffer, blockBuffers->valueEncodingType,
+								 blockData->existsArray, rowCount,
+								 attributeForm->attbyval, attributeForm->attlen,
+								 attributeForm->attalign, blockData->valueArray);
+			}
+			else
+			{
+				DeserializeDatumArray(valueBuffer, blockData->existsArray,
+									  allValuesExist, rowCount, attributeForm->attbyval,
+									  attributeForm->attlen, attributeForm->attalign,
+									  blockData->valueArray);
+			}
 		}
 		else if (columnAdded)
 		{
@@ -1251,6 +4568,60 @@ DeserializeBlockData(StripeBuffers *stripeBuffers, uint64 blockIndex,
 }
 
 
+/*
+ * DecompressBlockValues returns the decompressed value buffer of the given
+ * column block. Compressed blocks are decompressed into outputBuffer, and are
+ * kept in the shared block cache when it is enabled, so blocks that are read
+ * often are only decompressed once. Blocks stored without compression are
+ * returned as they are, and blocks compressed with their stripe's dictionary
+ * are decompressed with the given dictionary.
+ */
+static StringInfo
+DecompressBlockValues(TableReadState *readState, StringInfo compressionDictionary,
+					  ColumnBlockBuffers *blockBuffers, StringInfo outputBuffer)
+{
+	BlockCacheKey cacheKey;
+	bool useBlockCache = false;
+
+	if (blockBuffers->valueCompressionType != COMPRESSION_NONE &&
+		readState->fileInode != 0 && BlockCacheEnabled())
+	{
+		memset(&cacheKey, 0, sizeof(BlockCacheKey));
+		cacheKey.fileDevice = readState->fileDevice;
+		cacheKey.fileInode = readState->fileInode;
+		cacheKey.blockOffset = blockBuffers->valueFileOffset;
+		cacheKey.blockLength = blockBuffers->valueBuffer->len;
+
+		useBlockCache = true;
+	}
+
+	if (blockBuffers->valueCompressionType == COMPRESSION_NONE)
+	{
+		return blockBuffers->valueBuffer;
+	}
+
+	if (useBlockCache)
+	{
+		bool found = BlockCacheLookup(&cacheKey, outputBuffer);
+		if (found)
+		{
+			return outputBuffer;
+		}
+	}
+
+	DecompressBufferInto(blockBuffers->valueBuffer, blockBuffers->valueCompressionType,
+						 compressionDictionary, readState->decompressionState,
+						 outputBuffer);
+
+	if (useBlockCache)
+	{
+		BlockCacheInsert(&cacheKey, outputBuffer);
+	}
+
+	return outputBuffer;
+}
+
+
 /*
  * ColumnDefaultValue returns default value for given column. Only const values
  * are supported. The function errors on any other default value expressions.
@@ -1323,10 +4694,6 @@ FILESize(FILE *file)
 static StringInfo
 ReadFromFile(FILE *file, uint64 offset, uint32 size)
 {
-	int fseekResult = 0;
-	int freadResult = 0;
-	int fileError = 0;
-
 	StringInfo resultBuffer = makeStringInfo();
 	enlargeStringInfo(resultBuffer, size);
 	resultBuffer->len = size;
@@ -1336,48 +4703,210 @@ ReadFromFile(FILE *file, uint64 offset, uint32 size)
 		return resultBuffer;
 	}
 
-	errno = 0;
-	fseekResult = fseeko(file, offset, SEEK_SET);
-	if (fseekResult != 0)
+	ReadFileSegment(file, offset, resultBuffer->data, size);
+
+	return resultBuffer;
+}
+
+
+/*
+ * ReadFileSegment reads the given segment from the given file into the given
+ * buffer. The function uses pread() on the file's descriptor, so it doesn't
+ * need a separate seek, and bypasses the stdio buffer which would otherwise
+ * copy the data once more.
+ */
+static void
+ReadFileSegment(FILE *file, uint64 offset, char *buffer, uint64 size)
+{
+	int fileDescriptor = fileno(file);
+	uint64 readByteCount = 0;
+
+	while (readByteCount < size)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not seek in file: %m")));
+		ssize_t readResult = 0;
+
+		errno = 0;
+		readResult = pread(fileDescriptor, buffer + readByteCount,
+						   size - readByteCount, offset + readByteCount);
+		if (readResult < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read file: %m")));
+		}
+		else if (readResult == 0)
+		{
+			ereport(ERROR, (errmsg("could not read enough data from file")));
+		}
+
+		readByteCount += readResult;
 	}
+}
+
+
+/*
+ * ReadStripeSegment reads the given segment of the read state's table file into
+ * the given buffer, and adds the time it takes to the time that the scan spent
+ * blocked on reads. Deserializing and filtering the data isn't counted, so the
+ * total shows how much of the scan prefetching could save.
+ */
+static void
+ReadStripeSegment(TableReadState *readState, uint64 offset, char *buffer, uint64 size)
+{
+	instr_time readStartTime;
+	instr_time readEndTime;
 
-	freadResult = fread(resultBuffer->data, size, 1, file);
-	if (freadResult != 1)
+	if (size == 0)
 	{
-		ereport(ERROR, (errmsg("could not read enough data from file")));
+		return;
 	}
 
-	fileError = ferror(file);
-	if (fileError != 0)
+	INSTR_TIME_SET_CURRENT(readStartTime);
+	ReadFileSegment(readState->tableFile, offset, buffer, size);
+	INSTR_TIME_SET_CURRENT(readEndTime);
+
+	INSTR_TIME_ACCUM_DIFF(readState->readWaitTime, readEndTime, readStartTime);
+}
+
+
+/*
+ * AddReadRequest adds a request to read the given file segment to the read
+ * request list, and returns the buffer which will hold the segment's data
+ * once the requests are read.
+ */
+static StringInfo
+AddReadRequest(List **readRequestList, uint64 fileOffset, uint64 length)
+{
+	ReadRequest *readRequest = NULL;
+	StringInfo buffer = makeStringInfo();
+
+	if (length == 0)
 	{
-		ereport(ERROR, (errcode_for_file_access(),
-						errmsg("could not read file: %m")));
+		return buffer;
 	}
 
-	return resultBuffer;
-}
+	readRequest = palloc0(sizeof(ReadRequest));
+	readRequest->fileOffset = fileOffset;
+	readRequest->length = length;
+	readRequest->buffer = buffer;
 
+	(*readRequestList) = lappend(*readRequestList, readRequest);
 
+	return buffer;
+}
 
 
 /*
- * ResetUncompressedBlockData iterates over deserialized column block data
- * and sets valueBuffer field to empty buffer. This field is allocated in stripe
- * memory context and becomes invalid once memory context is reset.
+ * ReadCoalescedRequests reads the requested file segments. The function sorts
+ * the requests by file offset, and merges requests which are adjacent or which
+ * are separated by less than cstore_fdw.read_coalesce_gap into a single read.
+ * Buffers of merged requests then point into the memory of that single read,
+ * so they must not be freed individually. If the table file is memory mapped,
+ * buffers point directly into the mapping and nothing is copied.
  */
 static void
-ResetUncompressedBlockData(ColumnBlockData **blockDataArray, uint32 columnCount)
+ReadCoalescedRequests(TableReadState *readState, List *readRequestList)
 {
-	uint32 columnIndex = 0;
-	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	FileMapping *fileMapping = readState->fileMapping;
+	ReadRequest **readRequestArray = NULL;
+	ListCell *readRequestCell = NULL;
+	uint32 readRequestCount = list_length(readRequestList);
+	uint32 readRequestIndex = 0;
+	uint32 firstRangeRequestIndex = 0;
+	uint64 maximumGap = ((uint64) ReadCoalesceGap) * 1024;
+
+	if (readRequestCount == 0)
 	{
-		ColumnBlockData *blockData = blockDataArray[columnIndex];
-		if (blockData != NULL)
+		return;
+	}
+
+	readRequestArray = palloc0(readRequestCount * sizeof(ReadRequest *));
+	foreach(readRequestCell, readRequestList)
+	{
+		readRequestArray[readRequestIndex] = (ReadRequest *) lfirst(readRequestCell);
+		readRequestIndex++;
+	}
+
+	qsort(readRequestArray, readRequestCount, sizeof(ReadRequest *),
+		  CompareReadRequests);
+
+	while (firstRangeRequestIndex < readRequestCount)
+	{
+		ReadRequest *firstRangeRequest = readRequestArray[firstRangeRequestIndex];
+		uint64 rangeStartOffset = firstRangeRequest->fileOffset;
+		uint64 rangeEndOffset = rangeStartOffset + firstRangeRequest->length;
+		uint32 lastRangeRequestIndex = firstRangeRequestIndex;
+		char *rangeData = NULL;
+
+		/* extend the range as long as the next request is close enough */
+		while (lastRangeRequestIndex + 1 < readRequestCount)
 		{
-			blockData->valueBuffer = makeStringInfo();
+			ReadRequest *nextRequest = readRequestArray[lastRangeRequestIndex + 1];
+			uint64 nextEndOffset = nextRequest->fileOffset + nextRequest->length;
+
+			if (nextRequest->fileOffset > rangeEndOffset + maximumGap ||
+				nextEndOffset - rangeStartOffset > MAX_COALESCED_READ_SIZE)
+			{
+				break;
+			}
+
+			rangeEndOffset = Max(rangeEndOffset, nextEndOffset);
+			lastRangeRequestIndex++;
+		}
+
+		if (fileMapping != NULL && rangeEndOffset <= fileMapping->size)
+		{
+			rangeData = fileMapping->address + rangeStartOffset;
+		}
+		else
+		{
+			rangeData = palloc(rangeEndOffset - rangeStartOffset);
+			ReadStripeSegment(readState, rangeStartOffset, rangeData,
+							  rangeEndOffset - rangeStartOffset);
+		}
+
+		for (readRequestIndex = firstRangeRequestIndex;
+			 readRequestIndex <= lastRangeRequestIndex; readRequestIndex++)
+		{
+			ReadRequest *readRequest = readRequestArray[readRequestIndex];
+			StringInfo buffer = readRequest->buffer;
+			uint64 rangeOffset = readRequest->fileOffset - rangeStartOffset;
+
+			pfree(buffer->data);
+			buffer->data = rangeData + rangeOffset;
+			buffer->len = readRequest->length;
+			buffer->maxlen = readRequest->length;
 		}
+
+		firstRangeRequestIndex = lastRangeRequestIndex + 1;
+	}
+
+	pfree(readRequestArray);
+}
+
+
+/* CompareReadRequests orders read requests by their file offsets. */
+static int
+CompareReadRequests(const void *leftElement, const void *rightElement)
+{
+	const ReadRequest *leftRequest = *((const ReadRequest **) leftElement);
+	const ReadRequest *rightRequest = *((const ReadRequest **) rightElement);
+
+	if (leftRequest->fileOffset < rightRequest->fileOffset)
+	{
+		return -1;
+	}
+	else if (leftRequest->fileOffset > rightRequest->fileOffset)
+	{
+		return 1;
 	}
+
+	return 0;
 }
+
+
+
@@ -24,11 +24,42 @@
 #if PG_VERSION_NUM < 110000
 #define ALLOCSET_DEFAULT_SIZES ALLOCSET_DEFAULT_MINSIZE, ALLOCSET_DEFAULT_INITSIZE, ALLOCSET_DEFAULT_MAXSIZE
 #define ACLCHECK_OBJECT_TABLE ACL_KIND_CLASS
+#define HASHSTANDARD_PROC HASHPROC
+
+#define ExplainPropertyMilliseconds(qlabel, value, es) \
+	ExplainPropertyFloat(qlabel, value, 3, es)
 #else
 #define ACLCHECK_OBJECT_TABLE OBJECT_TABLE
 
 #define ExplainPropertyLong(qlabel, value, es) \
 	ExplainPropertyInteger(qlabel, NULL, value, es)
+#define ExplainPropertyMilliseconds(qlabel, value, es) \
+	ExplainPropertyFloat(qlabel, "ms", value, 3, es)
+#endif
+
+#if PG_VERSION_NUM < 90500
+#define JoinClauseIsMovableTo(restrictInfo, baserel) \
+	join_clause_is_movable_to(restrictInfo, (baserel)->relid)
+#else
+#define JoinClauseIsMovableTo(restrictInfo, baserel) \
+	join_clause_is_movable_to(restrictInfo, baserel)
+#endif
+
+#if PG_VERSION_NUM < 90500
+#define PlanStateDeparseContext(planState, es) \
+	deparse_context_for_planstate((Node *) (planState), NIL, (es)->rtable, \
+								  (es)->rtable_names)
+#else
+#define PlanStateDeparseContext(planState, es) \
+	set_deparse_context_planstate((es)->deparse_cxt, (Node *) (planState), NIL)
+#endif
+
+#if PG_VERSION_NUM >= 110000
+#define ComputeParallelWorkerCount(rel, heapPages) \
+	compute_parallel_worker(rel, heapPages, -1, max_parallel_workers_per_gather)
+#elif PG_VERSION_NUM >= 100000
+#define ComputeParallelWorkerCount(rel, heapPages) \
+	compute_parallel_worker(rel, heapPages, -1)
 #endif
 
 #define PREVIOUS_UTILITY (PreviousProcessUtilityHook != NULL \
@@ -16,10 +16,16 @@
 
 #include "postgres.h"
 #include "cstore_fdw.h"
+#include "cstore_compression_pool.h"
 #include "cstore_metadata_serialization.h"
 #include "cstore_version_compat.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "access/hash.h"
 #include "access/nbtree.h"
 #include "catalog/pg_collation.h"
 #include "commands/defrem.h"
@@ -35,6 +41,31 @@
 #include "utils/rel.h"
 
 
+/* the most buffers we pass to a single pwritev() call */
+#ifdef IOV_MAX
+#define WRITE_VECTOR_BATCH_LENGTH IOV_MAX
+#else
+#define WRITE_VECTOR_BATCH_LENGTH 16
+#endif
+
+
+/*
+ * BlockCompressionJob ties a compression job that runs in a worker thread to the
+ * block buffers that receive its result.
+ */
+typedef struct BlockCompressionJob
+{
+	ColumnBlockBuffers *blockBuffers;
+	CompressionJob *compressionJob;
+
+} BlockCompressionJob;
+
+
+/* Configuration parameters for writing cstore files */
+bool UseDirectWrite = false;
+bool EnableZstdDictionaries = true;
+
+
 static void CStoreWriteFooter(StringInfo footerFileName, TableFooter *tableFooter);
 static StripeBuffers * CreateEmptyStripeBuffers(uint32 stripeMaxRowCount,
 												uint32 blockRowCount,
@@ -43,16 +74,31 @@ static StripeSkipList * CreateEmptyStripeSkipList(uint32 stripeMaxRowCount,
 												  uint32 blockRowCount,
 												  uint32 columnCount);
 static StripeMetadata FlushStripe(TableWriteState *writeState);
+static void CompressStripeColumn(TableWriteState *writeState,
+								 ColumnBuffers *columnBuffers,
+								 ColumnOptions *columnOptions, uint32 blockCount);
+static uint64 CompressBlockBuffers(TableWriteState *writeState,
+								   ColumnOptions *columnOptions,
+								   StringInfo *rawBufferArray, uint32 blockCount,
+								   StringInfo compressionDictionary,
+								   StringInfo *compressedBufferArray);
+static ColumnStripeSkipNode * CreateColumnStripeSkipNodes(TableWriteState *writeState);
 static StringInfo * CreateSkipListBufferArray(StripeSkipList *stripeSkipList,
 											  TupleDesc tupleDescriptor);
 static StripeFooter * CreateStripeFooter(StripeSkipList *stripeSkipList,
+										 StripeBuffers *stripeBuffers,
 										 StringInfo *skipListBufferArray);
 static StringInfo SerializeBoolArray(bool *boolArray, uint32 boolArrayLength);
 static void SerializeSingleDatum(StringInfo datumBuffer, Datum datum,
 								 bool datumTypeByValue, int datumTypeLength,
 								 char datumTypeAlign);
+static void CollectCompressionJobs(TableWriteState *writeState);
 static void SerializeBlockData(TableWriteState *writeState, uint32 blockIndex,
 							   uint32 rowCount);
+static FmgrInfo * HashFunctionInfoOrNull(Oid typeId);
+static void AddBlockValueHash(TableWriteState *writeState, uint32 columnIndex,
+							  Datum columnValue, Oid columnCollation);
+static void BuildBlockBloomFilters(TableWriteState *writeState, uint32 blockIndex);
 static void UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode,
 									  Datum columnValue, bool columnTypeByValue,
 									  int columnTypeLength, Oid columnCollation,
@@ -60,6 +106,16 @@ static void UpdateBlockSkipNodeMinMax(ColumnBlockSkipNode *blockSkipNode,
 static Datum DatumCopy(Datum datum, bool datumTypeByValue, int datumTypeLength);
 static void AppendStripeMetadata(TableFooter *tableFooter,
 								 StripeMetadata stripeMetadata);
+static void AppendToWriteVector(struct iovec *writeVector, uint32 *writeVectorLength,
+								StringInfo buffer);
+static void WriteStripeToFile(TableWriteState *writeState, struct iovec *writeVector,
+							  uint32 writeVectorLength);
+static void StartDirectWrite(TableWriteState *writeState, const char *filename);
+static void CopyToDirectWriteBuffer(TableWriteState *writeState, char *data,
+									uint64 dataLength);
+static void FlushDirectWriteBuffer(TableWriteState *writeState);
+static void WriteDirectWriteBuffer(TableWriteState *writeState, uint32 writeLength);
+static bool DisableDirectIO(int fileDescriptor);
 static void WriteToFile(FILE *file, void *data, uint32 dataLength);
 static void SyncAndCloseFile(FILE *file);
 static StringInfo CopyStringInfo(StringInfo sourceString);
@@ -73,7 +129,7 @@ static StringInfo CopyStringInfo(StringInfo sourceString);
  * will be added.
  */
 TableWriteState *
-CStoreBeginWrite(const char *filename, CompressionType compressionType,
+CStoreBeginWrite(const char *filename, ColumnOptions *columnOptionsArray,
 				 uint64 stripeMaxRowCount, uint32 blockRowCount,
 				 TupleDesc tupleDescriptor)
 {
@@ -82,6 +138,8 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 	StringInfo tableFooterFilename = NULL;
 	TableFooter *tableFooter = NULL;
 	FmgrInfo **comparisonFunctionArray = NULL;
+	FmgrInfo **hashFunctionArray = NULL;
+	uint32 **blockHashArray = NULL;
 	MemoryContext stripeWriteContext = NULL;
 	uint64 currentFileOffset = 0;
 	uint32 columnCount = 0;
@@ -123,14 +181,14 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 	}
 
 	/*
-	 * If stripeMetadataList is not empty, jump to the position right after
-	 * the last position.
+	 * If stripeMetadataList is not empty, new stripes are written right after
+	 * the last stripe. Stripes are written at explicit offsets, so we don't
+	 * need to seek in the file.
 	 */
 	if (tableFooter->stripeMetadataList != NIL)
 	{
 		StripeMetadata *lastStripe = NULL;
 		uint64 lastStripeSize = 0;
-		int fseekResult = 0;
 
 		lastStripe = llast(tableFooter->stripeMetadataList);
 		lastStripeSize += lastStripe->skipListLength;
@@ -138,14 +196,6 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 		lastStripeSize += lastStripe->footerLength;
 
 		currentFileOffset = lastStripe->fileOffset + lastStripeSize;
-
-		errno = 0;
-		fseekResult = fseeko(tableFile, currentFileOffset, SEEK_SET);
-		if (fseekResult != 0)
-		{
-			ereport(ERROR, (errcode_for_file_access(),
-							errmsg("could not seek in file \"%s\": %m", filename)));
-		}
 	}
 
 	/* get comparison function pointers for each of the columns */
@@ -166,6 +216,33 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 		comparisonFunctionArray[columnIndex] = comparisonFunction;
 	}
 
+	/* get hash function pointers for columns with bloom filters */
+	hashFunctionArray = palloc0(columnCount * sizeof(FmgrInfo *));
+	blockHashArray = palloc0(columnCount * sizeof(uint32 *));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		FormData_pg_attribute *attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		FmgrInfo *hashFunction = NULL;
+
+		if (attributeForm->attisdropped || !columnOptionsArray[columnIndex].bloomFilter)
+		{
+			continue;
+		}
+
+		hashFunction = HashFunctionInfoOrNull(attributeForm->atttypid);
+		if (hashFunction == NULL)
+		{
+			ereport(ERROR, (errmsg("could not find hash function for column \"%s\"",
+								   NameStr(attributeForm->attname)),
+							errhint("Bloom filters can only be built for columns "
+									"whose data type has a default hash operator "
+									"class.")));
+		}
+
+		hashFunctionArray[columnIndex] = hashFunction;
+		blockHashArray[columnIndex] = palloc(blockRowCount * sizeof(uint32));
+	}
+
 	/*
 	 * We allocate all stripe specific data in the stripeWriteContext, and
 	 * reset this memory context once we have flushed the stripe to the file.
@@ -184,16 +261,39 @@ CStoreBeginWrite(const char *filename, CompressionType compressionType,
 	writeState->tableFile = tableFile;
 	writeState->tableFooterFilename = tableFooterFilename;
 	writeState->tableFooter = tableFooter;
-	writeState->compressionType = compressionType;
+	writeState->columnOptionsArray = columnOptionsArray;
 	writeState->stripeMaxRowCount = stripeMaxRowCount;
 	writeState->tupleDescriptor = tupleDescriptor;
 	writeState->currentFileOffset = currentFileOffset;
 	writeState->comparisonFunctionArray = comparisonFunctionArray;
+	writeState->hashFunctionArray = hashFunctionArray;
+	writeState->blockHashArray = blockHashArray;
+	writeState->blockHashCount = palloc0(columnCount * sizeof(uint32));
 	writeState->stripeBuffers = NULL;
 	writeState->stripeSkipList = NULL;
 	writeState->stripeWriteContext = stripeWriteContext;
 	writeState->blockDataArray = blockData;
-	writeState->compressionBuffer = NULL;
+	writeState->compressionBuffer = makeStringInfo();
+	writeState->encodingBuffer = makeStringInfo();
+	writeState->compressionState = CreateCompressionState();
+
+	writeState->autoCompressionTypeArray = palloc(columnCount * sizeof(CompressionType));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		writeState->autoCompressionTypeArray[columnIndex] = COMPRESSION_AUTO;
+	}
+
+	/* if we can't start compression threads, blocks are compressed in the backend */
+	if (CompressionWorkerCount > 0)
+	{
+		writeState->compressionPool = CreateCompressionPool(CompressionWorkerCount);
+	}
+	writeState->compressionJobList = NIL;
+
+	if (UseDirectWrite)
+	{
+		StartDirectWrite(writeState, filename);
+	}
 
 	return writeState;
 }
@@ -229,7 +329,6 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 												   blockRowCount, columnCount);
 		writeState->stripeBuffers = stripeBuffers;
 		writeState->stripeSkipList = stripeSkipList;
-		writeState->compressionBuffer = makeStringInfo();
 
 		/*
 		 * serializedValueBuffer lives in stripe write memory context so it needs to be
@@ -275,6 +374,12 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 			UpdateBlockSkipNodeMinMax(blockSkipNode, columnValues[columnIndex],
 									  columnTypeByValue, columnTypeLength,
 									  columnCollation, comparisonFunction);
+
+			if (writeState->hashFunctionArray[columnIndex] != NULL)
+			{
+				AddBlockValueHash(writeState, columnIndex, columnValues[columnIndex],
+								  columnCollation);
+			}
 		}
 
 		blockSkipNode->rowCount++;
@@ -292,18 +397,19 @@ CStoreWriteRow(TableWriteState *writeState, Datum *columnValues, bool *columnNul
 	if (stripeBuffers->rowCount >= writeState->stripeMaxRowCount)
 	{
 		StripeMetadata stripeMetadata = FlushStripe(writeState);
-		MemoryContextReset(writeState->stripeWriteContext);
-
-		/* set stripe data and skip list to NULL so they are recreated next time */
-		writeState->stripeBuffers = NULL;
-		writeState->stripeSkipList = NULL;
 
 		/*
 		 * Append stripeMetadata in old context so next MemoryContextReset
-		 * doesn't free it.
+		 * doesn't free it. Its column statistics live in the stripe context,
+		 * so we copy them before resetting that context.
 		 */
 		MemoryContextSwitchTo(oldContext);
 		AppendStripeMetadata(tableFooter, stripeMetadata);
+		MemoryContextReset(writeState->stripeWriteContext);
+
+		/* set stripe data and skip list to NULL so they are recreated next time */
+		writeState->stripeBuffers = NULL;
+		writeState->stripeSkipList = NULL;
 	}
 	else
 	{
@@ -332,10 +438,30 @@ CStoreEndWrite(TableWriteState *writeState)
 		MemoryContext oldContext = MemoryContextSwitchTo(writeState->stripeWriteContext);
 
 		StripeMetadata stripeMetadata = FlushStripe(writeState);
-		MemoryContextReset(writeState->stripeWriteContext);
 
 		MemoryContextSwitchTo(oldContext);
 		AppendStripeMetadata(writeState->tableFooter, stripeMetadata);
+		MemoryContextReset(writeState->stripeWriteContext);
+	}
+
+	if (writeState->compressionPool != NULL)
+	{
+		DestroyCompressionPool(writeState->compressionPool);
+	}
+
+	/* direct writes pad the file's last block, so we cut the padding off */
+	if (writeState->directWriteBuffer != NULL)
+	{
+		int truncateResult = 0;
+
+		errno = 0;
+		truncateResult = ftruncate(fileno(writeState->tableFile),
+								   writeState->currentFileOffset);
+		if (truncateResult != 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not truncate file: %m")));
+		}
 	}
 
 	SyncAndCloseFile(writeState->tableFile);
@@ -360,6 +486,7 @@ CStoreEndWrite(TableWriteState *writeState)
 	pfree(tempTableFooterFileName);
 
 	MemoryContextDelete(writeState->stripeWriteContext);
+	ReleaseCompressionState(writeState->compressionState);
 	list_free_deep(writeState->tableFooter->stripeMetadataList);
 	pfree(writeState->tableFooter);
 	pfree(writeState->tableFooterFilename->data);
@@ -439,6 +566,7 @@ CreateEmptyStripeBuffers(uint32 stripeMaxRowCount, uint32 blockRowCount,
 			blockBuffersArray[blockIndex]->existsBuffer = NULL;
 			blockBuffersArray[blockIndex]->valueBuffer = NULL;
 			blockBuffersArray[blockIndex]->valueCompressionType = COMPRESSION_NONE;
+			blockBuffersArray[blockIndex]->valueEncodingType = ENCODING_NONE;
 		}
 
 		columnBuffersArray[columnIndex] = palloc0(sizeof(ColumnBuffers));
@@ -502,7 +630,6 @@ FlushStripe(TableWriteState *writeState)
 	uint32 columnIndex = 0;
 	uint32 blockIndex = 0;
 	TableFooter *tableFooter = writeState->tableFooter;
-	FILE *tableFile = writeState->tableFile;
 	StripeBuffers *stripeBuffers = writeState->stripeBuffers;
 	StripeSkipList *stripeSkipList = writeState->stripeSkipList;
 	ColumnBlockSkipNode **columnSkipNodeArray = stripeSkipList->blockSkipNodeArray;
@@ -512,6 +639,9 @@ FlushStripe(TableWriteState *writeState)
 	uint32 blockRowCount = tableFooter->blockRowCount;
 	uint32 lastBlockIndex = stripeBuffers->rowCount / blockRowCount;
 	uint32 lastBlockRowCount = stripeBuffers->rowCount % blockRowCount;
+	uint32 maximumWriteVectorLength = 2 * columnCount * (blockCount + 1) + 1;
+	struct iovec *writeVector = palloc0(maximumWriteVectorLength * sizeof(struct iovec));
+	uint32 writeVectorLength = 0;
 
 	/*
 	 * check if the last block needs serialization , the last block was not serialized
@@ -522,6 +652,28 @@ FlushStripe(TableWriteState *writeState)
 		SerializeBlockData(writeState, lastBlockIndex, lastBlockRowCount);
 	}
 
+	CollectCompressionJobs(writeState);
+
+	/* zstd blocks are compressed together, once all of the stripe's data is in */
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnOptions columnOptions = writeState->columnOptionsArray[columnIndex];
+		if (columnOptions.compressionType == COMPRESSION_AUTO)
+		{
+			columnOptions.compressionType =
+				writeState->autoCompressionTypeArray[columnIndex];
+
+			/* the next stripe picks its own compression type */
+			writeState->autoCompressionTypeArray[columnIndex] = COMPRESSION_AUTO;
+		}
+
+		if (columnOptions.compressionType == COMPRESSION_ZSTD)
+		{
+			ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
+			CompressStripeColumn(writeState, columnBuffers, &columnOptions, blockCount);
+		}
+	}
+
 	/* update buffer sizes and positions in stripe skip list */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
@@ -537,6 +689,7 @@ FlushStripe(TableWriteState *writeState)
 			uint64 existsBufferSize = blockBuffers->existsBuffer->len;
 			uint64 valueBufferSize = blockBuffers->valueBuffer->len;
 			CompressionType valueCompressionType = blockBuffers->valueCompressionType;
+			EncodingType valueEncodingType = blockBuffers->valueEncodingType;
 			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
 
 			blockSkipNode->existsBlockOffset = currentExistsBlockOffset;
@@ -544,6 +697,7 @@ FlushStripe(TableWriteState *writeState)
 			blockSkipNode->valueBlockOffset = currentValueBlockOffset;
 			blockSkipNode->valueLength = valueBufferSize;
 			blockSkipNode->valueCompressionType = valueCompressionType;
+			blockSkipNode->valueEncodingType = valueEncodingType;
 
 			currentExistsBlockOffset += existsBufferSize;
 			currentValueBlockOffset += valueBufferSize;
@@ -552,7 +706,7 @@ FlushStripe(TableWriteState *writeState)
 
 	/* create skip list and footer buffers */
 	skipListBufferArray = CreateSkipListBufferArray(stripeSkipList, tupleDescriptor);
-	stripeFooter = CreateStripeFooter(stripeSkipList, skipListBufferArray);
+	stripeFooter = CreateStripeFooter(stripeSkipList, stripeBuffers, skipListBufferArray);
 	stripeFooterBuffer = SerializeStripeFooter(stripeFooter);
 
 	/*
@@ -566,17 +720,19 @@ FlushStripe(TableWriteState *writeState)
 	 * present values. For each column, we first store all "exists" buffers,
 	 * and then all "value" buffers.
 	 * (3) Stripe footer, which contains the skip list buffer size, exists buffer
-	 * size, and value buffer size for each of the columns.
+	 * size, and value buffer size for each of the columns, and the dictionaries
+	 * that columns were compressed with.
 	 *
-	 * We start by flushing the skip list buffers.
+	 * We gather the buffers in file order, and write them with as few calls as
+	 * we can. We start with the skip list buffers.
 	 */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
 		StringInfo skipListBuffer = skipListBufferArray[columnIndex];
-		WriteToFile(tableFile, skipListBuffer->data, skipListBuffer->len);
+		AppendToWriteVector(writeVector, &writeVectorLength, skipListBuffer);
 	}
 
-	/* then, we flush the data buffers */
+	/* then, we add the data buffers */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
 		ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
@@ -588,7 +744,7 @@ FlushStripe(TableWriteState *writeState)
 					columnBuffers->blockBuffersArray[blockIndex];
 			StringInfo existsBuffer = blockBuffers->existsBuffer;
 
-			WriteToFile(tableFile, existsBuffer->data, existsBuffer->len);
+			AppendToWriteVector(writeVector, &writeVectorLength, existsBuffer);
 		}
 
 		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
@@ -597,12 +753,13 @@ FlushStripe(TableWriteState *writeState)
 					columnBuffers->blockBuffersArray[blockIndex];
 			StringInfo valueBuffer = blockBuffers->valueBuffer;
 
-			WriteToFile(tableFile, valueBuffer->data, valueBuffer->len);
+			AppendToWriteVector(writeVector, &writeVectorLength, valueBuffer);
 		}
 	}
 
-	/* finally, we flush the footer buffer */
-	WriteToFile(tableFile, stripeFooterBuffer->data, stripeFooterBuffer->len);
+	/* finally, we add the footer buffer, and write the stripe */
+	AppendToWriteVector(writeVector, &writeVectorLength, stripeFooterBuffer);
+	WriteStripeToFile(writeState, writeVector, writeVectorLength);
 
 	/* set stripe metadata */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
@@ -616,6 +773,9 @@ FlushStripe(TableWriteState *writeState)
 	stripeMetadata.skipListLength = skipListLength;
 	stripeMetadata.dataLength = dataLength;
 	stripeMetadata.footerLength = stripeFooterBuffer->len;
+	stripeMetadata.rowCount = stripeBuffers->rowCount;
+	stripeMetadata.columnCount = columnCount;
+	stripeMetadata.columnSkipNodeArray = CreateColumnStripeSkipNodes(writeState);
 
 	/* advance current file offset */
 	writeState->currentFileOffset += skipListLength;
@@ -626,6 +786,203 @@ FlushStripe(TableWriteState *writeState)
 }
 
 
+/*
+ * CompressStripeColumn compresses the value buffers of the given column's blocks
+ * in the stripe. The function trains a dictionary on the blocks, and keeps it
+ * if the dictionary and the blocks compressed with it take less space than the
+ * blocks compressed on their own. This compresses each block twice, so loads
+ * can skip dictionaries and compress each block once. Blocks that don't get
+ * smaller are kept uncompressed.
+ */
+static void
+CompressStripeColumn(TableWriteState *writeState, ColumnBuffers *columnBuffers,
+					 ColumnOptions *columnOptions, uint32 blockCount)
+{
+	StringInfo *rawBufferArray = palloc0(blockCount * sizeof(StringInfo));
+	StringInfo *compressedBufferArray = palloc0(blockCount * sizeof(StringInfo));
+	StringInfo compressionDictionary = NULL;
+	uint64 compressedLength = 0;
+	uint32 blockIndex = 0;
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
+		rawBufferArray[blockIndex] = blockBuffers->valueBuffer;
+	}
+
+	compressedLength = CompressBlockBuffers(writeState, columnOptions, rawBufferArray,
+											blockCount, NULL, compressedBufferArray);
+
+	if (EnableZstdDictionaries)
+	{
+		compressionDictionary =
+			TrainCompressionDictionary(rawBufferArray, blockCount,
+									   columnOptions->compressionType);
+	}
+	if (compressionDictionary != NULL)
+	{
+		StringInfo *dictionaryBufferArray = palloc0(blockCount * sizeof(StringInfo));
+		uint64 dictionaryLength = compressionDictionary->len;
+
+		dictionaryLength += CompressBlockBuffers(writeState, columnOptions,
+												 rawBufferArray, blockCount,
+												 compressionDictionary,
+												 dictionaryBufferArray);
+		if (dictionaryLength < compressedLength)
+		{
+			compressedBufferArray = dictionaryBufferArray;
+			columnBuffers->compressionDictionary = compressionDictionary;
+		}
+	}
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
+		StringInfo compressedBuffer = compressedBufferArray[blockIndex];
+
+		if (compressedBuffer != NULL)
+		{
+			blockBuffers->valueBuffer = compressedBuffer;
+			blockBuffers->valueCompressionType = columnOptions->compressionType;
+		}
+	}
+}
+
+
+/*
+ * CompressBlockBuffers compresses each of the given raw buffers with the given
+ * dictionary, and stores the compressed buffers in compressedBufferArray. Raw
+ * buffers that don't compress get a NULL entry. The function returns the total
+ * length of the blocks as they would be written.
+ */
+static uint64
+CompressBlockBuffers(TableWriteState *writeState, ColumnOptions *columnOptions,
+					 StringInfo *rawBufferArray, uint32 blockCount, StringInfo compressionDictionary,
+					 StringInfo *compressedBufferArray)
+{
+	StringInfo compressionBuffer = writeState->compressionBuffer;
+	CompressionPool *compressionPool = writeState->compressionPool;
+	CompressionJob **compressionJobArray = NULL;
+	uint64 totalLength = 0;
+	uint32 blockIndex = 0;
+
+	/* with compression threads, we compress all blocks at once and wait for them */
+	if (compressionPool != NULL)
+	{
+		compressionJobArray = palloc0(blockCount * sizeof(CompressionJob *));
+
+		for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+		{
+			compressionJobArray[blockIndex] =
+				SubmitCompressionJob(compressionPool, rawBufferArray[blockIndex],
+									 columnOptions->compressionType,
+									 columnOptions->compressionLevel,
+									 compressionDictionary);
+		}
+
+		WaitForCompressionJobs(compressionPool);
+	}
+
+	for (blockIndex = 0; blockIndex < blockCount; blockIndex++)
+	{
+		StringInfo rawBuffer = rawBufferArray[blockIndex];
+		StringInfo compressedBuffer = NULL;
+
+		if (compressionJobArray != NULL)
+		{
+			CompressionJob *compressionJob = compressionJobArray[blockIndex];
+			if (compressionJob->compressed)
+			{
+				compressedBuffer = compressionJob->outputBuffer;
+			}
+		}
+		else if (CompressBuffer(rawBuffer, compressionBuffer,
+								columnOptions->compressionType,
+								columnOptions->compressionLevel,
+								compressionDictionary, writeState->compressionState))
+		{
+			compressedBuffer = CopyStringInfo(compressionBuffer);
+		}
+
+		compressedBufferArray[blockIndex] = compressedBuffer;
+		if (compressedBuffer != NULL)
+		{
+			totalLength += compressedBuffer->len;
+		}
+		else
+		{
+			totalLength += rawBuffer->len;
+		}
+	}
+
+	return totalLength;
+}
+
+
+/*
+ * CreateColumnStripeSkipNodes rolls up the block skip nodes of the current
+ * stripe into statistics for each column of the whole stripe. These go into
+ * the table footer, and let scans skip the stripe without reading it.
+ */
+static ColumnStripeSkipNode *
+CreateColumnStripeSkipNodes(TableWriteState *writeState)
+{
+	StripeBuffers *stripeBuffers = writeState->stripeBuffers;
+	StripeSkipList *stripeSkipList = writeState->stripeSkipList;
+	TupleDesc tupleDescriptor = writeState->tupleDescriptor;
+	uint32 columnCount = tupleDescriptor->natts;
+	uint32 columnIndex = 0;
+	ColumnStripeSkipNode *stripeSkipNodeArray =
+		palloc0(columnCount * sizeof(ColumnStripeSkipNode));
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
+		FmgrInfo *comparisonFunction = writeState->comparisonFunctionArray[columnIndex];
+		ColumnBlockSkipNode *blockSkipNodeArray =
+			stripeSkipList->blockSkipNodeArray[columnIndex];
+		ColumnStripeSkipNode *stripeSkipNode = &stripeSkipNodeArray[columnIndex];
+		ColumnBlockSkipNode stripeMinMaxNode;
+		uint32 blockIndex = 0;
+
+		memset(&stripeMinMaxNode, 0, sizeof(ColumnBlockSkipNode));
+
+		for (blockIndex = 0; blockIndex < stripeSkipList->blockCount; blockIndex++)
+		{
+			ColumnBlockSkipNode *blockSkipNode = &blockSkipNodeArray[blockIndex];
+			if (!blockSkipNode->hasMinMax)
+			{
+				continue;
+			}
+
+			UpdateBlockSkipNodeMinMax(&stripeMinMaxNode, blockSkipNode->minimumValue,
+									  attributeForm->attbyval, attributeForm->attlen,
+									  attributeForm->attcollation, comparisonFunction);
+			UpdateBlockSkipNodeMinMax(&stripeMinMaxNode, blockSkipNode->maximumValue,
+									  attributeForm->attbyval, attributeForm->attlen,
+									  attributeForm->attcollation, comparisonFunction);
+		}
+
+		stripeSkipNode->nullCount = stripeBuffers->columnBuffersArray[columnIndex]->nullCount;
+		stripeSkipNode->hasMinMax = stripeMinMaxNode.hasMinMax;
+
+		if (stripeMinMaxNode.hasMinMax)
+		{
+			stripeSkipNode->minimumValue = SerializeDatum(stripeMinMaxNode.minimumValue,
+														  attributeForm->attbyval,
+														  attributeForm->attlen,
+														  &stripeSkipNode->minimumLength);
+			stripeSkipNode->maximumValue = SerializeDatum(stripeMinMaxNode.maximumValue,
+														  attributeForm->attbyval,
+														  attributeForm->attlen,
+														  &stripeSkipNode->maximumLength);
+		}
+	}
+
+	return stripeSkipNodeArray;
+}
+
+
 /*
  * CreateSkipListBufferArray serializes the skip list for each column of the
  * given stripe and returns the result as an array.
@@ -659,7 +1016,8 @@ CreateSkipListBufferArray(StripeSkipList *stripeSkipList, TupleDesc tupleDescrip
 
 /* Creates and returns the footer for given stripe. */
 static StripeFooter *
-CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArray)
+CreateStripeFooter(StripeSkipList *stripeSkipList, StripeBuffers *stripeBuffers,
+				   StringInfo *skipListBufferArray)
 {
 	StripeFooter *stripeFooter = NULL;
 	uint32 columnIndex = 0;
@@ -667,9 +1025,11 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 	uint64 *skipListSizeArray = palloc0(columnCount * sizeof(uint64));
 	uint64 *existsSizeArray = palloc0(columnCount * sizeof(uint64));
 	uint64 *valueSizeArray = palloc0(columnCount * sizeof(uint64));
+	StringInfo *compressionDictionaryArray = palloc0(columnCount * sizeof(StringInfo));
 
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
 	{
+		ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
 		ColumnBlockSkipNode *blockSkipNodeArray =
 			stripeSkipList->blockSkipNodeArray[columnIndex];
 		uint32 blockIndex = 0;
@@ -680,6 +1040,7 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 			valueSizeArray[columnIndex] += blockSkipNodeArray[blockIndex].valueLength;
 		}
 		skipListSizeArray[columnIndex] = skipListBufferArray[columnIndex]->len;
+		compressionDictionaryArray[columnIndex] = columnBuffers->compressionDictionary;
 	}
 
 	stripeFooter = palloc0(sizeof(StripeFooter));
@@ -687,6 +1048,7 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 	stripeFooter->skipListSizeArray = skipListSizeArray;
 	stripeFooter->existsSizeArray = existsSizeArray;
 	stripeFooter->valueSizeArray = valueSizeArray;
+	stripeFooter->compressionDictionaryArray = compressionDictionaryArray;
 
 	return stripeFooter;
 }
@@ -694,27 +1056,46 @@ CreateStripeFooter(StripeSkipList *stripeSkipList, StringInfo *skipListBufferArr
 
 /*
  * SerializeBoolArray serializes the given boolean array and returns the result
- * as a StringInfo. This function packs every 8 boolean values into one byte.
+ * as a StringInfo. This function packs every 8 boolean values into one byte,
+ * and does so without branching on each value.
  */
 static StringInfo
 SerializeBoolArray(bool *boolArray, uint32 boolArrayLength)
 {
 	StringInfo boolArrayBuffer = NULL;
 	uint32 boolArrayIndex = 0;
+	uint32 byteIndex = 0;
 	uint32 byteCount = (boolArrayLength + 7) / 8;
+	uint32 fullByteCount = boolArrayLength / 8;
+	uint8 *byteArray = NULL;
 
 	boolArrayBuffer = makeStringInfo();
 	enlargeStringInfo(boolArrayBuffer, byteCount);
 	boolArrayBuffer->len = byteCount;
 	memset(boolArrayBuffer->data, 0, byteCount);
 
-	for (boolArrayIndex = 0; boolArrayIndex < boolArrayLength; boolArrayIndex++)
+	byteArray = (uint8 *) boolArrayBuffer->data;
+	for (byteIndex = 0; byteIndex < fullByteCount; byteIndex++)
+	{
+		const bool *currentBoolArray = boolArray + (byteIndex * 8);
+
+		byteArray[byteIndex] = (uint8) ((currentBoolArray[0] ? 0x01 : 0) |
+										(currentBoolArray[1] ? 0x02 : 0) |
+										(currentBoolArray[2] ? 0x04 : 0) |
+										(currentBoolArray[3] ? 0x08 : 0) |
+										(currentBoolArray[4] ? 0x10 : 0) |
+										(currentBoolArray[5] ? 0x20 : 0) |
+										(currentBoolArray[6] ? 0x40 : 0) |
+										(currentBoolArray[7] ? 0x80 : 0));
+	}
+
+	for (boolArrayIndex = fullByteCount * 8; boolArrayIndex < boolArrayLength;
+		 boolArrayIndex++)
 	{
 		if (boolArray[boolArrayIndex])
 		{
-			uint32 byteIndex = boolArrayIndex / 8;
 			uint32 bitIndex = boolArrayIndex % 8;
-			boolArrayBuffer->data[byteIndex] |= (1 << bitIndex);
+			byteArray[fullByteCount] |= (1 << bitIndex);
 		}
 	}
 
@@ -761,8 +1142,8 @@ SerializeSingleDatum(StringInfo datumBuffer, Datum datum, bool datumTypeByValue,
 
 
 /*
- * SerializeBlockData serializes and compresses block data at given block index with given
- * compression type for every column.
+ * SerializeBlockData serializes and compresses block data at given block index with
+ * each column's own encoding and compression options.
  */
 static void
 SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCount)
@@ -770,9 +1151,10 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
 	uint32 columnIndex = 0;
 	StripeBuffers *stripeBuffers = writeState->stripeBuffers;
 	ColumnBlockData **blockDataArray = writeState->blockDataArray;
-	CompressionType requestedCompressionType = writeState->compressionType;
 	const uint32 columnCount = stripeBuffers->columnCount;
 	StringInfo compressionBuffer = writeState->compressionBuffer;
+	StringInfo encodingBuffer = writeState->encodingBuffer;
+	TupleDesc tupleDescriptor = writeState->tupleDescriptor;
 
 	/* serialize exist values, data values are already serialized */
 	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
@@ -784,6 +1166,8 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
 		blockBuffers->existsBuffer = SerializeBoolArray(blockData->existsArray, rowCount);
 	}
 
+	BuildBlockBloomFilters(writeState, blockIndex);
+
 	/*
 	 * check and compress value buffers, if a value buffer is not compressable
 	 * then keep it as uncompressed, store compression information.
@@ -793,24 +1177,90 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
 		ColumnBuffers *columnBuffers = stripeBuffers->columnBuffersArray[columnIndex];
 		ColumnBlockBuffers *blockBuffers = columnBuffers->blockBuffersArray[blockIndex];
 		ColumnBlockData *blockData = blockDataArray[columnIndex];
+		ColumnOptions *columnOptions = &writeState->columnOptionsArray[columnIndex];
+		CompressionType requestedCompressionType = columnOptions->compressionType;
+		Form_pg_attribute attributeForm = TupleDescAttr(tupleDescriptor, columnIndex);
 		StringInfo serializedValueBuffer = NULL;
 		CompressionType actualCompressionType = COMPRESSION_NONE;
+		EncodingType encodingType = ENCODING_NONE;
+		uint32 valueCount = 0;
+		uint32 rowIndex = 0;
 		bool compressed = false;
+		bool compressInPool = false;
 
 		serializedValueBuffer = blockData->valueBuffer;
 
+		/* encode values first, so that compression works on the smaller buffer */
+		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+		{
+			valueCount += blockData->existsArray[rowIndex];
+		}
+
+		columnBuffers->nullCount += rowCount - valueCount;
+
+		encodingType = EncodeValueBuffer(serializedValueBuffer, encodingBuffer,
+										 valueCount, attributeForm->attbyval,
+										 attributeForm->attlen,
+										 attributeForm->attalign,
+										 columnOptions->encodingOption);
+		if (encodingType != ENCODING_NONE)
+		{
+			serializedValueBuffer = encodingBuffer;
+		}
+
+		/*
+		 * With auto compression, we pick the compression type on the first block
+		 * of the stripe that has values, and use it for the rest of the stripe.
+		 */
+		if (requestedCompressionType == COMPRESSION_AUTO)
+		{
+			CompressionType *autoCompressionType =
+				&writeState->autoCompressionTypeArray[columnIndex];
+
+			if (*autoCompressionType == COMPRESSION_AUTO &&
+				serializedValueBuffer->len > 0)
+			{
+				*autoCompressionType =
+					ChooseCompressionType(serializedValueBuffer, compressionBuffer,
+										  (CompressionObjective) AutoCompressionObjective,
+										  writeState->compressionState);
+			}
+
+			requestedCompressionType = *autoCompressionType;
+			if (requestedCompressionType == COMPRESSION_AUTO)
+			{
+				requestedCompressionType = COMPRESSION_NONE;
+			}
+		}
+
 		/* the only other supported compression type is pg_lz for now */
 		Assert(requestedCompressionType == COMPRESSION_NONE ||
 			   requestedCompressionType == COMPRESSION_PG_LZ ||
 			   requestedCompressionType == COMPRESSION_SNAPPY ||
-			   requestedCompressionType == COMPRESSION_DEFLATE);
+			   requestedCompressionType == COMPRESSION_DEFLATE ||
+			   requestedCompressionType == COMPRESSION_LZ4 ||
+			   requestedCompressionType == COMPRESSION_ZSTD);
 
 		/*
 		 * if serializedValueBuffer is be compressed, update serializedValueBuffer
-		 * with compressed data and store compression type.
+		 * with compressed data and store compression type. zstd blocks are
+		 * compressed in FlushStripe() instead, with a dictionary for the stripe.
+		 * With compression threads, other blocks are compressed in a worker
+		 * thread, and FlushStripe() collects the result.
 		 */
-		compressed = CompressBuffer(serializedValueBuffer, compressionBuffer,
-									requestedCompressionType);
+		if (requestedCompressionType != COMPRESSION_ZSTD &&
+			writeState->compressionPool != NULL &&
+			CompressionPoolSupported(requestedCompressionType))
+		{
+			compressInPool = true;
+		}
+		else if (requestedCompressionType != COMPRESSION_ZSTD)
+		{
+			compressed = CompressBuffer(serializedValueBuffer, compressionBuffer,
+										requestedCompressionType,
+										columnOptions->compressionLevel, NULL,
+										writeState->compressionState);
+		}
 		if (compressed)
 		{
 			serializedValueBuffer = compressionBuffer;
@@ -820,14 +1270,145 @@ SerializeBlockData(TableWriteState *writeState, uint32 blockIndex, uint32 rowCou
 
 		/* store (compressed) value buffer */
 		blockBuffers->valueCompressionType = actualCompressionType;
+		blockBuffers->valueEncodingType = encodingType;
 		blockBuffers->valueBuffer = CopyStringInfo(serializedValueBuffer);
 
+		if (compressInPool)
+		{
+			BlockCompressionJob *blockCompressionJob = palloc0(sizeof(BlockCompressionJob));
+			blockCompressionJob->blockBuffers = blockBuffers;
+			blockCompressionJob->compressionJob =
+				SubmitCompressionJob(writeState->compressionPool,
+									 blockBuffers->valueBuffer,
+									 requestedCompressionType,
+									 columnOptions->compressionLevel, NULL);
+
+			writeState->compressionJobList = lappend(writeState->compressionJobList,
+													 blockCompressionJob);
+		}
+
 		/* valueBuffer needs to be reset for next block's data */
 		resetStringInfo(blockData->valueBuffer);
 	}
 }
 
 
+/*
+ * CollectCompressionJobs waits for the stripe's blocks that are being compressed
+ * in worker threads, and stores the compressed value buffers in their blocks.
+ * Blocks that didn't compress are kept uncompressed.
+ */
+static void
+CollectCompressionJobs(TableWriteState *writeState)
+{
+	ListCell *blockCompressionJobCell = NULL;
+
+	if (writeState->compressionJobList == NIL)
+	{
+		return;
+	}
+
+	WaitForCompressionJobs(writeState->compressionPool);
+
+	foreach(blockCompressionJobCell, writeState->compressionJobList)
+	{
+		BlockCompressionJob *blockCompressionJob = lfirst(blockCompressionJobCell);
+		ColumnBlockBuffers *blockBuffers = blockCompressionJob->blockBuffers;
+		CompressionJob *compressionJob = blockCompressionJob->compressionJob;
+
+		if (compressionJob->compressed)
+		{
+			blockBuffers->valueBuffer = compressionJob->outputBuffer;
+			blockBuffers->valueCompressionType = compressionJob->compressionType;
+		}
+	}
+
+	/* the list lives in the stripe's memory context, which is reset next */
+	writeState->compressionJobList = NIL;
+}
+
+
+/*
+ * HashFunctionInfoOrNull returns the hash function of the given type's default
+ * hash operator class, or NULL if the type doesn't have one. Types such as
+ * varchar use the operator class of a binary compatible type, so we look the
+ * function up by the operator class's input type.
+ */
+static FmgrInfo *
+HashFunctionInfoOrNull(Oid typeId)
+{
+	FmgrInfo *functionInfo = NULL;
+	Oid operatorClassId = GetDefaultOpClass(typeId, HASH_AM_OID);
+	Oid inputTypeId = InvalidOid;
+	Oid functionId = InvalidOid;
+
+	if (operatorClassId == InvalidOid)
+	{
+		return NULL;
+	}
+
+	inputTypeId = get_opclass_input_type(operatorClassId);
+	functionId = get_opfamily_proc(get_opclass_family(operatorClassId), inputTypeId,
+								   inputTypeId, HASHSTANDARD_PROC);
+	if (functionId != InvalidOid)
+	{
+		functionInfo = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
+		fmgr_info(functionId, functionInfo);
+	}
+
+	return functionInfo;
+}
+
+
+/*
+ * AddBlockValueHash hashes the given value of a column with a bloom filter, and
+ * keeps the hash until the block's filter is built.
+ */
+static void
+AddBlockValueHash(TableWriteState *writeState, uint32 columnIndex, Datum columnValue,
+				  Oid columnCollation)
+{
+	FmgrInfo *hashFunction = writeState->hashFunctionArray[columnIndex];
+	uint32 hashCount = writeState->blockHashCount[columnIndex];
+	Datum hashDatum = FunctionCall1Coll(hashFunction, columnCollation, columnValue);
+
+	writeState->blockHashArray[columnIndex][hashCount] = DatumGetUInt32(hashDatum);
+	writeState->blockHashCount[columnIndex]++;
+}
+
+
+/*
+ * BuildBlockBloomFilters builds the bloom filters of the given block from the
+ * hashes collected for each column with a bloom filter, and stores them in the
+ * block's skip nodes. The filters live in the stripe's memory context.
+ */
+static void
+BuildBlockBloomFilters(TableWriteState *writeState, uint32 blockIndex)
+{
+	uint32 columnCount = writeState->tupleDescriptor->natts;
+	uint32 columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		uint32 *hashArray = writeState->blockHashArray[columnIndex];
+		ColumnBlockSkipNode *blockSkipNode = NULL;
+
+		if (hashArray == NULL)
+		{
+			continue;
+		}
+
+		blockSkipNode =
+			&writeState->stripeSkipList->blockSkipNodeArray[columnIndex][blockIndex];
+		blockSkipNode->bloomFilter =
+			BuildBloomFilter(hashArray, writeState->blockHashCount[columnIndex],
+							 &blockSkipNode->bloomFilterLength);
+
+		writeState->blockHashCount[columnIndex] = 0;
+	}
+}
+
+
 /*
  * UpdateBlockSkipNodeMinMax takes the given column value, and checks if this
  * value falls outside the range of minimum/maximum values of the given column
@@ -917,19 +1498,314 @@ DatumCopy(Datum datum, bool datumTypeByValue, int datumTypeLength)
 
 /*
  * AppendStripeMetadata adds a copy of given stripeMetadata to the given
- * table footer's stripeMetadataList.
+ * table footer's stripeMetadataList. Column statistics are copied as well,
+ * since they are created in the stripe's memory context.
  */
 static void
 AppendStripeMetadata(TableFooter *tableFooter, StripeMetadata stripeMetadata)
 {
 	StripeMetadata *stripeMetadataCopy = palloc0(sizeof(StripeMetadata));
+	uint32 columnCount = stripeMetadata.columnCount;
+	uint32 columnIndex = 0;
+
 	memcpy(stripeMetadataCopy, &stripeMetadata, sizeof(StripeMetadata));
 
+	stripeMetadataCopy->columnSkipNodeArray =
+		palloc0(columnCount * sizeof(ColumnStripeSkipNode));
+	for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		ColumnStripeSkipNode *skipNode = &stripeMetadata.columnSkipNodeArray[columnIndex];
+		ColumnStripeSkipNode *skipNodeCopy =
+			&stripeMetadataCopy->columnSkipNodeArray[columnIndex];
+
+		memcpy(skipNodeCopy, skipNode, sizeof(ColumnStripeSkipNode));
+		if (skipNode->hasMinMax)
+		{
+			skipNodeCopy->minimumValue = palloc(skipNode->minimumLength);
+			memcpy(skipNodeCopy->minimumValue, skipNode->minimumValue,
+				   skipNode->minimumLength);
+			skipNodeCopy->maximumValue = palloc(skipNode->maximumLength);
+			memcpy(skipNodeCopy->maximumValue, skipNode->maximumValue,
+				   skipNode->maximumLength);
+		}
+	}
+
 	tableFooter->stripeMetadataList = lappend(tableFooter->stripeMetadataList,
 											  stripeMetadataCopy);
 }
 
 
+/* AppendToWriteVector adds the given buffer to the write vector if it isn't empty. */
+static void
+AppendToWriteVector(struct iovec *writeVector, uint32 *writeVectorLength,
+					StringInfo buffer)
+{
+	if (buffer->len == 0)
+	{
+		return;
+	}
+
+	writeVector[*writeVectorLength].iov_base = buffer->data;
+	writeVector[*writeVectorLength].iov_len = buffer->len;
+	(*writeVectorLength)++;
+}
+
+
+/*
+ * WriteStripeToFile writes the given buffers to the table file at the current
+ * file offset. Buffers are written with pwritev() in batches, which avoids both
+ * a system call per buffer and copying the buffers into stdio's buffer. With
+ * direct writes, the buffers are copied into the aligned write buffer instead.
+ */
+static void
+WriteStripeToFile(TableWriteState *writeState, struct iovec *writeVector,
+				  uint32 writeVectorLength)
+{
+	int fileDescriptor = fileno(writeState->tableFile);
+	off_t fileOffset = writeState->currentFileOffset;
+	uint32 vectorIndex = 0;
+
+	if (writeState->directWriteBuffer != NULL)
+	{
+		for (vectorIndex = 0; vectorIndex < writeVectorLength; vectorIndex++)
+		{
+			CopyToDirectWriteBuffer(writeState, writeVector[vectorIndex].iov_base,
+									writeVector[vectorIndex].iov_len);
+		}
+
+		FlushDirectWriteBuffer(writeState);
+		return;
+	}
+
+	while (vectorIndex < writeVectorLength)
+	{
+		int batchLength = Min(writeVectorLength - vectorIndex, WRITE_VECTOR_BATCH_LENGTH);
+		ssize_t writeResult = 0;
+
+		errno = 0;
+		writeResult = pwritev(fileDescriptor, &writeVector[vectorIndex], batchLength,
+							  fileOffset);
+		if (writeResult <= 0)
+		{
+			/* if write didn't set errno, assume problem is no disk space */
+			if (errno == 0)
+			{
+				errno = ENOSPC;
+			}
+
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not write file: %m")));
+		}
+
+		fileOffset += writeResult;
+
+		/* skip the buffers that were written, and the written part of the next one */
+		while (vectorIndex < writeVectorLength &&
+			   (size_t) writeResult >= writeVector[vectorIndex].iov_len)
+		{
+			writeResult -= writeVector[vectorIndex].iov_len;
+			vectorIndex++;
+		}
+
+		if (writeResult > 0)
+		{
+			writeVector[vectorIndex].iov_base =
+				(char *) writeVector[vectorIndex].iov_base + writeResult;
+			writeVector[vectorIndex].iov_len -= writeResult;
+		}
+	}
+}
+
+
+/*
+ * StartDirectWrite switches the table file to direct I/O, so that large loads
+ * don't fill the page cache with data that isn't read soon. Direct writes need
+ * aligned memory, offsets and lengths, so stripes are copied into an aligned
+ * write buffer. The buffer starts at the aligned offset below the current file
+ * offset, so we first read in the part of the file's last block that we append
+ * to. If the file system doesn't support direct I/O, we keep writing through
+ * the page cache.
+ */
+static void
+StartDirectWrite(TableWriteState *writeState, const char *filename)
+{
+#ifdef O_DIRECT
+	int fileDescriptor = fileno(writeState->tableFile);
+	uint64 currentFileOffset = writeState->currentFileOffset;
+	uint64 directWriteOffset = TYPEALIGN_DOWN(CSTORE_DIRECT_IO_ALIGNMENT,
+											  currentFileOffset);
+	uint32 directWriteLength = currentFileOffset - directWriteOffset;
+	char *directWriteBuffer = NULL;
+	int fileFlags = 0;
+	uint32 readLength = 0;
+
+	directWriteBuffer = palloc(CSTORE_DIRECT_WRITE_BUFFER_SIZE +
+							   CSTORE_DIRECT_IO_ALIGNMENT);
+	directWriteBuffer = (char *) TYPEALIGN(CSTORE_DIRECT_IO_ALIGNMENT,
+										   directWriteBuffer);
+
+	while (readLength < directWriteLength)
+	{
+		ssize_t readResult = 0;
+
+		errno = 0;
+		readResult = pread(fileDescriptor, directWriteBuffer + readLength,
+						   directWriteLength - readLength,
+						   directWriteOffset + readLength);
+		if (readResult <= 0)
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read file \"%s\": %m", filename)));
+		}
+
+		readLength += readResult;
+	}
+
+	fileFlags = fcntl(fileDescriptor, F_GETFL);
+	if (fileFlags < 0 || fcntl(fileDescriptor, F_SETFL, fileFlags | O_DIRECT) < 0)
+	{
+		ereport(DEBUG1, (errmsg("could not enable direct I/O for file \"%s\": %m",
+								filename)));
+		return;
+	}
+
+	writeState->directWriteBuffer = directWriteBuffer;
+	writeState->directWriteOffset = directWriteOffset;
+	writeState->directWriteLength = directWriteLength;
+#else
+	ereport(DEBUG1, (errmsg("direct I/O is not supported on this platform")));
+#endif
+}
+
+
+/*
+ * CopyToDirectWriteBuffer copies the given data into the direct write buffer,
+ * and writes the buffer out whenever it fills up.
+ */
+static void
+CopyToDirectWriteBuffer(TableWriteState *writeState, char *data, uint64 dataLength)
+{
+	while (dataLength > 0)
+	{
+		uint64 freeLength = CSTORE_DIRECT_WRITE_BUFFER_SIZE -
+							writeState->directWriteLength;
+		uint64 copyLength = Min(dataLength, freeLength);
+
+		memcpy(writeState->directWriteBuffer + writeState->directWriteLength,
+			   data, copyLength);
+		writeState->directWriteLength += copyLength;
+		data += copyLength;
+		dataLength -= copyLength;
+
+		if (writeState->directWriteLength == CSTORE_DIRECT_WRITE_BUFFER_SIZE)
+		{
+			WriteDirectWriteBuffer(writeState, CSTORE_DIRECT_WRITE_BUFFER_SIZE);
+
+			writeState->directWriteOffset += CSTORE_DIRECT_WRITE_BUFFER_SIZE;
+			writeState->directWriteLength = 0;
+		}
+	}
+}
+
+
+/*
+ * FlushDirectWriteBuffer writes out the data in the direct write buffer. The
+ * last partial block is padded with zeros for the write, and is kept at the
+ * start of the buffer, so that the next stripe is written from that block on.
+ * CStoreEndWrite() truncates the padding after the last stripe.
+ */
+static void
+FlushDirectWriteBuffer(TableWriteState *writeState)
+{
+	uint32 directWriteLength = writeState->directWriteLength;
+	uint32 paddedLength = TYPEALIGN(CSTORE_DIRECT_IO_ALIGNMENT, directWriteLength);
+	uint32 fullBlockLength = TYPEALIGN_DOWN(CSTORE_DIRECT_IO_ALIGNMENT,
+											directWriteLength);
+	uint32 partialBlockLength = directWriteLength - fullBlockLength;
+
+	if (paddedLength == 0)
+	{
+		return;
+	}
+
+	memset(writeState->directWriteBuffer + directWriteLength, 0,
+		   paddedLength - directWriteLength);
+	WriteDirectWriteBuffer(writeState, paddedLength);
+
+	memmove(writeState->directWriteBuffer,
+			writeState->directWriteBuffer + fullBlockLength, partialBlockLength);
+	writeState->directWriteOffset += fullBlockLength;
+	writeState->directWriteLength = partialBlockLength;
+}
+
+
+/*
+ * WriteDirectWriteBuffer writes the given aligned length from the start of the
+ * direct write buffer to the buffer's file offset. Some file systems accept
+ * O_DIRECT when it is set, but then reject direct writes with EINVAL. In that
+ * case, we clear O_DIRECT and keep writing the buffer through the page cache.
+ */
+static void
+WriteDirectWriteBuffer(TableWriteState *writeState, uint32 writeLength)
+{
+	int fileDescriptor = fileno(writeState->tableFile);
+	uint32 writtenLength = 0;
+
+	while (writtenLength < writeLength)
+	{
+		ssize_t writeResult = 0;
+
+		errno = 0;
+		writeResult = pwrite(fileDescriptor,
+							 writeState->directWriteBuffer + writtenLength,
+							 writeLength - writtenLength,
+							 writeState->directWriteOffset + writtenLength);
+		if (writeResult < 0 && errno == EINVAL && DisableDirectIO(fileDescriptor))
+		{
+			ereport(DEBUG1, (errmsg("direct write was rejected, writing through "
+									"the page cache instead")));
+			continue;
+		}
+
+		if (writeResult <= 0)
+		{
+			/* if write didn't set errno, assume problem is no disk space */
+			if (errno == 0)
+			{
+				errno = ENOSPC;
+			}
+
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not write file: %m")));
+		}
+
+		writtenLength += writeResult;
+	}
+}
+
+
+/*
+ * DisableDirectIO clears O_DIRECT on the given file descriptor. The function
+ * returns true if O_DIRECT was set and is now cleared, and false otherwise.
+ */
+static bool
+DisableDirectIO(int fileDescriptor)
+{
+#ifdef O_DIRECT
+	int fileFlags = fcntl(fileDescriptor, F_GETFL);
+
+	if (fileFlags < 0 || (fileFlags & O_DIRECT) == 0)
+	{
+		return false;
+	}
+
+	return fcntl(fileDescriptor, F_SETFL, fileFlags & ~O_DIRECT) == 0;
+#else
+	return false;
+#endif
+}
+
+
 /* Writes the given data to the given file pointer and checks for errors. */
 static void
 WriteToFile(FILE *file, void *data, uint32 dataLength)
@@ -15,6 +15,45 @@ COPY table_with_data FROM STDIN;
 SELECT cstore_table_size('empty_table') < cstore_table_size('table_with_data');
 SELECT cstore_table_size('non_cstore_table');
 
+-- The block cache only works when the library is preloaded and the cache is
+-- sized. Scanning compressed blocks twice should then hit the cache, and the
+-- cache reports all zeros otherwise.
+CREATE FOREIGN TABLE block_cache_table (a int, b text) SERVER cstore_server
+OPTIONS (compression 'pglz');
+INSERT INTO block_cache_table
+SELECT i, repeat(i::text || ' ', 10) FROM generate_series(1, 20000) i;
+
+CREATE TEMPORARY TABLE block_cache_stats_before AS
+SELECT * FROM cstore_block_cache_stats();
+
+SELECT count(*), sum(length(b)) FROM block_cache_table;
+SELECT count(*), sum(length(b)) FROM block_cache_table;
+
+SELECT CASE WHEN cache_after.capacity_bytes = 0
+            THEN cache_after.hits = 0 AND cache_after.misses = 0 AND
+                 cache_after.cached_bytes = 0
+            ELSE cache_after.hits > cache_before.hits AND
+                 cache_after.cached_bytes <= cache_after.capacity_bytes
+       END
+FROM cstore_block_cache_stats() cache_after, block_cache_stats_before cache_before;
+
+-- Table footers, row counts and skip lists are cached in shared memory when the
+-- library is preloaded, and read from the file each time otherwise. Either way,
+-- scans must see the rows written since the last scan.
+CREATE FOREIGN TABLE metadata_cache_table (a int) SERVER cstore_server
+OPTIONS (block_row_count '1000', stripe_row_count '1000');
+INSERT INTO metadata_cache_table SELECT a FROM generate_series(1, 3000) a;
+SELECT count(*), min(a), max(a) FROM metadata_cache_table WHERE a > 1500;
+SELECT count(*), min(a), max(a) FROM metadata_cache_table WHERE a > 1500;
+INSERT INTO metadata_cache_table SELECT a FROM generate_series(3001, 5000) a;
+SELECT count(*), min(a), max(a) FROM metadata_cache_table WHERE a > 1500;
+TRUNCATE metadata_cache_table;
+SELECT count(*), min(a), max(a) FROM metadata_cache_table;
+INSERT INTO metadata_cache_table VALUES (7);
+SELECT count(*), min(a), max(a) FROM metadata_cache_table;
+
 DROP FOREIGN TABLE empty_table;
 DROP FOREIGN TABLE table_with_data;
 DROP TABLE non_cstore_table;
+DROP FOREIGN TABLE block_cache_table;
+DROP FOREIGN TABLE metadata_cache_table;
@@ -54,3 +54,233 @@ WHERE a.int_val = c.int_val AND a.hash = md5(c.text_val);
 
 DROP TABLE test_long_text_hash;
 DROP FOREIGN TABLE test_cstore_long_text;
+
+-- test text values with few distinct values, which get dictionary encoded
+CREATE FOREIGN TABLE test_dictionary_text(status text, code varchar(8))
+SERVER cstore_server;
+
+INSERT INTO test_dictionary_text
+SELECT CASE WHEN i % 10 = 0 THEN NULL ELSE 'status_' || (i % 3) END, 'c' || (i % 2)
+FROM generate_series(1, 3000) i;
+
+SELECT status, code, count(*) FROM test_dictionary_text
+GROUP BY status, code ORDER BY status, code;
+
+DROP FOREIGN TABLE test_dictionary_text;
+
+-- test columns with long runs of equal values, which get run-length encoded
+CREATE FOREIGN TABLE test_run_length(a int, b text)
+SERVER cstore_server;
+
+INSERT INTO test_run_length
+SELECT i / 1000, 'run_' || (i / 1000) FROM generate_series(1, 25000) i;
+
+SELECT b, count(*), min(a), max(a) FROM test_run_length
+WHERE b IN ('run_3', 'run_10', 'run_25') GROUP BY b ORDER BY b;
+
+SELECT count(*) FROM test_run_length WHERE a >= 20;
+
+DROP FOREIGN TABLE test_run_length;
+
+-- test integer, date and timestamp columns, which get bit-packed
+CREATE FOREIGN TABLE test_bit_packed(id bigint, small smallint, day date,
+									 created timestamp)
+SERVER cstore_server;
+
+INSERT INTO test_bit_packed
+SELECT 1000000000000 + i, CASE WHEN i % 7 = 0 THEN NULL ELSE (i % 100) - 50 END,
+	   date '2016-01-01' + i / 100, timestamp '2016-01-01 00:00:00' + i * interval '1 second'
+FROM generate_series(1, 25000) i;
+
+SELECT count(*), min(id), max(id), sum(id - 1000000000000) FROM test_bit_packed;
+
+SELECT count(small), min(small), max(small), sum(small) FROM test_bit_packed;
+
+SELECT min(day), max(day), count(DISTINCT day) FROM test_bit_packed;
+
+SELECT count(*), min(created), max(created) FROM test_bit_packed
+WHERE created BETWEEN '2016-01-01 03:00:00' AND '2016-01-01 03:59:59';
+
+DROP FOREIGN TABLE test_bit_packed;
+
+-- test lz4 and zstd compression, where zstd stripes train dictionaries
+CREATE FOREIGN TABLE test_lz4_compressed(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'lz4', compression_level '9');
+
+CREATE FOREIGN TABLE test_zstd_compressed(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'zstd', compression_level '5', block_row_count '1000',
+		stripe_row_count '10000');
+
+INSERT INTO test_lz4_compressed
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(1, 25000) i;
+
+INSERT INTO test_zstd_compressed SELECT * FROM test_lz4_compressed;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_lz4_compressed;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_zstd_compressed;
+
+SELECT description FROM test_zstd_compressed WHERE id IN (1, 12345, 25000) ORDER BY id;
+
+DROP FOREIGN TABLE test_lz4_compressed;
+DROP FOREIGN TABLE test_zstd_compressed;
+
+-- test per-column compression and encoding options
+CREATE FOREIGN TABLE test_column_options(id int, status text, note text)
+SERVER cstore_server
+OPTIONS(compression 'pglz');
+
+ALTER FOREIGN TABLE test_column_options
+	ALTER COLUMN id OPTIONS (encoding 'dict'),
+	ALTER COLUMN status OPTIONS (compression 'zstd', compression_level '3'),
+	ALTER COLUMN note OPTIONS (compression 'none', encoding 'none');
+
+-- invalid column options
+ALTER FOREIGN TABLE test_column_options ALTER COLUMN note OPTIONS (SET encoding 'delta');
+ALTER FOREIGN TABLE test_column_options ALTER COLUMN note OPTIONS (ADD compression_level '5');
+
+INSERT INTO test_column_options
+SELECT i % 5, 'status ' || (i % 3), 'note ' || i FROM generate_series(1, 20000) i;
+
+SELECT count(*), sum(id), count(DISTINCT status), sum(length(note)) FROM test_column_options;
+
+SELECT status, count(*) FROM test_column_options WHERE id = 2 GROUP BY status ORDER BY status;
+
+-- a column level that no longer fits the resolved codec only fails writes
+ALTER FOREIGN TABLE test_column_options ALTER COLUMN status OPTIONS (DROP compression);
+
+SELECT count(*) FROM test_column_options WHERE status = 'status 1';
+
+INSERT INTO test_column_options VALUES (1, 'status 1', 'note');
+
+DROP FOREIGN TABLE test_column_options;
+
+-- test auto compression, which picks a codec for each column in a stripe
+CREATE FOREIGN TABLE test_auto_compressed(id int, category text, description text)
+SERVER cstore_server
+OPTIONS(compression 'auto', block_row_count '1000', stripe_row_count '5000');
+
+CREATE FOREIGN TABLE test_auto_uncompressed(id int, category text, description text)
+SERVER cstore_server
+OPTIONS(compression 'none', block_row_count '1000', stripe_row_count '5000');
+
+SET cstore_fdw.auto_compression_objective TO 'size';
+
+INSERT INTO test_auto_compressed
+SELECT i, 'category ' || (i % 11), md5(i::text) FROM generate_series(1, 12000) i;
+
+RESET cstore_fdw.auto_compression_objective;
+
+INSERT INTO test_auto_uncompressed
+SELECT i, 'category ' || (i % 11), md5(i::text) FROM generate_series(1, 12000) i;
+
+-- the size objective should leave the table well below its uncompressed size
+SELECT cstore_table_size('test_auto_compressed') * 10 <
+       cstore_table_size('test_auto_uncompressed') * 8;
+
+DROP FOREIGN TABLE test_auto_uncompressed;
+
+INSERT INTO test_auto_compressed
+SELECT i, 'category ' || (i % 11), md5(i::text) FROM generate_series(12001, 20000) i;
+
+SELECT count(*), sum(id), count(DISTINCT category), count(DISTINCT description)
+FROM test_auto_compressed;
+
+SELECT description FROM test_auto_compressed WHERE id IN (1, 12001) ORDER BY id;
+
+DROP FOREIGN TABLE test_auto_compressed;
+
+-- test compression threads, which must load the same data as the backend alone
+CREATE FOREIGN TABLE test_no_workers(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'deflate', block_row_count '1000', stripe_row_count '5000');
+
+CREATE FOREIGN TABLE test_workers_deflate(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'deflate', block_row_count '1000', stripe_row_count '5000');
+
+CREATE FOREIGN TABLE test_workers_lz4(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'lz4', block_row_count '1000', stripe_row_count '5000');
+
+CREATE FOREIGN TABLE test_workers_zstd(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'zstd', block_row_count '1000', stripe_row_count '5000');
+
+INSERT INTO test_no_workers
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(1, 22000) i;
+
+SET cstore_fdw.compression_workers = 2;
+
+INSERT INTO test_workers_deflate SELECT * FROM test_no_workers;
+INSERT INTO test_workers_lz4 SELECT * FROM test_no_workers;
+INSERT INTO test_workers_zstd SELECT * FROM test_no_workers;
+
+RESET cstore_fdw.compression_workers;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_no_workers;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_workers_deflate;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_workers_lz4;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_workers_zstd;
+
+SELECT count(*) FROM (
+	(SELECT * FROM test_no_workers EXCEPT ALL SELECT * FROM test_workers_deflate)
+	UNION ALL
+	(SELECT * FROM test_no_workers EXCEPT ALL SELECT * FROM test_workers_lz4)
+	UNION ALL
+	(SELECT * FROM test_no_workers EXCEPT ALL SELECT * FROM test_workers_zstd)
+) differences;
+
+DROP FOREIGN TABLE test_no_workers;
+DROP FOREIGN TABLE test_workers_deflate;
+DROP FOREIGN TABLE test_workers_lz4;
+DROP FOREIGN TABLE test_workers_zstd;
+
+-- test direct writes, which append to the file's last partial block
+CREATE FOREIGN TABLE test_direct_write(id int, description text)
+SERVER cstore_server
+OPTIONS(block_row_count '1000', stripe_row_count '5000');
+
+SET cstore_fdw.use_direct_write = on;
+
+INSERT INTO test_direct_write
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(1, 12000) i;
+
+INSERT INTO test_direct_write
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(12001, 20000) i;
+
+INSERT INTO test_direct_write
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(20001, 20003) i;
+
+RESET cstore_fdw.use_direct_write;
+
+INSERT INTO test_direct_write
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(20004, 20010) i;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_direct_write;
+
+SELECT description FROM test_direct_write WHERE id IN (1, 12000, 12001, 20003, 20010)
+ORDER BY id;
+
+DROP FOREIGN TABLE test_direct_write;
+
+-- test zstd loads without dictionaries, which compress each block once
+CREATE FOREIGN TABLE test_zstd_no_dictionary(id int, description text)
+SERVER cstore_server
+OPTIONS(compression 'zstd', block_row_count '1000', stripe_row_count '5000');
+
+SET cstore_fdw.enable_zstd_dictionaries TO off;
+
+INSERT INTO test_zstd_no_dictionary
+SELECT i, 'item ' || i || ' of category ' || (i % 17) FROM generate_series(1, 12000) i;
+
+RESET cstore_fdw.enable_zstd_dictionaries;
+
+SELECT count(*), sum(id), sum(length(description)) FROM test_zstd_no_dictionary;
+
+DROP FOREIGN TABLE test_zstd_no_dictionary;
@@ -32,3 +32,137 @@ INSERT INTO union_second SELECT a, a FROM generate_series(11, 15) a;
 (SELECT a*1, b FROM union_first) union all (SELECT a*1, b FROM union_second);
 
 DROP FOREIGN TABLE union_first, union_second;
+
+-- Test comparison kernels of fixed-width types against the same rows in a
+-- regular table, including negative values, NaN, infinities, and constants of
+-- other types, which are compared by the operator's function instead
+CREATE FOREIGN TABLE kernel_values (i2 int2, i4 int4, i8 int8, f8 float8, d date,
+                                    ts timestamp)
+SERVER cstore_server OPTIONS (block_row_count '1000');
+CREATE TEMPORARY TABLE kernel_values_heap (i2 int2, i4 int4, i8 int8, f8 float8,
+                                           d date, ts timestamp);
+
+INSERT INTO kernel_values
+SELECT CASE WHEN i % 13 = 0 THEN NULL ELSE i END,
+       CASE WHEN i % 17 = 0 THEN NULL ELSE i * 1000 END,
+       i * 10000000000::int8,
+       CASE WHEN i % 97 = 0 THEN 'NaN'::float8
+            WHEN i % 89 = 0 THEN 'Infinity'::float8
+            WHEN i % 83 = 0 THEN '-Infinity'::float8
+            WHEN i % 10 = 0 THEN NULL
+            ELSE i / 7.0 END,
+       date '2000-01-01' + i,
+       timestamp '2000-01-01' + i * interval '1 hour'
+FROM generate_series(-1000, 1000) i;
+
+INSERT INTO kernel_values_heap
+SELECT CASE WHEN i % 13 = 0 THEN NULL ELSE i END,
+       CASE WHEN i % 17 = 0 THEN NULL ELSE i * 1000 END,
+       i * 10000000000::int8,
+       CASE WHEN i % 97 = 0 THEN 'NaN'::float8
+            WHEN i % 89 = 0 THEN 'Infinity'::float8
+            WHEN i % 83 = 0 THEN '-Infinity'::float8
+            WHEN i % 10 = 0 THEN NULL
+            ELSE i / 7.0 END,
+       date '2000-01-01' + i,
+       timestamp '2000-01-01' + i * interval '1 hour'
+FROM generate_series(-1000, 1000) i;
+
+CREATE FUNCTION kernel_check(predicate text, OUT row_count bigint,
+                             OUT mismatch_count bigint) AS
+$$
+    BEGIN
+        EXECUTE 'SELECT count(*) FROM kernel_values WHERE ' || predicate
+        INTO row_count;
+        EXECUTE format('SELECT count(*) FROM '
+                       '((SELECT * FROM kernel_values WHERE %1$s '
+                       '  EXCEPT ALL SELECT * FROM kernel_values_heap WHERE %1$s) '
+                       ' UNION ALL '
+                       ' (SELECT * FROM kernel_values_heap WHERE %1$s '
+                       '  EXCEPT ALL SELECT * FROM kernel_values WHERE %1$s)) d',
+                       predicate)
+        INTO mismatch_count;
+    END;
+$$ LANGUAGE PLPGSQL;
+
+SELECT predicate, (kernel_check(predicate)).*
+FROM (VALUES
+       ('i2 < ''-5'''),
+       ('i2 >= ''100'''),
+       ('i2 = ''-1'''),
+       ('i2 <> ''0'''),
+       ('i2 < -5'),
+       ('i4 <= -999000'),
+       ('i4 > 0'),
+       ('i4 > -2500::int8'),
+       ('i8 < -5000000000000'),
+       ('i8 = 10000000000'),
+       ('i8 <> -20000000000'),
+       ('i8 <= 5::int4'),
+       ('f8 > 100'),
+       ('f8 < -50'),
+       ('f8 = ''NaN'''),
+       ('f8 < ''NaN'''),
+       ('f8 <> ''NaN'''),
+       ('f8 >= ''Infinity'''),
+       ('f8 > ''-Infinity'''),
+       ('f8 <= ''-Infinity'''),
+       ('f8 > 50::float4'),
+       ('d < ''1999-12-01'''),
+       ('d >= ''2000-02-01'''),
+       ('d < ''2000-01-05 12:00''::timestamp'),
+       ('ts > ''2000-01-02 12:00'''),
+       ('ts <= ''1999-12-31''::date')) p (predicate);
+
+DROP FUNCTION kernel_check(text);
+DROP FOREIGN TABLE kernel_values;
+
+-- Verify that a parallel scan hands out each stripe to one participant only,
+-- so that it returns the same rows as a serial scan. Parallel query settings
+-- differ between PostgreSQL versions, so we only change the ones that exist.
+CREATE FOREIGN TABLE parallel_values (a int) SERVER cstore_server
+	OPTIONS (stripe_row_count '1000', block_row_count '1000');
+INSERT INTO parallel_values SELECT a FROM generate_series(1, 10000) a;
+
+CREATE FUNCTION uses_parallel_scan(query text) RETURNS bool AS
+$$
+    DECLARE
+        rec text;
+    BEGIN
+        FOR rec IN EXECUTE 'EXPLAIN (COSTS OFF) ' || query LOOP
+            IF rec ~ 'Parallel Foreign Scan' THEN
+                RETURN true;
+            END IF;
+        END LOOP;
+
+        RETURN false;
+    END;
+$$ LANGUAGE PLPGSQL;
+
+SET cstore_fdw.enable_aggregate_pushdown TO off;
+DO $$
+BEGIN
+    PERFORM set_config(name, CASE WHEN name = 'force_parallel_mode' THEN 'on' ELSE '0' END, false)
+    FROM pg_settings
+    WHERE name IN ('force_parallel_mode', 'parallel_setup_cost', 'parallel_tuple_cost',
+                   'min_parallel_table_scan_size');
+END
+$$;
+
+SELECT current_setting('server_version_num')::int < 100000 OR
+       uses_parallel_scan('SELECT count(*) FROM parallel_values') AS parallel_scan_or_unsupported;
+SELECT count(*), count(DISTINCT a), sum(a), min(a), max(a) FROM parallel_values;
+SELECT count(*), sum(a) FROM parallel_values WHERE a > 2500;
+
+DO $$
+BEGIN
+    PERFORM set_config(name, reset_val, false)
+    FROM pg_settings
+    WHERE name IN ('force_parallel_mode', 'parallel_setup_cost', 'parallel_tuple_cost',
+                   'min_parallel_table_scan_size');
+END
+$$;
+RESET cstore_fdw.enable_aggregate_pushdown;
+
+DROP FUNCTION uses_parallel_scan(text);
+DROP FOREIGN TABLE parallel_values;